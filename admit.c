@@ -0,0 +1,156 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: admit.c - Connection rate limits, for the whole server and
+--              per client address.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int adm_init(double rate, double ip_rate);
+--              int adm_check(uint32_t addr, uint64_t now);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- The buckets are shared by all shards: with SO_REUSEPORT the connections
+-- of one address are spread over the shards, so a bucket per shard would
+-- let an address in --threads times over. One mutex guards them; it is
+-- only taken once per accepted connection and held for a few loads and
+-- stores.
+------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include "admit.h"
+
+static double adm_rate;                 // connections per second, 0 = no limit
+static double adm_ip_rate;              // per address, 0 = no limit
+static struct tbucket adm_all;          // the whole server
+static struct adm_slot* adm_slots;      // per address
+static pthread_mutex_t adm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double adm_level(const struct adm_slot* slot, uint64_t now);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    adm_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int adm_init(double rate, double ip_rate)
+--              double rate: connections per second, 0 for no limit
+--              double ip_rate: connections per second and address, 0 for
+--                              no limit
+-- 
+-- RETURNS:     0 on success, -1 if memory runs out
+-- 
+-- NOTES:
+-- This function is called once at start-up, before any shard runs.
+------------------------------------------------------------------------------*/
+int adm_init(double rate, double ip_rate)
+{
+    adm_rate = (rate > 0) ? rate : 0;
+    adm_ip_rate = (ip_rate > 0) ? ip_rate : 0;
+    tb_init(&adm_all, (adm_rate > 1) ? adm_rate : 1, 0);
+    
+    if (adm_ip_rate > 0
+        && (adm_slots = (struct adm_slot*) calloc(ADM_SLOTS, sizeof(*adm_slots))) == NULL)
+        return -1;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    adm_check
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int adm_check(uint32_t addr, uint64_t now)
+--              uint32_t addr: the client address, network byte order
+--              uint64_t now: the current time, see stats_now()
+-- 
+-- RETURNS:     ADM_OK if the connection may stay, ADM_RATE or ADM_IP if it
+--              is over a limit
+-- 
+-- NOTES:
+-- This function is called for every connection accepted. The address is
+-- checked first, so a single address flooding the server is turned away
+-- without eating into the server's own budget. A free slot has not been
+-- refilled since time 0, so it is the fullest of its set and starts full.
+------------------------------------------------------------------------------*/
+int adm_check(uint32_t addr, uint64_t now)
+{
+    struct  adm_slot* set;
+    struct  adm_slot* slot = NULL;
+    double  burst;
+    int     i, rc = ADM_OK;
+    
+    if (adm_rate == 0 && adm_ip_rate == 0)
+        return ADM_OK;
+    
+    pthread_mutex_lock(&adm_lock);
+    
+    if (adm_ip_rate > 0) {
+        burst = (adm_ip_rate > 1) ? adm_ip_rate : 1;
+        set = &adm_slots[((addr * 2654435761u) >> (32 - ADM_BITS)) & ~(ADM_WAYS - 1)];
+        for (i = 0; i < ADM_WAYS && slot == NULL; i++) {
+            if (set[i].addr == addr)
+                slot = &set[i];
+        }
+        
+        // the tokens stay with the slot, whoever held it
+        if (slot == NULL) {
+            slot = set;
+            for (i = 1; i < ADM_WAYS; i++) {
+                if (adm_level(&set[i], now) > adm_level(slot, now))
+                    slot = &set[i];
+            }
+            slot->addr = addr;
+        }
+        if (!tb_try(&slot->tb, adm_ip_rate, burst, 1, now))
+            rc = ADM_IP;
+    }
+    
+    if (rc == ADM_OK && adm_rate > 0
+        && !tb_try(&adm_all, adm_rate, (adm_rate > 1) ? adm_rate : 1, 1, now)) {
+        rc = ADM_RATE;
+        if (adm_ip_rate > 0)
+            slot->tb.tokens += 1;
+    }
+    
+    pthread_mutex_unlock(&adm_lock);
+    return rc;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    adm_level
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static double adm_level(const struct adm_slot* slot,
+--                                      uint64_t now)
+--              const struct adm_slot* slot: an address slot
+--              uint64_t now: the current time, see stats_now()
+-- 
+-- RETURNS:     the tokens the slot's bucket would hold now, uncapped
+-- 
+-- NOTES:
+-- This function is called to choose the slot an address takes over.
+------------------------------------------------------------------------------*/
+static double adm_level(const struct adm_slot* slot, uint64_t now)
+{
+    if (now <= slot->tb.last)
+        return slot->tb.tokens;
+    return slot->tb.tokens + adm_ip_rate * (double) (now - slot->tb.last) / 1e9;
+}
@@ -0,0 +1,50 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: admit.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the connection admission limits. With
+-- --accept-rate the whole server, and with --ip-rate every client address,
+-- gets a token bucket refilled at that many connections per second and
+-- holding one second's worth. A connection that finds its bucket empty is
+-- refused; unlike the message limits, a refused connection takes nothing,
+-- so a flood cannot keep the others out for longer than it lasts.
+-- The address buckets live in a table of ADM_SLOTS, in sets of ADM_WAYS
+-- picked by a hash of the address. An address missing from its set takes
+-- over the slot whose bucket is the fullest, with the tokens left in it,
+-- so the table never grows whatever the number of addresses, and an
+-- address pushed out comes back to no more than the time refilled in
+-- the bucket it takes; a busy address is the last one pushed out.
+-------------------------------------------------------------------------------*/
+#ifndef __ADMIT_H__
+#define __ADMIT_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "throttle.h"
+
+#define ADM_BITS        12                  // log2 of the address slots
+#define ADM_SLOTS       (1 << ADM_BITS)     // address buckets
+#define ADM_WAYS        4                   // slots of a set, power of 2
+
+// adm_check() results
+#define ADM_OK          0       // admitted
+#define ADM_RATE        1       // over --accept-rate
+#define ADM_IP          2       // over --ip-rate
+
+// bucket of one client address
+struct adm_slot {
+    uint32_t    addr;           // address, network byte order, 0 = free
+    struct tbucket tb;          // its connections
+};
+
+// function prototypes
+int adm_init(double rate, double ip_rate);
+int adm_check(uint32_t addr, uint64_t now);
+
+#endif
@@ -0,0 +1,546 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: capture.c - Traffic capture, written by the server and read
+--              back by chatreplay.
+-- 
+-- PROGRAM:     chatsrv, chatreplay
+-- 
+-- FUNCTIONS:   int cap_start(const char* path);
+--              void cap_record(std::string* buf, int kind, int shard,
+--                              uint64_t serial, const char* data,
+--                              size_t len);
+--              void cap_flush(std::string* buf);
+--              void cap_sync(void);
+--              void cap_reader_init(struct cap_reader* r, const char* data,
+--                                   size_t len);
+--              int cap_next(struct cap_reader* r, struct cap_rec* rec);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- Each shard collects its records in its own buffer with cap_record() and
+-- hands them over as a chunk at the end of its loop iteration with
+-- cap_flush(), so a record costs a clock read and a copy on the shard's
+-- thread and no lock. The writer thread takes all the chunks handed over
+-- at once and appends them, looping on short writes, so a shard never
+-- waits on the disk. If the disk stalls long enough for CAP_BUF_MAX to
+-- fill up, new chunks are dropped and counted instead. A write that fails
+-- half way is cut back to the last whole chunk, the reader would stop at
+-- a broken one. A server killed loses what was not written yet.
+-- The reader walks a whole file held in memory and checks every length
+-- against the end of its chunk; a chunk cut short at the end of the file
+-- ends it.
+------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "capture.h"
+
+static int cap_fd = -1;             // the capture file
+static uint64_t cap_started;        // start time, ns since the epoch
+static uint64_t cap_mono;           // CLOCK_MONOTONIC at the start
+static std::string cap_pending;     // chunks handed over, not written yet
+static uint64_t cap_dropped;        // chunks dropped while the disk stalled
+static int cap_busy;                // set while the writer writes a batch
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER; // guards the above
+static pthread_cond_t cap_cond = PTHREAD_COND_INITIALIZER;   // wakes the writer
+static pthread_cond_t cap_done = PTHREAD_COND_INITIALIZER;   // a batch was written
+
+static void* cap_writer(void* arg);
+static void cap_write(const char* data, size_t len);
+static uint64_t cap_clock(clockid_t id);
+static void put_varint(std::string* buf, uint64_t v);
+static int get_varint(const char** p, const char* end, uint64_t* v);
+static void put32(char* p, uint32_t v);
+static uint32_t get32(const char* p);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_start
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int cap_start(const char* path)
+--              const char* path: the capture file
+-- 
+-- RETURNS:     0 on success, -1 if the file cannot be opened
+-- 
+-- NOTES:
+-- This function is called at start-up to open the file and start the
+-- writer. The file is appended to, not truncated, so the successor of a
+-- hot upgrade carries on in the same file.
+------------------------------------------------------------------------------*/
+int cap_start(const char* path)
+{
+    pthread_t tid;
+    
+    if ((cap_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) < 0)
+        return -1;
+    
+    cap_started = cap_clock(CLOCK_REALTIME);
+    cap_mono = cap_clock(CLOCK_MONOTONIC);
+    
+    if (pthread_create(&tid, NULL, cap_writer, NULL) != 0)
+        return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_record
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void cap_record(std::string* buf, int kind, int shard,
+--                              uint64_t serial, const char* data,
+--                              size_t len)
+--              std::string* buf: the shard's buffer
+--              int kind: CAP_*
+--              int shard: the session's shard
+--              uint64_t serial: the session's serial #
+--              const char* data: bytes received, CAP_DATA only
+--              size_t len: # of bytes
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by a shard for every event it captures. A
+-- buffer that reaches CAP_CHUNK_MAX is written out at once.
+------------------------------------------------------------------------------*/
+void cap_record(std::string* buf, int kind, int shard, uint64_t serial,
+                const char* data, size_t len)
+{
+    if (buf->empty())
+        buf->append(CAP_HDR_SIZE, '\0');
+    
+    buf->push_back((char) kind);
+    put_varint(buf, (cap_clock(CLOCK_MONOTONIC) - cap_mono) / 1000);
+    put_varint(buf, (uint64_t) shard);
+    put_varint(buf, serial);
+    if (kind == CAP_DATA) {
+        put_varint(buf, len);
+        buf->append(data, len);
+    }
+    
+    if (buf->size() >= CAP_HDR_SIZE + CAP_CHUNK_MAX)
+        cap_flush(buf);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void cap_flush(std::string* buf)
+--              std::string* buf: the shard's buffer
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called at the end of a shard's loop iteration to hand
+-- its records to the writer as one chunk. The chunk is dropped if the
+-- writer is CAP_BUF_MAX behind, the capture must not hold up the server.
+------------------------------------------------------------------------------*/
+void cap_flush(std::string* buf)
+{
+    char*   p;
+    int     wake = 0;
+    
+    if (buf->size() <= CAP_HDR_SIZE) {
+        buf->clear();
+        return;
+    }
+    
+    p = &(*buf)[0];
+    put32(p, CAP_MAGIC);
+    put32(p + 4, (uint32_t) (buf->size() - CAP_HDR_SIZE));
+    put32(p + 8, (uint32_t) (cap_started >> 32));
+    put32(p + 12, (uint32_t) cap_started);
+    
+    pthread_mutex_lock(&cap_lock);
+    
+    if (cap_pending.size() + buf->size() > CAP_BUF_MAX) {
+        cap_dropped++;
+    } else {
+        wake = cap_pending.empty();
+        cap_pending.append(*buf);
+    }
+    
+    pthread_mutex_unlock(&cap_lock);
+    
+    if (wake)
+        pthread_cond_signal(&cap_cond);
+    buf->clear();
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_sync
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void cap_sync(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by the hot upgrade once the shards stopped, so
+-- every chunk handed over is in the file before the successor appends to
+-- it.
+------------------------------------------------------------------------------*/
+void cap_sync(void)
+{
+    if (cap_fd < 0)
+        return;
+    
+    pthread_mutex_lock(&cap_lock);
+    while (!cap_pending.empty() || cap_busy)
+        pthread_cond_wait(&cap_done, &cap_lock);
+    pthread_mutex_unlock(&cap_lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_reader_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void cap_reader_init(struct cap_reader* r, const char* data,
+--                                   size_t len)
+--              struct cap_reader* r: the reader
+--              const char* data: the whole capture file
+--              size_t len: its size
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to read a capture from the start.
+------------------------------------------------------------------------------*/
+void cap_reader_init(struct cap_reader* r, const char* data, size_t len)
+{
+    r->p = r->end = data;
+    r->fend = data + len;
+    r->start = 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_next
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int cap_next(struct cap_reader* r, struct cap_rec* rec)
+--              struct cap_reader* r: the reader
+--              struct cap_rec* rec: receives the next record, its bytes
+--                                   point into the file
+-- 
+-- RETURNS:     1 for a record, 0 at the end, -1 if the file is corrupt
+-- 
+-- NOTES:
+-- This function is called to read the records in file order. Chunks of
+-- different shards overlap in time, the caller sorts the records.
+------------------------------------------------------------------------------*/
+int cap_next(struct cap_reader* r, struct cap_rec* rec)
+{
+    uint64_t usecs, shard, serial, len;
+    uint32_t size;
+    
+    while (r->p == r->end) {
+        if (r->fend - r->p < CAP_HDR_SIZE)
+            return 0;
+        if (get32(r->p) != CAP_MAGIC)
+            return -1;
+        size = get32(r->p + 4);
+        if ((size_t) (r->fend - r->p - CAP_HDR_SIZE) < size)
+            return 0;
+        r->start = ((uint64_t) get32(r->p + 8) << 32) | get32(r->p + 12);
+        r->p += CAP_HDR_SIZE;
+        r->end = r->p + size;
+    }
+    
+    rec->kind = (unsigned char) *r->p++;
+    if (get_varint(&r->p, r->end, &usecs) < 0
+        || get_varint(&r->p, r->end, &shard) < 0
+        || get_varint(&r->p, r->end, &serial) < 0)
+        return -1;
+    
+    rec->start = r->start;
+    rec->when = r->start + usecs * 1000;
+    rec->shard = (uint32_t) shard;
+    rec->serial = serial;
+    rec->data = NULL;
+    rec->len = 0;
+    
+    if (rec->kind == CAP_DATA) {
+        if (get_varint(&r->p, r->end, &len) < 0 || (uint64_t) (r->end - r->p) < len)
+            return -1;
+        rec->data = r->p;
+        rec->len = len;
+        r->p += len;
+    } else if (rec->kind != CAP_OPEN && rec->kind != CAP_CLOSE) {
+        return -1;
+    }
+    
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_writer
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void* cap_writer(void* arg)
+--              void* arg: unused
+-- 
+-- RETURNS:     never
+-- 
+-- NOTES:
+-- Writer thread. It swaps the pending chunks for its empty batch, so the
+-- lock is held for a swap and the shards keep handing over chunks while
+-- it writes.
+------------------------------------------------------------------------------*/
+static void* cap_writer(void* arg)
+{
+    std::string batch;
+    uint64_t dropped;
+    
+    for (;;) {
+        pthread_mutex_lock(&cap_lock);
+        
+        cap_busy = 0;
+        pthread_cond_broadcast(&cap_done);
+        while (cap_pending.empty())
+            pthread_cond_wait(&cap_cond, &cap_lock);
+        
+        batch.swap(cap_pending);
+        dropped = cap_dropped;
+        cap_dropped = 0;
+        cap_busy = 1;
+        
+        pthread_mutex_unlock(&cap_lock);
+        
+        if (dropped > 0)
+            printf(" - capture: %llu chunks dropped.\n", (unsigned long long) dropped);
+        cap_write(batch.data(), batch.size());
+        batch.clear();
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_write
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void cap_write(const char* data, size_t len)
+--              const char* data: whole chunks
+--              size_t len: the number of bytes
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Called on the writer thread only, the one process writing the file. A
+-- short write is carried on where it stopped. If the file takes no more,
+-- it is truncated after the last chunk written whole, and the rest of the
+-- batch is dropped.
+------------------------------------------------------------------------------*/
+static void cap_write(const char* data, size_t len)
+{
+    off_t   start = lseek(cap_fd, 0, SEEK_END);
+    size_t  done = 0, keep = 0;
+    ssize_t n;
+    
+    while (done < len) {
+        if ((n = write(cap_fd, data + done, len - done)) < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (done == len)
+        return;
+    
+    perror(" - capture: write error.\n");
+    while (keep + CAP_HDR_SIZE <= done && keep + CAP_HDR_SIZE + get32(data + keep + 4) <= done)
+        keep += CAP_HDR_SIZE + get32(data + keep + 4);
+    if (start >= 0 && ftruncate(cap_fd, start + keep) < 0)
+        perror(" - capture: ftruncate error.\n");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    cap_clock
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static uint64_t cap_clock(clockid_t id)
+--              clockid_t id: the clock to read
+-- 
+-- RETURNS:     the time in ns
+-- 
+-- NOTES:
+-- This function is called to time the records.
+------------------------------------------------------------------------------*/
+static uint64_t cap_clock(clockid_t id)
+{
+    struct timespec ts;
+    
+    clock_gettime(id, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    put_varint
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void put_varint(std::string* buf, uint64_t v)
+--              std::string* buf: where to append
+--              uint64_t v: the number
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to append a number, 7 bits per byte, low bits
+-- first, the top bit set on all bytes but the last.
+------------------------------------------------------------------------------*/
+static void put_varint(std::string* buf, uint64_t v)
+{
+    while (v >= 0x80) {
+        buf->push_back((char) (v | 0x80));
+        v >>= 7;
+    }
+    buf->push_back((char) v);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    get_varint
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int get_varint(const char** p, const char* end,
+--                                    uint64_t* v)
+--              const char** p: where to read, moved past the number
+--              const char* end: end of the chunk
+--              uint64_t* v: receives the number
+-- 
+-- RETURNS:     0 on success, -1 if the number runs past end or 64 bits
+-- 
+-- NOTES:
+-- This function is called to read a number written by put_varint().
+------------------------------------------------------------------------------*/
+static int get_varint(const char** p, const char* end, uint64_t* v)
+{
+    unsigned char c;
+    int     shift = 0;
+    
+    *v = 0;
+    do {
+        if (*p == end || shift > 63)
+            return -1;
+        c = (unsigned char) *(*p)++;
+        *v |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    put32
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void put32(char* p, uint32_t v)
+--              char* p: where to write
+--              uint32_t v: the number
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to write a big-endian 32-bit number.
+------------------------------------------------------------------------------*/
+static void put32(char* p, uint32_t v)
+{
+    p[0] = (char) (v >> 24);
+    p[1] = (char) (v >> 16);
+    p[2] = (char) (v >> 8);
+    p[3] = (char) v;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    get32
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static uint32_t get32(const char* p)
+--              const char* p: where to read
+-- 
+-- RETURNS:     the big-endian 32-bit number at p
+-- 
+-- NOTES:
+-- This function is called to read a number written by put32().
+------------------------------------------------------------------------------*/
+static uint32_t get32(const char* p)
+{
+    const unsigned char* u = (const unsigned char*) p;
+    
+    return ((uint32_t) u[0] << 24) | ((uint32_t) u[1] << 16)
+           | ((uint32_t) u[2] << 8) | u[3];
+}
@@ -0,0 +1,82 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: capture.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares the traffic capture. A server started with
+-- --capture file records every session it opens and closes and every run
+-- of bytes it receives, as received, so that chatreplay can play the same
+-- traffic against another build.
+-- The file is a sequence of chunks, each collected by one shard and
+-- appended by the capture's writer thread, so chunks of several shards, or
+-- of a hot upgrade's successor, may follow each other in any order. A
+-- chunk starts with a header that names the process that wrote it (its
+-- start time) and its length; the records in it are:
+-- 
+--      kind (1 byte) | usecs | shard | serial | [length | bytes]
+-- 
+-- where the numbers are unsigned LEB128 varints, usecs counts from the
+-- process' start time and only CAP_DATA records carry bytes. A session is
+-- known by its process, shard and serial #.
+-------------------------------------------------------------------------------*/
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define CAP_MAGIC       0x43434150  // "CCAP", starts every chunk
+#define CAP_HDR_SIZE    16          // magic, length, start time
+#define CAP_CHUNK_MAX   1048576     // records of a chunk, at most
+#define CAP_BUF_MAX     16777216    // chunks waiting for the writer, at most
+
+// record kinds
+#define CAP_OPEN        1           // session opened
+#define CAP_DATA        2           // bytes received
+#define CAP_CLOSE       3           // session closed
+
+// chunk header, big-endian on disk
+//
+//      0       4        8         16
+//      +-------+--------+---------+-----
+//      | magic | length | start   | records
+//      +-------+--------+---------+-----
+//
+// length is the size of the records, start is the writing process' start
+// time in ns since the epoch
+
+// one record as read back
+struct cap_rec {
+    uint64_t    start;          // process that wrote it
+    uint64_t    when;           // ns since the epoch
+    int         kind;           // CAP_*
+    uint32_t    shard;          // shard of the session
+    uint64_t    serial;         // serial # of the session
+    const char* data;           // bytes received, CAP_DATA only
+    size_t      len;
+};
+
+// position in a capture read into memory
+struct cap_reader {
+    const char* p;              // next record
+    const char* end;            // end of the current chunk
+    const char* fend;           // end of the file
+    uint64_t    start;          // start time of the current chunk
+};
+
+// function prototypes
+int cap_start(const char* path);
+void cap_record(std::string* buf, int kind, int shard, uint64_t serial,
+                const char* data, size_t len);
+void cap_flush(std::string* buf);
+void cap_sync(void);
+void cap_reader_init(struct cap_reader* r, const char* data, size_t len);
+int cap_next(struct cap_reader* r, struct cap_rec* rec);
+
+#endif
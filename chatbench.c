@@ -0,0 +1,722 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: chatbench.c - Load generator and latency benchmark for the
+--              chat room server.
+-- 
+-- PROGRAM:     chatbench
+-- 
+-- FUNCTIONS:   int main(int argc, char* argv[])
+--              int bench_connect(struct bench* b);
+--              void bench_setup(struct bench* b);
+--              void bench_run(struct bench* b);
+--              void bench_poll(struct bench* b, int timeout);
+--              void bench_read(struct bench* b, struct bench_clnt* c);
+--              int bench_frame(void* arg, const struct frame* f);
+--              void bench_send(struct bench* b, struct bench_clnt* c,
+--                              const char* text);
+--              void bench_flush(struct bench* b, struct bench_clnt* c);
+--              void bench_close(struct bench* b, struct bench_clnt* c);
+--              void bench_report(struct bench* b);
+--              uint64_t now_ns();
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- chatbench opens many simulated clients against a running server from a
+-- single epoll loop and speaks the same protocol as chatclnt: "/nickname"
+-- first, then text lines. With -s the clients are split into rooms of that
+-- many members with "/join". Once every client is set up, messages are
+-- sent at the requested total rate from the clients in turn. Each message
+-- carries its send time, so every recipient measures the fan-out latency.
+-- With -M path the clients attach through the server's --shm socket
+-- instead of TCP and talk over shared-memory rings (see shmring.h), so
+-- the two transports can be compared on the same load.
+-- 
+-- The result is printed as one JSON object on stdout, suitable for
+-- comparing runs:
+--      connect_per_sec     connections set up per second
+--      sent_per_sec        messages sent per second
+--      recv_per_sec        messages delivered per second (fan-out)
+--      p50_us, p99_us,     fan-out latency percentiles in microseconds
+--      p999_us, max_us
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+#include <algorithm>
+using namespace std;
+
+#define BENCH_TAG       "BENCH "    // marks benchmark messages
+#define BENCH_INFLIGHT  256         // maximum # of connects in progress
+
+// simulated client
+struct bench_clnt {
+    int     fd;                 // socket
+    int     id;                 // client #
+    int     ready;              // got the reply to its last setup command
+    struct bench* b;            // the benchmark
+    struct frame_decoder dec;   // incoming frame decoder
+    string  out;                // bytes the socket did not take yet
+    struct shm_link* shm;       // rings with -M, NULL for TCP
+};
+
+// benchmark settings and results
+struct bench {
+    char    host[IP_SIZE];      // server address
+    int     port;               // server port
+    int     nclients;           // # of simulated clients
+    int     room_size;          // members per room, 0 = everyone in the lobby
+    int     rate;               // messages per second, all clients together
+    int     duration;           // seconds of sending
+    const char* shm_path;       // server's --shm socket, NULL for TCP
+    int     epfd;               // epoll instance
+    vector<struct bench_clnt*> clnts;
+    vector<uint32_t> lat;       // fan-out latencies in microseconds
+    int     nready;             // # of clients set up
+    uint64_t sent;              // messages sent
+    uint64_t recv;              // benchmark messages received
+    uint64_t errors;            // failed connections and dropped sockets
+    double  connect_secs;       // time to set up all clients
+    double  send_secs;          // time spent sending
+};
+
+int bench_connect(struct bench* b);
+void bench_setup(struct bench* b);
+void bench_run(struct bench* b);
+void bench_poll(struct bench* b, int timeout);
+void bench_read(struct bench* b, struct bench_clnt* c);
+int bench_frame(void* arg, const struct frame* f);
+void bench_send(struct bench* b, struct bench_clnt* c, const char* text);
+void bench_flush(struct bench* b, struct bench_clnt* c);
+void bench_close(struct bench* b, struct bench_clnt* c);
+void bench_report(struct bench* b);
+uint64_t now_ns();
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    main
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int main(int argc, char* argv[])
+--              int argc: the number of arguments input
+--              char* argv[]: the list of arguments input
+-- 
+-- RETURNS:     return zero if it exits normally, otherwise return a
+--              non-zero value
+-- 
+-- NOTES:
+-- Main entry of the program.
+------------------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    struct  bench b;
+    struct  rlimit rl;
+    int     opt;
+    
+    strcpy(b.host, "127.0.0.1");
+    b.port = TCP_PORT;
+    b.nclients = 1000;
+    b.room_size = 0;
+    b.rate = 1000;
+    b.duration = 10;
+    b.shm_path = NULL;
+    b.nready = 0;
+    b.sent = b.recv = b.errors = 0;
+    b.connect_secs = b.send_secs = 0;
+    
+    while ((opt = getopt(argc, argv, "h:p:c:s:r:d:M:")) != -1) {
+        switch (opt) {
+        case 'h':
+            snprintf(b.host, sizeof(b.host), "%s", optarg);
+            break;
+        case 'p':
+            b.port = atoi(optarg);
+            break;
+        case 'c':
+            b.nclients = atoi(optarg);
+            break;
+        case 's':
+            b.room_size = atoi(optarg);
+            break;
+        case 'r':
+            b.rate = atoi(optarg);
+            break;
+        case 'd':
+            b.duration = atoi(optarg);
+            break;
+        case 'M':
+            b.shm_path = optarg;
+            break;
+        default:
+            printf("Usage: %s [-h host] [-p port] [-c clients] [-s room_size] "
+                   "[-r msgs_per_sec] [-d seconds] [-M shm_socket]\n", argv[0]);
+            return ERROR_EXIT;
+        }
+    }
+    
+    if (b.nclients < 2 || b.rate < 1 || b.duration < 1) {
+        printf("chatbench: need at least 2 clients, a rate and a duration.\n");
+        return ERROR_EXIT;
+    }
+    
+    // one descriptor per simulated client
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    if ((b.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("chatbench: epoll_create1 error.\n");
+        return ERROR_EXIT;
+    }
+    
+    if (bench_connect(&b) != 0)
+        return ERROR_EXIT;
+    
+    bench_setup(&b);
+    bench_run(&b);
+    bench_report(&b);
+    return NORMAL_EXIT;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_connect
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int bench_connect(struct bench* b)
+--              struct bench* b: the benchmark
+-- 
+-- RETURNS:     0 on success, -1 if no client could connect
+-- 
+-- NOTES:
+-- This function is called to open the client connections, at most
+-- BENCH_INFLIGHT at a time so the server's accept queue does not overflow.
+-- Each client sends its nickname as soon as it is connected. The time
+-- until every client is connected gives the connection setup rate.
+-- A client attached with -M is woken through its eventfd, its socket is
+-- not watched.
+------------------------------------------------------------------------------*/
+int bench_connect(struct bench* b)
+{
+    struct  sockaddr_in addr;
+    struct  epoll_event ev;
+    struct  bench_clnt* c;
+    struct  shm_link* l = NULL;
+    char    line[BUF_SIZE];
+    uint64_t start = now_ns();
+    int     i, fd;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(b->host);
+    addr.sin_port = htons(b->port);
+    
+    for (i = 0; i < b->nclients; i++) {
+        if (b->shm_path != NULL) {
+            l = new shm_link;
+            if ((fd = shm_attach(b->shm_path, l)) < 0) {
+                delete l;
+                b->errors++;
+                continue;
+            }
+        } else if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+                   || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            if (fd >= 0) close(fd);
+            b->errors++;
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        
+        c = new bench_clnt();
+        c->fd = fd;
+        c->id = i;
+        c->ready = 0;
+        c->b = b;
+        c->shm = l;
+        dec_init(&c->dec);
+        b->clnts.push_back(c);
+        
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (l != NULL) {
+            ev.events = EPOLLIN | EPOLLET;
+            epoll_ctl(b->epfd, EPOLL_CTL_ADD, l->wait_fd, &ev);
+        } else {
+            epoll_ctl(b->epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        
+        snprintf(line, sizeof(line), "/bench%d", i);
+        bench_send(b, c, line);
+        
+        // the server only kicks a client that said it waits
+        if (l != NULL)
+            bench_read(b, c);
+        
+        // let the server catch up with the accept queue
+        if ((i + 1) % BENCH_INFLIGHT == 0)
+            bench_poll(b, 0);
+    }
+    
+    b->connect_secs = (now_ns() - start) / 1e9;
+    
+    if (b->clnts.size() < 2) {
+        printf("chatbench: can't connect to %s:%d.\n", b->host, b->port);
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_setup
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_setup(struct bench* b)
+--              struct bench* b: the benchmark
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to put the clients into their rooms. It waits
+-- for every "/join" to be confirmed, then lets the join notices drain so
+-- they do not count as traffic.
+------------------------------------------------------------------------------*/
+void bench_setup(struct bench* b)
+{
+    char    line[BUF_SIZE];
+    uint64_t deadline;
+    size_t  i;
+    
+    if (b->room_size > 0) {
+        for (i = 0; i < b->clnts.size(); i++) {
+            snprintf(line, sizeof(line), "/join bench%d\n", (int) i / b->room_size);
+            bench_send(b, b->clnts[i], line);
+        }
+        
+        deadline = now_ns() + 30000000000ULL;
+        while (b->nready < (int) b->clnts.size() && now_ns() < deadline)
+            bench_poll(b, 100);
+    }
+    
+    deadline = now_ns() + 500000000ULL;
+    while (now_ns() < deadline)
+        bench_poll(b, 50);
+    b->recv = 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_run
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_run(struct bench* b)
+--              struct bench* b: the benchmark
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to send messages at the requested rate for the
+-- requested time. Messages that are due are sent in one go after each
+-- poll, so the rate holds even when the loop wakes up late. Deliveries
+-- still in flight are collected for one more second.
+------------------------------------------------------------------------------*/
+void bench_run(struct bench* b)
+{
+    char    line[BUF_SIZE];
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t) b->duration * 1000000000ULL;
+    uint64_t now, due;
+    size_t  next = 0;
+    
+    while ((now = now_ns()) < end) {
+        due = (uint64_t) ((double) (now - start) * b->rate / 1e9);
+        
+        while (b->sent < due) {
+            snprintf(line, sizeof(line), "%s%llu %llu\n", BENCH_TAG,
+                     (unsigned long long) b->sent, (unsigned long long) now_ns());
+            bench_send(b, b->clnts[next], line);
+            next = (next + 1) % b->clnts.size();
+            b->sent++;
+        }
+        
+        bench_poll(b, 1);
+    }
+    
+    b->send_secs = (now_ns() - start) / 1e9;
+    
+    end = now_ns() + 1000000000ULL;
+    while (now_ns() < end)
+        bench_poll(b, 50);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_poll
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_poll(struct bench* b, int timeout)
+--              struct bench* b: the benchmark
+--              int timeout: milliseconds to wait for events
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to handle one batch of socket events. A kick
+-- from the server may mean data or room for a client attached with -M.
+------------------------------------------------------------------------------*/
+void bench_poll(struct bench* b, int timeout)
+{
+    struct  epoll_event events[MAX_EVENTS];
+    struct  bench_clnt* c;
+    int     n, i;
+    
+    n = epoll_wait(b->epfd, events, MAX_EVENTS, timeout);
+    
+    for (i = 0; i < n; i++) {
+        c = (struct bench_clnt*) events[i].data.ptr;
+        
+        if (c->shm != NULL) {
+            shm_clear(c->shm);
+            bench_flush(b, c);
+            bench_read(b, c);
+            continue;
+        }
+        
+        if (events[i].events & EPOLLOUT)
+            bench_flush(b, c);
+        
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            bench_read(b, c);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_read
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_read(struct bench* b, struct bench_clnt* c)
+--              struct bench* b: the benchmark
+--              struct bench_clnt* c: the readable client
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to read until EAGAIN and decode the frames.
+-- A client the server drops is counted as an error and stays silent.
+-- With -M the frames are decoded in the ring until it is empty.
+------------------------------------------------------------------------------*/
+void bench_read(struct bench* b, struct bench_clnt* c)
+{
+    char    rbuf[READ_SIZE];
+    const   char* data;
+    int     n;
+    
+    while (c->shm != NULL && c->fd >= 0) {
+        if ((n = shm_peek(c->shm, &data)) == 0) {
+            if (shm_data_wait(c->shm))
+                return;
+            continue;
+        }
+        
+        if (n < 0 || dec_feed(&c->dec, data, n, bench_frame, c) < 0) {
+            bench_close(b, c);
+            return;
+        }
+        shm_consume(c->shm, n);
+    }
+    
+    while (c->fd >= 0) {
+        n = read(c->fd, rbuf, sizeof(rbuf));
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        
+        if (n <= 0 || dec_feed(&c->dec, rbuf, n, bench_frame, c) < 0)
+            bench_close(b, c);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_frame
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int bench_frame(void* arg, const struct frame* f)
+--              void* arg: the client the frame was received by
+--              const struct frame* f: the frame
+-- 
+-- RETURNS:     always 0 to keep decoding
+-- 
+-- NOTES:
+-- This function is called for each frame a client receives. Benchmark
+-- messages yield a latency sample, the confirmation of a "/join" marks the
+-- client as set up, pings are answered, anything else is ignored.
+------------------------------------------------------------------------------*/
+int bench_frame(void* arg, const struct frame* f)
+{
+    struct  bench_clnt* c = (struct bench_clnt*) arg;
+    struct  bench* b = c->b;
+    char    line[BUF_SIZE];
+    char*   p;
+    unsigned long long seq, sent;
+    uint64_t now = now_ns();
+    size_t  len;
+    
+    if (f->type == FRAME_PING) {
+        frame_header(line, FRAME_PONG, 0, 0);
+        c->out.append(line, FRAME_HDR_SIZE);
+        bench_flush(b, c);
+        return 0;
+    }
+    
+    if (f->type != FRAME_TEXT)
+        return 0;
+    
+    len = (f->length < BUF_SIZE) ? f->length : BUF_SIZE - 1;
+    memcpy(line, f->payload, len);
+    line[len] = '\0';
+    
+    if ((p = strstr(line, BENCH_TAG)) != NULL) {
+        if (sscanf(p + strlen(BENCH_TAG), "%llu %llu", &seq, &sent) == 2 && now >= sent)
+            b->lat.push_back((uint32_t) ((now - sent) / 1000));
+        b->recv++;
+    } else if (!c->ready && strstr(line, "Now talking in") != NULL) {
+        c->ready = 1;
+        b->nready++;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_send
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_send(struct bench* b, struct bench_clnt* c,
+--                              const char* text)
+--              struct bench* b: the benchmark
+--              struct bench_clnt* c: the sending client
+--              const char* text: the line to send
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to send a line as a text frame without blocking;
+-- what the socket does not take is sent by bench_flush().
+------------------------------------------------------------------------------*/
+void bench_send(struct bench* b, struct bench_clnt* c, const char* text)
+{
+    char    out[FRAME_HDR_SIZE + BUF_SIZE];
+    int     n;
+    
+    if (c->fd < 0)
+        return;
+    
+    if ((n = frame_encode(out, sizeof(out), FRAME_TEXT, 0, text, strlen(text))) < 0)
+        return;
+    
+    c->out.append(out, n);
+    bench_flush(b, c);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_flush(struct bench* b, struct bench_clnt* c)
+--              struct bench* b: the benchmark
+--              struct bench_clnt* c: the client
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to write the client's pending bytes. With -M
+-- a full ring has the server kick the client once it made room.
+------------------------------------------------------------------------------*/
+void bench_flush(struct bench* b, struct bench_clnt* c)
+{
+    ssize_t n;
+    
+    while (c->fd >= 0 && !c->out.empty()) {
+        if (c->shm != NULL) {
+            if ((n = shm_write(c->shm, c->out.data(), c->out.size())) < 0) {
+                bench_close(b, c);
+                return;
+            }
+            c->out.erase(0, n);
+            if (n == 0 && shm_room_wait(c->shm))
+                return;
+            continue;
+        }
+        
+        n = send(c->fd, c->out.data(), c->out.size(), MSG_NOSIGNAL);
+        
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                bench_close(b, c);
+            return;
+        }
+        
+        c->out.erase(0, n);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_close
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_close(struct bench* b, struct bench_clnt* c)
+--              struct bench* b: the benchmark
+--              struct bench_clnt* c: a client the server dropped
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to count a dropped client as an error and close
+-- it. The server holds the eventfd of a client attached with -M too, so it
+-- is taken out of the epoll set by hand.
+------------------------------------------------------------------------------*/
+void bench_close(struct bench* b, struct bench_clnt* c)
+{
+    if (c->shm != NULL) {
+        epoll_ctl(b->epfd, EPOLL_CTL_DEL, c->shm->wait_fd, NULL);
+        shm_unmap(c->shm);
+        delete c->shm;
+        c->shm = NULL;
+    }
+    
+    close(c->fd);
+    c->fd = -1;
+    b->errors++;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    bench_report
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void bench_report(struct bench* b)
+--              struct bench* b: the benchmark
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to print the results as one JSON object.
+-- "expected" is the number of deliveries a lossless server would make.
+------------------------------------------------------------------------------*/
+void bench_report(struct bench* b)
+{
+    vector<uint32_t>& lat = b->lat;
+    uint64_t expected;
+    uint32_t pct[3] = { 0, 0, 0 }, worst = 0;
+    double  q[3] = { 0.5, 0.99, 0.999 };
+    int     members, i;
+    
+    members = (b->room_size > 0) ? b->room_size : (int) b->clnts.size();
+    if (members > (int) b->clnts.size())
+        members = b->clnts.size();
+    expected = b->sent * (members - 1);
+    
+    if (!lat.empty()) {
+        sort(lat.begin(), lat.end());
+        for (i = 0; i < 3; i++)
+            pct[i] = lat[(size_t) (q[i] * (lat.size() - 1))];
+        worst = lat.back();
+    }
+    
+    printf("{\"clients\": %d, \"connected\": %d, \"room_size\": %d, "
+           "\"rate\": %d, \"duration\": %d, "
+           "\"connect_secs\": %.3f, \"connect_per_sec\": %.1f, "
+           "\"sent\": %llu, \"recv\": %llu, \"expected\": %llu, "
+           "\"sent_per_sec\": %.1f, \"recv_per_sec\": %.1f, "
+           "\"p50_us\": %u, \"p99_us\": %u, \"p999_us\": %u, \"max_us\": %u, "
+           "\"errors\": %llu}\n",
+           b->nclients, (int) b->clnts.size(), b->room_size, b->rate, b->duration,
+           b->connect_secs, b->clnts.size() / (b->connect_secs > 0 ? b->connect_secs : 1e-9),
+           (unsigned long long) b->sent, (unsigned long long) b->recv,
+           (unsigned long long) expected,
+           b->sent / b->send_secs, b->recv / b->send_secs,
+           pct[0], pct[1], pct[2], worst, (unsigned long long) b->errors);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    now_ns
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   uint64_t now_ns()
+-- 
+-- RETURNS:     the monotonic time in nanoseconds
+-- 
+-- NOTES:
+-- This function is called to timestamp messages and deliveries.
+------------------------------------------------------------------------------*/
+uint64_t now_ns()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -7,12 +7,29 @@
 -- 
 -- FUNCTIONS:   int main(int argc, char *argv[])
 --              int init_clnt(char* ipaddr, int port);
+--              int clnt_connect(char* ipaddr, int port, int max_ms);
+--              void clnt_hello(int sockfd);
+--              void clnt_track(const char* line);
+--              int clnt_seen(uint64_t id);
+--              uint64_t clnt_now(void);
 --              void add_set(fd_set *sockset, int sockfd);
+--              int send_text(int sockfd, const char* text, int len);
+--              int clnt_frame(void* arg, const struct frame* f);
 --              void signal_clnt(int signo);
 --              void leave();
+--              void clnt_exit(int code);
 -- 
 -- DATE:        March 11, 2017
 -- 
+-- REVISIONS:   October 16, 2026 - length-prefixed frames (see frame.h).
+--              October 16, 2026 - the dump file is written by a background
+--              thread (see logger.h) and can be rotated.
+--              October 16, 2026 - answers the server's heartbeats.
+--              October 16, 2026 - reconnects with backoff and resumes from
+--              the last message received.
+--              October 16, 2026 - resumes from the oldest message id still
+--              missing, drops the messages it gets twice.
+-- 
 -- DESIGNER:    Fred Yang, Maitiu Morton
 -- 
 -- PROGRAMMER:  Fred Yang, Maitiu Morton
@@ -22,12 +39,45 @@
 -- information it was from. The client information includes hostname, ipaddress,
 -- and the file descriptor connected.
 -- User can specify (command line argument) that the chat session also be dumped
--- to a file with CR-LF terminated records.
+-- to a file with CR-LF terminated records. Records are batched in memory and
+-- written by a background thread, so a slow disk never freezes the terminal:
+--      -i ms       flush interval (default 1000)
+--      -s bytes    rotate the file once it reaches this size
+--      -r seconds  rotate the file once it is this old
+--      -k count    # of rotated files kept (default 5)
+-- Messages are exchanged with the server as length-prefixed frames (see
+-- frame.h), so several messages arriving in one read are still displayed one
+-- by one.
+-- When the server goes away the client connects again by itself, after a
+-- delay that doubles from RECONNECT_MIN_MS with every failed try, up to
+-- -b ms (default RECONNECT_MAX_MS, 0 exits instead). Each delay is drawn
+-- at random below that bound, so clients dropped together by a restart
+-- spread their reconnects out. Once back it sends "/resume" with the id of
+-- the last message received, its nickname and its rooms: the server joins
+-- them again and sends only the messages missed meanwhile (they need the
+-- server's journal, without one the client gets the rooms' scrollback).
+-- Messages do not always arrive in id order: one relayed between the
+-- server's threads can come after a later one. An id skipped is kept as a
+-- gap for CLNT_GAP_MS of traffic, and the client resumes from the oldest
+-- gap still open, dropping by id what it is sent again. A gap that stays
+-- open is a message of a room the client is not in. Only the stream that
+-- follows /resume is deduplicated: the scrollback of a room joined comes
+-- without ids, and old ids asked for with /history are shown.
 ------------------------------------------------------------------------------*/
 
 #include "common.h"
 using namespace std;
 
+int clnt_sockfd = -1;                       // client socket file descriptor
+char clnt_name[MAX_NAME];                   // nickname
+uint64_t clnt_last;                         // id of the last message received
+map<uint64_t, pair<uint64_t, uint64_t> > clnt_gaps; // ids missing, first -> last, since
+vector<string> clnt_rooms;                  // rooms joined, the current one last
+int clnt_browse;                            // /history sent since the last reconnect
+int clnt_tries;                             // reconnects failed in a row
+char default_file[MAX_NAME] = "log.txt";    // default dump file
+struct logger clnt_log;                     // chat session dump file
+
 /*------------------------------------------------------------------------------
 -- FUNCTION:    main
 -- 
@@ -58,29 +108,67 @@ int main(int argc, char* argv[])
     char    name[MAX_NAME];     // nick name
     char    input[MAX_NAME];    // input prompt
     char    file[MAX_NAME];     // file to dump the chat records
+    char    rbuf[READ_SIZE];    // socket read buffer
+    char    record[BUF_SIZE];   // nickname prompt record
     fd_set  sockset;            // file descriptor sets
+    struct  frame_decoder dec;  // incoming frame decoder
+    int     flush_ms = LOG_FLUSH_MS;    // log flush interval
+    long    rotate_size = 0;    // rotate the log at this size
+    int     rotate_secs = 0;    // rotate the log at this age
+    int     keep = LOG_KEEP;    // # of rotated logs kept
+    int     max_ms = RECONNECT_MAX_MS;  // ceiling of the reconnect delay
+    time_t  up;                 // when the connection was made
+    int     opt;
 
-    // call signal_clnt() on SIGINT
+    // call signal_clnt() on SIGINT, a lost server is noticed on write
     signal(SIGINT, signal_clnt);
+    signal(SIGPIPE, SIG_IGN);
+    srandom((unsigned) time(NULL) ^ (unsigned) getpid());
+    
+    while ((opt = getopt(argc, argv, "i:s:r:k:b:")) != -1) {
+        switch (opt) {
+        case 'i':
+            flush_ms = atoi(optarg);
+            break;
+        case 's':
+            rotate_size = atol(optarg);
+            break;
+        case 'r':
+            rotate_secs = atoi(optarg);
+            break;
+        case 'k':
+            keep = atoi(optarg);
+            break;
+        case 'b':
+            max_ms = atoi(optarg);
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
     
     // program usage
-    if(argc < 3) {
-        printf("Usage: %s <IP> <Port> [File]\n", argv[0]);
+    if(argc - optind < 2) {
+        printf("Usage: %s [-i flush_ms] [-s rotate_bytes] [-r rotate_secs] "
+               "[-k keep] [-b max_backoff_ms] <IP> <Port> [File]\n", argv[0]);
         return ERROR_EXIT;
     }
 
-    strcpy(hostaddr, argv[1]);
-    tcpport = strtol(argv[2], NULL, PORT_SIZE);
-    if (argc == 4) {
-        strcpy(file, argv[3]);
+    snprintf(hostaddr, sizeof(hostaddr), "%s", argv[optind]);
+    tcpport = strtol(argv[optind + 1], NULL, PORT_SIZE);
+    if (argc - optind > 2) {
+        snprintf(file, sizeof(file), "%s", argv[optind + 2]);
     }
     else {
         strcpy(file, default_file);
     }
     
-    // open file as ofstream
-    ofstream ofs;
-    ofs.open(file, ofstream::out | ofstream::app);
+    // start the background log writer
+    if (log_open(&clnt_log, file, flush_ms, rotate_size > 0 ? rotate_size : 0,
+                 rotate_secs, keep) != 0) {
+        perror("client: can't open log file.\n");
+    }
     
     // initialize client socket given host ip and port #
     sockfd = init_clnt(hostaddr, tcpport);
@@ -99,15 +187,32 @@ int main(int argc, char* argv[])
 
     // prompt for nickname
     strcpy(input, "Please input your nickname:");
-    fprintf(stdout, input);
-    ofs << input;
-    fscanf(stdin, "%s", name);
+    fprintf(stdout, "%s", input);
+    fflush(stdout);
+    fscanf(stdin, "%99s", name);
     strcpy(msg, "/");
-    strcat(msg, name);
-    write(sockfd, msg, strlen(msg));
-    ofs << name << endl;
+    strncat(msg, name, BUF_SIZE - 2);
+    send_text(sockfd, msg, strlen(msg));
+    snprintf(record, sizeof(record), "%s%s", input, name);
+    log_write(&clnt_log, record, strlen(record));
+    strcpy(clnt_name, name);
+    clnt_rooms.push_back(ROOM_DEFAULT);     // where srv_admit() puts us
+    dec_init(&dec);
+    up = time(NULL);
     
     while (1) {
+        // connection lost: wait, connect again and pick up where we were
+        if (sockfd < 0) {
+            if (max_ms <= 0) clnt_exit(0);
+            if (time(NULL) - up >= RECONNECT_STABLE) clnt_tries = 0;
+            printf("- Connection lost.\n");
+            dec_free(&dec);
+            sockfd = clnt_sockfd = clnt_connect(hostaddr, tcpport, max_ms);
+            clnt_hello(sockfd);
+            up = time(NULL);
+            add_set(&sockset, sockfd);
+        }
+        
         /* 
          * select() allows the client to monitor multiple file descriptors
          * waiting until one or more of the file descriptors become "ready"
@@ -117,28 +222,36 @@ int main(int argc, char* argv[])
         
         // socket fd is ready for READ
         if (FD_ISSET(sockfd, &sockset)) {
-            readbytes = read(sockfd, msg, BUF_SIZE);
-            if (readbytes == 0) exit(0);
-            msg[readbytes] = '\0';
-            ofs << msg << endl;
-            printf("%s", msg);
+            readbytes = read(sockfd, rbuf, READ_SIZE);
+            if (readbytes > 0 && dec_feed(&dec, rbuf, readbytes, clnt_frame, &clnt_log) < 0) {
+                printf("client: protocol error.\n");
+                clnt_exit(0);
+            }
             fflush(stdout);
+            if (readbytes <= 0) {
+                close(sockfd);
+                sockfd = clnt_sockfd = -1;
+                continue;
+            }
         }
         
         // input fd is ready for READ and then WRITE
         if (FD_ISSET(0, &sockset)) {
-            readbytes = read(0, msg, BUF_SIZE);
+            readbytes = read(0, msg, BUF_SIZE - 1);
+            if (readbytes <= 0) leave();
             msg[readbytes] = '\0';
-            ofs << msg << endl;
+            log_write(&clnt_log, msg, readbytes);
             
             if (msg[0] == '/' && msg[1] == 'q') {
                 leave();
             }
             
-            int len = strlen(msg);
-            if (write(sockfd, msg, len) != len) {
+            clnt_track(msg);
+            if (send_text(sockfd, msg, strlen(msg)) != 0) {
                 printf("client: write socket error.\n");
-                exit(0);
+                close(sockfd);
+                sockfd = clnt_sockfd = -1;
+                continue;
             }
         }
         
@@ -146,8 +259,8 @@ int main(int argc, char* argv[])
         add_set(&sockset, sockfd);
    }
    
-   // close file stream
-   ofs.close();
+   // flush the log
+   log_close(&clnt_log);
    return NORMAL_EXIT;
 }
 
@@ -193,12 +306,331 @@ int init_clnt(char* ipaddr, int port)
         sizeof(serv_addr)) < 0) {
         perror("client: can't connect to server.\n");
         fflush(stdout);
+        close(sockfd);
         return 0;
     }
     
     return sockfd;
 }
 
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_connect
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int clnt_connect(char* ipaddr, int port, int max_ms)
+--              char* ipaddr: the ip address of the server
+--              int port: the port # the server listening to
+--              int max_ms: the longest delay between two tries
+-- 
+-- RETURNS:     the connected socket, does not return before it has one
+-- 
+-- NOTES:
+-- This function is called to reconnect after the connection was lost. Try
+-- n waits a random delay below RECONNECT_MIN_MS * 2^n, capped at max_ms
+-- ("full jitter"), so a crowd of clients losing the server together does
+-- not come back in one burst. The keyboard is still read while waiting:
+-- "/q" quits, anything else cannot be sent and is dropped.
+------------------------------------------------------------------------------*/
+int clnt_connect(char* ipaddr, int port, int max_ms)
+{
+    struct  timeval tv, now, until;
+    fd_set  set;
+    char    line[BUF_SIZE];
+    long    bound, delay;
+    int     sockfd, n;
+    
+    for (;;) {
+        bound = RECONNECT_MIN_MS;
+        for (n = 0; n < clnt_tries && bound < max_ms; n++)
+            bound *= 2;
+        if (bound > max_ms) bound = max_ms;
+        delay = random() % (bound + 1);
+        clnt_tries++;
+        
+        printf("- Reconnecting in %ld ms...\n", delay);
+        fflush(stdout);
+        
+        gettimeofday(&until, NULL);
+        until.tv_sec += delay / 1000;
+        until.tv_usec += (delay % 1000) * 1000;
+        if (until.tv_usec >= 1000000) {
+            until.tv_sec++;
+            until.tv_usec -= 1000000;
+        }
+        
+        for (;;) {
+            gettimeofday(&now, NULL);
+            if (!timercmp(&now, &until, <))
+                break;
+            timersub(&until, &now, &tv);
+            FD_ZERO(&set);
+            FD_SET(0, &set);
+            if (select(1, &set, NULL, NULL, &tv) <= 0 || !FD_ISSET(0, &set))
+                continue;
+            
+            if ((n = read(0, line, BUF_SIZE - 1)) <= 0 || (line[0] == '/' && line[1] == 'q'))
+                clnt_exit(0);
+            printf("client: not connected, message dropped.\n");
+            fflush(stdout);
+        }
+        
+        if ((sockfd = init_clnt(ipaddr, port)) != 0)
+            break;
+    }
+    
+    printf("- Reconnected.\n");
+    fflush(stdout);
+    return sockfd;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_hello
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void clnt_hello(int sockfd)
+--              int sockfd: the socket just connected again
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called after a reconnect, in place of the nickname, to
+-- send "/resume id nickname rooms...". The id is the one before the oldest
+-- gap, or the last received without gaps. Rooms that do not fit in one
+-- line are left out.
+------------------------------------------------------------------------------*/
+void clnt_hello(int sockfd)
+{
+    char    msg[BUF_SIZE];
+    size_t  i;
+    int     n;
+    
+    n = snprintf(msg, sizeof(msg), "/resume %llu %s",
+                 (unsigned long long) (clnt_gaps.empty() ? clnt_last
+                                                         : clnt_gaps.begin()->first - 1),
+                 clnt_name);
+    for (i = 0; i < clnt_rooms.size(); i++) {
+        if (n + 1 + clnt_rooms[i].size() >= sizeof(msg))
+            break;
+        n += snprintf(msg + n, sizeof(msg) - n, " %s", clnt_rooms[i].c_str());
+    }
+    
+    clnt_browse = 0;
+    send_text(sockfd, msg, n);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_track
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void clnt_track(const char* line)
+--              const char* line: a line typed by the user
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for each line sent to keep the list of rooms
+-- joined for clnt_hello(). "/join" moves the room to the end, as it becomes
+-- the room talked to; "/part" without a name leaves the last one. A
+-- "/history" lets the old messages it asks for through clnt_frame().
+------------------------------------------------------------------------------*/
+void clnt_track(const char* line)
+{
+    char    word[ROOM_NAME_MAX];
+    string  room;
+    size_t  i;
+    int     join;
+    
+    if (strncmp(line, "/history", 8) == 0 && isspace((unsigned char) line[8]))
+        clnt_browse = 1;
+    
+    if (strncmp(line, "/join", 5) == 0 && isspace((unsigned char) line[5]))
+        join = 1;
+    else if (strncmp(line, "/part", 5) == 0 && isspace((unsigned char) line[5]))
+        join = 0;
+    else
+        return;
+    
+    if (sscanf(line + 5, " %31s", word) != 1) {
+        if (!join && !clnt_rooms.empty())
+            clnt_rooms.pop_back();
+        return;
+    }
+    
+    room = (word[0] == '#') ? word + 1 : word;
+    for (i = 0; i < clnt_rooms.size(); i++) {
+        if (clnt_rooms[i] == room) {
+            clnt_rooms.erase(clnt_rooms.begin() + i);
+            break;
+        }
+    }
+    if (join)
+        clnt_rooms.push_back(room);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_seen
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int clnt_seen(uint64_t id)
+--              uint64_t id: the id of a message received
+-- 
+-- RETURNS:     1 the first time the id comes, 0 if the message was had
+--              already
+-- 
+-- NOTES:
+-- This function is called for every message with an id. An id past the
+-- last one opens a gap for the ids skipped, an id in a gap closes that
+-- part of it. Gaps are opened in id order, so the oldest is always the
+-- first; those open for CLNT_GAP_MS are given up here, while messages
+-- come, never while the client is away.
+------------------------------------------------------------------------------*/
+int clnt_seen(uint64_t id)
+{
+    map<uint64_t, pair<uint64_t, uint64_t> >::iterator it;
+    uint64_t first, last, since, now = clnt_now();
+    
+    while (!clnt_gaps.empty() && clnt_gaps.begin()->second.second + CLNT_GAP_MS <= now)
+        clnt_gaps.erase(clnt_gaps.begin());
+    
+    if (id > clnt_last) {
+        if (clnt_last > 0 && id > clnt_last + 1)
+            clnt_gaps[clnt_last + 1] = make_pair(id - 1, now);
+        clnt_last = id;
+        return 1;
+    }
+    
+    // below the last id it is new only if it fills a gap
+    if ((it = clnt_gaps.upper_bound(id)) == clnt_gaps.begin())
+        return 0;
+    if (id > (--it)->second.first)
+        return 0;
+    
+    first = it->first;
+    last = it->second.first;
+    since = it->second.second;
+    clnt_gaps.erase(it);
+    if (first < id)
+        clnt_gaps[first] = make_pair(id - 1, since);
+    if (id < last)
+        clnt_gaps[id + 1] = make_pair(last, since);
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_now
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   uint64_t clnt_now(void)
+-- 
+-- RETURNS:     a monotonic time in milliseconds
+------------------------------------------------------------------------------*/
+uint64_t clnt_now(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    send_text
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int send_text(int sockfd, const char* text, int len)
+--              int sockfd: the socket connected to the server
+--              const char* text: the text or "/command" to send
+--              int len: the length of the text
+-- 
+-- RETURNS:     return 0 on success, -1 on failure
+-- 
+-- NOTES:
+-- This function is called to send a line to the server as one text frame.
+------------------------------------------------------------------------------*/
+int send_text(int sockfd, const char* text, int len)
+{
+    char    out[FRAME_HDR_SIZE + BUF_SIZE];
+    int     n;
+    
+    if ((n = frame_encode(out, sizeof(out), FRAME_TEXT, 0, text, len)) < 0)
+        return -1;
+    
+    return (write(sockfd, out, n) == n) ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_frame
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int clnt_frame(void* arg, const struct frame* f)
+--              void* arg: the dump file logger
+--              const struct frame* f: the frame received from the server
+-- 
+-- RETURNS:     always 0 to keep decoding
+-- 
+-- NOTES:
+-- This function is called for each frame received from the server. Text
+-- frames are displayed and dumped to the file, heartbeats are answered so
+-- the server does not take an idle client for a dead one. The ids seen are
+-- tracked for clnt_hello(), and a message sent again after a reconnect is
+-- dropped, unless the user asked for old ones with /history.
+------------------------------------------------------------------------------*/
+int clnt_frame(void* arg, const struct frame* f)
+{
+    struct logger* lg = (struct logger*) arg;
+    char    pong[FRAME_HDR_SIZE];
+    
+    if (f->type == FRAME_PING) {
+        frame_header(pong, FRAME_PONG, 0, 0);
+        if (write(clnt_sockfd, pong, sizeof(pong)) != (ssize_t) sizeof(pong))
+            printf("client: write socket error.\n");
+        return 0;
+    }
+    
+    if (f->type != FRAME_TEXT)
+        return 0;
+    
+    if (f->id > 0 && !clnt_seen(f->id) && !clnt_browse)
+        return 0;
+    fwrite(f->payload, 1, f->length, stdout);
+    log_write(lg, f->payload, f->length);
+    return 0;
+}
+
 /*------------------------------------------------------------------------------
 -- FUNCTION:    add_set
 -- 
@@ -242,9 +674,32 @@ void add_set(fd_set* sockset, int sockfd)
 -- the client socket.
 ------------------------------------------------------------------------------*/
 void leave() {
-    write(clnt_sockfd, "/q\n", 3);
+    send_text(clnt_sockfd, "/q\n", 3);
     close(clnt_sockfd);
-    exit(0);
+    clnt_exit(0);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    clnt_exit
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void clnt_exit(int code)
+--              int code: the exit status
+-- 
+-- RETURNS:     does not return
+-- 
+-- NOTES:
+-- This function is called to terminate the client once the buffered log
+-- records have been written out.
+------------------------------------------------------------------------------*/
+void clnt_exit(int code) {
+    log_close(&clnt_log);
+    exit(code);
 }
 
 /*------------------------------------------------------------------------------
@@ -0,0 +1,937 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: chatreplay.c - Plays a traffic capture back against a chat
+--              room server.
+-- 
+-- PROGRAM:     chatreplay
+-- 
+-- FUNCTIONS:   int main(int argc, char* argv[])
+--              int replay_load(struct replay* r, const char* path);
+--              int replay_frame_count(void* arg, const struct frame* f);
+--              int replay_probes(struct replay* r);
+--              void replay_run(struct replay* r);
+--              void replay_event(struct replay* r, const struct rp_event* e);
+--              void replay_poll(struct replay* r, int timeout);
+--              void replay_read(struct replay* r, struct rp_sess* c);
+--              int replay_frame(void* arg, const struct frame* f);
+--              void replay_flush(struct replay* r, struct rp_sess* c);
+--              void replay_close(struct replay* r, struct rp_sess* c);
+--              int replay_connect(struct replay* r, struct rp_sess* c);
+--              void replay_report(struct replay* r);
+--              int replay_baseline(const char* path, const char* key,
+--                                  double* v);
+--              uint64_t now_ns();
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- chatreplay reads a file written by chatsrv --capture (see capture.h) and
+-- plays it against a server: every session of the capture gets its own
+-- connection, opened and closed when the session was, and is sent the
+-- same bytes at the same times. With -x N the capture is played N times
+-- faster, with -x 0 as fast as the server takes it. All from one epoll
+-- loop, like chatbench.
+-- The replayed sessions' own traffic carries no timestamps, so the
+-- latency is measured by two probe clients of their own in a room of
+-- their own: one sends a timestamped message -r times a second and the
+-- other one times its arrival, which shows how long the server takes to
+-- get to a message under the captured load.
+-- The sessions do not answer the server's pings, the capture holds the
+-- answers they gave. A session is closed by shutting down its side and
+-- waiting for the server to close, so the server reads all it was sent.
+-- The result is printed as one JSON object on stdout:
+--      sessions, records   what the capture holds
+--      trace_secs          time the capture spans
+--      replay_secs         time the replay took
+--      sent_per_sec        frames sent per second of replay
+--      recv_per_sec        frames the sessions received per second
+--      dropped             sessions the server closed before the capture
+--                          did
+--      lag_max_ms          how far the replay fell behind the schedule
+--      p50_us, p99_us,     probe latency percentiles in microseconds
+--      p999_us, max_us
+-- With -c, the JSON output of an earlier run (another build, say) is read
+-- and "delta_pct" gives the change of the main figures against it.
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+#define PROBE_TAG       "PROBE "    // marks probe messages
+#define PROBE_ROOM      "replay-probe" // room of the probe clients
+#define RP_BATCH        4096        // events sent per poll at full speed
+#define RP_DRAIN_MS     500         // quiet time that ends the replay
+
+// session of the capture, or probe client
+struct rp_sess {
+    int     fd;                 // socket, -1 while not connected
+    int     state;              // RP_*
+    int     probe;              // 1 for the probe clients
+    int     ready;              // probe: got the reply to its "/join"
+    struct replay* r;           // the replay
+    struct frame_decoder dec;   // incoming frame decoder
+    string  out;                // bytes the socket did not take yet
+};
+
+// session states
+#define RP_NEW          0       // not opened yet
+#define RP_OPEN         1       // connected
+#define RP_CLOSING      2       // closed by the capture, waiting for the server
+#define RP_DONE         3       // closed
+
+// one record of the capture, in time order
+struct rp_event {
+    uint64_t    when;           // ns since the epoch
+    int         kind;           // CAP_*
+    int         sess;           // index in replay.sess
+    const char* data;           // CAP_DATA: bytes to send
+    size_t      len;
+};
+
+// replay settings and results
+struct replay {
+    char    host[IP_SIZE];      // server address
+    int     port;               // server port
+    double  speed;              // 1 = as captured, 0 = as fast as possible
+    int     probe_rate;         // probe messages per second, 0 = none
+    const char* baseline;       // JSON of an earlier run, NULL for none
+    int     epfd;               // epoll instance
+    vector<struct rp_sess*> sess;   // sessions of the capture
+    vector<struct rp_event> events; // the capture's records
+    struct rp_sess* probe[2];   // sender and receiver of the probes
+    vector<uint32_t> lat;       // probe latencies in microseconds
+    uint64_t frames;            // frames in the capture
+    uint64_t probes;            // probe messages sent
+    uint64_t sent;              // bytes sent
+    uint64_t recv;              // frames the sessions received
+    uint64_t recv_bytes;        // bytes the sessions received
+    uint64_t dropped;           // sessions the server closed early
+    uint64_t errors;            // connections that failed
+    uint64_t lag_max;           // ns behind the schedule, at most
+    uint64_t last_recv;         // when a session last received data
+    double  trace_secs;         // span of the capture
+    double  replay_secs;        // time spent replaying
+};
+
+int replay_load(struct replay* r, const char* path);
+int replay_frame_count(void* arg, const struct frame* f);
+int replay_probes(struct replay* r);
+void replay_run(struct replay* r);
+void replay_event(struct replay* r, const struct rp_event* e);
+void replay_poll(struct replay* r, int timeout);
+void replay_read(struct replay* r, struct rp_sess* c);
+int replay_frame(void* arg, const struct frame* f);
+void replay_flush(struct replay* r, struct rp_sess* c);
+void replay_close(struct replay* r, struct rp_sess* c);
+int replay_connect(struct replay* r, struct rp_sess* c);
+void replay_report(struct replay* r);
+int replay_baseline(const char* path, const char* key, double* v);
+uint64_t now_ns();
+
+// orders the events by time, records of one shard keep their order
+static bool event_earlier(const struct rp_event& a, const struct rp_event& b)
+{
+    return a.when < b.when;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    main
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int main(int argc, char* argv[])
+--              int argc: the number of arguments input
+--              char* argv[]: the list of arguments input
+-- 
+-- RETURNS:     return zero if it exits normally, otherwise return a
+--              non-zero value
+-- 
+-- NOTES:
+-- Main entry of the program.
+-- Usage: chatreplay [-h host] [-p port] [-x speed] [-r probes_per_sec]
+--                   [-c baseline.json] capture_file
+------------------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    struct  replay r;
+    struct  rlimit rl;
+    int     opt;
+    
+    strcpy(r.host, "127.0.0.1");
+    r.port = TCP_PORT;
+    r.speed = 1;
+    r.probe_rate = 100;
+    r.baseline = NULL;
+    r.probe[0] = r.probe[1] = NULL;
+    r.frames = r.probes = r.sent = r.recv = r.recv_bytes = 0;
+    r.dropped = r.errors = r.lag_max = r.last_recv = 0;
+    r.trace_secs = r.replay_secs = 0;
+    
+    while ((opt = getopt(argc, argv, "h:p:x:r:c:")) != -1) {
+        switch (opt) {
+        case 'h':
+            snprintf(r.host, sizeof(r.host), "%s", optarg);
+            break;
+        case 'p':
+            r.port = atoi(optarg);
+            break;
+        case 'x':
+            r.speed = atof(optarg);
+            break;
+        case 'r':
+            r.probe_rate = atoi(optarg);
+            break;
+        case 'c':
+            r.baseline = optarg;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    
+    if (optind != argc - 1 || r.speed < 0 || r.probe_rate < 0) {
+        printf("Usage: %s [-h host] [-p port] [-x speed] [-r probes_per_sec] "
+               "[-c baseline.json] capture_file\n", argv[0]);
+        return ERROR_EXIT;
+    }
+    
+    // one descriptor per session
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    if ((r.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("chatreplay: epoll_create1 error.\n");
+        return ERROR_EXIT;
+    }
+    
+    if (replay_load(&r, argv[optind]) != 0 || replay_probes(&r) != 0)
+        return ERROR_EXIT;
+    
+    replay_run(&r);
+    replay_report(&r);
+    return NORMAL_EXIT;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_load
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int replay_load(struct replay* r, const char* path)
+--              struct replay* r: the replay
+--              const char* path: the capture file
+-- 
+-- RETURNS:     0 on success, -1 if the file cannot be read, is corrupt or
+--              holds nothing
+-- 
+-- NOTES:
+-- This function is called to map the capture and turn its records into
+-- events in time order, each session numbered in order of appearance. A
+-- session whose opening is not in the capture is opened with its first
+-- bytes. The frames each session sends are counted here, so the replay
+-- does not have to decode its own output.
+------------------------------------------------------------------------------*/
+int replay_load(struct replay* r, const char* path)
+{
+    map<pair<uint64_t, uint64_t>, int> ids;     // session key -> index
+    map<pair<uint64_t, uint64_t>, int>::iterator it;
+    pair<uint64_t, uint64_t> key;
+    vector<struct frame_decoder> decs;
+    struct  cap_reader rd;
+    struct  cap_rec rec;
+    struct  rp_event e;
+    struct  rp_sess* c;
+    struct  stat st;
+    void*   data;
+    size_t  i;
+    int     fd, rc;
+    
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror("chatreplay: can't open the capture.\n");
+        return -1;
+    }
+    if (st.st_size == 0
+        || (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        printf("chatreplay: %s is empty or can't be mapped.\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    
+    cap_reader_init(&rd, (const char*) data, st.st_size);
+    while ((rc = cap_next(&rd, &rec)) == 1) {
+        // process and shard/serial #, a shard serves fewer than 2^48 sessions
+        key = make_pair(rec.start, ((uint64_t) rec.shard << 48) | rec.serial);
+        if ((it = ids.find(key)) == ids.end()) {
+            c = new rp_sess();
+            c->fd = -1;
+            c->state = RP_NEW;
+            c->probe = 0;
+            c->ready = 0;
+            c->r = r;
+            dec_init(&c->dec);
+            it = ids.insert(make_pair(key, (int) r->sess.size())).first;
+            r->sess.push_back(c);
+            decs.push_back(frame_decoder());
+            dec_init(&decs.back());
+        }
+        
+        e.when = rec.when;
+        e.kind = rec.kind;
+        e.sess = it->second;
+        e.data = rec.data;
+        e.len = rec.len;
+        r->events.push_back(e);
+        
+        if (rec.kind == CAP_DATA)
+            dec_feed(&decs[e.sess], rec.data, rec.len, replay_frame_count, r);
+    }
+    
+    for (i = 0; i < decs.size(); i++)
+        dec_free(&decs[i]);
+    
+    if (rc < 0 || r->events.empty()) {
+        printf("chatreplay: %s is %s.\n", path, rc < 0 ? "corrupt" : "empty");
+        return -1;
+    }
+    
+    stable_sort(r->events.begin(), r->events.end(), event_earlier);
+    r->trace_secs = (r->events.back().when - r->events.front().when) / 1e9;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_frame_count
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int replay_frame_count(void* arg, const struct frame* f)
+--              void* arg: the replay
+--              const struct frame* f: a frame of the capture
+-- 
+-- RETURNS:     always 0 to keep decoding
+-- 
+-- NOTES:
+-- This function is called for every frame the capture's sessions sent.
+------------------------------------------------------------------------------*/
+int replay_frame_count(void* arg, const struct frame* f)
+{
+    ((struct replay*) arg)->frames++;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_probes
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int replay_probes(struct replay* r)
+--              struct replay* r: the replay
+-- 
+-- RETURNS:     0 on success, -1 if the server cannot be reached
+-- 
+-- NOTES:
+-- This function is called before the replay to connect the two probe
+-- clients and put them in PROBE_ROOM. It waits for both "/join"s to be
+-- confirmed. Without probes only the server is checked for.
+------------------------------------------------------------------------------*/
+int replay_probes(struct replay* r)
+{
+    char    line[BUF_SIZE];
+    char    out[FRAME_HDR_SIZE + BUF_SIZE];
+    uint64_t deadline;
+    int     i, n;
+    
+    for (i = 0; i < 2; i++) {
+        r->probe[i] = new rp_sess();
+        r->probe[i]->fd = -1;
+        r->probe[i]->state = RP_NEW;
+        r->probe[i]->probe = 1;
+        r->probe[i]->ready = 0;
+        r->probe[i]->r = r;
+        dec_init(&r->probe[i]->dec);
+        
+        if (replay_connect(r, r->probe[i]) != 0) {
+            printf("chatreplay: can't connect to %s:%d.\n", r->host, r->port);
+            return -1;
+        }
+        if (r->probe_rate == 0)
+            continue;
+        
+        snprintf(line, sizeof(line), "/replay-probe%d", i);
+        n = frame_encode(out, sizeof(out), FRAME_TEXT, 0, line, strlen(line));
+        r->probe[i]->out.append(out, n);
+        snprintf(line, sizeof(line), "/join %s\n", PROBE_ROOM);
+        n = frame_encode(out, sizeof(out), FRAME_TEXT, 0, line, strlen(line));
+        r->probe[i]->out.append(out, n);
+        replay_flush(r, r->probe[i]);
+    }
+    
+    deadline = now_ns() + 10000000000ULL;
+    while (r->probe_rate > 0 && !(r->probe[0]->ready && r->probe[1]->ready)) {
+        if (now_ns() > deadline) {
+            printf("chatreplay: the probes could not join %s.\n", PROBE_ROOM);
+            return -1;
+        }
+        replay_poll(r, 50);
+    }
+    
+    // the join notices must not count as traffic
+    deadline = now_ns() + 200000000ULL;
+    while (now_ns() < deadline)
+        replay_poll(r, 20);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_run
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_run(struct replay* r)
+--              struct replay* r: the replay
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to play the events on the capture's clock,
+-- scaled by the speed. The events that are due are sent in one go after
+-- each poll, so the replay holds its pace when the loop wakes up late;
+-- how late is kept as lag_max. At full speed RP_BATCH events go between
+-- polls. The replay ends when the sessions have received nothing for
+-- RP_DRAIN_MS after the last event, and took until the last delivery: at
+-- full speed the server is still working long after the last send.
+------------------------------------------------------------------------------*/
+void replay_run(struct replay* r)
+{
+    char    line[BUF_SIZE];
+    char    out[FRAME_HDR_SIZE + BUF_SIZE];
+    uint64_t start = now_ns();
+    uint64_t t0 = r->events.front().when;
+    uint64_t now, at, probe_due, sent_at;
+    int64_t wait;
+    size_t  next = 0, batch;
+    int     n;
+    
+    while (next < r->events.size()) {
+        now = now_ns();
+        
+        for (batch = 0; next < r->events.size(); next++, batch++) {
+            if (r->speed > 0) {
+                at = start + (uint64_t) ((r->events[next].when - t0) / r->speed);
+                if (at > now)
+                    break;
+                if (now - at > r->lag_max)
+                    r->lag_max = now - at;
+            } else if (batch == RP_BATCH) {
+                break;
+            }
+            replay_event(r, &r->events[next]);
+        }
+        
+        // probes at their own rate
+        probe_due = (r->probe_rate > 0)
+                    ? (uint64_t) ((double) (now - start) * r->probe_rate / 1e9) : 0;
+        while (r->probes < probe_due) {
+            snprintf(line, sizeof(line), "%s%llu\n", PROBE_TAG,
+                     (unsigned long long) now_ns());
+            n = frame_encode(out, sizeof(out), FRAME_TEXT, 0, line, strlen(line));
+            r->probe[0]->out.append(out, n);
+            replay_flush(r, r->probe[0]);
+            r->probes++;
+        }
+        
+        wait = 0;
+        if (r->speed > 0 && next < r->events.size()) {
+            at = start + (uint64_t) ((r->events[next].when - t0) / r->speed);
+            wait = (at > now_ns()) ? (int64_t) ((at - now_ns()) / 1000000) : 0;
+            if (wait > 1) wait = 1;
+        }
+        replay_poll(r, (int) wait);
+    }
+    
+    sent_at = now_ns();
+    do {
+        replay_poll(r, 50);
+        now = now_ns();
+    } while (now - max(sent_at, r->last_recv) < RP_DRAIN_MS * 1000000ULL);
+    
+    r->replay_secs = (max(sent_at, r->last_recv) - start) / 1e9;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_event
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_event(struct replay* r, const struct rp_event* e)
+--              struct replay* r: the replay
+--              const struct rp_event* e: the event that is due
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to play one event. The bytes of a session that
+-- could not connect, or that the server dropped, go nowhere.
+------------------------------------------------------------------------------*/
+void replay_event(struct replay* r, const struct rp_event* e)
+{
+    struct rp_sess* c = r->sess[e->sess];
+    
+    if (c->state == RP_NEW && replay_connect(r, c) != 0) {
+        c->state = RP_DONE;
+        r->errors++;
+        return;
+    }
+    
+    switch (e->kind) {
+    case CAP_DATA:
+        if (c->state == RP_OPEN) {
+            c->out.append(e->data, e->len);
+            replay_flush(r, c);
+        }
+        break;
+    
+    case CAP_CLOSE:
+        if (c->state == RP_OPEN) {
+            c->state = RP_CLOSING;
+            replay_flush(r, c);
+        }
+        break;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_poll
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_poll(struct replay* r, int timeout)
+--              struct replay* r: the replay
+--              int timeout: milliseconds to wait for events
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to handle one batch of socket events.
+------------------------------------------------------------------------------*/
+void replay_poll(struct replay* r, int timeout)
+{
+    struct  epoll_event events[MAX_EVENTS];
+    struct  rp_sess* c;
+    int     n, i;
+    
+    n = epoll_wait(r->epfd, events, MAX_EVENTS, timeout);
+    
+    for (i = 0; i < n; i++) {
+        c = (struct rp_sess*) events[i].data.ptr;
+        
+        if (events[i].events & EPOLLOUT)
+            replay_flush(r, c);
+        
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            replay_read(r, c);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_read
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_read(struct replay* r, struct rp_sess* c)
+--              struct replay* r: the replay
+--              struct rp_sess* c: the readable session
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to read until EAGAIN and decode the frames. A
+-- session the server closes before the capture did counts as dropped.
+------------------------------------------------------------------------------*/
+void replay_read(struct replay* r, struct rp_sess* c)
+{
+    char    rbuf[READ_SIZE];
+    int     n;
+    
+    while (c->fd >= 0) {
+        n = read(c->fd, rbuf, sizeof(rbuf));
+        
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        
+        if (n <= 0 || dec_feed(&c->dec, rbuf, n, replay_frame, c) < 0) {
+            if (c->state == RP_OPEN && !c->probe)
+                r->dropped++;
+            replay_close(r, c);
+            return;
+        }
+        
+        if (!c->probe) {
+            r->recv_bytes += n;
+            r->last_recv = now_ns();
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_frame
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int replay_frame(void* arg, const struct frame* f)
+--              void* arg: the session the frame was received by
+--              const struct frame* f: the frame
+-- 
+-- RETURNS:     always 0 to keep decoding
+-- 
+-- NOTES:
+-- This function is called for each frame a session receives. The
+-- sessions only count them. The probe clients answer pings, note the
+-- confirmation of their "/join" and time the probe messages.
+------------------------------------------------------------------------------*/
+int replay_frame(void* arg, const struct frame* f)
+{
+    struct  rp_sess* c = (struct rp_sess*) arg;
+    struct  replay* r = c->r;
+    char    line[BUF_SIZE];
+    char*   p;
+    unsigned long long sent;
+    uint64_t now = now_ns();
+    size_t  len;
+    
+    if (!c->probe) {
+        r->recv++;
+        return 0;
+    }
+    
+    if (f->type == FRAME_PING) {
+        frame_header(line, FRAME_PONG, 0, 0);
+        c->out.append(line, FRAME_HDR_SIZE);
+        replay_flush(r, c);
+        return 0;
+    }
+    
+    if (f->type != FRAME_TEXT)
+        return 0;
+    
+    len = (f->length < BUF_SIZE) ? f->length : BUF_SIZE - 1;
+    memcpy(line, f->payload, len);
+    line[len] = '\0';
+    
+    if ((p = strstr(line, PROBE_TAG)) != NULL) {
+        if (sscanf(p + strlen(PROBE_TAG), "%llu", &sent) == 1 && now >= sent)
+            r->lat.push_back((uint32_t) ((now - sent) / 1000));
+    } else if (!c->ready && strstr(line, "Now talking in") != NULL) {
+        c->ready = 1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_flush(struct replay* r, struct rp_sess* c)
+--              struct replay* r: the replay
+--              struct rp_sess* c: the session
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to write the session's pending bytes. Once a
+-- session closed by the capture has sent everything, its side of the
+-- connection is shut down; it is closed when the server closes its side.
+------------------------------------------------------------------------------*/
+void replay_flush(struct replay* r, struct rp_sess* c)
+{
+    ssize_t n;
+    
+    while (c->fd >= 0 && !c->out.empty()) {
+        n = send(c->fd, c->out.data(), c->out.size(), MSG_NOSIGNAL);
+        
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                if (c->state == RP_OPEN && !c->probe)
+                    r->dropped++;
+                replay_close(r, c);
+            }
+            return;
+        }
+        
+        if (!c->probe)
+            r->sent += n;
+        c->out.erase(0, n);
+    }
+    
+    if (c->fd >= 0 && c->state == RP_CLOSING && c->out.empty())
+        shutdown(c->fd, SHUT_WR);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_close
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_close(struct replay* r, struct rp_sess* c)
+--              struct replay* r: the replay
+--              struct rp_sess* c: the session
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once the server has closed a session.
+------------------------------------------------------------------------------*/
+void replay_close(struct replay* r, struct rp_sess* c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->state = RP_DONE;
+    c->out.clear();
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_connect
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int replay_connect(struct replay* r, struct rp_sess* c)
+--              struct replay* r: the replay
+--              struct rp_sess* c: the session to open
+-- 
+-- RETURNS:     0 on success, -1 if the connection failed
+-- 
+-- NOTES:
+-- This function is called to connect a session. The connect itself
+-- blocks, which takes no time against a local server, then the socket is
+-- made non-blocking and watched.
+------------------------------------------------------------------------------*/
+int replay_connect(struct replay* r, struct rp_sess* c)
+{
+    struct  sockaddr_in addr;
+    struct  epoll_event ev;
+    int     fd;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(r->host);
+    addr.sin_port = htons(r->port);
+    
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+        || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev);
+    
+    c->fd = fd;
+    c->state = RP_OPEN;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_report
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void replay_report(struct replay* r)
+--              struct replay* r: the replay
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to print the results as one JSON object. With
+-- a baseline, "delta_pct" holds the change of each main figure in
+-- percent of the baseline's; a figure the baseline lacks is left out.
+------------------------------------------------------------------------------*/
+void replay_report(struct replay* r)
+{
+    static const char* keys[] = { "replay_secs", "sent_per_sec", "recv_per_sec",
+                                  "p50_us", "p99_us", "p999_us", "max_us" };
+    vector<uint32_t>& lat = r->lat;
+    uint32_t pct[3] = { 0, 0, 0 }, worst = 0;
+    double  q[3] = { 0.5, 0.99, 0.999 };
+    double  secs = (r->replay_secs > 0) ? r->replay_secs : 1e-9;
+    double  cur[7], base;
+    int     i, first = 1;
+    
+    if (!lat.empty()) {
+        sort(lat.begin(), lat.end());
+        for (i = 0; i < 3; i++)
+            pct[i] = lat[(size_t) (q[i] * (lat.size() - 1))];
+        worst = lat.back();
+    }
+    
+    cur[0] = r->replay_secs;
+    cur[1] = r->frames / secs;
+    cur[2] = r->recv / secs;
+    cur[3] = pct[0];
+    cur[4] = pct[1];
+    cur[5] = pct[2];
+    cur[6] = worst;
+    
+    printf("{\"sessions\": %d, \"records\": %d, \"speed\": %g, "
+           "\"trace_secs\": %.3f, \"replay_secs\": %.3f, "
+           "\"frames\": %llu, \"sent_bytes\": %llu, \"sent_per_sec\": %.1f, "
+           "\"recv\": %llu, \"recv_bytes\": %llu, \"recv_per_sec\": %.1f, "
+           "\"dropped\": %llu, \"errors\": %llu, \"lag_max_ms\": %.3f, "
+           "\"probes\": %llu, \"p50_us\": %u, \"p99_us\": %u, \"p999_us\": %u, "
+           "\"max_us\": %u",
+           (int) r->sess.size(), (int) r->events.size(), r->speed,
+           r->trace_secs, r->replay_secs,
+           (unsigned long long) r->frames, (unsigned long long) r->sent, cur[1],
+           (unsigned long long) r->recv, (unsigned long long) r->recv_bytes, cur[2],
+           (unsigned long long) r->dropped, (unsigned long long) r->errors,
+           r->lag_max / 1e6, (unsigned long long) lat.size(),
+           pct[0], pct[1], pct[2], worst);
+    
+    if (r->baseline != NULL) {
+        printf(", \"delta_pct\": {");
+        for (i = 0; i < 7; i++) {
+            if (replay_baseline(r->baseline, keys[i], &base) != 0 || base == 0)
+                continue;
+            printf("%s\"%s\": %.1f", first ? "" : ", ", keys[i],
+                   (cur[i] - base) * 100 / base);
+            first = 0;
+        }
+        printf("}");
+    }
+    
+    printf("}\n");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    replay_baseline
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int replay_baseline(const char* path, const char* key,
+--                                  double* v)
+--              const char* path: JSON output of an earlier run
+--              const char* key: the figure to look up
+--              double* v: receives its value
+-- 
+-- RETURNS:     0 on success, -1 if the file or the figure is missing
+-- 
+-- NOTES:
+-- This function is called for every figure compared. It only needs to
+-- read what replay_report() prints: the first "key": is the top-level
+-- one, the baseline's own "delta_pct" comes last.
+------------------------------------------------------------------------------*/
+int replay_baseline(const char* path, const char* key, double* v)
+{
+    ifstream in(path);
+    string  text, pat;
+    size_t  at;
+    
+    if (!in)
+        return -1;
+    getline(in, text, '\0');
+    
+    pat = string("\"") + key + "\":";
+    if ((at = text.find(pat)) == string::npos)
+        return -1;
+    
+    *v = atof(text.c_str() + at + pat.size());
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    now_ns
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   uint64_t now_ns()
+-- 
+-- RETURNS:     the monotonic clock in nanoseconds
+-- 
+-- NOTES:
+-- This function is called to time the replay.
+------------------------------------------------------------------------------*/
+uint64_t now_ns()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
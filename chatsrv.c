@@ -6,20 +6,138 @@
 -- 
 -- PROGRAM:     chatsrv
 -- 
--- FUNCTIONS:   int main(void)
---              int init_srv(int port);
---              int max(int a, int b);
---              int user_free(int user_link[MAX_CLIENT]);
---              char* get_hostname(const char*);
+-- FUNCTIONS:   int main(int argc, char* argv[])
+--              void* srv_loop(void* arg);
+--              int init_srv(int port, int reuseport);
+--              int init_server(struct server* srv, int id);
+--              int set_nonblock(int fd);
+--              void srv_resolved(struct server* srv);
 --              void signal_srv(int signo);
---              void add_name(char* line, const char* name, int);
---              void set_name(char* line, char* name);
---              void remove_name(char* line, const char* name);
---              void add_sockset(fd_set* sockset, int sockfd, int* userfd, 
---                               const int* usrlink);
+--              void set_name(const char* line, char* name);
+--              void srv_accept(struct server* srv);
+--              void srv_admit(struct server* srv, int fd,
+--                             const struct sockaddr_in* addr);
+--              void srv_refuse(int fd, const char* why);
+--              int srv_shed(struct server* srv);
+--              struct session* sess_new(struct server* srv);
+--              void sess_free(struct server* srv, struct session* s);
+--              void srv_read(struct server* srv, struct session* s);
+--              int srv_input(struct server* srv, struct session* s,
+--                            const char* data, size_t len);
+--              int srv_frame(void* arg, const struct frame* f);
+--              void srv_close(struct server* srv, struct session* s);
+--              int srv_command(struct server* srv, struct session* s,
+--                              char* line);
+--              void broadcast_mb(struct server* srv, struct session* sender,
+--                                struct room_info* ri, struct msgbuf* mb,
+--                                int kind);
+--              void broadcast_from(struct server* srv,
+--                                  const struct sess_ref* from,
+--                                  const char* nick, struct room_info* ri,
+--                                  struct msgbuf* mb, int kind);
+--              void broadcast_peer(const char* room, const char* text,
+--                                  int len);
+--              void srv_fanout(struct server* srv, struct msgbuf* mb,
+--                              const struct sess_ref* from,
+--                              struct room_info* ri);
+--              void shard_post(struct server* dst, struct shard_msg* m);
+--              void srv_inbox(struct server* srv);
+--              void sess_send(struct server* srv, struct session* s,
+--                             struct msgbuf* mb, const struct sess_ref* from);
+--              void sess_flush(struct server* srv, struct session* s);
+--              void sess_dirty(struct server* srv, struct session* s);
+--              int sess_sendfile(struct server* srv, struct session* s);
+--              void sess_congested(struct server* srv, struct session* s,
+--                                  const struct sess_ref* from);
+--              void sess_release(struct server* srv, struct session* s);
+--              void sess_kill(struct server* srv, struct session* s);
+--              void sess_reply(struct server* srv, struct session* s,
+--                              const char* line);
+--              void sess_replay(struct server* srv, struct session* s,
+--                               struct room_info* ri);
+--              int sess_history(struct server* srv, struct session* s,
+--                               uint64_t after);
+--              int sess_reads(void* arg, uint64_t room);
+--              void sess_resume(struct server* srv, struct session* s,
+--                               char* line);
+--              void sess_decorate(struct session* s);
+--              struct msgbuf* sess_format(struct session* s,
+--                                         struct room_info* ri,
+--                                         const char* text, size_t len);
+--              void sess_throttle(struct server* srv, struct session* s,
+--                                 size_t len);
+--              void sess_yield(struct server* srv, struct session* s);
+--              struct room* sess_join(struct server* srv, struct session* s,
+--                                     struct room_info* ri);
+--              void sess_part(struct server* srv, struct session* s,
+--                             struct room* r);
+--              void sess_named(struct server* srv, struct session* s);
+--              void sess_presence(struct server* srv, struct session* s,
+--                                 struct room_info* ri, int join);
+--              void srv_presence(struct server* srv);
+--              void srv_announce(struct server* srv, struct presence* p);
+--              struct session* sess_lookup(struct server* srv,
+--                                          struct sess_ref ref);
+--              void srv_wake(struct server* srv);
+--              int64_t srv_timeout(struct server* srv);
+--              int srv_flush_due(struct server* srv);
+--              void srv_flush(struct server* srv);
+--              void srv_timer(void* arg, struct tw_timer* t);
+--              void sess_timeout(struct server* srv, struct session* s);
+--              void srv_reap(struct server* srv);
+--              void srv_quiesce(struct server* srv);
+--              void srv_handoff(struct server* srv);
+--              void srv_adopt(struct server* srv);
+--              int parse_policy(const char* name);
 -- 
 -- DATE:        March 11, 2017
 -- 
+-- REVISIONS:   October 16, 2026 - replaced the select() loop and fixed client
+--              arrays with an epoll edge-triggered reactor and a session
+--              table sized at runtime.
+--              October 16, 2026 - length-prefixed frames (see frame.h).
+--              October 16, 2026 - non-blocking output queues (see outq.h)
+--              with a congestion policy for slow consumers.
+--              October 16, 2026 - broadcasts are encoded once into a shared
+--              message buffer (see msgbuf.h).
+--              October 16, 2026 - reverse DNS moved off the event loop (see
+--              resolver.h).
+--              October 16, 2026 - one event loop (shard) per thread with
+--              --threads, cross-shard broadcasts through lock-free queues.
+--              October 16, 2026 - rooms (/join, /part, /rooms), messages
+--              only visit the members of the sender's room.
+--              October 16, 2026 - metrics served on a stats socket (see
+--              stats.h).
+--              October 16, 2026 - io_uring backend with --io uring (see
+--              srv_uring.c).
+--              October 16, 2026 - room scrollback replayed on joining (see
+--              scrollback.h).
+--              October 16, 2026 - message journal with --journal, /history
+--              streams it (see journal.h).
+--              October 16, 2026 - sessions recycled through a per-shard free
+--              list, the client info lives in the session instead of usermap.
+--              October 16, 2026 - chat messages are assembled from prefixes
+--              and suffixes built once per session (see sess_format()).
+--              October 16, 2026 - per-client rate limits with --rate-msgs
+--              and --rate-bytes, a read budget per loop iteration.
+--              October 16, 2026 - output coalescing with --coalesce.
+--              October 16, 2026 - heartbeats, handshake and idle deadlines
+--              kept in a timer wheel per shard (see twheel.h).
+--              October 16, 2026 - hot upgrade with --upgrade, the sockets
+--              and sessions are handed to the new process (see handoff.h).
+--              October 16, 2026 - journaled messages carry their id,
+--              "/resume" brings a reconnecting client back where it was.
+--              October 16, 2026 - admission control: accepts in batches,
+--              --backlog, --accept-rate and --ip-rate, refusals are told why.
+--              October 16, 2026 - federation with --federate and --peer, one
+--              conversation spans several servers (see peer.h).
+--              October 16, 2026 - local clients attach through shared
+--              memory rings with --shm (see srv_shm.c).
+--              October 16, 2026 - traffic capture with --capture, played
+--              back by chatreplay (see capture.h).
+--              October 16, 2026 - /who from a roster kept per room, joins
+--              and leaves announced in batches.
+-- 
 -- DESIGNER:    Fred Yang, Maitiu Morton
 -- 
 -- PROGRAMMER:  Fred Yang, Maitiu Morton
@@ -30,163 +148,624 @@
 -- console.
 -- The server echoes the text strings it receives from each client to all other
 -- clients except the one that sent it.
+-- The event loop is driven by epoll in edge-triggered mode, so each wakeup
+-- only touches the descriptors that are ready. Sessions are looked up by fd
+-- in a table sized from RLIMIT_NOFILE and kept in a dense client list.
+-- They are carved from slabs of SESS_SLAB and recycled through a free
+-- list, so once a shard has seen its peak number of clients, accepting
+-- and closing a connection allocates nothing.
+-- Writes never block. Whatever a client socket does not take is queued and
+-- flushed when epoll reports the socket writable. Once a queue grows past
+-- the high-water mark the congestion policy either drops the oldest queued
+-- messages, disconnects the slow client, or stops reading from the senders
+-- until the queue drains below the low-water mark.
+-- With --threads N the server runs N shards, each an independent event loop
+-- on its own thread with its own SO_REUSEPORT listening socket, so the
+-- kernel spreads new connections over the shards and a session stays on
+-- the shard that accepted it. A shard fans a broadcast out to its own
+-- clients and posts the shared buffer to every other shard's lock-free
+-- inbox; no lock is taken on the message path.
+-- Clients talk in rooms. Everyone starts in the default room, "/join name"
+-- joins or switches to a room, "/part [name]" leaves it and "/rooms" lists
+-- the rooms in use. Each shard indexes the members of its rooms in
+-- contiguous arrays, so a message costs one visit per member of the room,
+-- and it is only forwarded to the shards that have members in it. Each
+-- room keeps its last --history messages, a client gets them in one write
+-- when it sets its name and when it joins a room.
+-- With --io uring a shard is driven by io_uring completions instead of
+-- epoll readiness (see srv_uring.c); the session, room and broadcast code
+-- is shared, only reading and writing the sockets differ.
+-- With --journal every broadcast is also appended to an on-disk journal by
+-- a writer thread. "/history id" sends a client the journaled messages
+-- after that id straight from the segment files with sendfile(); messages
+-- queued for the client meanwhile are held behind it. The frames of
+-- journaled messages carry their id (FRAME_F_ID), and a client that lost
+-- its connection sends "/resume id nickname rooms..." instead of its
+-- nickname: it joins its rooms again without their scrollback and gets
+-- the messages after id from the journal, only what it missed.
+-- A client is handled for at most READ_BUDGET frames per loop iteration,
+-- then it yields until the next one, so a busy client cannot hold the loop
+-- while the others wait. With --rate-msgs and --rate-bytes every client
+-- also gets token buckets; one that goes over its rate is not read again
+-- until it is back under it, and is told so at most every THROTTLE_NOTICE
+-- seconds. Both only pause the session, what it sent meanwhile waits in
+-- the socket or the decoder.
+-- By default a message is written to a client as soon as it is sent. With
+-- --coalesce N the messages a client gets are queued instead and written
+-- together with one writev() once N microseconds have passed, or at the
+-- end of the loop iteration with N = 0. Busy rooms then cost one system
+-- call and a few packets per client and window instead of per message,
+-- for at most N microseconds of added latency.
+-- Every session has one timer in its shard's timer wheel, set to its next
+-- deadline: a client that gave no nickname within --handshake seconds, or
+-- did not talk for --idle seconds, is dropped; one silent for --ping
+-- seconds gets a FRAME_PING and is dropped as a dead peer if nothing comes
+-- back within --ping-timeout seconds. Frames only note the current tick in
+-- the session; the deadline is worked out again when the timer fires.
+-- With --upgrade path a new server can replace a running one without
+-- dropping anybody: started with the same --upgrade path, or by the old
+-- one on SIGUSR2, it receives the listening sockets and every client
+-- socket with its session from the old server, which then exits (see
+-- handoff.c). The clients keep their connections, nicknames and rooms.
+-- Connections are accepted ACCEPT_BATCH at a time, the rest of a burst
+-- waits for the next loop iteration instead of starving the clients
+-- already in. --backlog sets the accept queue. A connection over
+-- --max-clients, --accept-rate or --ip-rate (see admit.h) gets a reply
+-- telling why and is closed at once; one that comes while the process is
+-- out of descriptors is shed the same way with a spare descriptor kept
+-- for it, so it does not sit in the queue.
+-- Several servers can hold one conversation: each one started with
+-- --federate port takes links from the others, --peer host:port (given
+-- as many times as needed) links to one. Every broadcast, join and leave
+-- is relayed to the other servers, which deliver it to their members of
+-- the room (see peer.c). A server only carries its own clients plus one
+-- record per message and link, so adding a server adds its capacity. The
+-- federation port trusts whoever connects; it is meant for the servers'
+-- own network.
+-- With --shm path, programs on the same host (bots, bridges) can attach
+-- through a Unix domain socket at path and exchange frames with the
+-- server over a pair of shared-memory rings instead of TCP (see
+-- shmring.h). They are sessions like the others; a message reaches them
+-- with a memcpy() and wakes them only if they sleep.
+-- With --capture file every session opened and closed and every run of
+-- bytes received is appended to file with its time (see capture.h);
+-- chatreplay plays such a capture against a server, as recorded or
+-- faster, to compare builds on real traffic. The capture holds what the
+-- clients typed, it is meant for test and staging servers.
+-- Every room keeps a roster of the nicknames in it on any shard (see
+-- room.h), and /who is answered with a reply framed once per change of
+-- the roster and shared by every /who after it. Joins and leaves,
+-- disconnects included, are announced as the nicknames that changed, not
+-- as lists, and a shard gathers them over a loop iteration into one
+-- notice per room; a storm of joins costs each member one notice per
+-- iteration instead of one per join.
 --
 ------------------------------------------------------------------------------*/
 
 #include "common.h"
 using namespace std;
 
+int srv_sockfd;                             // server socket file descriptor
+char default_host[MAX_NAME] = "datacomm";   // default host name
+struct srv_config cfg;                      // server settings
+struct server** shards;                     // one event loop per thread
+int nshards;                                // # of shards
+struct room_info* default_room;             // room every client starts in
+struct journal* journal;                    // message journal, or NULL
+
+// orders srv->throttled as a min-heap on the deadline
+static bool timer_later(const struct sess_timer& a, const struct sess_timer& b)
+{
+    return a.when > b.when;
+}
+
+// bytes of one "a, b join #room..." line of a notice, as srv_announce() writes it
+static size_t notice_line(size_t names, const char* verb, size_t room)
+{
+    return names == 0 ? 0 : sizeof(MAG "..." RESET "\n") - 1 + names + strlen(verb) + room;
+}
+
+static struct option long_opts[] = {
+    { "port",        required_argument, NULL, 'p' },
+    { "max-clients", required_argument, NULL, 'm' },
+    { "policy",      required_argument, NULL, 'b' },
+    { "high-water",  required_argument, NULL, 'w' },
+    { "resolvers",   required_argument, NULL, 'r' },
+    { "threads",     required_argument, NULL, 't' },
+    { "stats",       required_argument, NULL, 'S' },
+    { "io",          required_argument, NULL, 'i' },
+    { "history",     required_argument, NULL, 'H' },
+    { "history-secs", required_argument, NULL, 'T' },
+    { "journal",     required_argument, NULL, 'J' },
+    { "rate-msgs",   required_argument, NULL, 'R' },
+    { "rate-bytes",  required_argument, NULL, 'B' },
+    { "coalesce",    required_argument, NULL, 'C' },
+    { "ping",        required_argument, NULL, 'P' },
+    { "ping-timeout", required_argument, NULL, 'D' },
+    { "handshake",   required_argument, NULL, 'E' },
+    { "idle",        required_argument, NULL, 'I' },
+    { "upgrade",     required_argument, NULL, 'U' },
+    { "backlog",     required_argument, NULL, 'L' },
+    { "accept-rate", required_argument, NULL, 'A' },
+    { "ip-rate",     required_argument, NULL, 'a' },
+    { "federate",    required_argument, NULL, 'F' },
+    { "peer",        required_argument, NULL, 'N' },
+    { "shm",         required_argument, NULL, 'M' },
+    { "capture",     required_argument, NULL, 'K' },
+    { NULL, 0, NULL, 0 }
+};
+
 /*------------------------------------------------------------------------------
 -- FUNCTION:    main
 -- 
 -- DATE:        March 11, 2017
 -- 
+-- REVISIONS:   October 16, 2026 - epoll event loop, command line options.
+-- 
 -- DESIGNER:    Fred Yang, Maitiu Morton
 -- 
 -- PROGRAMMER:  Fred Yang, Maitiu Morton
 --
--- INTERFACE:   int main(void) 
+-- INTERFACE:   int main(int argc, char* argv[])
+--              int argc: the number of arguments input
+--              char* argv[]: the list of arguments input
 -- 
 -- RETURNS:     return zero if it exits normally, otherwise return a 
 --              non-zero value
 -- 
 -- NOTES: 
 -- Main entry of the program.
---
+-- Usage: chatsrv [-p port] [-m max_clients] [-b drop|disconnect|pause]
+--                [-w high_water_bytes] [-r resolver_threads] [-t threads]
+--                [-S stats_socket] [-i epoll|uring] [-H history_msgs]
+--                [-T history_secs] [-J journal_dir] [-R msgs_per_sec]
+--                [-B bytes_per_sec] [-C coalesce_usecs] [-P ping_secs]
+--                [-D ping_timeout_secs] [-E handshake_secs] [-I idle_secs]
+--                [-U upgrade_socket] [-L backlog] [-A conns_per_sec]
+--                [-a conns_per_sec_per_ip] [-F federation_port]
+--                [-N host:port]... [-M shm_socket] [-K capture_file]
+-- With --upgrade the server first tries to take over from one already
+-- running on that socket, and listens on it for its own successor.
 ------------------------------------------------------------------------------*/
-int main(void)
+int main(int argc, char* argv[])
 {
-    int     sockfd;                 // socket file descriptor
-    int     newsockfd;              // socket file descriptor for new connection
-    int     userlink[MAX_CLIENT];   // array that stores client connect status
-    int     userfd[MAX_CLIENT];     // array that stores client connect fd
-    char    userinfo[MAX_NAME];     // hostname:ip:fd
-    char    username[MAX_CLIENT][MAX_NAME];// user nickname
-    char    line[BUF_SIZE];         // temporary line (message)
-    char    ipbuf[IP_SIZE];         // stores client ip address
-    int     userindex;              // first index of userlink with value=0
-    int     length, i, j;           // temporary variables
-    int     maxfd = 0;              // maximum file descriptor
-    unsigned int cli_len;           // size of sockaddr_in struct
-    struct  sockaddr_in cli_addr;   // socketaddr_in struct
-    fd_set  sockset;                // fd set
+    pthread_t tid;                      // shard thread
+    struct  ho_state ho;                // what the server taken over handed over
+    long    hwm = DEFAULT_HWM;          // output queue high-water mark
+    size_t  k;                          // session handed over
+    int     peerfd = -1;                // --federate socket
+    int     opt, i;                     // temporary variables
+    
+    cfg.port = TCP_PORT;
+    cfg.maxclients = 0;
+    cfg.policy = POLICY_DROP;
+    cfg.nresolvers = RES_THREADS;
+    cfg.nthreads = 1;
+    cfg.stats_path = NULL;
+    cfg.io = DEFAULT_IO;
+    cfg.history = SB_DEFAULT_MSGS;
+    cfg.history_secs = 0;
+    cfg.journal_path = NULL;
+    cfg.rate_msgs = 0;
+    cfg.rate_bytes = 0;
+    cfg.coalesce = -1;
+    cfg.ping_secs = DEFAULT_PING;
+    cfg.pong_secs = DEFAULT_PONG;
+    cfg.handshake_secs = DEFAULT_HANDSHAKE;
+    cfg.idle_secs = 0;
+    cfg.upgrade_path = NULL;
+    cfg.backlog = DEFAULT_BACKLOG;
+    cfg.accept_rate = 0;
+    cfg.ip_rate = 0;
+    cfg.peer_port = 0;
+    cfg.capture_path = NULL;
     
-    // call signal_srv() on SIGINT
+    while ((opt = getopt_long(argc, argv, "p:m:b:w:r:t:S:i:H:T:J:R:B:C:P:D:E:I:U:L:A:a:F:N:M:K:",
+                              long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            cfg.port = atoi(optarg);
+            break;
+        case 'm':
+            cfg.maxclients = atoi(optarg);
+            break;
+        case 'b':
+            if ((cfg.policy = parse_policy(optarg)) < 0) {
+                printf("Unknown policy %s\n", optarg);
+                return ERROR_EXIT;
+            }
+            break;
+        case 'w':
+            hwm = atol(optarg);
+            break;
+        case 'r':
+            cfg.nresolvers = atoi(optarg);
+            break;
+        case 't':
+            cfg.nthreads = atoi(optarg);
+            break;
+        case 'S':
+            cfg.stats_path = optarg;
+            break;
+        case 'i':
+            if (strcmp(optarg, "epoll") == 0) {
+                cfg.io = IO_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                cfg.io = IO_URING;
+            } else {
+                printf("Unknown I/O backend %s\n", optarg);
+                return ERROR_EXIT;
+            }
+            break;
+        case 'H':
+            cfg.history = atoi(optarg);
+            break;
+        case 'T':
+            cfg.history_secs = atoi(optarg);
+            break;
+        case 'J':
+            cfg.journal_path = optarg;
+            break;
+        case 'R':
+            cfg.rate_msgs = atof(optarg);
+            break;
+        case 'B':
+            cfg.rate_bytes = atof(optarg);
+            break;
+        case 'C':
+            cfg.coalesce = atoi(optarg);
+            break;
+        case 'P':
+            cfg.ping_secs = atoi(optarg);
+            break;
+        case 'D':
+            cfg.pong_secs = atoi(optarg);
+            break;
+        case 'E':
+            cfg.handshake_secs = atoi(optarg);
+            break;
+        case 'I':
+            cfg.idle_secs = atoi(optarg);
+            break;
+        case 'U':
+            cfg.upgrade_path = optarg;
+            break;
+        case 'L':
+            cfg.backlog = atoi(optarg);
+            break;
+        case 'A':
+            cfg.accept_rate = atof(optarg);
+            break;
+        case 'a':
+            cfg.ip_rate = atof(optarg);
+            break;
+        case 'F':
+            cfg.peer_port = atoi(optarg);
+            break;
+        case 'N':
+            if (peer_add(optarg) != 0) {
+                printf("Bad peer %s, expected host:port\n", optarg);
+                return ERROR_EXIT;
+            }
+            break;
+        case 'M':
+            cfg.shm_path = optarg;
+            break;
+        case 'K':
+            cfg.capture_path = optarg;
+            break;
+        default:
+            printf("Usage: %s [-p port] [-m max_clients] "
+                   "[-b drop|disconnect|pause] [-w high_water_bytes] "
+                   "[-r resolver_threads] [-t threads] [-S stats_socket] "
+                   "[-i epoll|uring] [-H history_msgs] [-T history_secs] "
+                   "[-J journal_dir] [-R msgs_per_sec] [-B bytes_per_sec] "
+                   "[-C coalesce_usecs] [-P ping_secs] [-D ping_timeout_secs] "
+                   "[-E handshake_secs] [-I idle_secs] [-U upgrade_socket] "
+                   "[-L backlog] [-A conns_per_sec] [-a conns_per_sec_per_ip] "
+                   "[-F federation_port] [-N host:port]... [-M shm_socket] "
+                   "[-K capture_file]\n",
+                   argv[0]);
+            return ERROR_EXIT;
+        }
+    }
+    
+    cfg.hwm = (hwm > FRAME_HDR_SIZE + BUF_SIZE) ? hwm : FRAME_HDR_SIZE + BUF_SIZE;
+    cfg.lwm = cfg.hwm / 2;
+    if (cfg.nthreads < 1) cfg.nthreads = 1;
+    if (cfg.nthreads > MAX_SHARDS) cfg.nthreads = MAX_SHARDS;
+    if (cfg.history < 0) cfg.history = 0;
+    if (cfg.rate_msgs < 0) cfg.rate_msgs = 0;
+    if (cfg.rate_bytes < 0) cfg.rate_bytes = 0;
+    if (cfg.coalesce < 0) cfg.coalesce = -1;
+    if (cfg.ping_secs < 0) cfg.ping_secs = 0;
+    if (cfg.pong_secs < 1) cfg.pong_secs = 1;
+    if (cfg.handshake_secs < 0) cfg.handshake_secs = 0;
+    if (cfg.idle_secs < 0) cfg.idle_secs = 0;
+    if (cfg.backlog < 1) cfg.backlog = DEFAULT_BACKLOG;
+    
+    // take the sockets over from the server running on the upgrade socket
+    if (cfg.upgrade_path != NULL) {
+        switch (ho_takeover(cfg.upgrade_path, &ho)) {
+        case 0:
+            printf(" - Took over %d clients from the running server.\n",
+                   (int) ho.sessions.size());
+            break;
+        case 1:     // nobody to take over from
+            break;
+        default:
+            printf(" - Takeover from the running server failed.\n");
+            return ERROR_EXIT;
+        }
+    }
+    
+    // call signal_srv() on SIGINT and SIGUSR2, a dead peer must not kill
+    // the server
     signal(SIGINT, signal_srv);
+    signal(SIGUSR2, signal_srv);
+    signal(SIGPIPE, SIG_IGN);
     
-     // initialize server socket given port #
-    sockfd = init_srv(TCP_PORT);
-
-    if (sockfd == 0) {
-        perror(" - Init server socket error.\n");
-        fflush(stdout);
+    // connection rate limits, shared by the shards
+    if (adm_init(cfg.accept_rate, cfg.ip_rate) != 0) {
+        perror(" - Init admission error.\n");
+        exit(1);
+    }
+    
+    // start the reverse DNS workers
+    if (res_init(cfg.nresolvers > 0 ? cfg.nresolvers : 1, RES_CACHE_SIZE, RES_TTL,
+                 RES_NEG_TTL) != 0) {
+        perror(" - Init resolver error.\n");
         exit(1);
     }
+    
+    // create the room directory and the default room, slots fit a message id
+    if (room_init(cfg.nthreads, cfg.history, FRAME_HDR_SIZE + FRAME_ID_SIZE + BUF_SIZE) != 0) {
+        perror(" - Init rooms error.\n");
+        exit(1);
+    }
+    default_room = room_intern(ROOM_DEFAULT);
+    ho_rooms(&ho);
+    
+    // the journal picks up the message ids where the last run left them
+    if (cfg.journal_path != NULL) {
+        journal = (struct journal*) calloc(1, sizeof(*journal));
+        if (jr_open(journal, cfg.journal_path, JR_SEG_SIZE) != 0) {
+            perror(" - Init journal error.\n");
+            exit(1);
+        }
+    }
+    
+    // initialize one listening socket, epoll instance and session table
+    // per shard
+    nshards = cfg.nthreads;
+    shards = (struct server**) calloc(nshards, sizeof(struct server*));
+    for (i = 0; i < nshards; i++) {
+        shards[i] = new server();
+        
+        // listening sockets handed over are kept, extra shards share one
+        if (i < (int) ho.listeners.size() && ho.listeners[i] >= 0)
+            shards[i]->listenfd = ho.listeners[i];
+        else if (!ho.listeners.empty() && ho.listeners[0] >= 0)
+            shards[i]->listenfd = dup(ho.listeners[0]);
+        
+        if (init_server(shards[i], i) != 0) {
+            perror(" - Init server socket error.\n");
+            fflush(stdout);
+            exit(1);
+        }
+    }
 
-    srv_sockfd = sockfd;
-    fprintf(stdout, " - Chat room server running, press CTRL+C to exit\n");
+    srv_sockfd = shards[0]->listenfd;
+    
+    // with fewer shards than before, the connections still waiting on the
+    // extra sockets are lost
+    for (i = nshards; i < (int) ho.listeners.size(); i++) {
+        if (ho.listeners[i] >= 0)
+            close(ho.listeners[i]);
+    }
+    
+    // sessions stay on their shard, each shard adopts them when it starts
+    for (k = 0; k < ho.sessions.size(); k++)
+        shards[ho.sessions[k].shard % nshards]->adopt.push_back(ho.sessions[k]);
+    
+    // captured traffic goes to the end of the file
+    if (cfg.capture_path != NULL && cap_start(cfg.capture_path) != 0) {
+        perror(" - Init capture file error.\n");
+        exit(1);
+    }
+    
+    // metrics on a local socket, see stats.c for the format
+    if (cfg.stats_path != NULL && stats_start(cfg.stats_path) != 0) {
+        perror(" - Init stats socket error.\n");
+        exit(1);
+    }
+    
+    // link up with the other servers, relayed messages go to the shards
+    if (cfg.peer_port > 0 && (peerfd = init_srv(cfg.peer_port, 1)) == 0) {
+        perror(" - Init federation socket error.\n");
+        exit(1);
+    }
+    if (peer_start(peerfd) != 0) {
+        perror(" - Init federation error.\n");
+        exit(1);
+    }
     
-    // listen for connections, BACKLOG = MAX_CLIENT
-    listen(sockfd, MAX_CLIENT);
-    cli_len = sizeof(cli_addr);
+    // local clients, served by the epoll shards
+    if (cfg.shm_path != NULL) {
+        if (cfg.io == IO_URING)
+            printf(" - Local clients need --io epoll, --shm ignored.\n");
+        else if (shm_listen(cfg.shm_path) != 0) {
+            perror(" - Init shared memory socket error.\n");
+            exit(1);
+        }
+    }
     
-    for ( i = 0; i < MAX_CLIENT; i++) {
-        userlink[i] = 0;
-        username[i][0] = '\0';
+    // wait for the next server on the upgrade socket
+    if (cfg.upgrade_path != NULL && ho_start(cfg.upgrade_path, argv) != 0) {
+        perror(" - Init upgrade socket error.\n");
+        exit(1);
     }
+    fprintf(stdout, " - Chat room server running on port %d (%d thread%s, %s, max %d"
+            " clients), press CTRL+C to exit\n", cfg.port, nshards,
+            nshards > 1 ? "s" : "", cfg.io == IO_URING ? "io_uring" : "epoll",
+            shards[0]->maxclients * nshards);
     
-    userindex = 0;
+    // shard 0 runs on the main thread
+    for (i = 1; i < nshards; i++) {
+        if (pthread_create(&tid, NULL, srv_loop, shards[i]) != 0) {
+            perror(" - server: can't start shard thread.\n");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
     
-    // clear the fd set
-    FD_ZERO(&sockset);
+    srv_loop(shards[0]);
+    return NORMAL_EXIT;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_loop
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void* srv_loop(void* arg)
+--              void* arg: the shard to run
+-- 
+-- RETURNS:     NULL when epoll fails
+-- 
+-- NOTES:
+-- Event loop of one shard. With more than one shard the thread is pinned
+-- to a CPU so a shard's sessions stay in that core's caches.
+-- With --io uring the shard hands over to srv_loop_uring(), or stays on
+-- epoll when the kernel lacks the io_uring features it needs.
+------------------------------------------------------------------------------*/
+void* srv_loop(void* arg)
+{
+    struct  server* srv = (struct server*) arg;
+    struct  epoll_event events[MAX_EVENTS]; // ready events
+    struct  session* s;                 // session of a ready descriptor
+    cpu_set_t cpus;                     // cpu to pin the shard to
+    uint64_t start;                     // when the batch of events came in
+    int64_t timeout;                    // until the next throttled session
+    int     n, i, fd;                   // temporary variables
     
-    // add sockfd to the set
-    FD_SET(sockfd, &sockset);
+    if (nshards > 1) {
+        CPU_ZERO(&cpus);
+        CPU_SET(srv->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
     
-    // update maxfd
-    maxfd = max(maxfd, sockfd + 1);
+    // the ring is created here, it belongs to the thread that submits
+    if (cfg.io == IO_URING) {
+        if (uring_start(srv) == 0)
+            return srv_loop_uring(srv);
+        printf(" - Shard %d: io_uring unavailable, using epoll.\n", srv->id);
+    }
 
+    // sessions handed over by the server we took over from
+    srv_adopt(srv);
+    shm_register(srv);
+    
     while (1) {
         /* 
-         * select() allows the server to monitor multiple file descriptors
-         * waiting until one or more of the file descriptors become "ready"
-         * for I/O operation (input, output, read, and write).
+         * epoll_wait() only reports the descriptors that became ready, so
+         * the cost of a wakeup is proportional to the number of ready
+         * descriptors instead of the number of connected clients.
          */
-        select(maxfd, &sockset, NULL, NULL, NULL);
+        timeout = srv_timeout(srv);
+        n = epoll_wait(srv->epfd, events, MAX_EVENTS,
+                       timeout < 0 ? -1 : (int) ((timeout + 999999) / 1000000));
         
-        // new client connection
-        if (FD_ISSET(sockfd, &sockset)
-            && (userindex = user_free(userlink)) >= 0) {
-            // accept new connection
-            newsockfd = accept(sockfd, (struct sockaddr*)&cli_addr, &cli_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror(" - server: epoll_wait error.\n");
+            break;
+        }
+        
+        start = stats_now();
+        srv_wake(srv);
             
-            if (newsockfd < 0) {
-                userlink[userindex] = 0;
-                perror(" - server: accept error.\n");
-            } else {
-                userlink[userindex] = 1;
-                userfd[userindex] = newsockfd;
-                FD_SET(newsockfd, &sockset);
-                maxfd = max(maxfd, newsockfd + 1);
-                
-                // get client ip address
-                strcpy(ipbuf, inet_ntoa(cli_addr.sin_addr));
-                
-                // build userinfo - hostname:ip:fd
-                sprintf(userinfo, "%s:%s:%d", get_hostname(ipbuf), ipbuf, userindex+4);
-                
-                // store the userinfo in a map
-                if (usermap.find(newsockfd) == usermap.end())
-                    usermap.insert(pair<int, string>(userindex+4, userinfo));
+        // the rest of a burst of connections
+        if (srv->accept_more)
+            srv_accept(srv);
+        
+        for (i = 0; i < n; i++) {
+            fd = events[i].data.fd;
                 
-                printf(" - Connection established: [%s]\n", userinfo);
+            if (fd == srv->listenfd) {
+                // new client connection(s)
+                srv_accept(srv);
+                continue;
+            }
+            
+            if (fd == srv->inbox_efd) {
+                // messages from other shards
+                srv_inbox(srv);
+                continue;
+            }
+            
+            if (fd == srv->resq.efd) {
+                // host names resolved in the background
+                srv_resolved(srv);
+                continue;
+            }
+            
+            if (fd == shm_lfd) {
+                // local client(s) attaching
+                shm_accept(srv);
+                continue;
+            }
+            
+            if ((s = srv->fdtab[fd]) == NULL)
+                continue;
+            
+            // kick from a local client, or it went away
+            if (s->shm != NULL) {
+                shm_event(srv, s, fd);
+                continue;
             }
+            
+            // room in the socket send buffer
+            if (events[i].events & EPOLLOUT)
+                sess_flush(srv, s);
+            
+            // client data or hangup
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                srv_read(srv, s);
         }
         
-        // traverse clients to transfer messages
-        for (i = 0; i < MAX_CLIENT; i++) {
-            if ((userlink[i] == 1) && (FD_ISSET(userfd[i], &sockset))) {
-                length = read(userfd[i], line, BUF_SIZE);
-                
-                if (length == 0) { // socket is closed.
-                    userlink[i] = 0;
-                    username[i][0] = '\0';
-                    FD_CLR(userfd[i], &sockset);
-                } else if (length > 0) {
-                    line[length] = '\0';
-                    
-                    if ((line[0] == '/') && (username[i][0] == '\0')) {
-                        // set nick name
-                        set_name(line, username[i]);
-                    } else if (line[0] == '/' && line[1] == 'q') {
-                        // user quit the chat room
-                        remove_name(line, username[i]);
-                        string removeinfo(usermap.find(i+4)->second);
-                        printf(" - Connection removed: [%s]\n", removeinfo.c_str());
-                        usermap.erase(i + 4);
-                        userlink[i] = 0;
-                        username[i][0] = '\0';
-                        FD_CLR(userfd[i], &sockset);
-                    } else {
-                        // build the message body - name: message (userinfo)
-                        add_name(line, username[i], i + 4);
-                    }
-                    
-                    // distribute messages to all clients except the sender
-                    for (j = 0; j < MAX_CLIENT; j++) {
-                        if ((j != i) && (userlink[j] == 1)) {
-                            write(userfd[j], line, strlen(line));
-                        }
-                    }
-                }
-            }
+        // resume unblocked senders and close dead sessions
+        srv_reap(srv);
+        
+        // the iteration's joins and leaves, one notice per room
+        while (!srv->presence.empty()) {
+            srv_presence(srv);
+            srv_reap(srv);
+        }
+        
+        // write the output coalesced over the iteration or the window
+        if (srv_flush_due(srv)) {
+            srv_flush(srv);
+            srv_reap(srv);
         }
         
-        // update fd set
-        add_sockset(&sockset, sockfd, userfd, userlink);
+        // the traffic captured during the iteration, in one write
+        if (!srv->cap.empty())
+            cap_flush(&srv->cap);
+        
+        // hot upgrade, hand everything over
+        if (srv->handoff)
+            srv_handoff(srv);
+        
+        STAT_ADD(srv->stats.loops, 1);
+        hist_record(&srv->stats.loop_ns, stats_now() - start);
     }
     
-    return NORMAL_EXIT;
+    return NULL;
 }
 
 /*------------------------------------------------------------------------------
@@ -198,8 +777,9 @@ int main(void)
 -- 
 -- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   int init_srv(int port)
+-- INTERFACE:   int init_srv(int port, int reuseport)
 --              int port: the port # the server listening to
+--              int reuseport: non-zero to let several sockets bind the port
 -- 
 -- RETURNS:     return socket file descriptor on success, 0 on failure
 -- 
@@ -207,9 +787,10 @@ int main(void)
 -- This function is called to create a server socket listening for 
 -- client connections.
 ------------------------------------------------------------------------------*/
-int init_srv(int port)
+int init_srv(int port, int reuseport)
 {
     int     sockfd;
+    int     on = 1;
     struct  sockaddr_in serv_addr;
 
     // create a stream socket
@@ -218,6 +799,13 @@ int init_srv(int port)
         fflush(stdout);
         return 0;
     }
+    
+    // allow a quick restart while old connections are in TIME_WAIT
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    
+    // every shard binds its own socket, the kernel balances between them
+    if (reuseport)
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
 
     // bind an address to the socket
     bzero((char*)&serv_addr, sizeof(serv_addr));
@@ -236,235 +824,3002 @@ int init_srv(int port)
 }
 
 /*------------------------------------------------------------------------------
--- FUNCTION:    set_name
+-- FUNCTION:    init_server
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
 -- DESIGNER:    Fred Yang
 -- 
 -- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   void set_name(char* line, char* name)
---              char* line: the input line
---              char* name: nickname specified
+-- INTERFACE:   int init_server(struct server* srv, int id)
+--              struct server* srv: the event loop state to initialize
+--              int id: the shard #
 -- 
--- RETURNS:     void
+-- RETURNS:     return 0 on success, -1 on failure
 -- 
 -- NOTES:
--- This function is called to set the user nick name and output message 
--- "... join the room..."
+-- This function is called to create the listening socket and the epoll
+-- instance of a shard, and to size its session table. The soft RLIMIT_NOFILE
+-- is raised to the hard limit, and the fd-indexed session table is allocated
+-- to match. The client limit is split evenly between the shards.
+-- A listening socket handed over by a hot upgrade is set in srv->listenfd
+-- beforehand and used as it is.
 ------------------------------------------------------------------------------*/
-void set_name(char* line, char* name)
+int init_server(struct server* srv, int id)
 {
-    strcpy(name, &line[1]);
-    sprintf(line, "%s%s join the room...%s\n", MAG, name, RESET);
+    struct  rlimit rl;
+    struct  epoll_event ev;
+    int     maxclients;
+    
+    srv->id = id;
+    srv->nclients = 0;
+    srv->serial = 0;
+    srv->freelist = NULL;
+    srv->ring = NULL;
+    srv->bufs = NULL;
+    srv->iov = NULL;
+    srv->handoff = 0;
+    srv->accepting = 0;
+    srv->accept_more = 0;
+    memset(&srv->stats, 0, sizeof(srv->stats));
+    tw_init(&srv->wheel, stats_now() / TICK_NS);
+    
+    // heartbeats carry no payload, every session can share one of each
+    srv->ping = mb_frame(FRAME_PING, 0, "", 0);
+    srv->pong = mb_frame(FRAME_PONG, 0, "", 0);
+    if (srv->ping == NULL || srv->pong == NULL)
+        return -1;
+    
+    // raise the descriptor limit as far as we are allowed to
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+        srv->tabsize = (rl.rlim_cur > (rlim_t)MAX_FDS) ? MAX_FDS : (int)rl.rlim_cur;
+    } else {
+        srv->tabsize = 1024;
+    }
+    
+    maxclients = srv->tabsize - FD_RESERVED;
+    if (cfg.maxclients > 0 && cfg.maxclients < maxclients)
+        maxclients = cfg.maxclients;
+    srv->maxclients = (maxclients + cfg.nthreads - 1) / cfg.nthreads;
+    
+    srv->fdtab = (struct session**) calloc(srv->tabsize, sizeof(struct session*));
+    srv->clients = (struct session**) calloc(srv->maxclients, sizeof(struct session*));
+    if (srv->fdtab == NULL || srv->clients == NULL)
+        return -1;
+    
+    // initialize server socket given port #, listen() again on one handed
+    // over to set its backlog
+    if (srv->listenfd <= 0 && (srv->listenfd = init_srv(cfg.port, cfg.nthreads > 1)) == 0)
+        return -1;
+    if (listen(srv->listenfd, cfg.backlog) < 0)
+        return -1;
+    
+    set_nonblock(srv->listenfd);
+    
+    // given up when the process runs out of descriptors, see srv_shed()
+    srv->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    
+    if ((srv->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+    
+    // answers from the resolver threads arrive through an eventfd
+    if (res_queue_init(&srv->resq) < 0)
+        return -1;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = srv->resq.efd;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->resq.efd, &ev) < 0)
+        return -1;
+    
+    // other shards post to the inbox and kick its eventfd
+    mpsc_init(&srv->inbox);
+    srv->inbox_signaled = 0;
+    if ((srv->inbox_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return -1;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = srv->inbox_efd;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->inbox_efd, &ev) < 0)
+        return -1;
+    
+    // the listening socket is edge-triggered too, srv_accept() drains it
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = srv->listenfd;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->listenfd, &ev) < 0)
+        return -1;
+    
+    return 0;
 }
 
 /*------------------------------------------------------------------------------
--- FUNCTION:    remove_name
+-- FUNCTION:    set_nonblock
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
 -- DESIGNER:    Fred Yang
 -- 
 -- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   void remove_name(char* line, const char* name)
---              char* line: the input line
---              char* name: nickname to remove
+-- INTERFACE:   int set_nonblock(int fd)
+--              int fd: the file descriptor to switch to non-blocking mode
 -- 
--- RETURNS:     void
+-- RETURNS:     return 0 on success, -1 on failure
 -- 
 -- NOTES:
--- This function is called to output the message "... leave the room..."
+-- Edge-triggered epoll requires every descriptor to be drained until EAGAIN,
+-- so all sockets handled by the event loop are non-blocking.
 ------------------------------------------------------------------------------*/
-void remove_name(char* line, const char* name)
+int set_nonblock(int fd)
 {
-    sprintf(line, "%s%s leave the room...%s\n", MAG, name, RESET);
+    int flags = fcntl(fd, F_GETFL, 0);
+    
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
 /*------------------------------------------------------------------------------
--- FUNCTION:    add_set
+-- FUNCTION:    srv_accept
 -- 
--- DATE:        March 13, 2017
+-- DATE:        October 16, 2026
 -- 
 -- DESIGNER:    Fred Yang
 -- 
 -- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   void add_name(char* line, const char* name, int sockfd)
---              char* line: the input line
---              char* name: nickname specified
---              int sockfd: the socket file descriptor specified
+-- INTERFACE:   void srv_accept(struct server* srv)
+--              struct server* srv: the event loop state
 -- 
 -- RETURNS:     void
 -- 
 -- NOTES:
--- This function is called to output the message body plus user info.
+-- This function is called when the listening socket is readable. It accepts
+-- connections, already non-blocking, until the accept queue is empty and
+-- hands each one to srv_admit(). After ACCEPT_BATCH of them it stops and
+-- sets accept_more, the loop comes back for the rest in its next iteration
+-- without waiting: the socket is edge-triggered and would not tell again.
+-- Out of descriptors, the connection at the head of the queue is shed; if
+-- there is none, the next connection makes the socket readable again.
 ------------------------------------------------------------------------------*/
-void add_name(char* line, const char* name, int sockfd)
+void srv_accept(struct server* srv)
 {
-    char theline[BUF_SIZE];
-    string userinfo(usermap.find(sockfd)->second);
+    struct  sockaddr_in cli_addr;   // socketaddr_in struct
+    socklen_t cli_len;              // size of sockaddr_in struct
+    int     newsockfd;              // socket file descriptor for new connection
+    int     n;
+    
+    srv->accept_more = 0;
     
-    strcpy(theline, name);
-    strcat(theline, ": ");
-    strcat(theline, line);
-    string msg(theline);
-    sprintf(line, "%s%s %s[from %s]%s\n", YEL, msg.substr(0,msg.size()-1).c_str(), 
-            CYN, userinfo.c_str(), RESET);
+    for (n = 0; n < ACCEPT_BATCH; n++) {
+        cli_len = sizeof(cli_addr);
+        newsockfd = accept4(srv->listenfd, (struct sockaddr*)&cli_addr, &cli_len,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        
+        if (newsockfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if ((errno == EMFILE || errno == ENFILE) && srv_shed(srv))
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror(" - server: accept error.\n");
+            return;
+        }
+        
+        srv_admit(srv, newsockfd, &cli_addr);
+    }
+    
+    srv->accept_more = 1;
 }
-
+        
 /*------------------------------------------------------------------------------
--- FUNCTION:    user_free
+-- FUNCTION:    srv_admit
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
 -- DESIGNER:    Fred Yang
 -- 
 -- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   int user_free(int usrlink[MAX_CLIENT])
---              int usrlink[MAX_CLIENT]: array that stores client connect status
+-- INTERFACE:   void srv_admit(struct server* srv, int fd,
+--                             const struct sockaddr_in* addr)
+--              struct server* srv: the event loop state
+--              int fd: the accepted socket
+--              const struct sockaddr_in* addr: the client address
 -- 
--- RETURNS:     the first index of the array usrlink with value = 0 (free to 
---              connect); return -1 if all values = 1 (connected)
+-- RETURNS:     void
 -- 
 -- NOTES:
--- This function is called to return the first index of the array usrlink
--- with the value = 0 (free to connect).
+-- This function is called for every accepted connection. It creates the
+-- session, registers it with epoll or starts receiving on the ring, and
+-- records the client info (hostname:ip:fd) in it. Connections above the
+-- client limit or the connection rates are told so and closed straight
+-- away.
+-- The host name comes from the resolver cache when it is known. Otherwise the
+-- ip address stands in for it until srv_resolved() receives the answer, so a
+-- slow PTR lookup never holds up the event loop.
+-- A connection accepted while a hot upgrade is under way starts paused.
 ------------------------------------------------------------------------------*/
-int user_free(int usrlink[MAX_CLIENT])
+void srv_admit(struct server* srv, int fd, const struct sockaddr_in* addr)
 {
-    int i = 0;
-
-    while ((usrlink[i] != 0) && ( i < MAX_CLIENT)) i++;
-    if (i == MAX_CLIENT) return -1;
-    return i;
+    struct  epoll_event ev;         // epoll registration
+    struct  session* s;             // new session
+    char    ipbuf[IP_SIZE];         // stores client ip address
+    char    host[RES_HOST_MAX];     // client host name
+    int     on = 1;                 // socket option value
+        
+    if (srv->nclients >= srv->maxclients) {
+        STAT_ADD(srv->stats.rejects, 1);
+        srv_refuse(fd, RED "The server is full, try again later." RESET "\n");
+        return;
+    }
+    
+    switch (adm_check(addr->sin_addr.s_addr, stats_now())) {
+    case ADM_RATE:
+        STAT_ADD(srv->stats.refused, 1);
+        srv_refuse(fd, RED "Too many connections, try again later." RESET "\n");
+        return;
+    case ADM_IP:
+        STAT_ADD(srv->stats.refused, 1);
+        srv_refuse(fd, RED "Too many connections from your address, "
+                   "try again later." RESET "\n");
+        return;
+    }
+    
+    if (fd >= srv->tabsize || (s = sess_new(srv)) == NULL) {
+        STAT_ADD(srv->stats.rejects, 1);
+        close(fd);
+        return;
+    }
+        
+    s->fd = fd;
+    s->paused = srv->handoff;
+    
+    // coalesced output is one write per window, Nagle would only delay it
+    if (cfg.coalesce >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    
+    // EPOLLOUT is edge-triggered as well, it fires when a full send
+    // buffer drains, so it never has to be switched on and off
+    if (srv->ring == NULL) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror(" - server: epoll_ctl error.\n");
+            close(fd);
+            sess_free(srv, s);
+            return;
+        }
+    }
+        
+    s->slot = srv->nclients;
+    srv->clients[srv->nclients++] = s;
+    srv->fdtab[fd] = s;
+    s->room = sess_join(srv, s, default_room);
+    STAT_ADD(srv->stats.accepts, 1);
+    if (cfg.capture_path != NULL)
+        cap_record(&srv->cap, CAP_OPEN, srv->id, s->serial, NULL, 0);
+        
+    s->born = s->rx_at = s->talk_at = srv->wheel.now;
+    sess_timeout(srv, s);
+    
+    if (srv->ring != NULL)
+        uring_recv(srv, s);
+        
+    // get client ip address
+    strcpy(ipbuf, inet_ntoa(addr->sin_addr));
+        
+    // get client host name, or a placeholder while it is resolved
+    switch (res_lookup(addr->sin_addr.s_addr, host, sizeof(host),
+                       &srv->resq, fd, s->serial)) {
+    case 1:     // cached name
+        break;
+    case 0:     // cached failure
+        strcpy(host, default_host);
+        break;
+    default:    // lookup queued
+        strcpy(host, ipbuf);
+        break;
+    }
+        
+    // build userinfo - hostname:ip:fd
+    snprintf(s->info, sizeof(s->info), "%s:%s:%d", host, ipbuf, fd);
+    sess_decorate(s);
+        
+    printf(" - Connection established: [%s]\n", s->info);
 }
 
 /*------------------------------------------------------------------------------
--- FUNCTION:    add_sockset
+-- FUNCTION:    srv_refuse
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
 -- DESIGNER:    Fred Yang
 -- 
 -- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   void add_sockset(fd_set* sockset, int sockfd, int* usrfd, const int* usrlink)
---              fd_set* sockset: the set that holds the socket file descriptors
---              int sockfd: the socket file descriptor to add to the set
---              int* usrfd: points to userfd array
---              const int* usrlink: points to userlink array
+-- INTERFACE:   void srv_refuse(int fd, const char* why)
+--              int fd: a connection just accepted
+--              const char* why: the line telling the client why
 -- 
 -- RETURNS:     void
 -- 
 -- NOTES:
--- This function is called to add a given sockfd and userfd to the fd set.
+-- This function is called to turn a connection away. The reason goes out
+-- as one text frame, without waiting: a fresh socket has room for it, and
+-- a client that cannot take it loses nothing it could use.
 ------------------------------------------------------------------------------*/
-void add_sockset(fd_set* sockset, int sockfd, int* usrfd, const int* usrlink)
+void srv_refuse(int fd, const char* why)
 {
-    int i;
-
-    FD_ZERO(sockset);
-    FD_SET(sockfd, sockset);
-    for (i = 0; i < MAX_CLIENT; i++) {
-        if (usrlink[i] == 1) {
-            FD_SET(usrfd[i], sockset);
-        }
-    }
+    char    out[FRAME_HDR_SIZE + BUF_SIZE];
+    int     n;
+    
+    if ((n = frame_encode(out, sizeof(out), FRAME_TEXT, 0, why, strlen(why))) > 0)
+        send(fd, out, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
 }
 
 /*------------------------------------------------------------------------------
--- FUNCTION:    get_hostname
+-- FUNCTION:    srv_shed
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
--- DESIGNER:    Maitiu Morton
+-- DESIGNER:    Fred Yang
 -- 
--- PROGRAMMER:  Maitiu Morton
+-- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   char* get_hostname(const char* ipaddr)
---              const char* ipaddr: host ip address to be resolved
+-- INTERFACE:   int srv_shed(struct server* srv)
+--              struct server* srv: the shard
 -- 
--- RETURNS:     returns the host name given the ip address
+-- RETURNS:     1 if a connection was shed, 0 if none was waiting
 -- 
--- NOTES: 
--- Resolve host name given an ip address.
+-- NOTES:
+-- This function is called when accept fails because the process has no
+-- descriptor left. The connection would stay at the head of the queue and
+-- the listening socket readable for good, so the spare descriptor is
+-- given up to accept it, it is refused, and the spare is taken back.
+-- The kernel reports EMFILE before it looks at the queue, so the caller
+-- must not try again when nothing was shed.
 ------------------------------------------------------------------------------*/
-char* get_hostname(const char* ipaddr)
+int srv_shed(struct server* srv)
 {
-    struct hostent *hp;
-    struct in_addr addr, *addr_p;
-    char **phost;
-
-    char* host = (char*) malloc(255);
-    host[0] = '\0';
-
-    addr_p = &addr;
-    inet_aton(ipaddr, &addr);
-
-    hp = gethostbyaddr(addr_p, sizeof(addr), PF_INET);
-    if (hp == NULL)
-    {
-        return default_host;
+    int     fd;
+    
+    if (srv->spare < 0)
+        return 0;
+    
+    close(srv->spare);
+    if ((fd = accept4(srv->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        STAT_ADD(srv->stats.rejects, 1);
+        srv_refuse(fd, RED "The server is full, try again later." RESET "\n");
     }
-
-    for (phost = hp->h_addr_list; *phost != 0; phost++)
-    {
-        strcpy(host, hp->h_name);
-        break;
+    srv->spare = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+}
+    
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_new
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct session* sess_new(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     a blank session, NULL if memory runs out
+-- 
+-- NOTES:
+-- This function is called to take a session off the shard's free list.
+-- An empty list is refilled with a slab of SESS_SLAB sessions, which is
+-- never given back. A recycled session keeps the capacity of its vectors.
+-- The serial # is the session's generation: it changes on every reuse, so
+-- references to the previous occupant no longer match (see sess_lookup()).
+------------------------------------------------------------------------------*/
+struct session* sess_new(struct server* srv)
+{
+    struct  session* slab;
+    struct  session* s;
+    uint64_t now;
+    int     i;
+    
+    if (srv->freelist == NULL) {
+        if ((slab = new (std::nothrow) session[SESS_SLAB]) == NULL)
+            return NULL;
+        for (i = SESS_SLAB - 1; i >= 0; i--) {
+            slab[i].nextfree = srv->freelist;
+            srv->freelist = &slab[i];
+        }
     }
+    
+    s = srv->freelist;
+    srv->freelist = s->nextfree;
+    
+    s->fd = -1;
+    s->name[0] = '\0';
+    s->info[0] = '\0';
+    s->srv = srv;
+    s->serial = ++srv->serial;
+    s->paused = 0;
+    s->closing = 0;
+    s->room = NULL;
+    s->inflight = 0;
+    s->recv_armed = 0;
+    s->writing = 0;
+    s->dirty = 0;
+    s->wbytes = 0;
+    s->nextfree = NULL;
+    memset(&s->from, 0, sizeof(s->from));
+    memset(&s->stream, 0, sizeof(s->stream));
+    now = stats_now();
+    tb_init(&s->tb_msgs, cfg.rate_msgs, now);
+    tb_init(&s->tb_bytes, cfg.rate_bytes, now);
+    s->throttled = 0;
+    s->yielded = 0;
+    s->budget = 0;
+    s->budget_iter = 0;
+    s->noticed = 0;
+    s->timer.next = NULL;
+    s->timer.prev = NULL;
+    s->timer.arg = s;
+    s->ping_at = 0;
+    s->shm = NULL;
+    dec_init(&s->dec);
+    oq_init(&s->oq);
+    return s;
+}
 
-    return host;
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_free
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_free(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a session no longer in any table
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to release a session's buffers and put it back
+-- on the free list.
+------------------------------------------------------------------------------*/
+void sess_free(struct server* srv, struct session* s)
+{
+    dec_free(&s->dec);
+    oq_free(&s->oq);
+    s->blocked.clear();
+    s->rooms.clear();
+    s->nextfree = srv->freelist;
+    srv->freelist = s;
 }
 
 /*------------------------------------------------------------------------------
--- FUNCTION:    max
+-- FUNCTION:    srv_resolved
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
 -- DESIGNER:    Maitiu Morton
 -- 
 -- PROGRAMMER:  Maitiu Morton
 -- 
--- INTERFACE:   int max(int a, int b)
---              int a: the first integer to be evaluated
---              int b: the second integer to be evaluated
+-- INTERFACE:   void srv_resolved(struct server* srv)
+--              struct server* srv: the event loop state
 -- 
--- RETURNS:     returns the bigger one of a & b
+-- RETURNS:     void
 -- 
--- NOTES: 
--- Called to return the bigger one of a & b.
+-- NOTES:
+-- This function is called when the resolver posts answers. The host name
+-- replaces the ip placeholder in the session's userinfo; a failed lookup
+-- falls back to the default host name as before. Answers for sessions that
+-- have gone away in the meantime are ignored.
 ------------------------------------------------------------------------------*/
-int max(int a, int b)
+void srv_resolved(struct server* srv)
 {
-    return (a > b) ? a : b;
-}
+    std::vector<struct res_done> done;
+    struct  session* s;
+    struct  sess_ref ref;
+    struct  in_addr addr;
+    size_t  i;
     
+    res_drain(&srv->resq, &done);
+    
+    for (i = 0; i < done.size(); i++) {
+        ref.shard = srv->id;
+        ref.fd = done[i].id;
+        ref.serial = done[i].tag;
+        if ((s = sess_lookup(srv, ref)) == NULL)
+            continue;
+        
+        addr.s_addr = done[i].ip;
+        snprintf(s->info, sizeof(s->info), "%s:%s:%d",
+                 done[i].ok ? done[i].host : default_host, inet_ntoa(addr), s->fd);
+        sess_decorate(s);
+        
+        printf(" - Connection resolved: [%s]\n", s->info);
+    }
+}
+
 /*------------------------------------------------------------------------------
--- FUNCTION:    signal_srv
+-- FUNCTION:    srv_read
 -- 
--- DATE:        March 12, 2017
+-- DATE:        October 16, 2026
 -- 
--- DESIGNER:    Maitiu Morton
+-- DESIGNER:    Fred Yang
 -- 
--- PROGRAMMER:  Maitiu Morton
+-- PROGRAMMER:  Fred Yang
 -- 
--- INTERFACE:   void signal_srv(int signo)
---              int signo: the signal # passed in
+-- INTERFACE:   void srv_read(struct server* srv, struct session* s)
+--              struct server* srv: the event loop state
+--              struct session* s: the session that became readable
 -- 
 -- RETURNS:     void
 -- 
--- NOTES: 
--- This function will be invoked when the user press 'Ctrl+C' to terminate
--- the program. It will call close the server socket before termination.
+-- NOTES:
+-- This function is called when a client socket is readable. It reads until
+-- EAGAIN, as required by edge-triggered epoll, into the server's large read
+-- buffer and hands the bytes to srv_input().
+-- A paused session is not read at all; frames it sent before the pause stay
+-- in its decoder and are handled first when it is resumed. A local client
+-- is read from its ring by shm_read().
 ------------------------------------------------------------------------------*/
-void signal_srv(int signo) {
-    if (signo == SIGINT) {
-        signal(SIGINT, NULL);
-        close(srv_sockfd);
-        exit(1);
+void srv_read(struct server* srv, struct session* s)
+{
+    int     length;                 // bytes read
+    
+    if (s->paused || s->closing)
+        return;
+    
+    // frames held back by an earlier pause
+    if (dec_pending(&s->dec) && srv_input(srv, s, NULL, 0) != 0)
+        return;
+    
+    if (s->shm != NULL) {
+        shm_read(srv, s);
+        return;
     }
-}
\ No newline at end of file
+    
+    while (1) {
+        length = read(s->fd, srv->rbuf, READ_SIZE);
+        
+        if (length == 0) { // socket is closed.
+            sess_kill(srv, s);
+            return;
+        }
+        
+        if (length < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                sess_kill(srv, s);
+            return;
+        }
+        
+        STAT_ADD(srv->stats.bytes_in, length);
+        
+        // protocol error, "/q" or paused by a congested recipient
+        if (srv_input(srv, s, srv->rbuf, length) != 0)
+            return;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_input
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int srv_input(struct server* srv, struct session* s,
+--                            const char* data, size_t len)
+--              struct server* srv: the event loop state
+--              struct session* s: the session the bytes came from
+--              const char* data: bytes received, NULL to resume decoding
+--              size_t len: the number of bytes received
+-- 
+-- RETURNS:     0 to keep reading, 1 if the session was closed or paused,
+--              -1 on a protocol error (the session is closed)
+-- 
+-- NOTES:
+-- This function is called by both backends to hand received bytes to the
+-- session's frame decoder, which calls srv_frame() for every complete
+-- frame. With --capture the bytes are recorded first, as received.
+------------------------------------------------------------------------------*/
+int srv_input(struct server* srv, struct session* s, const char* data, size_t len)
+{
+    int rc;
+    
+    if (cfg.capture_path != NULL && data != NULL)
+        cap_record(&srv->cap, CAP_DATA, srv->id, s->serial, data, len);
+    
+    rc = dec_feed(&s->dec, data, len, srv_frame, s);
+    if (rc < 0)
+        sess_kill(srv, s);
+    return rc;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_frame
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int srv_frame(void* arg, const struct frame* f)
+--              void* arg: the session the frame came from
+--              const struct frame* f: the decoded frame
+-- 
+-- RETURNS:     0 to continue decoding, 1 if the session was closed or
+--              paused
+-- 
+-- NOTES:
+-- This function is called for each frame received from a client and handles
+-- it the same way the select() loop handled a read: the first "/name" sets
+-- the nickname, or "/resume" for a client reconnecting, "/q" leaves the
+-- rooms, room commands go to srv_command()
+-- and anything else is broadcast to the sender's room with the sender info.
+-- Unknown frame types are ignored.
+-- Plain text, the common case, is framed straight from the decoder's
+-- buffer; only lines starting with '/' are copied out to be parsed.
+-- Every text frame is charged to the rate limits and the read budget
+-- before it is handled; going over either pauses the session after it.
+-- Any frame shows the client is alive, a ping is answered right away.
+------------------------------------------------------------------------------*/
+int srv_frame(void* arg, const struct frame* f)
+{
+    struct  session* s = (struct session*) arg;
+    struct  server* srv = s->srv;
+    struct  msgbuf* mb;
+    char    line[BUF_SIZE];         // temporary line (message)
+    int     length;
+    
+    STAT_ADD(srv->stats.frames_in, 1);
+    s->rx_at = srv->wheel.now;
+    
+    if (f->type == FRAME_PING)
+        sess_send(srv, s, srv->pong, NULL);
+    if (f->type != FRAME_TEXT)
+        return (s->closing) ? 1 : 0;
+    
+    s->talk_at = srv->wheel.now;
+    
+    if (cfg.rate_msgs > 0 || cfg.rate_bytes > 0)
+        sess_throttle(srv, s, f->length);
+    
+    if (s->budget_iter != srv->iter) {
+        s->budget_iter = srv->iter;
+        s->budget = READ_BUDGET;
+    }
+    if (--s->budget <= 0)
+        sess_yield(srv, s);
+    
+    if ((f->length == 0 || f->payload[0] != '/') && s->room != NULL) {
+        if ((mb = sess_format(s, s->room->info, f->payload, f->length)) != NULL)
+            broadcast_mb(srv, s, s->room->info, mb, PEER_MSG);
+        return (s->paused || s->closing) ? 1 : 0;
+    }
+    
+    length = (f->length < BUF_SIZE) ? f->length : BUF_SIZE - 1;
+    memcpy(line, f->payload, length);
+    line[length] = '\0';
+    
+    if ((line[0] == '/') && (s->name[0] == '\0') && strncmp(line, "/resume", 7) == 0
+        && isspace((unsigned char) line[7])) {
+        // a client back after a lost connection
+        sess_resume(srv, s, line);
+    } else if ((line[0] == '/') && (s->name[0] == '\0')) {
+        // set nick name, then catch up on the room
+        set_name(line, s->name);
+        sess_decorate(s);
+        sess_named(srv, s);
+        if (s->room != NULL)
+            sess_replay(srv, s, s->room->info);
+    } else if (srv_command(srv, s, line)) {
+        // "/join", "/part", "/rooms", "/who" or "/history"
+    } else if (line[0] == '/' && line[1] == 'q') {
+        // user quit the chat room, srv_close() announces it
+        sess_kill(srv, s);
+        return 1;
+    } else if (s->room == NULL) {
+        sess_reply(srv, s, RED "You are not in a room, /join one first." RESET "\n");
+    } else if ((mb = sess_format(s, s->room->info, line, strlen(line))) != NULL) {
+        // an unknown command is sent as text
+        broadcast_mb(srv, s, s->room->info, mb, PEER_MSG);
+    }
+    
+    return (s->paused || s->closing) ? 1 : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_command
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int srv_command(struct server* srv, struct session* s,
+--                              char* line)
+--              struct server* srv: the shard
+--              struct session* s: the session the line came from
+--              char* line: the line received, may be overwritten
+-- 
+-- RETURNS:     1 if the line was a room, roster or history command, 0
+--              otherwise
+-- 
+-- NOTES:
+-- This function is called to handle the room commands:
+--      /join name      join the room (created on first use) and talk in it
+--      /part [name]    leave the room, the current one by default
+--      /rooms          list the rooms in use and their member counts
+--      /who [name]     list the nicknames in one of the session's rooms,
+--                      the current one by default
+--      /history [id]   send the journaled messages after id, or tell which
+--                      ids the journal holds
+-- Room names may be given with or without a leading '#'. Joins and leaves
+-- are announced by srv_presence() at the end of the loop iteration.
+------------------------------------------------------------------------------*/
+int srv_command(struct server* srv, struct session* s, char* line)
+{
+    struct  room_info* ri;
+    struct  room* r;
+    struct  msgbuf* mb;
+    char    name[ROOM_NAME_MAX];    // room name argument
+    char    list[BUF_SIZE - 32];    // /rooms reply
+    char    reply[BUF_SIZE];
+    unsigned long long after;       // /history argument
+    uint64_t first, last;           // ids in the journal
+    size_t  i, had;
+    
+    name[0] = '\0';
+    
+    if (strncmp(line, "/rooms", 6) == 0 && isspace((unsigned char) line[6])) {
+        room_list(list, sizeof(list));
+        snprintf(reply, sizeof(reply), "%sRooms: %s%s\n", GRN, list, RESET);
+        sess_reply(srv, s, reply);
+        return 1;
+    }
+    
+    if (strncmp(line, "/who", 4) == 0 && isspace((unsigned char) line[4])) {
+        if (sscanf(line + 4, " #%31s", name) != 1)
+            sscanf(line + 4, " %31s", name);
+        
+        r = (name[0] == '\0') ? s->room : NULL;
+        for (i = 0; r == NULL && i < s->rooms.size(); i++) {
+            if (strcmp(s->rooms[i].room->info->name, name) == 0)
+                r = s->rooms[i].room;
+        }
+        
+        if (r == NULL) {
+            sess_reply(srv, s, RED "You are not in that room." RESET "\n");
+            return 1;
+        }
+        
+        // the same buffer for every /who until the roster changes
+        if ((mb = room_who(r->info)) != NULL) {
+            sess_send(srv, s, mb, NULL);
+            mb_unref(mb);
+        }
+        return 1;
+    }
+    
+    if (strncmp(line, "/join", 5) == 0 && isspace((unsigned char) line[5])) {
+        if (sscanf(line + 5, " #%31s", name) != 1)
+            sscanf(line + 5, " %31s", name);
+        if (!room_valid(name)) {
+            sess_reply(srv, s, RED "Usage: /join name (letters, digits, - and _)"
+                       RESET "\n");
+            return 1;
+        }
+        
+        had = s->rooms.size();
+        if ((ri = room_intern(name)) == NULL || (r = sess_join(srv, s, ri)) == NULL)
+            return 1;
+        
+        s->room = r;
+        sess_replay(srv, s, ri);
+        if (s->rooms.size() > had && s->name[0] != '\0')
+            sess_presence(srv, s, ri, 1);
+        snprintf(reply, sizeof(reply), "%sNow talking in #%s%s\n", GRN, name, RESET);
+        sess_reply(srv, s, reply);
+        return 1;
+    }
+    
+    if (strncmp(line, "/history", 8) == 0 && isspace((unsigned char) line[8])) {
+        if (journal == NULL) {
+            sess_reply(srv, s, RED "The server keeps no journal." RESET "\n");
+            return 1;
+        }
+        
+        jr_range(journal, &first, &last);
+        if (sscanf(line + 8, " %llu", &after) != 1) {
+            if (first > last)
+                snprintf(reply, sizeof(reply), "%sThe journal is empty.%s\n", GRN, RESET);
+            else
+                snprintf(reply, sizeof(reply), "%sThe journal holds messages #%llu-#%llu,"
+                         " /history id sends the ones after id.%s\n", GRN,
+                         (unsigned long long) first, (unsigned long long) last, RESET);
+            sess_reply(srv, s, reply);
+            return 1;
+        }
+        
+        if (s->stream.active) {
+            sess_reply(srv, s, RED "A history is still being sent." RESET "\n");
+            return 1;
+        }
+        if (sess_history(srv, s, after) < 0) {
+            snprintf(reply, sizeof(reply), "%sNo messages after #%llu.%s\n", GRN, after, RESET);
+            sess_reply(srv, s, reply);
+        }
+        return 1;
+    }
+    
+    if (strncmp(line, "/part", 5) == 0 && isspace((unsigned char) line[5])) {
+        if (sscanf(line + 5, " #%31s", name) != 1)
+            sscanf(line + 5, " %31s", name);
+        
+        r = (name[0] == '\0') ? s->room : NULL;
+        for (i = 0; r == NULL && i < s->rooms.size(); i++) {
+            if (strcmp(s->rooms[i].room->info->name, name) == 0)
+                r = s->rooms[i].room;
+        }
+        
+        if (r == NULL) {
+            sess_reply(srv, s, RED "You are not in that room." RESET "\n");
+            return 1;
+        }
+        
+        ri = r->info;
+        if (s->name[0] != '\0')
+            sess_presence(srv, s, ri, 0);
+        sess_part(srv, s, r);
+        
+        if (s->room != NULL)
+            snprintf(reply, sizeof(reply), "%sLeft #%s, now talking in #%s%s\n",
+                     GRN, ri->name, s->room->info->name, RESET);
+        else
+            snprintf(reply, sizeof(reply), "%sLeft #%s%s\n", GRN, ri->name, RESET);
+        sess_reply(srv, s, reply);
+        return 1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_close
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_close(struct server* srv, struct session* s)
+--              struct server* srv: the event loop state
+--              struct session* s: the session to remove
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to remove a session from the server. The last
+-- entry of the client list is moved into the freed slot so the list stays
+-- dense. Closing the fd also removes it from the epoll set. Senders paused
+-- on behalf of this session are released and its rooms are left, which is
+-- announced to them, then the session goes back on the free list.
+------------------------------------------------------------------------------*/
+void srv_close(struct server* srv, struct session* s)
+{
+    struct session* last;
+    
+    printf(" - Connection removed: [%s]\n", s->info);
+    
+    last = srv->clients[--srv->nclients];
+    srv->clients[s->slot] = last;
+    last->slot = s->slot;
+    
+    sess_release(srv, s);
+    tw_del(&srv->wheel, &s->timer);
+    
+    while (!s->rooms.empty()) {
+        if (s->name[0] != '\0')
+            sess_presence(srv, s, s->rooms.back().room->info, 0);
+        sess_part(srv, s, s->rooms.back().room);
+    }
+    
+    STAT_ADD(srv->stats.closes, 1);
+    if (cfg.capture_path != NULL)
+        cap_record(&srv->cap, CAP_CLOSE, srv->id, s->serial, NULL, 0);
+    
+    if (s->shm != NULL)
+        shm_close(srv, s);
+    
+    srv->fdtab[s->fd] = NULL;
+    close(s->fd);
+    sess_free(srv, s);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    broadcast_mb
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void broadcast_mb(struct server* srv, struct session* sender,
+--                                struct room_info* ri, struct msgbuf* mb,
+--                                int kind)
+--              struct server* srv: the shard the sender belongs to
+--              struct session* sender: the session the message came from
+--              struct room_info* ri: the room to send to
+--              struct msgbuf* mb: the framed message, the caller's
+--                                 reference is taken over
+--              int kind: what it is for the other servers, PEER_*
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to distribute a framed message to the members of
+-- a room except the sender, see broadcast_from().
+------------------------------------------------------------------------------*/
+void broadcast_mb(struct server* srv, struct session* sender, struct room_info* ri,
+                  struct msgbuf* mb, int kind)
+{
+    struct sess_ref from;
+    
+    from.shard = srv->id;
+    from.fd = sender->fd;
+    from.serial = sender->serial;
+    broadcast_from(srv, &from, sender->name, ri, mb, kind);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    broadcast_from
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void broadcast_from(struct server* srv,
+--                                  const struct sess_ref* from,
+--                                  const char* nick, struct room_info* ri,
+--                                  struct msgbuf* mb, int kind)
+--              struct server* srv: the shard the message comes from
+--              const struct sess_ref* from: the sender, which is skipped,
+--                                           or shard -1 for nobody
+--              const char* nick: the sender's nickname for the other
+--                                servers
+--              struct room_info* ri: the room to send to
+--              struct msgbuf* mb: the framed message, the caller's
+--                                 reference is taken over
+--              int kind: what it is for the other servers, PEER_*
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Queues that cannot send the message right away keep a reference instead
+-- of a copy, and only the room's members are visited. Every other shard
+-- with members in the room gets a reference to the same buffer through
+-- its inbox. The framed message is also copied into the room's scrollback
+-- and handed to the journal's writer, which gives it its id first. A
+-- federated server relays the payload, id aside, to the other servers.
+------------------------------------------------------------------------------*/
+void broadcast_from(struct server* srv, const struct sess_ref* from, const char* nick,
+                    struct room_info* ri, struct msgbuf* mb, int kind)
+{
+    struct  shard_msg* m;
+    size_t  off;
+    int     i;
+    
+    STAT_ADD(srv->stats.broadcasts, 1);
+    if (journal != NULL)
+        jr_append(journal, mb, ri->key);
+    sb_append(&ri->hist, MB_DATA(mb), mb->len, stats_now());
+    srv_fanout(srv, mb, from, ri);
+    
+    if (peer_enabled()) {
+        off = FRAME_HDR_SIZE + ((MB_DATA(mb)[3] & FRAME_F_ID) ? FRAME_ID_SIZE : 0);
+        peer_relay(kind, ri->name, nick, MB_DATA(mb) + off, mb->len - off);
+    }
+    
+    for (i = 0; i < nshards; i++) {
+        if (shards[i] == srv || !room_active(ri, i))
+            continue;
+        
+        m = new shard_msg();
+        m->type = SHARD_BCAST;
+        m->mb = mb;
+        m->room = ri;
+        m->ref = *from;
+        mb_ref(mb);
+        shard_post(shards[i], m);
+    }
+    
+    mb_unref(mb);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    broadcast_peer
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void broadcast_peer(const char* room, const char* text, int len)
+--              const char* room: the room name
+--              const char* text: the message, not NUL terminated
+--              int len: the length of the message
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by the peer thread for a message relayed from
+-- another server. It is framed, journaled and kept in the scrollback like
+-- a local broadcast, and posted to every shard with members in the room.
+-- There is no local sender: the shards see shard -1, which nobody matches
+-- and which the pause policy leaves alone.
+------------------------------------------------------------------------------*/
+void broadcast_peer(const char* room, const char* text, int len)
+{
+    struct  room_info* ri;
+    struct  shard_msg* m;
+    struct  msgbuf* mb;
+    int     i;
+    
+    if (!room_valid(room) || (ri = room_intern(room)) == NULL)
+        return;
+    if ((mb = mb_frame(FRAME_TEXT, (journal != NULL) ? FRAME_F_ID : 0, text, len)) == NULL)
+        return;
+    
+    if (journal != NULL)
+        jr_append(journal, mb, ri->key);
+    sb_append(&ri->hist, MB_DATA(mb), mb->len, stats_now());
+    
+    for (i = 0; i < nshards; i++) {
+        if (!room_active(ri, i))
+            continue;
+        
+        m = new shard_msg();
+        m->type = SHARD_BCAST;
+        m->mb = mb;
+        m->room = ri;
+        m->ref.shard = -1;
+        m->ref.fd = -1;
+        m->ref.serial = 0;
+        mb_ref(mb);
+        shard_post(shards[i], m);
+    }
+    
+    mb_unref(mb);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_fanout
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_fanout(struct server* srv, struct msgbuf* mb,
+--                              const struct sess_ref* from,
+--                              struct room_info* ri)
+--              struct server* srv: the shard
+--              struct msgbuf* mb: the framed message
+--              const struct sess_ref* from: the sender, which is skipped
+--              struct room_info* ri: the room
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to queue a message for the members of a room on
+-- one shard.
+------------------------------------------------------------------------------*/
+void srv_fanout(struct server* srv, struct msgbuf* mb, const struct sess_ref* from,
+                struct room_info* ri)
+{
+    std::unordered_map<uint32_t, struct room*>::iterator it;
+    struct  session* c;
+    size_t  i, sent = 0;
+    
+    if ((it = srv->rooms.find(ri->id)) == srv->rooms.end())
+        return;
+    
+    // a congested member may be disconnected while we walk the room, but
+    // sess_kill() only closes sessions later in srv_reap()
+    std::vector<struct session*>& members = it->second->members;
+    
+    for (i = 0; i < members.size(); i++) {
+        c = members[i];
+        if (from->shard != srv->id || c->fd != from->fd || c->serial != from->serial) {
+            sess_send(srv, c, mb, from);
+            sent++;
+        }
+    }
+    
+    STAT_ADD(srv->stats.deliveries, sent);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shard_post
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shard_post(struct server* dst, struct shard_msg* m)
+--              struct server* dst: the shard to send to
+--              struct shard_msg* m: the message, owned by dst from now on
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function may be called from any thread. The eventfd is only written
+-- when the inbox is not already flagged, so a burst of messages costs the
+-- consumer a single wakeup.
+------------------------------------------------------------------------------*/
+void shard_post(struct server* dst, struct shard_msg* m)
+{
+    uint64_t one = 1;
+    
+    mpsc_push(&dst->inbox, &m->node);
+    
+    if (__atomic_exchange_n(&dst->inbox_signaled, 1, __ATOMIC_SEQ_CST) == 0) {
+        if (write(dst->inbox_efd, &one, sizeof(one)) < 0)
+            perror(" - server: eventfd write error.\n");
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_inbox
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_inbox(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the inbox eventfd is readable. The flag is
+-- cleared before the queue is drained, so a message posted meanwhile either
+-- is seen by this drain or triggers another wakeup.
+-- The handoff thread kicks the inbox to start a hot upgrade.
+------------------------------------------------------------------------------*/
+void srv_inbox(struct server* srv)
+{
+    struct  mpsc_node* n;
+    struct  shard_msg* m;
+    struct  session* s;
+    uint64_t cnt;
+    
+    while (read(srv->inbox_efd, &cnt, sizeof(cnt)) > 0)
+        ;
+    
+    __atomic_store_n(&srv->inbox_signaled, 0, __ATOMIC_SEQ_CST);
+    
+    while ((n = mpsc_pop(&srv->inbox)) != NULL) {
+        m = (struct shard_msg*) n;
+        
+        switch (m->type) {
+        case SHARD_BCAST:
+            srv_fanout(srv, m->mb, &m->ref, m->room);
+            mb_unref(m->mb);
+            break;
+        
+        case SHARD_PAUSE:
+            // a client of another shard is congested by one of ours
+            if ((s = sess_lookup(srv, m->ref)) != NULL)
+                s->paused++;
+            break;
+        
+        case SHARD_RESUME:
+            if ((s = sess_lookup(srv, m->ref)) != NULL && --s->paused == 0)
+                srv->resume.push_back(m->ref);
+            break;
+        }
+        
+        delete m;
+    }
+    
+    if (!srv->handoff && ho_pending())
+        srv_quiesce(srv);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_send
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_send(struct server* srv, struct session* s,
+--                             struct msgbuf* mb, const struct sess_ref* from)
+--              struct server* srv: the event loop state
+--              struct session* s: the recipient
+--              struct msgbuf* mb: the framed message
+--              const struct sess_ref* from: the sender, or NULL
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to deliver a message to one client without ever
+-- blocking. With an empty queue and no history being sent, the message is
+-- written straight away and only the part the socket did not take is
+-- queued; otherwise it goes to the back of the queue. Crossing the high-water mark invokes the congestion
+-- policy. A local client gets the message copied into its ring instead.
+-- With --coalesce the message is always queued, and a queue that was empty
+-- is listed to be written by srv_flush(); one that was not is already
+-- listed or waiting for the socket to become writable.
+-- With io_uring nothing is written here: the message is queued and the
+-- session marked, and all marked sessions are written with one submission
+-- at the end of the loop iteration. The kernel has not been offered the
+-- message yet, so the high-water mark is checked when the write completes.
+------------------------------------------------------------------------------*/
+void sess_send(struct server* srv, struct session* s, struct msgbuf* mb,
+               const struct sess_ref* from)
+{
+    int n = 0;
+    
+    if (s->closing)
+        return;
+        
+    if (s->oq.count == 0 && !s->oq.marked && srv->ring == NULL && cfg.coalesce < 0) {
+        if (s->shm != NULL)
+            n = shm_write(s->shm, MB_DATA(mb), mb->len);
+        else
+            n = send(s->fd, MB_DATA(mb), mb->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                sess_kill(srv, s);
+                return;
+            }
+            n = 0;
+        }
+        
+        STAT_ADD(srv->stats.bytes_out, n);
+        if (n == (int) mb->len)
+            return;
+    }
+    
+    if (oq_push(&s->oq, mb, n) < 0) {
+        sess_kill(srv, s);
+        return;
+    }
+    
+    hist_record(&srv->stats.queue_bytes, s->oq.bytes);
+    
+    if (srv->ring != NULL) {
+        if (from != NULL)
+            s->from = *from;
+        else
+            s->from.shard = -1;
+        sess_dirty(srv, s);
+        return;
+    }
+    
+    if (cfg.coalesce >= 0 && s->oq.count == 1 && !s->oq.marked)
+        sess_dirty(srv, s);
+    
+    // the ring was full, the local client has to say when it made room
+    if (s->shm != NULL && cfg.coalesce < 0 && s->oq.count == 1 && !s->oq.marked)
+        shm_idle(srv, s);
+    
+    if (s->oq.bytes > cfg.hwm)
+        sess_congested(srv, s, from);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_flush(struct server* srv, struct session* s)
+--              struct server* srv: the event loop state
+--              struct session* s: the session whose socket became writable
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a client socket becomes writable to send as
+-- much of its queue as possible. Senders paused because of this client are
+-- resumed once the queue drops below the low-water mark.
+-- A history stream goes out once the messages queued before it are sent,
+-- and the rest of the queue after it.
+-- With --coalesce the socket is corked while a flush takes more than one
+-- system call, so the end of one write and the start of the next share
+-- packets.
+-- A local client is written through its ring instead, and woken once at
+-- the end.
+------------------------------------------------------------------------------*/
+void sess_flush(struct server* srv, struct session* s)
+{
+    size_t queued = s->oq.bytes;
+    int cork, on = 1, off = 0;
+    int rc;
+    
+    if (s->closing || (s->oq.count == 0 && !s->oq.marked))
+        return;
+    
+    cork = s->shm == NULL && cfg.coalesce >= 0
+           && (s->oq.count > OQ_IOV_MAX || s->oq.marked);
+    if (cork)
+        setsockopt(s->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    
+    if ((s->shm != NULL ? shm_flush(srv, s) : oq_flush(&s->oq, s->fd)) < 0) {
+        sess_kill(srv, s);
+        return;
+    }
+    
+    if (s->oq.marked && s->oq.mark == 0) {
+        if ((rc = sess_sendfile(srv, s)) < 0) {
+            sess_kill(srv, s);
+            return;
+        }
+        if (rc == 1) {
+            oq_unmark(&s->oq);
+            if ((s->shm != NULL ? shm_flush(srv, s) : oq_flush(&s->oq, s->fd)) < 0) {
+                sess_kill(srv, s);
+                return;
+            }
+        }
+    }
+    
+    if (cork)
+        setsockopt(s->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    
+    STAT_ADD(srv->stats.bytes_out, queued - s->oq.bytes);
+    
+    if (s->shm != NULL)
+        shm_idle(srv, s);
+    
+    if (s->oq.bytes <= cfg.lwm)
+        sess_release(srv, s);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_dirty
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_dirty(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a session with queued output
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to have a session written by the next
+-- srv_flush(), or uring_flush() with io_uring. A session is listed once
+-- however many messages it gets. The first session listed starts the
+-- --coalesce window.
+------------------------------------------------------------------------------*/
+void sess_dirty(struct server* srv, struct session* s)
+{
+    struct sess_ref ref;
+    
+    if (s->dirty)
+        return;
+    
+    if (srv->dirty.empty())
+        srv->flush_at = (cfg.coalesce > 0) ? stats_now() + cfg.coalesce * 1000ULL : 0;
+    
+    ref.shard = srv->id;
+    ref.fd = s->fd;
+    ref.serial = s->serial;
+    srv->dirty.push_back(ref);
+    s->dirty = 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_sendfile
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int sess_sendfile(struct server* srv, struct session* s)
+--              struct server* srv: the event loop state
+--              struct session* s: the session receiving a history
+-- 
+-- RETURNS:     1 once the history is sent, 0 when the socket is full,
+--              -1 on a socket error
+-- 
+-- NOTES:
+-- This function is called to send as much of a history stream as the
+-- socket accepts. The bytes go from the journal's segment files to the
+-- socket with sendfile(), they are never copied through the server. A
+-- local client's ring takes them from the journal's mapping.
+-- A stream that reached a message the writer has not committed yet is
+-- tried again by the session's timer on the next tick.
+------------------------------------------------------------------------------*/
+int sess_sendfile(struct server* srv, struct session* s)
+{
+    char*   data;
+    size_t  len;
+    off_t   off;
+    ssize_t n;
+    int     fd, rc;
+    
+    while ((rc = jr_next(journal, &s->stream, &fd, &data, &len)) > 0) {
+        off = (off_t) s->stream.off;
+        if (s->shm != NULL)
+            n = shm_put(s->shm, data, len);
+        else
+            n = sendfile(s->fd, fd, &off, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        
+        STAT_ADD(srv->stats.bytes_out, n);
+        s->stream.off += n;
+        if ((size_t) n < len)
+            return 0;
+    }
+    
+    if (rc < 0) {
+        tw_add(&srv->wheel, &s->timer, srv->wheel.now + 1);
+        return 0;
+    }
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_congested
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_congested(struct server* srv, struct session* s,
+--                                  const struct sess_ref* from)
+--              struct server* srv: the event loop state
+--              struct session* s: the client whose queue is over the limit
+--              const struct sess_ref* from: the sender of the last message
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a queue crosses the high-water mark and
+-- applies the configured policy:
+--   POLICY_DROP        drop the oldest queued messages of the slow client
+--   POLICY_DISCONNECT  disconnect the slow client
+--   POLICY_PAUSE       stop reading from the sender until the queue drains
+-- Whatever the policy, a queue that reaches HWM_HARD_FACTOR times the
+-- high-water mark is disconnected so memory stays bounded. A sender on
+-- another shard is paused through that shard's inbox.
+------------------------------------------------------------------------------*/
+void sess_congested(struct server* srv, struct session* s, const struct sess_ref* from)
+{
+    struct  session* sender;
+    struct  shard_msg* m;
+    size_t  i;
+    
+    switch (cfg.policy) {
+    case POLICY_DROP:
+        STAT_ADD(srv->stats.dropped, oq_drop_oldest(&s->oq, cfg.hwm));
+        break;
+    
+    case POLICY_DISCONNECT:
+        printf(" - Slow client disconnected: [%s]\n", s->info);
+        STAT_ADD(srv->stats.slow_kills, 1);
+        sess_kill(srv, s);
+        return;
+    
+    case POLICY_PAUSE:
+        if (from == NULL || from->shard < 0)
+            break;
+        
+        for (i = 0; i < s->blocked.size(); i++) {
+            if (s->blocked[i].shard == from->shard && s->blocked[i].fd == from->fd
+                && s->blocked[i].serial == from->serial)
+                break;
+        }
+        
+        if (i < s->blocked.size())
+            break;
+        
+        if (from->shard == srv->id) {
+            if ((sender = sess_lookup(srv, *from)) == NULL)
+                break;
+            sender->paused++;
+        } else {
+            m = new shard_msg();
+            m->type = SHARD_PAUSE;
+            m->ref = *from;
+            shard_post(shards[from->shard], m);
+        }
+        s->blocked.push_back(*from);
+        break;
+    }
+    
+    if (s->oq.bytes > cfg.hwm * HWM_HARD_FACTOR) {
+        printf(" - Slow client disconnected: [%s]\n", s->info);
+        STAT_ADD(srv->stats.slow_kills, 1);
+        sess_kill(srv, s);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_release
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_release(struct server* srv, struct session* s)
+--              struct server* srv: the event loop state
+--              struct session* s: the recipient that no longer blocks anyone
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to drop the pauses a recipient put on senders.
+-- A sender whose last pause is lifted is scheduled for reading, since
+-- edge-triggered epoll will not report the data already waiting for it.
+-- Senders on other shards are resumed through their shard's inbox.
+------------------------------------------------------------------------------*/
+void sess_release(struct server* srv, struct session* s)
+{
+    struct  session* sender;
+    struct  shard_msg* m;
+    size_t  i;
+    
+    for (i = 0; i < s->blocked.size(); i++) {
+        if (s->blocked[i].shard != srv->id) {
+            m = new shard_msg();
+            m->type = SHARD_RESUME;
+            m->ref = s->blocked[i];
+            shard_post(shards[m->ref.shard], m);
+            continue;
+        }
+        
+        sender = sess_lookup(srv, s->blocked[i]);
+        if (sender != NULL && --sender->paused == 0)
+            srv->resume.push_back(s->blocked[i]);
+    }
+    
+    s->blocked.clear();
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_kill
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_kill(struct server* srv, struct session* s)
+--              struct server* srv: the event loop state
+--              struct session* s: the session to close
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to schedule a session for closing. The session is
+-- closed by srv_reap() once the current batch of events is handled, so a
+-- broadcast can safely walk the client list while recipients fail, and a
+-- recycled fd can never receive an event meant for the old session.
+-- With io_uring the socket is shut down so the requests the kernel holds
+-- for it complete, the session is only closed after the last one.
+------------------------------------------------------------------------------*/
+void sess_kill(struct server* srv, struct session* s)
+{
+    if (s->closing)
+        return;
+    
+    s->closing = 1;
+    srv->closing.push_back(s);
+    
+    if (srv->ring != NULL)
+        shutdown(s->fd, SHUT_RDWR);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_reply
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_reply(struct server* srv, struct session* s,
+--                              const char* line)
+--              struct server* srv: the shard
+--              struct session* s: the client to answer
+--              const char* line: the text to send
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to send a server message to a single client.
+------------------------------------------------------------------------------*/
+void sess_reply(struct server* srv, struct session* s, const char* line)
+{
+    struct msgbuf* mb;
+    
+    if ((mb = mb_frame(FRAME_TEXT, 0, line, strlen(line))) == NULL)
+        return;
+    
+    sess_send(srv, s, mb, NULL);
+    mb_unref(mb);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_replay
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void sess_replay(struct server* srv, struct session* s,
+--                               struct room_info* ri)
+--              struct server* srv: the shard
+--              struct session* s: the client catching up
+--              struct room_info* ri: the room
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to send a client the room's recent messages,
+-- limited by --history and --history-secs. They are copied out of the
+-- scrollback into one buffer, so the client gets them in a single write.
+-- The copies go without their journal ids: the client only has ids for
+-- the messages it must not show twice after a /resume.
+------------------------------------------------------------------------------*/
+void sess_replay(struct server* srv, struct session* s, struct room_info* ri)
+{
+    struct  msgbuf* mb;
+    uint64_t now = stats_now(), since = 0;
+    
+    if (cfg.history_secs > 0 && now > (uint64_t) cfg.history_secs * 1000000000ULL)
+        since = now - (uint64_t) cfg.history_secs * 1000000000ULL;
+    
+    if ((mb = sb_replay(&ri->hist, cfg.history, since)) == NULL)
+        return;
+    
+    mb->len = (uint32_t) frame_unstamp(MB_DATA(mb), mb->len);
+    sess_send(srv, s, mb, NULL);
+    mb_unref(mb);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_history
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int sess_history(struct server* srv, struct session* s,
+--                               uint64_t after)
+--              struct server* srv: the shard
+--              struct session* s: the client, with no history being sent
+--              uint64_t after: the last message id the client has
+-- 
+-- RETURNS:     0 if the history is on its way, -1 if the journal holds no
+--              messages after that id
+-- 
+-- NOTES:
+-- This function is called to send a client the journaled messages after
+-- an id. A reply announces the ids sent, then the stream follows it and
+-- the messages queued later wait behind the mark. Only the messages of the
+-- rooms the client is in are sent, the others are stepped over.
+------------------------------------------------------------------------------*/
+int sess_history(struct server* srv, struct session* s, uint64_t after)
+{
+    char    reply[BUF_SIZE];
+    
+    if (jr_seek(journal, after, &s->stream) < 0)
+        return -1;
+    s->stream.keep = sess_reads;
+    s->stream.arg = s;
+    
+    snprintf(reply, sizeof(reply), "%sHistory #%llu-#%llu:%s\n", GRN,
+             (unsigned long long) s->stream.first,
+             (unsigned long long) s->stream.upto, RESET);
+    sess_reply(srv, s, reply);
+    oq_mark(&s->oq);
+    if (srv->ring != NULL)
+        sess_dirty(srv, s);
+    else
+        sess_flush(srv, s);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_reads
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int sess_reads(void* arg, uint64_t room)
+--              void* arg: the session a history is sent to
+--              uint64_t room: key of a journaled message's room
+-- 
+-- RETURNS:     1 if the session is in the room, 0 otherwise
+-- 
+-- NOTES:
+-- This function is the filter of a session's history stream. It looks at
+-- the rooms the session is in as the stream goes, so a room left halfway
+-- is not read any further.
+------------------------------------------------------------------------------*/
+int sess_reads(void* arg, uint64_t room)
+{
+    struct session* s = (struct session*) arg;
+    size_t i;
+    
+    for (i = 0; i < s->rooms.size(); i++) {
+        if (s->rooms[i].room->info->key == room)
+            return 1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_resume
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void sess_resume(struct server* srv, struct session* s,
+--                               char* line)
+--              struct server* srv: the shard
+--              struct session* s: a session with no nickname yet
+--              char* line: "/resume id nickname [room ...]"
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for a client that lost its connection and came
+-- back. It takes the nickname, joins the rooms again in the order given,
+-- the last one becomes the room talked to, and sends the journaled
+-- messages of those rooms after id instead of the scrollbacks. With id 0,
+-- or without a journal, the client gets the scrollback of every room like
+-- a new one.
+-- The client gives the id before its oldest gap, not the last it got,
+-- since messages reach a client slightly out of id order; it drops what
+-- it already had. The client lists the default room like any other, so
+-- a list without it means the client had left it: the session leaves it
+-- again before it is named, unseen. The history runs up to the last id handed out once the
+-- rooms are joined, so a message sent to them just before is either
+-- streamed or comes live, never neither.
+------------------------------------------------------------------------------*/
+void sess_resume(struct server* srv, struct session* s, char* line)
+{
+    struct  room_info* ri;
+    struct  room* r;
+    unsigned long long after;
+    char    name[MAX_NAME];
+    char    word[ROOM_NAME_MAX];
+    char*   room;
+    char*   p;
+    size_t  i, had;
+    int     n, m, rooms = 0, lobby = 0;
+    
+    if (sscanf(line + 7, " %llu %99s%n", &after, name, &n) != 2) {
+        sess_reply(srv, s, RED "Usage: /resume id nickname [room ...]" RESET "\n");
+        return;
+    }
+    
+    for (p = line + 7 + n; sscanf(p, " %31s%n", word, &m) == 1; p += m, rooms++)
+        lobby |= strcmp((word[0] == '#') ? word + 1 : word, ROOM_DEFAULT) == 0;
+    for (i = 0; rooms > 0 && !lobby && i < s->rooms.size(); i++) {
+        if (s->rooms[i].room->info == default_room) {
+            sess_part(srv, s, s->rooms[i].room);
+            break;
+        }
+    }
+    
+    snprintf(s->name, MAX_NAME, "%s", name);
+    sess_decorate(s);
+    sess_named(srv, s);
+    
+    for (p = line + 7 + n; sscanf(p, " %31s%n", word, &n) == 1; p += n) {
+        room = (word[0] == '#') ? word + 1 : word;
+        if (!room_valid(room))
+            continue;
+        
+        had = s->rooms.size();
+        if ((ri = room_intern(room)) == NULL
+            || (r = sess_join(srv, s, ri)) == NULL)
+            continue;
+        
+        s->room = r;
+        if (s->rooms.size() > had)
+            sess_presence(srv, s, ri, 1);
+    }
+    
+    if (after > 0 && journal != NULL) {
+        sess_history(srv, s, after);
+        return;
+    }
+    
+    for (i = 0; i < s->rooms.size(); i++)
+        sess_replay(srv, s, s->rooms[i].room->info);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_decorate
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_decorate(struct session* s)
+--              struct session* s: the session whose name or info changed
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called whenever the nickname or the user info is set to
+-- build what goes around every message of the session:
+--      prefix  <yellow>name:
+--      suffix   <cyan>[from hostname:ip:fd]<reset>\n
+------------------------------------------------------------------------------*/
+void sess_decorate(struct session* s)
+{
+    s->prefixlen = snprintf(s->prefix, sizeof(s->prefix), "%s%s: ", YEL, s->name);
+    s->suffixlen = snprintf(s->suffix, sizeof(s->suffix), " %s[from %s]%s\n",
+                            CYN, s->info, RESET);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_format
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct msgbuf* sess_format(struct session* s,
+--                                         struct room_info* ri,
+--                                         const char* text, size_t len)
+--              struct session* s: the sender
+--              struct room_info* ri: the room the message goes to
+--              const char* text: the chat text, not NUL terminated
+--              size_t len: the length of the text
+-- 
+-- RETURNS:     the framed message, NULL if memory runs out
+-- 
+-- NOTES:
+-- This function is called for every chat message to frame
+--      [id ][#room ]prefix text suffix
+-- The pieces are copied one after the other into the message buffer, with
+-- no formatting and no buffer in between. The id is only there with a
+-- journal, which fills it in. The text loses its newline, the suffix
+-- brings one, and is cut so the payload, id aside, stays below BUF_SIZE.
+------------------------------------------------------------------------------*/
+struct msgbuf* sess_format(struct session* s, struct room_info* ri,
+                           const char* text, size_t len)
+{
+    struct  msgbuf* mb;
+    size_t  namelen = 0, taglen = 0, room, total;
+    size_t  idlen = (journal != NULL) ? FRAME_ID_SIZE : 0;
+    char*   p;
+    
+    if (ri != default_room) {
+        namelen = strlen(ri->name);
+        taglen = sizeof(GRN) - 1 + 1 + namelen + sizeof(RESET) - 1 + 1;
+    }
+    
+    if (len > 0 && text[len - 1] == '\n')
+        len--;
+    room = BUF_SIZE - 1 - taglen - s->prefixlen - s->suffixlen;
+    if (len > room)
+        len = room;
+    
+    total = idlen + taglen + s->prefixlen + len + s->suffixlen;
+    if ((mb = mb_alloc(FRAME_HDR_SIZE + total)) == NULL)
+        return NULL;
+    
+    p = MB_DATA(mb);
+    frame_header(p, FRAME_TEXT, idlen ? FRAME_F_ID : 0, total);
+    p += FRAME_HDR_SIZE;
+    memset(p, 0, idlen);
+    p += idlen;
+    
+    if (taglen > 0) {
+        memcpy(p, GRN "#", sizeof(GRN));
+        p += sizeof(GRN);
+        memcpy(p, ri->name, namelen);
+        p += namelen;
+        memcpy(p, RESET " ", sizeof(RESET));
+        p += sizeof(RESET);
+    }
+    
+    memcpy(p, s->prefix, s->prefixlen);
+    p += s->prefixlen;
+    memcpy(p, text, len);
+    p += len;
+    memcpy(p, s->suffix, s->suffixlen);
+    return mb;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_throttle
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void sess_throttle(struct server* srv, struct session* s,
+--                                 size_t len)
+--              struct server* srv: the shard
+--              struct session* s: the session a frame came from
+--              size_t len: the payload length of the frame
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to charge a frame to the session's token
+-- buckets. A session that goes into debt is paused until the bucket that
+-- is deepest in debt is back to zero, then srv_wake() lets it go. Its
+-- socket is not read meanwhile, so TCP flow control pushes back on the
+-- client instead of the server buffering for it. The notice is only sent
+-- every THROTTLE_NOTICE seconds, so a flooder cannot use it to fill its own
+-- queue either.
+------------------------------------------------------------------------------*/
+void sess_throttle(struct server* srv, struct session* s, size_t len)
+{
+    struct  sess_timer t;
+    uint64_t now = stats_now();
+    uint64_t wait = 0, w;
+    
+    if (cfg.rate_msgs > 0)
+        wait = tb_take(&s->tb_msgs, cfg.rate_msgs, cfg.rate_msgs, 1, now);
+    if (cfg.rate_bytes > 0) {
+        w = tb_take(&s->tb_bytes, cfg.rate_bytes, cfg.rate_bytes, len, now);
+        if (w > wait)
+            wait = w;
+    }
+    if (wait == 0 || s->throttled)
+        return;
+    
+    s->throttled = 1;
+    s->paused++;
+    t.when = now + wait;
+    t.ref.shard = srv->id;
+    t.ref.fd = s->fd;
+    t.ref.serial = s->serial;
+    srv->throttled.push_back(t);
+    std::push_heap(srv->throttled.begin(), srv->throttled.end(), timer_later);
+    STAT_ADD(srv->stats.throttles, 1);
+    
+    if (s->noticed == 0 || now - s->noticed >= THROTTLE_NOTICE * 1000000000ULL) {
+        s->noticed = now;
+        sess_reply(srv, s, RED "You are sending too fast, "
+                   "your messages are being delayed." RESET "\n");
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_yield
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void sess_yield(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a session out of read budget
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a session used up its READ_BUDGET frames
+-- for this loop iteration. It is paused until the next iteration, after
+-- every other ready session had its turn.
+------------------------------------------------------------------------------*/
+void sess_yield(struct server* srv, struct session* s)
+{
+    struct  sess_ref ref;
+    
+    if (s->yielded)
+        return;
+    
+    s->yielded = 1;
+    s->paused++;
+    ref.shard = srv->id;
+    ref.fd = s->fd;
+    ref.serial = s->serial;
+    srv->yielded.push_back(ref);
+    STAT_ADD(srv->stats.yields, 1);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_join
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct room* sess_join(struct server* srv, struct session* s,
+--                                     struct room_info* ri)
+--              struct server* srv: the shard
+--              struct session* s: the session joining
+--              struct room_info* ri: the room to join
+-- 
+-- RETURNS:     the shard's room, NULL if memory runs out
+-- 
+-- NOTES:
+-- This function is called to add a session to a room. The shard's part of
+-- the room is created with its first member, and a named session is put on
+-- the room's roster, here and on the other servers. Joining a room twice
+-- is harmless.
+------------------------------------------------------------------------------*/
+struct room* sess_join(struct server* srv, struct session* s, struct room_info* ri)
+{
+    struct  membership ms;
+    struct  room* r;
+    size_t  i;
+    
+    if (ri == NULL)
+        return NULL;
+    
+    for (i = 0; i < s->rooms.size(); i++) {
+        if (s->rooms[i].room->info == ri)
+            return s->rooms[i].room;
+    }
+    
+    if ((r = srv->rooms[ri->id]) == NULL) {
+        r = new room();
+        r->info = ri;
+        srv->rooms[ri->id] = r;
+    }
+    
+    ms.room = r;
+    ms.idx = r->members.size();
+    r->members.push_back(s);
+    s->rooms.push_back(ms);
+    room_count(ri, srv->id, 1);
+    if (s->name[0] != '\0') {
+        room_enter(ri, s->name);
+        peer_presence(ri->name, s->name, 1);
+    }
+    return r;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_part
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_part(struct server* srv, struct session* s,
+--                             struct room* r)
+--              struct server* srv: the shard
+--              struct session* s: the session leaving
+--              struct room* r: a room the session is in
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to remove a session from a room. The last member
+-- is moved into the freed seat, so leaving costs no more than the number of
+-- rooms the moved member is in. If the session was talking in the room it
+-- switches to the room it joined last. An empty room is freed.
+------------------------------------------------------------------------------*/
+void sess_part(struct server* srv, struct session* s, struct room* r)
+{
+    struct  session* last;
+    size_t  i, j;
+    
+    for (i = 0; i < s->rooms.size() && s->rooms[i].room != r; i++)
+        ;
+    if (i == s->rooms.size())
+        return;
+    
+    // fill the hole with the room's last member and fix its seat
+    last = r->members.back();
+    r->members[s->rooms[i].idx] = last;
+    r->members.pop_back();
+    for (j = 0; j < last->rooms.size(); j++) {
+        if (last->rooms[j].room == r)
+            last->rooms[j].idx = s->rooms[i].idx;
+    }
+    
+    s->rooms.erase(s->rooms.begin() + i);
+    room_count(r->info, srv->id, -1);
+    if (s->name[0] != '\0') {
+        room_leave(r->info, s->name);
+        peer_presence(r->info->name, s->name, 0);
+    }
+    
+    if (s->room == r)
+        s->room = s->rooms.empty() ? NULL : s->rooms.back().room;
+    
+    if (r->members.empty()) {
+        srv->rooms.erase(r->info->id);
+        delete r;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_named
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_named(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a session that just got its nickname
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once a session has a nickname, by "/name" or
+-- "/resume". An unnamed member is on no roster, so it enters the rosters
+-- of the rooms it is already in, and joins them as far as the other
+-- members can tell.
+------------------------------------------------------------------------------*/
+void sess_named(struct server* srv, struct session* s)
+{
+    size_t i;
+    
+    for (i = 0; i < s->rooms.size(); i++) {
+        room_enter(s->rooms[i].room->info, s->name);
+        peer_presence(s->rooms[i].room->info->name, s->name, 1);
+        sess_presence(srv, s, s->rooms[i].room->info, 1);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_presence
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_presence(struct server* srv, struct session* s,
+--                                 struct room_info* ri, int join)
+--              struct server* srv: the shard
+--              struct session* s: a named session
+--              struct room_info* ri: the room joined or left
+--              int join: 1 for a join, 0 for a leave
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every join and leave to announce. It is
+-- added to the room's notice for the iteration. A notice the name would
+-- grow past PRESENCE_MAX bytes is sent first, so that every notice fits a
+-- scrollback slot and is replayed to those who join later.
+------------------------------------------------------------------------------*/
+void sess_presence(struct server* srv, struct session* s, struct room_info* ri, int join)
+{
+    struct presence* q = &srv->presence[ri->id];
+    size_t room = strlen(ri->name);
+    size_t joins = q->joins.size();
+    size_t parts = q->parts.size();
+    size_t& grown = join ? joins : parts;
+    
+    grown += (grown > 0 ? 2 : 0) + strlen(s->name);
+    if (q->count > 0 && notice_line(joins, " join #", room)
+            + notice_line(parts, " leave #", room) > PRESENCE_MAX) {
+        srv_announce(srv, q);
+        srv->presence.erase(ri->id);
+    }
+    
+    struct presence& p = srv->presence[ri->id];
+    std::string& names = join ? p.joins : p.parts;
+    
+    if (p.count == 0) {
+        p.room = ri;
+        p.from.shard = srv->id;
+        p.from.fd = s->fd;
+        p.from.serial = s->serial;
+    }
+    
+    // the one joining does not need to be told, unless others are
+    if (p.count++ > 0 || !join)
+        p.from.shard = -1;
+    
+    if (!names.empty())
+        names += ", ";
+    names += s->name;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_presence
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_presence(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called at the end of a loop iteration to send the
+-- notices gathered during it, one per room.
+------------------------------------------------------------------------------*/
+void srv_presence(struct server* srv)
+{
+    std::unordered_map<uint32_t, struct presence>::iterator it;
+    
+    for (it = srv->presence.begin(); it != srv->presence.end(); ++it)
+        srv_announce(srv, &it->second);
+    srv->presence.clear();
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_announce
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_announce(struct server* srv, struct presence* p)
+--              struct server* srv: the shard
+--              struct presence* p: the joins and leaves of a room
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to broadcast a room's notice, one frame of
+-- "a, b join #room..." and "c leave #room..." lines. A single join reads
+-- as it always did and skips the one joining; a notice of several names
+-- goes to every member. The other servers get it as a message, their
+-- rosters follow the joins and leaves relayed by sess_join() and
+-- sess_part().
+------------------------------------------------------------------------------*/
+void srv_announce(struct server* srv, struct presence* p)
+{
+    struct  msgbuf* mb;
+    std::string text;
+    const   char* nick;
+    
+    if (!p->joins.empty())
+        text += MAG + p->joins + " join #" + p->room->name + "..." RESET "\n";
+    if (!p->parts.empty())
+        text += MAG + p->parts + " leave #" + p->room->name + "..." RESET "\n";
+    
+    nick = (p->count == 1) ? (p->joins.empty() ? p->parts.c_str() : p->joins.c_str()) : "";
+    
+    if ((mb = mb_frame(FRAME_TEXT, (journal != NULL) ? FRAME_F_ID : 0,
+                       text.data(), text.size())) != NULL)
+        broadcast_from(srv, &p->from, nick, p->room, mb, PEER_MSG);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_lookup
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct session* sess_lookup(struct server* srv,
+--                                          struct sess_ref ref)
+--              struct server* srv: the shard owning the session
+--              struct sess_ref ref: shard, fd and serial # of a session
+-- 
+-- RETURNS:     the session, or NULL if it has gone away
+-- 
+-- NOTES:
+-- The serial # tells a live session apart from a later one that happens to
+-- reuse the same fd.
+------------------------------------------------------------------------------*/
+struct session* sess_lookup(struct server* srv, struct sess_ref ref)
+{
+    struct session* s;
+    
+    if (ref.shard != srv->id || ref.fd < 0 || ref.fd >= srv->tabsize)
+        return NULL;
+    
+    s = srv->fdtab[ref.fd];
+    if (s == NULL || s->serial != ref.serial || s->closing)
+        return NULL;
+    
+    return s;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_wake
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void srv_wake(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called at the start of every loop iteration, before
+-- the new events are handled. It starts a new read budget, lifts the
+-- pause of the sessions that yielded in the last iteration and of the
+-- throttled sessions whose deadline has passed, and leaves them to
+-- srv_reap() to be read again. Then it runs the session timers that are
+-- due.
+------------------------------------------------------------------------------*/
+void srv_wake(struct server* srv)
+{
+    std::vector<struct sess_timer>& heap = srv->throttled;
+    struct  sess_ref ref;
+    struct  session* s;
+    uint64_t now;
+    size_t  i;
+    
+    now = stats_now();
+    srv->iter++;
+    
+    for (i = 0; i < srv->yielded.size(); i++) {
+        if ((s = sess_lookup(srv, srv->yielded[i])) == NULL || !s->yielded)
+            continue;
+        s->yielded = 0;
+        if (--s->paused == 0)
+            srv->resume.push_back(srv->yielded[i]);
+    }
+    srv->yielded.clear();
+    
+    while (!heap.empty() && heap.front().when <= now) {
+        ref = heap.front().ref;
+        std::pop_heap(heap.begin(), heap.end(), timer_later);
+        heap.pop_back();
+        if ((s = sess_lookup(srv, ref)) == NULL || !s->throttled)
+            continue;
+        s->throttled = 0;
+        if (--s->paused == 0)
+            srv->resume.push_back(ref);
+    }
+    
+    tw_advance(&srv->wheel, now / TICK_NS, srv_timer, srv);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_timeout
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int64_t srv_timeout(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     nanoseconds the loop may wait for events, -1 for no limit
+-- 
+-- NOTES:
+-- This function is called before waiting for events. Sessions that
+-- yielded are read again in the next iteration whether or not anything
+-- happens, and so are the connections left over by srv_accept(), so the
+-- loop does not wait at all; otherwise it waits until
+-- the coalesced output is due, the first throttled session may talk
+-- again or the timer wheel has work, whichever comes first.
+------------------------------------------------------------------------------*/
+int64_t srv_timeout(struct server* srv)
+{
+    uint64_t now, when = UINT64_MAX, tick;
+    
+    if (!srv->yielded.empty() || srv->accept_more)
+        return 0;
+    
+    if (!srv->dirty.empty())
+        when = srv->flush_at;
+    if (!srv->throttled.empty())
+        when = std::min(when, srv->throttled.front().when);
+    if ((tick = tw_next(&srv->wheel)) != UINT64_MAX)
+        when = std::min<uint64_t>(when, tick * TICK_NS);
+    if (when == UINT64_MAX)
+        return -1;
+    
+    now = stats_now();
+    return (when > now) ? when - now : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_flush_due
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int srv_flush_due(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     1 if the listed sessions are to be written now, 0 otherwise
+-- 
+-- NOTES:
+-- This function is called at the end of a loop iteration. Without a
+-- --coalesce window the output is due right away.
+------------------------------------------------------------------------------*/
+int srv_flush_due(struct server* srv)
+{
+    if (srv->dirty.empty())
+        return 0;
+    return (srv->flush_at == 0 || stats_now() >= srv->flush_at) ? 1 : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_flush(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to write the coalesced output of every session
+-- listed by sess_dirty(), one writev() each. What a socket does not take
+-- stays queued until epoll reports it writable.
+------------------------------------------------------------------------------*/
+void srv_flush(struct server* srv)
+{
+    std::vector<struct sess_ref> dirty;
+    struct  session* s;
+    size_t  i;
+    
+    dirty.swap(srv->dirty);
+    for (i = 0; i < dirty.size(); i++) {
+        if ((s = sess_lookup(srv, dirty[i])) == NULL)
+            continue;
+        s->dirty = 0;
+        sess_flush(srv, s);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_timer
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_timer(void* arg, struct tw_timer* t)
+--              void* arg: the shard
+--              struct tw_timer* t: the session timer that fired
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by the timer wheel for each session deadline
+-- that has come.
+------------------------------------------------------------------------------*/
+void srv_timer(void* arg, struct tw_timer* t)
+{
+    sess_timeout((struct server*) arg, (struct session*) t->arg);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sess_timeout
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void sess_timeout(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: the session
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a session's timer fires, and once when the
+-- session is accepted. It checks every deadline of the session against the
+-- current tick, drops the client if one has passed, pings it if it has
+-- been silent for --ping seconds, and sets the timer to the earliest
+-- deadline left. Receiving a frame does not touch the timer, so a busy
+-- client costs nothing here until its deadline comes and turns out to
+-- have moved. A history stream at the front of the queue is pushed on
+-- every tick while it lasts, it may be waiting for the journal's writer.
+------------------------------------------------------------------------------*/
+void sess_timeout(struct server* srv, struct session* s)
+{
+    uint64_t now = srv->wheel.now;
+    uint64_t next = UINT64_MAX;
+    uint64_t when;
+    
+    if (s->closing)
+        return;
+    
+    if (cfg.handshake_secs > 0 && s->name[0] == '\0') {
+        if ((when = s->born + SECS_TICKS(cfg.handshake_secs)) <= now) {
+            sess_reply(srv, s, RED "No nickname given in time, bye." RESET "\n");
+            STAT_ADD(srv->stats.timeouts, 1);
+            sess_kill(srv, s);
+            return;
+        }
+        next = when;
+    }
+    
+    if (cfg.idle_secs > 0) {
+        if ((when = s->talk_at + SECS_TICKS(cfg.idle_secs)) <= now) {
+            sess_reply(srv, s, RED "Idle for too long, bye." RESET "\n");
+            STAT_ADD(srv->stats.timeouts, 1);
+            sess_kill(srv, s);
+            return;
+        }
+        next = std::min(next, when);
+    }
+    
+    if (cfg.ping_secs > 0) {
+        // a paused session is not read, its silence proves nothing
+        if (s->paused)
+            s->rx_at = now;
+        if (s->ping_at > s->rx_at) {
+            // nothing came back since the ping, the peer is gone
+            if ((when = s->ping_at + SECS_TICKS(cfg.pong_secs)) <= now) {
+                STAT_ADD(srv->stats.timeouts, 1);
+                sess_kill(srv, s);
+                return;
+            }
+        } else if ((when = s->rx_at + SECS_TICKS(cfg.ping_secs)) <= now) {
+            sess_send(srv, s, srv->ping, NULL);
+            STAT_ADD(srv->stats.pings, 1);
+            s->ping_at = now;
+            when = now + SECS_TICKS(cfg.pong_secs);
+        }
+        next = std::min(next, when);
+    }
+    
+    if (s->stream.active && s->oq.marked && s->oq.mark == 0) {
+        if (srv->ring != NULL)
+            sess_dirty(srv, s);
+        else
+            sess_flush(srv, s);
+        if (s->closing)
+            return;
+        if (s->stream.active)
+            next = std::min(next, now + 1);
+    }
+    
+    if (next != UINT64_MAX)
+        tw_add(&srv->wheel, &s->timer, next);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_reap
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_reap(struct server* srv)
+--              struct server* srv: the event loop state
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called after each batch of events. Resumed senders are
+-- read first, since that can pause or close more sessions, then every
+-- session scheduled by sess_kill() is closed. A session with io_uring
+-- requests in flight is marked instead and closed when the last one
+-- completes.
+------------------------------------------------------------------------------*/
+void srv_reap(struct server* srv)
+{
+    std::vector<struct sess_ref> resume;
+    struct  session* s;
+    size_t  i;
+    
+    while (!srv->resume.empty() || !srv->closing.empty()) {
+        resume.swap(srv->resume);
+        for (i = 0; i < resume.size(); i++) {
+            if ((s = sess_lookup(srv, resume[i])) == NULL)
+                continue;
+            if (srv->ring != NULL)
+                uring_resume(srv, s);
+            else
+                srv_read(srv, s);
+        }
+        resume.clear();
+        
+        // closing releases paused senders, which refills srv->resume
+        for (i = 0; i < srv->closing.size(); i++) {
+            s = srv->closing[i];
+            if (s->inflight > 0) {
+                s->closing = 2;
+                continue;
+            }
+            srv_close(srv, s);
+        }
+        srv->closing.clear();
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_quiesce
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_quiesce(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a hot upgrade starts. Every session gets
+-- one more pause, so nothing is read and the input stays in the sockets
+-- for the new server; output still goes out. With io_uring the accept
+-- and the receives are cancelled as well.
+------------------------------------------------------------------------------*/
+void srv_quiesce(struct server* srv)
+{
+    int i;
+    
+    srv->handoff = 1;
+    for (i = 0; i < srv->nclients; i++)
+        srv->clients[i]->paused++;
+    
+    if (srv->ring != NULL)
+        uring_quiesce(srv);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_handoff
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_handoff(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void, only when the hot upgrade failed or cannot go on yet
+-- 
+-- NOTES:
+-- This function is called at the end of every loop iteration once
+-- srv_quiesce() ran, and goes ahead as soon as the kernel holds nothing
+-- of the shard's. It waits for the other shards to stop too, takes the
+-- last messages they posted, writes what the sockets take and hands the
+-- sessions over (see handoff.c). If the new server fails, the pauses are
+-- lifted again and the shard carries on.
+------------------------------------------------------------------------------*/
+void srv_handoff(struct server* srv)
+{
+    struct  session* s;
+    struct  sess_ref ref;
+    int     i;
+    
+    if (srv->ring != NULL && !uring_quiet(srv))
+        return;
+    
+    ho_sync();
+    srv_inbox(srv);
+    
+    if (srv->ring != NULL) {
+        uring_drain(srv);
+    } else {
+        for (i = 0; i < srv->nclients; i++)
+            sess_flush(srv, srv->clients[i]);
+    }
+    srv_reap(srv);
+    if (!srv->cap.empty())
+        cap_flush(&srv->cap);
+    
+    ho_finish(ho_send(srv) == 0);
+    
+    srv->handoff = 0;
+    for (i = 0; i < srv->nclients; i++) {
+        s = srv->clients[i];
+        if (--s->paused > 0)
+            continue;
+        ref.shard = srv->id;
+        ref.fd = s->fd;
+        ref.serial = s->serial;
+        srv->resume.push_back(ref);
+    }
+    
+    if (srv->ring != NULL)
+        uring_reopen(srv);
+    srv_reap(srv);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_adopt
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void srv_adopt(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called on the shard's thread before its loop starts,
+-- to set up the sessions handed over to it like srv_admit() does for a new
+-- connection, but with the nickname, userinfo and rooms they had. The
+-- socket is switched to the mode of this shard's backend, which may not be
+-- the one of the old server. The input held by the old decoder is handled
+-- first; the queued output is split back into frames, and a /history
+-- stream carries on from the journal where it was.
+------------------------------------------------------------------------------*/
+void srv_adopt(struct server* srv)
+{
+    struct  epoll_event ev;
+    struct  ho_session* hs;
+    struct  session* s;
+    struct  sess_ref ref;
+    struct  msgbuf* mb;
+    struct  room* r;
+    const char* p;
+    size_t  i, j, left, n;
+    int     on = 1, streaming, rc;
+    
+    for (i = 0; i < srv->adopt.size(); i++) {
+        hs = &srv->adopt[i];
+        
+        if (srv->nclients >= srv->maxclients || hs->fd >= srv->tabsize
+            || (s = sess_new(srv)) == NULL) {
+            STAT_ADD(srv->stats.rejects, 1);
+            close(hs->fd);
+            continue;
+        }
+        
+        s->fd = hs->fd;
+        snprintf(s->name, sizeof(s->name), "%s", hs->name.c_str());
+        snprintf(s->info, sizeof(s->info), "%s", hs->info.c_str());
+        
+        if (cfg.coalesce >= 0)
+            setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        
+        if (srv->ring == NULL) {
+            set_nonblock(s->fd);
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = s->fd;
+            if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+                perror(" - server: epoll_ctl error.\n");
+                close(s->fd);
+                sess_free(srv, s);
+                continue;
+            }
+        } else {
+            fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL, 0) & ~O_NONBLOCK);
+        }
+        
+        s->slot = srv->nclients;
+        srv->clients[srv->nclients++] = s;
+        srv->fdtab[s->fd] = s;
+        if (cfg.capture_path != NULL)
+            cap_record(&srv->cap, CAP_OPEN, srv->id, s->serial, NULL, 0);
+        for (j = 0; j < hs->rooms.size(); j++) {
+            r = sess_join(srv, s, room_intern(hs->rooms[j].c_str()));
+            if ((int) j == hs->current)
+                s->room = r;
+        }
+        sess_decorate(s);
+        
+        s->born = s->rx_at = s->talk_at = srv->wheel.now;
+        sess_timeout(srv, s);
+        
+        if (!hs->input.empty()
+            && dec_hold(&s->dec, hs->input.data(), hs->input.size()) < 0) {
+            sess_kill(srv, s);
+            continue;
+        }
+        
+        // the frames behind the mark wait for the history, as they did
+        streaming = hs->mark >= 0 && journal != NULL
+                    && jr_import(journal, &hs->stream, &s->stream) == 0;
+        s->stream.keep = sess_reads;
+        s->stream.arg = s;
+        p = hs->output.data();
+        left = hs->output.size();
+        while ((n = frame_size(p, left)) > 0) {
+            if (streaming && !s->oq.marked && p - hs->output.data() >= hs->mark)
+                oq_mark(&s->oq);
+            if ((mb = mb_alloc(n)) == NULL)
+                break;
+            memcpy(MB_DATA(mb), p, n);
+            rc = oq_push(&s->oq, mb, (p == hs->output.data()) ? hs->sent : 0);
+            mb_unref(mb);
+            if (rc < 0)
+                break;
+            p += n;
+            left -= n;
+        }
+        if (streaming && !s->oq.marked)
+            oq_mark(&s->oq);
+        
+        // a frame cut short would garble everything after it
+        if (left > 0 || (hs->mark >= 0 && !streaming)) {
+            sess_kill(srv, s);
+            continue;
+        }
+        if (s->oq.count > 0 || s->oq.marked)
+            sess_dirty(srv, s);
+        
+        ref.shard = srv->id;
+        ref.fd = s->fd;
+        ref.serial = s->serial;
+        srv->resume.push_back(ref);
+        
+        printf(" - Connection adopted: [%s]\n", s->info);
+    }
+    
+    srv->adopt.clear();
+    srv_reap(srv);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    parse_policy
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int parse_policy(const char* name)
+--              const char* name: "drop", "disconnect" or "pause"
+-- 
+-- RETURNS:     the POLICY_* value, or -1 if the name is unknown
+-- 
+-- NOTES:
+-- This function is called to parse the -b command line option.
+------------------------------------------------------------------------------*/
+int parse_policy(const char* name)
+{
+    if (strcmp(name, "drop") == 0) return POLICY_DROP;
+    if (strcmp(name, "disconnect") == 0) return POLICY_DISCONNECT;
+    if (strcmp(name, "pause") == 0) return POLICY_PAUSE;
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    set_name
+-- 
+-- DATE:        March 12, 2017
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void set_name(const char* line, char* name)
+--              const char* line: the input line
+--              char* name: nickname specified
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to set the user nick name. The join is announced
+-- by sess_named().
+------------------------------------------------------------------------------*/
+void set_name(const char* line, char* name)
+{
+    snprintf(name, MAX_NAME, "%s", &line[1]);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    signal_srv
+-- 
+-- DATE:        March 12, 2017
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void signal_srv(int signo)
+--              int signo: the signal # passed in
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES: 
+-- This function will be invoked when the user press 'Ctrl+C' to terminate
+-- the program. It will call close the server socket before termination.
+-- SIGUSR2 starts a new server to hand over to, see handoff.c.
+------------------------------------------------------------------------------*/
+void signal_srv(int signo) {
+    if (signo == SIGINT) {
+        signal(SIGINT, NULL);
+        close(srv_sockfd);
+        exit(1);
+    }
+    if (signo == SIGUSR2)
+        ho_request();
+}
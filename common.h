@@ -26,19 +26,88 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fstream>
+#include <algorithm>
 #include <map>
+#include <vector>
+#include <unordered_map>
+#include <new>
+#include "frame.h"
+#include "msgbuf.h"
+#include "outq.h"
+#include "resolver.h"
+#include "mpsc.h"
+#include "room.h"
+#include "logger.h"
+#include "stats.h"
+#include "uring.h"
+#include "scrollback.h"
+#include "journal.h"
+#include "throttle.h"
+#include "twheel.h"
+#include "handoff.h"
+#include "admit.h"
+#include "peer.h"
+#include "shmring.h"
+#include "capture.h"
 
 #define NORMAL_EXIT     0       // normal exit
 #define ERROR_EXIT      1       // error exit
 
-#define MAX_CLIENT      30      // maximum # of clients allowed
+#define MAX_EVENTS      256     // maximum # of events per epoll_wait()
+#define MAX_FDS         1048576 // upper bound for the session table size
+#define FD_RESERVED     16      // descriptors kept for the server itself
+#define DEFAULT_HWM     262144  // default output queue high-water mark
+#define HWM_HARD_FACTOR 4       // queue size that always disconnects, in HWMs
+#define MAX_SHARDS      256     // maximum # of event loop threads
+#define SESS_SLAB       1024    // sessions allocated at once
+#define READ_BUDGET     64      // frames handled per session and loop iteration
+#define ACCEPT_BATCH    64      // connections accepted per loop iteration
+#define DEFAULT_BACKLOG SOMAXCONN // listen() backlog, the kernel caps it at somaxconn
+#define THROTTLE_NOTICE 10      // seconds between two throttle notices
+#define TIMER_TICK_MS   100     // resolution of the session timers
+#define DEFAULT_PING    60      // idle seconds before a client is pinged
+#define DEFAULT_PONG    20      // seconds a client has to answer a ping
+#define DEFAULT_HANDSHAKE 60    // seconds a client has to give its nickname
+#define RECONNECT_MIN_MS 250    // client: first reconnect delay, doubled per try
+#define RECONNECT_MAX_MS 30000  // client: default ceiling of the reconnect delay
+#define RECONNECT_STABLE 10     // client: seconds up before the delay starts over
+#define CLNT_GAP_MS     2000    // client: how long a missing message id is waited for
+
+// seconds to timer wheel ticks and ticks to stats_now() time
+#define SECS_TICKS(x)   ((uint64_t) (x) * 1000 / TIMER_TICK_MS)
+#define TICK_NS         (TIMER_TICK_MS * 1000000ULL)
+
+// congestion policies for clients whose output queue is over the limit
+#define POLICY_DROP         0   // drop the oldest queued messages
+#define POLICY_DISCONNECT   1   // disconnect the slow client
+#define POLICY_PAUSE        2   // stop reading from the senders
+
+// I/O backends of the event loop
+#define IO_EPOLL        0       // readiness with epoll and non-blocking calls
+#define IO_URING        1       // completions with io_uring
+#ifndef DEFAULT_IO
+#define DEFAULT_IO      IO_EPOLL // build with DEFS=-DDEFAULT_IO=IO_URING
+#endif
 #define MAX_NAME        100     // maximum length of name string
 #define IP_SIZE         16      // maximum length of ip address string
+#define INFO_SIZE       (RES_HOST_MAX + IP_SIZE + 16) // hostname:ip:fd string
 #define PORT_SIZE       10      // maximum length of port string
 #define BUF_SIZE        512     // buffer size
+#define READ_SIZE       65536   // size of the server's socket read buffer
+#define PRESENCE_MAX    BUF_SIZE // bytes in one join/leave notice, fits a scrollback slot
 #define TCP_PORT        7000    // tcp port #
 
 // color styles
@@ -51,29 +120,275 @@
 #define WHT   "\x1B[37m"
 #define RESET "\x1B[0m"
 
+// inter-shard message types
+#define SHARD_BCAST     1       // fan a message out to the shard's clients
+#define SHARD_PAUSE     2       // stop reading from a session
+#define SHARD_RESUME    3       // lift a pause put by SHARD_PAUSE
+
+// server settings, read-only once the shards run
+struct srv_config {
+    int     port;               // tcp port #
+    int     maxclients;         // client limit, 0 = limited by RLIMIT_NOFILE
+    int     policy;             // congestion policy, POLICY_*
+    size_t  hwm;                // output queue high-water mark
+    size_t  lwm;                // output queue low-water mark
+    int     nresolvers;         // # of reverse DNS threads
+    int     nthreads;           // # of shards
+    const char* stats_path;     // stats socket, NULL for none
+    int     io;                 // I/O backend, IO_*
+    int     history;            // messages replayed on joining a room
+    int     history_secs;       // only replay messages this recent, 0 = any
+    const char* journal_path;   // journal directory, NULL for none
+    double  rate_msgs;          // messages per second per client, 0 = no limit
+    double  rate_bytes;         // payload bytes per second per client, 0 = no limit
+    int     coalesce;           // output held for this many us, 0 = one tick, -1 = off
+    int     ping_secs;          // ping clients silent this long, 0 = never
+    int     pong_secs;          // drop clients not answering a ping this long
+    int     handshake_secs;     // drop clients without a nickname, 0 = never
+    int     idle_secs;          // drop clients not talking this long, 0 = never
+    const char* upgrade_path;   // hot upgrade socket, NULL for none
+    int     backlog;            // listen() backlog
+    double  accept_rate;        // connections per second, 0 = no limit
+    double  ip_rate;            // connections per second per address, 0 = no limit
+    int     peer_port;          // port other servers link to, 0 = none
+    const char* shm_path;       // local clients' socket, NULL for none
+    const char* capture_path;   // traffic capture file, NULL for none
+};
+
+// reference to a session that may go away, see sess_lookup()
+struct sess_ref {
+    int         shard;          // shard owning the session
+    int         fd;             // client socket file descriptor
+    uint64_t    serial;         // serial # of the session
+};
+
+// throttled session waiting for its buckets to refill
+struct sess_timer {
+    uint64_t    when;           // deadline, see stats_now()
+    struct sess_ref ref;        // the session
+};
+
+// message posted to another shard's inbox
+struct shard_msg {
+    struct mpsc_node node;      // inbox link, must come first
+    int     type;               // SHARD_*
+    struct msgbuf* mb;          // SHARD_BCAST: the framed message
+    struct room_info* room;     // SHARD_BCAST: the target room
+    struct sess_ref ref;        // the sender, or the session to pause/resume
+};
+
+// joins and leaves of a room on one shard, announced once per iteration
+struct presence {
+    struct room_info* room;     // the room
+    std::string joins;          // nicknames joining, ", " separated
+    std::string parts;          // nicknames leaving
+    int     count;              // # of nicknames
+    struct sess_ref from;       // the only one joining, or shard -1
+};
+
+// members of a room on one shard, kept contiguous for fan-out
+struct room {
+    struct room_info* info;     // directory entry
+    std::vector<struct session*> members;
+};
+
+// a session's seat in a room
+struct membership {
+    struct room* room;          // the room
+    int     idx;                // index in room->members
+};
+
+// connected client session
+struct session {
+    int     fd;                 // client socket file descriptor
+    int     slot;               // index in the server's client list
+    char    name[MAX_NAME];     // user nickname
+    char    info[INFO_SIZE];    // user info (hostname:ip:fd)
+    char    prefix[MAX_NAME + 16]; // put before every message, see sess_decorate()
+    char    suffix[INFO_SIZE + 24]; // put after every message
+    int     prefixlen;          // length of prefix
+    int     suffixlen;          // length of suffix
+    struct server* srv;         // the server owning the session
+    struct frame_decoder dec;   // incoming frame decoder
+    struct outq oq;             // outgoing message queue
+    uint64_t serial;            // tells sessions sharing an fd apart
+    int     paused;             // # of congested clients blocking our reads
+    int     closing;            // scheduled for closing by sess_kill()
+    std::vector<struct sess_ref> blocked; // senders paused because of us
+    std::vector<struct membership> rooms; // rooms joined
+    struct room* room;          // room messages are sent to, or NULL
+    int     inflight;           // io_uring: requests the kernel still holds
+    int     recv_armed;         // io_uring: 1 while receiving, 2 when cancelled
+    int     writing;            // io_uring: 1 queue, 2 history write in flight
+    int     dirty;              // queued output not yet written, see sess_dirty()
+    size_t  wbytes;             // io_uring: bytes of the write in flight
+    struct sess_ref from;       // io_uring: sender of the last message queued
+    struct jr_cursor stream;    // history being sent from the journal
+    struct tbucket tb_msgs;     // --rate-msgs budget
+    struct tbucket tb_bytes;    // --rate-bytes budget
+    int     throttled;          // over its rate, one of the paused reasons
+    int     yielded;            // out of read budget, one of the paused reasons
+    int     budget;             // frames left in this loop iteration
+    uint64_t budget_iter;       // loop iteration budget belongs to
+    uint64_t noticed;           // when the last throttle notice was sent
+    struct tw_timer timer;      // next deadline, see sess_timeout()
+    uint64_t born;              // tick the session was accepted at
+    uint64_t rx_at;             // tick of the last frame received
+    uint64_t talk_at;           // tick of the last text frame received
+    uint64_t ping_at;           // tick the last ping was sent, 0 = none
+    struct shm_link* shm;       // rings of a local client, NULL for TCP
+    struct session* nextfree;   // free list link while the session is unused
+};
+
+// event loop state of one shard
+struct server {
+    int     id;                 // shard #
+    int     listenfd;           // listening socket
+    int     epfd;               // epoll instance
+    int     maxclients;         // maximum # of clients allowed
+    int     nclients;           // # of connected clients
+    int     tabsize;            // size of the fd-indexed session table
+    struct session** fdtab;     // sessions indexed by fd
+    struct session** clients;   // dense list of connected sessions
+    char    rbuf[READ_SIZE];    // socket read buffer shared by all sessions
+    uint64_t serial;            // last session serial # handed out
+    struct session* freelist;   // unused sessions, see sess_new()
+    struct srv_stats stats;     // metrics, written by this shard only
+    std::vector<struct sess_ref> resume;   // senders to read again
+    std::vector<struct session*> closing;  // sessions to close
+    uint64_t iter;              // # of the current loop iteration
+    std::vector<struct sess_ref> yielded;  // out of read budget, see sess_yield()
+    std::vector<struct sess_timer> throttled; // heap of throttled sessions
+    struct res_queue resq;      // reverse DNS answers
+    struct mpsc_queue inbox;    // messages from other shards
+    int     inbox_efd;          // eventfd kicked by shard_post()
+    int     inbox_signaled;     // set while a wakeup is pending
+    std::unordered_map<uint32_t, struct room*> rooms; // local rooms by id
+    struct uring* ring;         // io_uring backend, NULL with epoll
+    struct uring_bufs* bufs;    // receive buffers of the ring
+    std::vector<struct sess_ref> dirty; // sessions with output to write
+    uint64_t flush_at;          // when the dirty sessions are written
+    struct twheel wheel;        // session deadlines, in TIMER_TICK_MS ticks
+    struct msgbuf* ping;        // FRAME_PING shared by all sessions
+    struct msgbuf* pong;        // FRAME_PONG shared by all sessions
+    struct iovec* iov;          // writev() vectors of a batch of writes
+    int     handoff;            // set once reading stopped for a hot upgrade
+    int     accepting;          // io_uring: the multishot accept is posted
+    int     accept_more;        // epoll: the accept batch ran out, see srv_accept()
+    int     spare;              // descriptor given up to shed a connection, see srv_shed()
+    std::vector<struct ho_session> adopt; // handed over, see srv_adopt()
+    std::string cap;            // --capture records not written yet
+    std::unordered_map<uint32_t, struct presence> presence; // see srv_presence()
+};
+
 // global variables
-int clnt_sockfd;    // client socket file descriptor
-int srv_sockfd;     // server socket file descriptor
-char default_file[MAX_NAME] = "log.txt";  // default dump file
-char default_host[MAX_NAME] = "datacomm"; // default host name
-std::map<int, std::string> usermap; // store user info (hostname:ip:fd)
+extern int clnt_sockfd;         // client socket file descriptor
+extern int srv_sockfd;          // server socket file descriptor
+extern char default_file[MAX_NAME];  // default dump file
+extern char default_host[MAX_NAME];  // default host name
+extern struct logger clnt_log;  // chat session dump file
+extern struct srv_config cfg;   // server settings
+extern struct server** shards;  // one event loop per thread
+extern int nshards;             // # of shards
+extern struct room_info* default_room; // room every client starts in
+extern struct journal* journal; // message journal, NULL without --journal
+extern int shm_lfd;             // --shm socket, -1 without
 
 // function prototypes
 // server side
-int init_srv(int port);
-int max(int a, int b);
-int user_free(int user_link[MAX_CLIENT]);
-char* get_hostname(const char* ipaddr);
+int init_srv(int port, int reuseport);
+int init_server(struct server* srv, int id);
+void* srv_loop(void* arg);
+int set_nonblock(int fd);
+int parse_policy(const char* name);
+void srv_resolved(struct server* srv);
 void signal_srv(int signo);
-void add_name(char* line, const char* name, int);
-void set_name(char* line, char* name);
-void remove_name(char* line, const char* name);
-void add_sockset(fd_set* sockset, int sockfd, int* usrfd, const int* usrlink);
+void set_name(const char* line, char* name);
+void srv_accept(struct server* srv);
+void srv_admit(struct server* srv, int fd, const struct sockaddr_in* addr);
+void srv_refuse(int fd, const char* why);
+int srv_shed(struct server* srv);
+struct session* sess_new(struct server* srv);
+void sess_free(struct server* srv, struct session* s);
+void srv_read(struct server* srv, struct session* s);
+int srv_input(struct server* srv, struct session* s, const char* data, size_t len);
+int srv_frame(void* arg, const struct frame* f);
+void srv_close(struct server* srv, struct session* s);
+int srv_command(struct server* srv, struct session* s, char* line);
+void broadcast_mb(struct server* srv, struct session* sender, struct room_info* ri,
+                  struct msgbuf* mb, int kind);
+void broadcast_from(struct server* srv, const struct sess_ref* from, const char* nick,
+                    struct room_info* ri, struct msgbuf* mb, int kind);
+void broadcast_peer(const char* room, const char* text, int len);
+void srv_fanout(struct server* srv, struct msgbuf* mb, const struct sess_ref* from,
+                struct room_info* ri);
+void shard_post(struct server* dst, struct shard_msg* m);
+void srv_inbox(struct server* srv);
+void sess_send(struct server* srv, struct session* s, struct msgbuf* mb,
+               const struct sess_ref* from);
+void sess_flush(struct server* srv, struct session* s);
+void sess_dirty(struct server* srv, struct session* s);
+int sess_sendfile(struct server* srv, struct session* s);
+void sess_congested(struct server* srv, struct session* s, const struct sess_ref* from);
+void sess_release(struct server* srv, struct session* s);
+void sess_kill(struct server* srv, struct session* s);
+void sess_reply(struct server* srv, struct session* s, const char* line);
+void sess_replay(struct server* srv, struct session* s, struct room_info* ri);
+int sess_history(struct server* srv, struct session* s, uint64_t after);
+int sess_reads(void* arg, uint64_t room);
+void sess_resume(struct server* srv, struct session* s, char* line);
+void sess_decorate(struct session* s);
+void sess_throttle(struct server* srv, struct session* s, size_t len);
+void sess_yield(struct server* srv, struct session* s);
+void srv_wake(struct server* srv);
+int64_t srv_timeout(struct server* srv);
+int srv_flush_due(struct server* srv);
+void srv_flush(struct server* srv);
+void srv_timer(void* arg, struct tw_timer* t);
+void sess_timeout(struct server* srv, struct session* s);
+void srv_quiesce(struct server* srv);
+void srv_handoff(struct server* srv);
+void srv_adopt(struct server* srv);
+struct msgbuf* sess_format(struct session* s, struct room_info* ri,
+                           const char* text, size_t len);
+struct room* sess_join(struct server* srv, struct session* s, struct room_info* ri);
+void sess_part(struct server* srv, struct session* s, struct room* r);
+void sess_named(struct server* srv, struct session* s);
+void sess_presence(struct server* srv, struct session* s, struct room_info* ri, int join);
+void srv_presence(struct server* srv);
+void srv_announce(struct server* srv, struct presence* p);
+struct session* sess_lookup(struct server* srv, struct sess_ref ref);
+void srv_reap(struct server* srv);
+int uring_start(struct server* srv);
+void* srv_loop_uring(struct server* srv);
+void uring_recv(struct server* srv, struct session* s);
+void uring_resume(struct server* srv, struct session* s);
+void uring_flush(struct server* srv);
+void uring_quiesce(struct server* srv);
+int uring_quiet(struct server* srv);
+void uring_drain(struct server* srv);
+void uring_reopen(struct server* srv);
+int shm_listen(const char* path);
+void shm_register(struct server* srv);
+void shm_accept(struct server* srv);
+void shm_event(struct server* srv, struct session* s, int fd);
+void shm_read(struct server* srv, struct session* s);
+int shm_flush(struct server* srv, struct session* s);
+void shm_idle(struct server* srv, struct session* s);
+void shm_close(struct server* srv, struct session* s);
 
 // client side
 void leave();
+void clnt_exit(int code);
 void signal_clnt(int signo);
 void add_set(fd_set *sockset, int sockfd);
 int init_clnt(char* ipaddr, int port);
+int clnt_connect(char* ipaddr, int port, int max_ms);
+void clnt_hello(int sockfd);
+void clnt_track(const char* line);
+int clnt_seen(uint64_t id);
+uint64_t clnt_now(void);
+int send_text(int sockfd, const char* text, int len);
+int clnt_frame(void* arg, const struct frame* f);
 
 #endif
@@ -0,0 +1,523 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: frame.c - Encoder and streaming decoder for the chat wire
+--              protocol.
+-- 
+-- PROGRAM:     chatsrv, chatclnt
+-- 
+-- FUNCTIONS:   void frame_header(char* out, int type, int flags,
+--                                uint32_t length);
+--              int frame_encode(char* out, size_t size, int type, int flags,
+--                               const void* payload, uint32_t length);
+--              void dec_init(struct frame_decoder* d);
+--              void dec_free(struct frame_decoder* d);
+--              int dec_feed(struct frame_decoder* d, const char* data,
+--                           size_t len, frame_cb cb, void* arg);
+--              int dec_pending(const struct frame_decoder* d);
+--              int dec_hold(struct frame_decoder* d, const char* data,
+--                           size_t len);
+--              size_t frame_size(const char* p, size_t len);
+--              void frame_stamp(char* p, uint64_t id);
+--              size_t frame_unstamp(char* p, size_t len);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- TCP does not preserve message boundaries, so a single read may return
+-- several frames, part of a frame, or both. The decoder walks the frames
+-- in place inside the caller's read buffer and only stashes the bytes of an
+-- incomplete frame, so one large read can yield many frames without any
+-- copying.
+------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+static int parse_header(const char* p, struct frame* f);
+static int take_id(struct frame* f);
+static int stash(struct frame_decoder* d, const char* data, size_t len);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    frame_header
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void frame_header(char* out, int type, int flags,
+--                                uint32_t length)
+--              char* out: where to write the FRAME_HDR_SIZE header bytes
+--              int type: the frame type
+--              int flags: the frame flags
+--              uint32_t length: the payload length
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to write a frame header in network byte order.
+------------------------------------------------------------------------------*/
+void frame_header(char* out, int type, int flags, uint32_t length)
+{
+    unsigned char* p = (unsigned char*) out;
+    
+    p[0] = FRAME_MAGIC;
+    p[1] = FRAME_VERSION;
+    p[2] = (unsigned char) type;
+    p[3] = (unsigned char) flags;
+    p[4] = (unsigned char) (length >> 24);
+    p[5] = (unsigned char) (length >> 16);
+    p[6] = (unsigned char) (length >> 8);
+    p[7] = (unsigned char) length;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    frame_encode
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int frame_encode(char* out, size_t size, int type, int flags,
+--                               const void* payload, uint32_t length)
+--              char* out: the output buffer
+--              size_t size: the size of the output buffer
+--              int type: the frame type
+--              int flags: the frame flags
+--              const void* payload: the payload bytes
+--              uint32_t length: the payload length
+-- 
+-- RETURNS:     the total frame size, or -1 if it does not fit
+-- 
+-- NOTES:
+-- This function is called to build a complete frame in a caller buffer.
+------------------------------------------------------------------------------*/
+int frame_encode(char* out, size_t size, int type, int flags,
+                 const void* payload, uint32_t length)
+{
+    if (length > FRAME_MAX || FRAME_HDR_SIZE + (size_t)length > size)
+        return -1;
+    
+    frame_header(out, type, flags, length);
+    memcpy(out + FRAME_HDR_SIZE, payload, length);
+    return FRAME_HDR_SIZE + length;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    dec_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void dec_init(struct frame_decoder* d)
+--              struct frame_decoder* d: the decoder to initialize
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- The stash buffer is only allocated the first time a frame is split across
+-- reads, so idle connections cost no buffer memory.
+------------------------------------------------------------------------------*/
+void dec_init(struct frame_decoder* d)
+{
+    d->buf = NULL;
+    d->head = d->tail = d->cap = 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    dec_free
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void dec_free(struct frame_decoder* d)
+--              struct frame_decoder* d: the decoder to release
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to release the stash buffer of a decoder.
+------------------------------------------------------------------------------*/
+void dec_free(struct frame_decoder* d)
+{
+    free(d->buf);
+    dec_init(d);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    dec_feed
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int dec_feed(struct frame_decoder* d, const char* data,
+--                           size_t len, frame_cb cb, void* arg)
+--              struct frame_decoder* d: the connection's decoder
+--              const char* data: bytes just received (may be NULL)
+--              size_t len: the number of bytes received
+--              frame_cb cb: called once per complete frame
+--              void* arg: passed through to cb
+-- 
+-- RETURNS:     0 when all input has been consumed or stashed,
+--              1 when cb asked to stop (the rest of the input is stashed),
+--              -1 on a protocol error (bad magic, version or length,
+--              or a message id cut short)
+-- 
+-- NOTES:
+-- Held over bytes are completed first, then whole frames are delivered in
+-- place from data, and the trailing partial frame is stashed. The frame
+-- passed to cb is only valid during the call. cb must not free the decoder;
+-- it returns non-zero instead and the caller tears down after dec_feed().
+-- Calling dec_feed() with no data resumes decoding after a stop. The
+-- message id of a FRAME_F_ID frame is taken off its payload into f->id.
+------------------------------------------------------------------------------*/
+int dec_feed(struct frame_decoder* d, const char* data, size_t len,
+             frame_cb cb, void* arg)
+{
+    struct  frame f;
+    size_t  have, total, take;
+    int     rc;
+    
+    // finish the frames held over from an earlier call
+    while (d->tail > d->head) {
+        have = d->tail - d->head;
+        
+        if (have < FRAME_HDR_SIZE) {
+            take = FRAME_HDR_SIZE - have;
+            if (take > len) take = len;
+            if (stash(d, data, take) < 0) return -1;
+            data += take;
+            len -= take;
+            if (d->tail - d->head < FRAME_HDR_SIZE) return 0;
+            have = d->tail - d->head;
+        }
+        
+        if (parse_header(d->buf + d->head, &f) < 0) return -1;
+        total = FRAME_HDR_SIZE + f.length;
+        
+        if (have < total) {
+            take = total - have;
+            if (take > len) take = len;
+            if (stash(d, data, take) < 0) return -1;
+            data += take;
+            len -= take;
+            if (d->tail - d->head < total) return 0;
+        }
+        
+        f.payload = d->buf + d->head + FRAME_HDR_SIZE;
+        if (take_id(&f) < 0) return -1;
+        rc = cb(arg, &f);
+        d->head += total;
+        if (d->head == d->tail) d->head = d->tail = 0;
+        
+        if (rc) return (stash(d, data, len) < 0) ? -1 : 1;
+    }
+    
+    // deliver whole frames straight from the input
+    while (len >= FRAME_HDR_SIZE) {
+        if (parse_header(data, &f) < 0) return -1;
+        total = FRAME_HDR_SIZE + f.length;
+        if (len < total) break;
+        
+        f.payload = data + FRAME_HDR_SIZE;
+        if (take_id(&f) < 0) return -1;
+        data += total;
+        len -= total;
+        
+        if (cb(arg, &f)) return (stash(d, data, len) < 0) ? -1 : 1;
+    }
+    
+    // keep the partial frame for the next read
+    return (stash(d, data, len) < 0) ? -1 : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    dec_pending
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int dec_pending(const struct frame_decoder* d)
+--              const struct frame_decoder* d: the decoder to check
+-- 
+-- RETURNS:     1 if a complete frame is held over, 0 otherwise
+-- 
+-- NOTES:
+-- This function is called to find out whether a stopped decoder can make
+-- progress without reading more input.
+------------------------------------------------------------------------------*/
+int dec_pending(const struct frame_decoder* d)
+{
+    struct frame f;
+    size_t have = d->tail - d->head;
+    
+    if (have < FRAME_HDR_SIZE) return 0;
+    if (parse_header(d->buf + d->head, &f) < 0) return 1;
+    return have >= FRAME_HDR_SIZE + f.length;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    dec_hold
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int dec_hold(struct frame_decoder* d, const char* data,
+--                           size_t len)
+--              struct frame_decoder* d: the connection's decoder
+--              const char* data: bytes just received
+--              size_t len: the number of bytes received
+-- 
+-- RETURNS:     0 on success, -1 if memory runs out
+-- 
+-- NOTES:
+-- This function is called to keep input without decoding it, for a reader
+-- that cannot stop the data from arriving while it does not want frames.
+-- A later dec_feed() delivers the held frames first.
+------------------------------------------------------------------------------*/
+int dec_hold(struct frame_decoder* d, const char* data, size_t len)
+{
+    return stash(d, data, len);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    frame_size
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   size_t frame_size(const char* p, size_t len)
+--              const char* p: bytes starting with a frame header
+--              size_t len: the number of bytes at p
+-- 
+-- RETURNS:     the size of the frame at p, header included, 0 if p does
+--              not hold a whole valid frame
+-- 
+-- NOTES:
+-- This function is called to split a run of encoded frames.
+------------------------------------------------------------------------------*/
+size_t frame_size(const char* p, size_t len)
+{
+    struct frame f;
+    
+    if (len < FRAME_HDR_SIZE || parse_header(p, &f) < 0
+        || len - FRAME_HDR_SIZE < f.length)
+        return 0;
+    return FRAME_HDR_SIZE + f.length;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    frame_stamp
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void frame_stamp(char* p, uint64_t id)
+--              char* p: an encoded frame
+--              uint64_t id: the message id
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to fill in the message id of a frame encoded
+-- with FRAME_F_ID. Other frames are left alone.
+------------------------------------------------------------------------------*/
+void frame_stamp(char* p, uint64_t id)
+{
+    unsigned char* u = (unsigned char*) p + FRAME_HDR_SIZE;
+    int     i;
+    
+    if (!(p[3] & FRAME_F_ID))
+        return;
+    
+    for (i = FRAME_ID_SIZE - 1; i >= 0; i--, id >>= 8)
+        u[i] = (unsigned char) id;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    frame_unstamp
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   size_t frame_unstamp(char* p, size_t len)
+--              char* p: a run of encoded frames, rewritten in place
+--              size_t len: the number of bytes at p
+-- 
+-- RETURNS:     the number of bytes left at p
+-- 
+-- NOTES:
+-- This function is called to take the message ids off a run of frames,
+-- clearing FRAME_F_ID, so the client shows them without taking them for
+-- messages it had already. The frames move down over the ids dropped; a
+-- partial frame at the end is dropped too.
+------------------------------------------------------------------------------*/
+size_t frame_unstamp(char* p, size_t len)
+{
+    size_t  in = 0, out = 0, n;
+    
+    while ((n = frame_size(p + in, len - in)) > 0) {
+        if ((p[in + 3] & FRAME_F_ID) && n >= FRAME_HDR_SIZE + FRAME_ID_SIZE) {
+            frame_header(p + out, (unsigned char) p[in + 2], p[in + 3] & ~FRAME_F_ID,
+                         (uint32_t) (n - FRAME_HDR_SIZE - FRAME_ID_SIZE));
+            memmove(p + out + FRAME_HDR_SIZE, p + in + FRAME_HDR_SIZE + FRAME_ID_SIZE,
+                    n - FRAME_HDR_SIZE - FRAME_ID_SIZE);
+            out += n - FRAME_ID_SIZE;
+        } else {
+            memmove(p + out, p + in, n);
+            out += n;
+        }
+        in += n;
+    }
+    
+    return out;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    parse_header
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int parse_header(const char* p, struct frame* f)
+--              const char* p: FRAME_HDR_SIZE header bytes
+--              struct frame* f: receives type, flags and length
+-- 
+-- RETURNS:     0 on success, -1 if the header is invalid
+-- 
+-- NOTES:
+-- A frame with a different major version is rejected rather than guessed
+-- at, so incompatible peers fail fast.
+------------------------------------------------------------------------------*/
+static int parse_header(const char* p, struct frame* f)
+{
+    const unsigned char* u = (const unsigned char*) p;
+    
+    if (u[0] != FRAME_MAGIC || u[1] != FRAME_VERSION)
+        return -1;
+    
+    f->type = u[2];
+    f->flags = u[3];
+    f->length = ((uint32_t)u[4] << 24) | ((uint32_t)u[5] << 16)
+              | ((uint32_t)u[6] << 8) | (uint32_t)u[7];
+    
+    f->id = 0;
+    
+    return (f->length > FRAME_MAX) ? -1 : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    take_id
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int take_id(struct frame* f)
+--              struct frame* f: a decoded frame, payload set
+-- 
+-- RETURNS:     0 on success, -1 if a FRAME_F_ID payload is too short
+-- 
+-- NOTES:
+-- Moves the message id of a FRAME_F_ID frame from the payload to f->id.
+------------------------------------------------------------------------------*/
+static int take_id(struct frame* f)
+{
+    const unsigned char* u = (const unsigned char*) f->payload;
+    int     i;
+    
+    if (!(f->flags & FRAME_F_ID))
+        return 0;
+    if (f->length < FRAME_ID_SIZE)
+        return -1;
+    
+    for (i = 0; i < FRAME_ID_SIZE; i++)
+        f->id = (f->id << 8) | u[i];
+    f->payload += FRAME_ID_SIZE;
+    f->length -= FRAME_ID_SIZE;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    stash
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int stash(struct frame_decoder* d, const char* data,
+--                               size_t len)
+--              struct frame_decoder* d: the decoder
+--              const char* data: the bytes to keep
+--              size_t len: the number of bytes to keep
+-- 
+-- RETURNS:     0 on success, -1 if memory runs out
+-- 
+-- NOTES:
+-- This function is called to append bytes to the stash buffer. Consumed
+-- bytes are compacted away before the buffer is grown.
+------------------------------------------------------------------------------*/
+static int stash(struct frame_decoder* d, const char* data, size_t len)
+{
+    size_t  need, cap;
+    char*   buf;
+    
+    if (len == 0) return 0;
+    
+    if (d->tail + len > d->cap && d->head > 0) {
+        memmove(d->buf, d->buf + d->head, d->tail - d->head);
+        d->tail -= d->head;
+        d->head = 0;
+    }
+    
+    need = d->tail + len;
+    if (need > d->cap) {
+        cap = d->cap ? d->cap : 256;
+        while (cap < need) cap *= 2;
+        if ((buf = (char*) realloc(d->buf, cap)) == NULL) return -1;
+        d->buf = buf;
+        d->cap = cap;
+    }
+    
+    memcpy(d->buf + d->tail, data, len);
+    d->tail += len;
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: frame.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the chat wire protocol. Every message travels
+-- in a frame made of a fixed 8-byte header followed by the payload:
+-- 
+--      0       1         2      3       4               8
+--      +-------+---------+------+-------+---------------+---------
+--      | magic | version | type | flags | length (BE32) | payload
+--      +-------+---------+------+-------+---------------+---------
+-- 
+-- A frame with FRAME_F_ID set starts its payload with the 8-byte message id
+-- (BE64) the server's journal gave it; the decoder takes it off the payload,
+-- so a client can tell the server where to resume after a reconnect.
+-- A frame decoder is kept per connection. It is fed with whatever a read
+-- returned, delivers every complete frame straight from that buffer and only
+-- copies the bytes of a frame that is split across reads.
+-------------------------------------------------------------------------------*/
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_MAGIC     0xC7    // first byte of every frame
+#define FRAME_VERSION   1       // protocol version
+#define FRAME_HDR_SIZE  8       // size of the frame header
+#define FRAME_MAX       65536   // maximum payload length
+#define FRAME_ID_SIZE   8       // size of the message id of a FRAME_F_ID frame
+
+// frame types
+#define FRAME_TEXT      1       // chat text or "/command" line
+#define FRAME_PING      2       // heartbeat, answered with a FRAME_PONG
+#define FRAME_PONG      3       // heartbeat answer
+#define FRAME_RELAY     4       // server to server record, see peer.h
+
+// frame flags
+#define FRAME_F_ID      0x01    // the payload starts with the message id
+
+// decoded frame, payload points into the decoder's input
+struct frame {
+    int         type;           // frame type
+    int         flags;          // type specific flags
+    uint32_t    length;         // payload length
+    const char* payload;        // payload bytes (not NUL terminated)
+    uint64_t    id;             // message id, 0 = none
+};
+
+// streaming decoder state, one per connection
+struct frame_decoder {
+    char*       buf;            // bytes held over between calls
+    size_t      head;           // first pending byte in buf
+    size_t      tail;           // end of the pending bytes in buf
+    size_t      cap;            // size of buf
+};
+
+// called for each decoded frame, return non-zero to stop decoding
+typedef int (*frame_cb)(void* arg, const struct frame* f);
+
+// function prototypes
+void frame_header(char* out, int type, int flags, uint32_t length);
+int frame_encode(char* out, size_t size, int type, int flags,
+                 const void* payload, uint32_t length);
+void dec_init(struct frame_decoder* d);
+void dec_free(struct frame_decoder* d);
+int dec_feed(struct frame_decoder* d, const char* data, size_t len,
+             frame_cb cb, void* arg);
+int dec_pending(const struct frame_decoder* d);
+int dec_hold(struct frame_decoder* d, const char* data, size_t len);
+size_t frame_size(const char* p, size_t len);
+void frame_stamp(char* p, uint64_t id);
+size_t frame_unstamp(char* p, size_t len);
+
+#endif
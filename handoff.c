@@ -0,0 +1,880 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: handoff.c - Hot upgrade, hands the sockets and sessions over
+--              to a new server process.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int ho_takeover(const char* path, struct ho_state* st);
+--              int ho_start(const char* path, char* argv[]);
+--              void ho_request(void);
+--              int ho_pending(void);
+--              void ho_sync(void);
+--              int ho_send(struct server* srv);
+--              int ho_finish(int ok);
+--              void ho_rooms(const struct ho_state* st);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- The old server runs a handoff thread next to the shards. It waits on the
+-- upgrade socket for a successor, and on SIGUSR2 starts one itself with
+-- the command line the server was started with. Once the successor says
+-- hello, the thread sets the flag the shards check in srv_inbox() and
+-- kicks every inbox:
+--      1. each shard stops reading and accepting, and waits in ho_sync()
+--         for the others, after which no shard posts to another;
+--      2. each shard takes the broadcasts left in its inbox, lets the
+--         writes in flight finish and sends its listening socket and
+--         sessions with ho_send(), then blocks in ho_finish();
+--      3. the thread waits for the journal and capture writers to catch
+--         up, sends the room scrollbacks and HO_END, and the old process
+--         exits.
+-- A client socket is only closed by the exit, never shut down, so the
+-- copy the successor received keeps the connection open. If the transfer
+-- fails on the way the successor drops what it got and the old server
+-- carries on as if nothing happened.
+-- A session's congestion pauses, rate limits and timers are not handed
+-- over, the new server starts them afresh; the scrollback is stamped with
+-- the time it was received.
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+#include <sys/un.h>
+
+static int ho_lfd = -1;             // upgrade socket
+static int ho_efd = -1;             // eventfd kicked by ho_request()
+static char** ho_argv;              // command line the successor is started with
+static int ho_active;               // set while handing over, see ho_pending()
+static int ho_fd = -1;              // socket to the successor
+static int ho_done;                 // shards done with ho_send()
+static int ho_failed;               // set if one of them failed
+static int ho_result;               // -1 once the handoff failed
+static pthread_mutex_t ho_lock = PTHREAD_MUTEX_INITIALIZER;  // guards the above
+static pthread_cond_t ho_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t ho_wlock = PTHREAD_MUTEX_INITIALIZER; // one shard sends at a time
+static pthread_barrier_t ho_barrier;    // see ho_sync()
+
+static void* ho_main(void* arg);
+static void ho_spawn(void);
+static int ho_handoff(int fd);
+static int ho_put(int fd, struct ho_msg* m, int passfd, const std::string& data);
+static int ho_get(int fd, struct ho_msg* m, int* passfd);
+static int ho_data(int fd, size_t len, std::string* out);
+static void ho_timeouts(int fd);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_takeover
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int ho_takeover(const char* path, struct ho_state* st)
+--              const char* path: the upgrade socket
+--              struct ho_state* st: receives what was handed over
+-- 
+-- RETURNS:     0 once the server was handed over, 1 if no server listens
+--              on path, -1 if the handoff failed
+-- 
+-- NOTES:
+-- This function is called at start-up, before anything else is set up, to
+-- take over from a server already running. Nothing received is used
+-- unless the whole transfer arrives: the descriptors of a failed one are
+-- closed again and the old server keeps them.
+------------------------------------------------------------------------------*/
+int ho_takeover(const char* path, struct ho_state* st)
+{
+    struct  sockaddr_un addr;
+    struct  ho_msg m;
+    struct  ho_session hs;
+    struct  ho_room hr;
+    std::string data;
+    const char* p;
+    const char* end;
+    size_t  len, i;
+    int     fd, pfd, k;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+    
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return (errno == ENOENT || errno == ECONNREFUSED) ? 1 : -1;
+    }
+    ho_timeouts(fd);
+    
+    memset(&m, 0, sizeof(m));
+    m.type = HO_HELLO;
+    if (ho_put(fd, &m, -1, "") < 0)
+        goto fail;
+    
+    while (1) {
+        if (ho_get(fd, &m, &pfd) < 0)
+            goto fail;
+        
+        if (m.type == HO_END) {
+            close(fd);
+            return 0;
+        }
+        
+        if (m.type == HO_LISTEN) {
+            if (pfd < 0 || m.shard < 0 || m.shard >= MAX_SHARDS) {
+                if (pfd >= 0) close(pfd);
+                goto fail;
+            }
+            if ((int) st->listeners.size() <= m.shard)
+                st->listeners.resize(m.shard + 1, -1);
+            st->listeners[m.shard] = pfd;
+            continue;
+        }
+        
+        if (m.type != HO_SESSION && m.type != HO_ROOM) {
+            if (pfd >= 0) close(pfd);
+            goto fail;
+        }
+        
+        len = (size_t) m.textlen + m.inlen + m.outlen;
+        if (m.textlen > len || m.inlen > len || ho_data(fd, len, &data) < 0) {
+            if (pfd >= 0) close(pfd);
+            goto fail;
+        }
+        
+        // the strings are NUL terminated, the last one ends at textlen
+        p = data.data();
+        end = p + m.textlen;
+        if (m.textlen == 0 || end[-1] != '\0') {
+            if (pfd >= 0) close(pfd);
+            goto fail;
+        }
+        
+        if (m.type == HO_ROOM) {
+            if (pfd >= 0) close(pfd);
+            hr.name = p;
+            hr.frames.assign(end, m.outlen);
+            st->rooms.push_back(hr);
+            continue;
+        }
+        
+        if (pfd < 0)
+            goto fail;
+        hs.shard = (m.shard >= 0) ? m.shard : 0;
+        hs.fd = pfd;
+        hs.rooms.clear();
+        for (k = -2; k < m.nrooms && p < end; k++) {
+            if (k == -2) hs.name = p;
+            else if (k == -1) hs.info = p;
+            else hs.rooms.push_back(p);
+            p += strlen(p) + 1;
+        }
+        hs.current = (m.current >= 0 && m.current < (int) hs.rooms.size()) ? m.current : -1;
+        hs.input.assign(end, m.inlen);
+        hs.output.assign(end + m.inlen, m.outlen);
+        hs.sent = (m.sent < m.outlen) ? m.sent : 0;
+        hs.mark = (m.mark >= 0 && (uint64_t) m.mark <= m.outlen) ? m.mark : -1;
+        hs.stream = m.stream;
+        st->sessions.push_back(hs);
+    }
+
+fail:
+    for (i = 0; i < st->listeners.size(); i++) {
+        if (st->listeners[i] >= 0)
+            close(st->listeners[i]);
+    }
+    for (i = 0; i < st->sessions.size(); i++)
+        close(st->sessions[i].fd);
+    st->listeners.clear();
+    st->sessions.clear();
+    st->rooms.clear();
+    close(fd);
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_start
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int ho_start(const char* path, char* argv[])
+--              const char* path: the upgrade socket to listen on
+--              char* argv[]: the command line, used to start a successor
+-- 
+-- RETURNS:     0 on success, -1 if the socket or thread cannot be created
+-- 
+-- NOTES:
+-- This function is called once the shards are initialized. The socket
+-- left by the server taken over, or by an earlier run, is removed first.
+------------------------------------------------------------------------------*/
+int ho_start(const char* path, char* argv[])
+{
+    struct  sockaddr_un addr;
+    pthread_t tid;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    
+    ho_argv = argv;
+    pthread_barrier_init(&ho_barrier, NULL, nshards);
+    
+    if ((ho_lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if ((ho_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+        || bind(ho_lfd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(ho_lfd, 4) < 0
+        || pthread_create(&tid, NULL, ho_main, NULL) != 0) {
+        close(ho_lfd);
+        ho_lfd = -1;
+        return -1;
+    }
+    
+    pthread_detach(tid);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_request
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void ho_request(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called from the SIGUSR2 handler to have the handoff
+-- thread start a successor. Writing an eventfd is async-signal-safe.
+------------------------------------------------------------------------------*/
+void ho_request(void)
+{
+    uint64_t one = 1;
+    
+    if (ho_efd >= 0 && write(ho_efd, &one, sizeof(one)) < 0)
+        return;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_pending
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int ho_pending(void)
+-- 
+-- RETURNS:     1 while the server is being handed over, 0 otherwise
+-- 
+-- NOTES:
+-- Checked by the shards whenever their inbox is kicked.
+------------------------------------------------------------------------------*/
+int ho_pending(void)
+{
+    return __atomic_load_n(&ho_active, __ATOMIC_SEQ_CST);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_sync
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void ho_sync(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by a shard that stopped reading and accepting.
+-- It returns once every shard has, so nothing is posted to an inbox any
+-- more.
+------------------------------------------------------------------------------*/
+void ho_sync(void)
+{
+    pthread_barrier_wait(&ho_barrier);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_send
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int ho_send(struct server* srv)
+--              struct server* srv: a shard with nothing in flight
+-- 
+-- RETURNS:     0 on success, -1 if the successor cannot be reached
+-- 
+-- NOTES:
+-- This function is called on the shard's thread to send its listening
+-- socket and its sessions. The output is the queue as it stands, whole
+-- messages so the new server can tell the frames apart, and the part of
+-- the first one already sent; with a /history stream going, the messages
+-- queued behind it follow the mark.
+------------------------------------------------------------------------------*/
+int ho_send(struct server* srv)
+{
+    struct  session* s;
+    struct  outq* q;
+    struct  msgbuf* mb;
+    struct  ho_msg m;
+    std::string data;
+    size_t  before;
+    uint32_t i;
+    int     rc = 0, j;
+    
+    pthread_mutex_lock(&ho_wlock);
+    
+    memset(&m, 0, sizeof(m));
+    m.type = HO_LISTEN;
+    m.shard = srv->id;
+    if (ho_put(ho_fd, &m, srv->listenfd, "") < 0)
+        rc = -1;
+    
+    for (j = 0; j < srv->nclients && rc == 0; j++) {
+        // local clients attach to the new server again
+        if ((s = srv->clients[j])->closing || s->shm != NULL)
+            continue;
+        
+        memset(&m, 0, sizeof(m));
+        m.type = HO_SESSION;
+        m.shard = srv->id;
+        m.nrooms = s->rooms.size();
+        m.current = -1;
+        m.mark = -1;
+        
+        data.assign(s->name, strlen(s->name) + 1);
+        data.append(s->info, strlen(s->info) + 1);
+        for (i = 0; i < s->rooms.size(); i++) {
+            data.append(s->rooms[i].room->info->name,
+                        strlen(s->rooms[i].room->info->name) + 1);
+            if (s->rooms[i].room == s->room)
+                m.current = i;
+        }
+        m.textlen = data.size();
+        
+        m.inlen = s->dec.tail - s->dec.head;
+        data.append(s->dec.buf + s->dec.head, m.inlen);
+        
+        q = &s->oq;
+        before = data.size();
+        for (i = 0; i < q->count; i++) {
+            if (q->marked && i == q->mark)
+                m.mark = data.size() - before;
+            mb = q->ring[(q->head + i) & (q->cap - 1)].mb;
+            data.append(MB_DATA(mb), mb->len);
+        }
+        m.outlen = data.size() - before;
+        m.sent = (q->count > 0) ? q->off : 0;
+        
+        // a history finished but not unmarked yet is just the queue
+        if (q->marked && q->mark == q->count)
+            m.mark = m.outlen;
+        if (journal == NULL || !s->stream.active)
+            m.mark = -1;
+        else if (m.mark >= 0)
+            jr_export(journal, &s->stream, &m.stream);
+        
+        if (ho_put(ho_fd, &m, s->fd, data) < 0)
+            rc = -1;
+    }
+    
+    pthread_mutex_unlock(&ho_wlock);
+    return rc;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_finish
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int ho_finish(int ok)
+--              int ok: non-zero if ho_send() succeeded
+-- 
+-- RETURNS:     -1 when the handoff failed and the shard has to carry on,
+--              does not return otherwise
+-- 
+-- NOTES:
+-- This function is called by a shard once it is done sending. It blocks
+-- until the handoff thread tells how the handoff ended; a successful one
+-- ends with the process exiting.
+------------------------------------------------------------------------------*/
+int ho_finish(int ok)
+{
+    pthread_mutex_lock(&ho_lock);
+    
+    ho_done++;
+    if (!ok)
+        ho_failed = 1;
+    pthread_cond_broadcast(&ho_cond);
+    
+    while (ho_result == 0)
+        pthread_cond_wait(&ho_cond, &ho_lock);
+    
+    ho_done--;
+    pthread_cond_broadcast(&ho_cond);
+    pthread_mutex_unlock(&ho_lock);
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_rooms
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void ho_rooms(const struct ho_state* st)
+--              const struct ho_state* st: what was handed over
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once the room directory is set up to put the
+-- scrollbacks handed over back into their rooms.
+------------------------------------------------------------------------------*/
+void ho_rooms(const struct ho_state* st)
+{
+    struct  room_info* ri;
+    const char* p;
+    size_t  i, left, n;
+    uint64_t now = stats_now();
+    
+    for (i = 0; i < st->rooms.size(); i++) {
+        if ((ri = room_intern(st->rooms[i].name.c_str())) == NULL)
+            continue;
+        p = st->rooms[i].frames.data();
+        left = st->rooms[i].frames.size();
+        while ((n = frame_size(p, left)) > 0) {
+            sb_append(&ri->hist, p, n, now);
+            p += n;
+            left -= n;
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_main
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void* ho_main(void* arg)
+--              void* arg: unused
+-- 
+-- RETURNS:     never returns
+-- 
+-- NOTES:
+-- Handoff thread body. It starts a successor when asked to and hands the
+-- server over to the first one that says hello.
+------------------------------------------------------------------------------*/
+static void* ho_main(void* arg)
+{
+    struct  pollfd pfd[2];
+    struct  ho_msg m;
+    uint64_t cnt;
+    int     fd, passfd;
+    
+    (void) arg;
+    
+    pfd[0].fd = ho_lfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = ho_efd;
+    pfd[1].events = POLLIN;
+    
+    while (1) {
+        if (poll(pfd, 2, -1) < 0)
+            continue;
+        
+        if (pfd[1].revents & POLLIN) {
+            while (read(ho_efd, &cnt, sizeof(cnt)) > 0)
+                ;
+            ho_spawn();
+        }
+        
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+        if ((fd = accept4(ho_lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+            continue;
+        
+        ho_timeouts(fd);
+        if (ho_get(fd, &m, &passfd) == 0 && m.type == HO_HELLO && passfd < 0)
+            ho_handoff(fd);
+        else if (passfd >= 0)
+            close(passfd);
+        close(fd);
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_spawn
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void ho_spawn(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called on SIGUSR2 to start the binary the server was
+-- started from, which may have been replaced since, with the same command
+-- line; it finds the upgrade socket and takes over. It runs in a
+-- grandchild so nothing has to wait for it, and inherits none of the
+-- server's descriptors: a client socket still open in it would keep the
+-- connection up after the client is closed.
+------------------------------------------------------------------------------*/
+static void ho_spawn(void)
+{
+    struct  rlimit rl;
+    pid_t   pid;
+    int     fd, maxfd = 1024, status;
+    
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        maxfd = (int) rl.rlim_cur;
+    
+    printf(" - Starting a new server to hand over to.\n");
+    fflush(stdout);
+    
+    if ((pid = fork()) < 0) {
+        perror(" - upgrade: fork error.\n");
+        return;
+    }
+    
+    // only async-signal-safe calls between fork() and exec
+    if (pid == 0) {
+        if (fork() == 0) {
+            if (close_range(3, ~0U, 0) < 0) {
+                for (fd = 3; fd < maxfd; fd++)
+                    close(fd);
+            }
+            execvp(ho_argv[0], ho_argv);
+            _exit(ERROR_EXIT);
+        }
+        _exit(NORMAL_EXIT);
+    }
+    
+    waitpid(pid, &status, 0);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_handoff
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int ho_handoff(int fd)
+--              int fd: the successor
+-- 
+-- RETURNS:     -1 if the handoff failed, exits the process otherwise
+-- 
+-- NOTES:
+-- This function is called on the handoff thread to drive the handoff
+-- described at the top of the file. The journal and the capture are synced
+-- before HO_END, the successor writes to them after.
+------------------------------------------------------------------------------*/
+static int ho_handoff(int fd)
+{
+    std::vector<struct room_info*> rooms;
+    struct  msgbuf* mb;
+    struct  ho_msg m;
+    std::string data;
+    uint64_t one = 1;
+    size_t  i;
+    int     failed;
+    
+    printf(" - Handing the server over to a new process.\n");
+    
+    pthread_mutex_lock(&ho_lock);
+    ho_fd = fd;
+    ho_done = 0;
+    ho_failed = 0;
+    ho_result = 0;
+    pthread_mutex_unlock(&ho_lock);
+    
+    __atomic_store_n(&ho_active, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < (size_t) nshards; i++) {
+        if (write(shards[i]->inbox_efd, &one, sizeof(one)) < 0)
+            perror(" - upgrade: eventfd write error.\n");
+    }
+    
+    pthread_mutex_lock(&ho_lock);
+    while (ho_done < nshards)
+        pthread_cond_wait(&ho_cond, &ho_lock);
+    failed = ho_failed;
+    pthread_mutex_unlock(&ho_lock);
+    
+    if (!failed && journal != NULL)
+        jr_sync(journal);
+    if (!failed)
+        cap_sync();
+    
+    if (!failed) {
+        room_all(&rooms);
+        for (i = 0; i < rooms.size() && !failed; i++) {
+            if ((mb = sb_replay(&rooms[i]->hist, UINT32_MAX, 0)) == NULL)
+                continue;
+            memset(&m, 0, sizeof(m));
+            m.type = HO_ROOM;
+            data.assign(rooms[i]->name, strlen(rooms[i]->name) + 1);
+            m.textlen = data.size();
+            m.outlen = mb->len;
+            data.append(MB_DATA(mb), mb->len);
+            mb_unref(mb);
+            failed = ho_put(fd, &m, -1, data) < 0;
+        }
+    }
+    
+    if (!failed) {
+        memset(&m, 0, sizeof(m));
+        m.type = HO_END;
+        failed = ho_put(fd, &m, -1, "") < 0;
+    }
+    
+    if (!failed) {
+        printf(" - Handed over, exiting.\n");
+        fflush(stdout);
+        _exit(NORMAL_EXIT);
+    }
+    
+    // the shards take their sessions back
+    printf(" - Hot upgrade failed, carrying on.\n");
+    __atomic_store_n(&ho_active, 0, __ATOMIC_SEQ_CST);
+    
+    pthread_mutex_lock(&ho_lock);
+    ho_result = -1;
+    pthread_cond_broadcast(&ho_cond);
+    while (ho_done > 0)
+        pthread_cond_wait(&ho_cond, &ho_lock);
+    ho_fd = -1;
+    pthread_mutex_unlock(&ho_lock);
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_put
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int ho_put(int fd, struct ho_msg* m, int passfd,
+--                                const std::string& data)
+--              int fd: the handoff socket
+--              struct ho_msg* m: the record, the version is filled in
+--              int passfd: descriptor sent with the record, -1 for none
+--              const std::string& data: the record's data
+-- 
+-- RETURNS:     0 on success, -1 on a socket error
+-- 
+-- NOTES:
+-- This function is called to send one record, the data in HO_CHUNK
+-- pieces after it.
+------------------------------------------------------------------------------*/
+static int ho_put(int fd, struct ho_msg* m, int passfd, const std::string& data)
+{
+    struct  msghdr msg;
+    struct  iovec iov;
+    struct  cmsghdr* cm;
+    char    cbuf[CMSG_SPACE(sizeof(int))];
+    size_t  off, len;
+    
+    m->version = HO_VERSION;
+    
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = m;
+    iov.iov_len = sizeof(*m);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    
+    if (passfd >= 0) {
+        memset(cbuf, 0, sizeof(cbuf));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &passfd, sizeof(int));
+    }
+    
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t) sizeof(*m))
+        return -1;
+    
+    for (off = 0; off < data.size(); off += len) {
+        len = (data.size() - off < HO_CHUNK) ? data.size() - off : HO_CHUNK;
+        if (send(fd, data.data() + off, len, MSG_NOSIGNAL) != (ssize_t) len)
+            return -1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_get
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int ho_get(int fd, struct ho_msg* m, int* passfd)
+--              int fd: the handoff socket
+--              struct ho_msg* m: receives the record
+--              int* passfd: receives the descriptor sent with it, or -1
+-- 
+-- RETURNS:     0 on success, -1 on a socket error, a short record or
+--              another version
+-- 
+-- NOTES:
+-- This function is called to receive the next record; its data is read
+-- with ho_data().
+------------------------------------------------------------------------------*/
+static int ho_get(int fd, struct ho_msg* m, int* passfd)
+{
+    struct  msghdr msg;
+    struct  iovec iov;
+    struct  cmsghdr* cm;
+    char    cbuf[CMSG_SPACE(sizeof(int))];
+    ssize_t n;
+    
+    *passfd = -1;
+    
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = m;
+    iov.iov_len = sizeof(*m);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    
+    while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    
+    for (cm = CMSG_FIRSTHDR(&msg); n > 0 && cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(passfd, CMSG_DATA(cm), sizeof(int));
+    }
+    
+    if (n != (ssize_t) sizeof(*m) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        || m->version != HO_VERSION) {
+        if (*passfd >= 0) close(*passfd);
+        *passfd = -1;
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_data
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int ho_data(int fd, size_t len, std::string* out)
+--              int fd: the handoff socket
+--              size_t len: the length of the data
+--              std::string* out: receives the data
+-- 
+-- RETURNS:     0 on success, -1 on a socket error or a short piece
+-- 
+-- NOTES:
+-- This function is called to receive the data of a record, which comes
+-- in HO_CHUNK pieces.
+------------------------------------------------------------------------------*/
+static int ho_data(int fd, size_t len, std::string* out)
+{
+    size_t  off, want;
+    ssize_t n;
+    
+    out->resize(len);
+    
+    for (off = 0; off < len; off += want) {
+        want = (len - off < HO_CHUNK) ? len - off : HO_CHUNK;
+        while ((n = recv(fd, &(*out)[off], want, 0)) < 0 && errno == EINTR)
+            ;
+        if (n != (ssize_t) want)
+            return -1;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    ho_timeouts
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void ho_timeouts(int fd)
+--              int fd: the handoff socket
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Neither side waits more than HO_TIMEOUT seconds for the other, a stuck
+-- peer fails the handoff instead of hanging the server.
+------------------------------------------------------------------------------*/
+static void ho_timeouts(int fd)
+{
+    struct timeval tv;
+    
+    tv.tv_sec = HO_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
@@ -0,0 +1,99 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: handoff.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the hot upgrade. A server started with
+-- --upgrade path listens on that Unix domain socket for its successor: a
+-- new chatsrv started with the same option connects to it, or the running
+-- one starts it on SIGUSR2. The old server stops reading, then passes its
+-- listening sockets and every client socket with SCM_RIGHTS, together with
+-- what the session was doing: nickname, userinfo, rooms, the input not
+-- decoded yet, the output not written yet and the /history stream being
+-- sent. The new server carries on with the same sockets, the clients never
+-- see a disconnect.
+-- The transfer runs over a SOCK_SEQPACKET socket. Every record is one
+-- struct ho_msg, the descriptor rides along with it, and its data follows
+-- in messages of at most HO_CHUNK bytes.
+-------------------------------------------------------------------------------*/
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "journal.h"
+
+#define HO_VERSION      1       // bumped when struct ho_msg changes
+#define HO_CHUNK        65536   // most data bytes per message
+#define HO_TIMEOUT      10      // seconds either side waits for the other
+
+// record types
+#define HO_HELLO        1       // successor: hand the server over
+#define HO_LISTEN       2       // a listening socket
+#define HO_SESSION      3       // a client socket and its session
+#define HO_ROOM         4       // a room and its scrollback
+#define HO_END          5       // everything is sent, the old server exits
+
+// record header, the data is the strings then the input then the output
+struct ho_msg {
+    uint32_t    type;           // HO_*
+    uint32_t    version;        // HO_VERSION
+    int32_t     shard;          // shard the socket comes from
+    int32_t     nrooms;         // HO_SESSION: # of rooms joined
+    int32_t     current;        // HO_SESSION: room talked to, -1 = none
+    uint32_t    textlen;        // NUL terminated strings at the start of the data
+    uint64_t    inlen;          // HO_SESSION: input held by the decoder
+    uint64_t    outlen;         // queued output, HO_ROOM: the scrollback
+    uint64_t    sent;           // bytes of the first queued frame already sent
+    int64_t     mark;           // output ahead of the history, -1 = no history
+    struct jr_spot stream;      // history still to send
+};
+
+// a client session as handed over
+struct ho_session {
+    int         shard;          // shard it was on
+    int         fd;             // client socket
+    std::string name;           // nickname
+    std::string info;           // userinfo
+    std::vector<std::string> rooms; // rooms joined
+    int         current;        // index of the room talked to, -1 = none
+    std::string input;          // bytes received but not decoded
+    std::string output;         // queued frames, the first may be partly sent
+    size_t      sent;           // bytes of the first frame already sent
+    int64_t     mark;           // output ahead of the history, -1 = none
+    struct jr_spot stream;      // history still to send
+};
+
+// a room's scrollback as handed over
+struct ho_room {
+    std::string name;           // room name
+    std::string frames;         // stored messages, oldest first
+};
+
+// everything the predecessor handed over
+struct ho_state {
+    std::vector<int> listeners; // listening sockets, by shard
+    std::vector<struct ho_session> sessions;
+    std::vector<struct ho_room> rooms;
+};
+
+struct server;
+
+// function prototypes
+int ho_takeover(const char* path, struct ho_state* st);
+int ho_start(const char* path, char* argv[]);
+void ho_request(void);
+int ho_pending(void);
+void ho_sync(void);
+int ho_send(struct server* srv);
+int ho_finish(int ok);
+void ho_rooms(const struct ho_state* st);
+
+#endif
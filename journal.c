@@ -0,0 +1,1150 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: journal.c - Append-only message journal with group commit.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int jr_open(struct journal* j, const char* dir,
+--                          size_t seg_size);
+--              void jr_append(struct journal* j, struct msgbuf* mb,
+--                             uint64_t room);
+--              void jr_range(struct journal* j, uint64_t* first,
+--                            uint64_t* last);
+--              int jr_seek(struct journal* j, uint64_t after,
+--                          struct jr_cursor* c);
+--              int jr_next(struct journal* j, struct jr_cursor* c, int* fd,
+--                          char** data, size_t* len);
+--              void jr_sync(struct journal* j);
+--              void jr_export(struct journal* j, const struct jr_cursor* c,
+--                             struct jr_spot* p);
+--              int jr_import(struct journal* j, const struct jr_spot* p,
+--                            struct jr_cursor* c);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- The journal is a directory of segments. <id>.jrn holds the frames of the
+-- messages from id on, back to back and byte for byte as they were sent to
+-- the clients, so any run of whole messages can go to a socket unchanged.
+-- <id>.idx holds the sparse index of the segment as struct jr_index records.
+-- A segment is created at its full size and mapped; the writer thread
+-- copies frames into the mapping and, once the queue is empty, syncs the
+-- bytes of the whole batch with one msync() before it publishes them. A
+-- full segment is truncated to the bytes it holds and a new one started.
+-- On start-up the existing segments are scanned, the end of each is the
+-- first byte that is not a valid frame, and writing resumes in a new
+-- segment. The index is not synced: an entry past the end of the data is
+-- ignored when the segment is loaded again.
+-- Ids are handed out in jr_append() by an atomic increment, so the shards
+-- never wait for each other; one may push its message on the queue ahead
+-- of a lower id another shard is still pushing. The writer holds such a
+-- message back until the ids before it have come, and writes the segments
+-- in id order. Messages the writer has to drop keep their ids, so the
+-- next segment may start past a gap.
+-- <id>.rms holds the room key of each message of the segment, 8 bytes per
+-- message in id order. It is sized and mapped like the segment, enough for
+-- a segment of empty frames, is synced with the same batch and shrinks to
+-- the keys written when the segment is sealed. A message without a key,
+-- from a segment written before the file existed or past its end, belongs
+-- to no room and is never streamed to a filtered reader.
+------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "frame.h"
+#include "journal.h"
+
+static void* jr_writer(void* arg);
+static void jr_commit(struct journal* j);
+static int jr_load(struct journal* j, uint64_t base);
+static struct jr_segment* jr_roll(struct journal* j, uint64_t base);
+static void jr_seal(struct jr_segment* seg);
+static void jr_publish(struct journal* j, struct jr_segment* seg, size_t from,
+                       size_t to, uint64_t n);
+static int jr_add(struct journal* j, struct jr_segment* seg);
+static void jr_mark(struct journal* j, struct jr_segment* seg,
+                    const struct jr_index* e);
+static uint32_t jr_frame_len(const char* p);
+static int jr_cmp(const void* a, const void* b);
+static int jr_find(struct journal* j, uint64_t base);
+static uint64_t jr_room(const struct jr_segment* seg, uint64_t id);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_open
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int jr_open(struct journal* j, const char* dir,
+--                          size_t seg_size)
+--              struct journal* j: the journal to start
+--              const char* dir: the journal directory, created if missing
+--              size_t seg_size: size of a segment file
+-- 
+-- RETURNS:     0 on success, -1 if the journal cannot be opened
+-- 
+-- NOTES:
+-- This function is called once at start-up to load the segments already
+-- in the directory and start the writer thread. Message ids carry on from
+-- the last message found.
+------------------------------------------------------------------------------*/
+int jr_open(struct journal* j, const char* dir, size_t seg_size)
+{
+    struct  dirent* de;
+    DIR*    d;
+    uint64_t* bases = NULL;
+    unsigned long long base;
+    size_t  n = 0, cap = 0, i;
+    char    ext[8];
+    
+    memset(j, 0, sizeof(*j));
+    snprintf(j->dir, sizeof(j->dir), "%s", dir);
+    j->seg_size = (seg_size > FRAME_HDR_SIZE + FRAME_MAX) ? seg_size
+                                                          : FRAME_HDR_SIZE + FRAME_MAX;
+    mpsc_init(&j->queue);
+    pthread_mutex_init(&j->lock, NULL);
+    
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return -1;
+    if ((d = opendir(dir)) == NULL)
+        return -1;
+    
+    // segments are named after their first id, load them in order
+    while ((de = readdir(d)) != NULL) {
+        if (sscanf(de->d_name, "%llu.%3s", &base, ext) != 2 || strcmp(ext, "jrn") != 0)
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            bases = (uint64_t*) realloc(bases, cap * sizeof(*bases));
+        }
+        bases[n++] = base;
+    }
+    closedir(d);
+    
+    if (n > 0)
+        qsort(bases, n, sizeof(*bases), jr_cmp);
+    for (i = 0; i < n; i++) {
+        if (jr_load(j, bases[i]) < 0) {
+            free(bases);
+            return -1;
+        }
+    }
+    free(bases);
+    
+    if ((j->efd = eventfd(0, EFD_CLOEXEC)) < 0)
+        return -1;
+    j->next = j->taken = j->settled = j->committed;
+    if ((j->active = jr_roll(j, j->committed + 1)) == NULL)
+        return -1;
+    if (pthread_create(&j->tid, NULL, jr_writer, j) != 0)
+        return -1;
+    
+    pthread_detach(j->tid);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_append
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void jr_append(struct journal* j, struct msgbuf* mb,
+--                             uint64_t room)
+--              struct journal* j: the journal
+--              struct msgbuf* mb: the framed message
+--              uint64_t room: key of the room it was sent to, never 0
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function may be called from any thread. It only takes a reference
+-- to the message and queues it. The message id is taken with one atomic
+-- add and is written into a FRAME_F_ID frame, so this must come before
+-- the message is sent to anyone. The eventfd is only written when no
+-- wakeup is pending, as with the shard inboxes.
+------------------------------------------------------------------------------*/
+void jr_append(struct journal* j, struct msgbuf* mb, uint64_t room)
+{
+    struct  jr_entry* e;
+    struct  timespec ts;
+    uint64_t one = 1;
+    
+    if ((e = (struct jr_entry*) malloc(sizeof(*e))) == NULL)
+        return;
+    
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e->ts = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    e->mb = mb;
+    e->room = room;
+    mb_ref(mb);
+    __atomic_add_fetch(&j->queued, 1, __ATOMIC_SEQ_CST);
+    
+    e->id = __atomic_add_fetch(&j->next, 1, __ATOMIC_SEQ_CST);
+    frame_stamp(MB_DATA(mb), e->id);
+    mpsc_push(&j->queue, &e->node);
+    
+    if (__atomic_exchange_n(&j->signaled, 1, __ATOMIC_SEQ_CST) == 0) {
+        if (write(j->efd, &one, sizeof(one)) < 0)
+            perror(" - journal: eventfd write error.\n");
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_range
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void jr_range(struct journal* j, uint64_t* first,
+--                            uint64_t* last)
+--              struct journal* j: the journal
+--              uint64_t* first: receives the id of the oldest message
+--              uint64_t* last: receives the id of the newest committed one
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to tell the ids a reader may ask for. first is
+-- above last while the journal is empty.
+------------------------------------------------------------------------------*/
+void jr_range(struct journal* j, uint64_t* first, uint64_t* last)
+{
+    pthread_mutex_lock(&j->lock);
+    *first = j->segs[0]->base;
+    *last = j->committed;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_seek
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int jr_seek(struct journal* j, uint64_t after,
+--                          struct jr_cursor* c)
+--              struct journal* j: the journal
+--              uint64_t after: the last message id the reader has seen
+--              struct jr_cursor* c: receives the position
+-- 
+-- RETURNS:     0 if there are messages after the given id, -1 otherwise
+-- 
+-- NOTES:
+-- This function is called to start reading after a message id, or from
+-- the oldest message if it is older than that. The end is fixed at the
+-- last id handed out now, committed or not: a message sent to the rooms
+-- before the reader joined them may still be on its way to the writer,
+-- the stream waits for it. The segment is found by binary search over the
+-- segments, then the index, and at most JR_INDEX_EVERY - 1 frame headers
+-- are stepped over from the index entry. An id lost in a gap between
+-- segments starts at the next segment, one not committed yet at the end
+-- of the last. The cursor has no filter, the caller may set keep
+-- afterwards.
+------------------------------------------------------------------------------*/
+int jr_seek(struct journal* j, uint64_t after, struct jr_cursor* c)
+{
+    struct  jr_segment* seg;
+    uint64_t want = after + 1, id, off, upto;
+    int     lo, hi, mid;
+    size_t  ilo, ihi, imid;
+    
+    pthread_mutex_lock(&j->lock);
+    
+    upto = __atomic_load_n(&j->next, __ATOMIC_SEQ_CST);
+    
+    if (want < j->segs[0]->base)
+        want = j->segs[0]->base;
+    if (want > upto) {
+        pthread_mutex_unlock(&j->lock);
+        return -1;
+    }
+    
+    if (want > j->committed) {
+        lo = j->nsegs - 1;
+        seg = j->segs[lo];
+        c->active = 1;
+        c->seg = lo;
+        c->off = c->run = seg->len;
+        c->id = seg->base + seg->count;
+        c->first = want;
+        c->upto = upto;
+        c->keep = NULL;
+        c->arg = NULL;
+        pthread_mutex_unlock(&j->lock);
+        return 0;
+    }
+    
+    // last segment starting at or before want
+    lo = 0;
+    hi = j->nsegs - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (j->segs[mid]->base <= want) lo = mid;
+        else hi = mid - 1;
+    }
+    seg = j->segs[lo];
+    while (want >= seg->base + seg->count && lo + 1 < j->nsegs) {
+        seg = j->segs[++lo];
+        want = seg->base;
+    }
+    
+    // last index entry at or before want, the first message always has one
+    ilo = 0;
+    ihi = seg->nindex - 1;
+    while (ilo < ihi) {
+        imid = (ilo + ihi + 1) / 2;
+        if (seg->index[imid].id <= want) ilo = imid;
+        else ihi = imid - 1;
+    }
+    id = seg->index[ilo].id;
+    off = seg->index[ilo].off;
+    
+    for (; id < want; id++)
+        off += FRAME_HDR_SIZE + jr_frame_len(seg->map + off);
+    
+    c->active = 1;
+    c->seg = lo;
+    c->off = off;
+    c->first = want;
+    c->upto = upto;
+    c->id = want;
+    c->run = off;
+    c->keep = NULL;
+    c->arg = NULL;
+    
+    pthread_mutex_unlock(&j->lock);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_next
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int jr_next(struct journal* j, struct jr_cursor* c, int* fd,
+--                          char** data, size_t* len)
+--              struct journal* j: the journal
+--              struct jr_cursor* c: the reader's position
+--              int* fd: receives the segment file, c->off is the offset
+--              char** data: receives the same bytes in the mapping
+--              size_t* len: receives the number of bytes, at most JR_CHUNK
+-- 
+-- RETURNS:     1 if there is a range to send, 0 once the end is reached,
+--              -1 while the next message is not committed yet
+-- 
+-- NOTES:
+-- This function is called to get the next run of bytes of a stream. The
+-- caller sends it with sendfile() from the file or a write from the
+-- mapping and adds what went out to c->off. The cursor is deactivated at
+-- the end. On -1 the caller tries again later; the writer is only a batch
+-- behind.
+-- A run is made of whole messages that pass the cursor's filter, about
+-- JR_CHUNK bytes of them; the messages in between, and those before the
+-- first id asked for, are stepped over by their headers and their bytes
+-- never leave the journal. Until the run is sent the rest of it is handed
+-- out again.
+------------------------------------------------------------------------------*/
+int jr_next(struct journal* j, struct jr_cursor* c, int* fd, char** data, size_t* len)
+{
+    struct  jr_segment* seg;
+    uint64_t end, off, settled;
+    
+    for (;;) {
+        pthread_mutex_lock(&j->lock);
+    
+        // a segment is done with once the next one is started
+        while (c->seg + 1 < j->nsegs && c->off >= j->segs[c->seg]->len) {
+            c->seg++;
+            c->off = c->run = 0;
+            c->id = j->segs[c->seg]->base;
+        }
+    
+        seg = j->segs[c->seg];
+        end = seg->len;
+        settled = j->settled;
+    
+        pthread_mutex_unlock(&j->lock);
+    
+        if (c->off < c->run)
+            break;
+        if (c->id > c->upto || (c->off >= end && settled >= c->upto)) {
+            c->active = 0;
+            return 0;
+        }
+        if (c->off >= end)
+            return -1;
+        
+        // step over what the reader may not see, then take what it may
+        for (off = c->off; off < end && c->id <= c->upto
+             && (c->id < c->first || (c->keep != NULL
+                                      && !c->keep(c->arg, jr_room(seg, c->id)))); c->id++)
+            off += FRAME_HDR_SIZE + jr_frame_len(seg->map + off);
+        
+        for (c->off = off; off < end && c->id <= c->upto && off - c->off < JR_CHUNK
+             && (c->keep == NULL || c->keep(c->arg, jr_room(seg, c->id))); c->id++)
+            off += FRAME_HDR_SIZE + jr_frame_len(seg->map + off);
+        
+        c->run = off;
+        if (c->off < c->run)
+            break;
+    }
+    
+    *fd = seg->fd;
+    *data = seg->map + c->off;
+    *len = (c->run - c->off < JR_CHUNK) ? (size_t) (c->run - c->off) : JR_CHUNK;
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_sync
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void jr_sync(struct journal* j)
+--              struct journal* j: the journal
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once nothing is appended any more, before
+-- another process opens the journal. It waits until the writer has
+-- committed every message queued so far.
+------------------------------------------------------------------------------*/
+void jr_sync(struct journal* j)
+{
+    while (__atomic_load_n(&j->written, __ATOMIC_SEQ_CST)
+           < __atomic_load_n(&j->queued, __ATOMIC_SEQ_CST))
+        usleep(1000);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_export
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void jr_export(struct journal* j, const struct jr_cursor* c,
+--                             struct jr_spot* p)
+--              struct journal* j: the journal
+--              const struct jr_cursor* c: an active cursor
+--              struct jr_spot* p: receives the same position
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to hand a stream over to another process. The
+-- segments are named by their base, their index in segs is only good in
+-- this process.
+------------------------------------------------------------------------------*/
+void jr_export(struct journal* j, const struct jr_cursor* c, struct jr_spot* p)
+{
+    pthread_mutex_lock(&j->lock);
+    p->seg = j->segs[c->seg]->base;
+    pthread_mutex_unlock(&j->lock);
+    
+    p->off = c->off;
+    p->first = c->first;
+    p->upto = c->upto;
+    p->id = c->id;
+    p->run = c->run;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_import
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int jr_import(struct journal* j, const struct jr_spot* p,
+--                            struct jr_cursor* c)
+--              struct journal* j: the journal
+--              const struct jr_spot* p: a position saved by jr_export()
+--              struct jr_cursor* c: receives the active cursor
+-- 
+-- RETURNS:     0 on success, -1 if a segment is not in this journal
+-- 
+-- NOTES:
+-- This function is called to carry on with a stream started by another
+-- process on the same journal directory. The filter is not carried over,
+-- the caller sets it again.
+------------------------------------------------------------------------------*/
+int jr_import(struct journal* j, const struct jr_spot* p, struct jr_cursor* c)
+{
+    int seg;
+    
+    pthread_mutex_lock(&j->lock);
+    seg = jr_find(j, p->seg);
+    pthread_mutex_unlock(&j->lock);
+    
+    if (seg < 0)
+        return -1;
+    
+    c->active = 1;
+    c->seg = seg;
+    c->off = p->off;
+    c->first = p->first;
+    c->upto = p->upto;
+    c->id = p->id;
+    c->run = p->run;
+    c->keep = NULL;
+    c->arg = NULL;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_writer
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void* jr_writer(void* arg)
+--              void* arg: the journal
+-- 
+-- RETURNS:     NULL, never returns
+-- 
+-- NOTES:
+-- Writer thread. It sleeps on the eventfd and commits whatever has been
+-- queued when it wakes up. Messages queued during a commit are picked up
+-- by the next one, so the batch grows with the load.
+------------------------------------------------------------------------------*/
+static void* jr_writer(void* arg)
+{
+    struct  journal* j = (struct journal*) arg;
+    uint64_t cnt;
+    
+    for (;;) {
+        if (read(j->efd, &cnt, sizeof(cnt)) < 0 && errno != EINTR) {
+            perror(" - journal: eventfd read error.\n");
+            return NULL;
+        }
+        
+        __atomic_store_n(&j->signaled, 0, __ATOMIC_SEQ_CST);
+        jr_commit(j);
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_commit
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void jr_commit(struct journal* j)
+--              struct journal* j: the journal
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Called on the writer thread only. Drains the queue into the active
+-- segment in id order with the room keys, indexing every JR_INDEX_EVERY-th
+-- message, then syncs and publishes the batch. A message popped before
+-- its turn waits on the held list, whose link is the queue's. A message
+-- that does not fit ends the segment. If no segment can be created the
+-- messages are dropped until one can; their ids are skipped.
+------------------------------------------------------------------------------*/
+static void jr_commit(struct journal* j)
+{
+    struct  mpsc_node* node;
+    struct  jr_entry* e;
+    struct  jr_entry** at;
+    struct  jr_segment* seg = j->active;
+    struct  jr_index ie;
+    uint64_t n = 0, done = 0;
+    size_t  from, off;
+    
+    from = off = (seg != NULL) ? seg->len : 0;
+    
+    for (;;) {
+        if (j->held != NULL && j->held->id == j->taken + 1) {
+            e = j->held;
+            j->held = (struct jr_entry*) e->node.next;
+        } else if ((node = mpsc_pop(&j->queue)) != NULL) {
+            e = (struct jr_entry*) node;
+            if (e->id != j->taken + 1) {
+                for (at = &j->held; *at != NULL && (*at)->id < e->id;
+                     at = (struct jr_entry**) &(*at)->node.next)
+                    ;
+                e->node.next = (struct mpsc_node*) *at;
+                *at = e;
+                continue;
+            }
+        } else {
+            break;
+        }
+        
+        if (seg != NULL && off + e->mb->len > seg->size) {
+            jr_publish(j, seg, from, off, n);
+            jr_seal(seg);
+            seg = j->active = NULL;
+        }
+        j->taken++;
+        if (seg == NULL && (seg = j->active = jr_roll(j, j->taken)) != NULL)
+            from = off = n = 0;
+        
+        if (seg != NULL) {
+            memcpy(seg->map + off, MB_DATA(e->mb), e->mb->len);
+            if (j->taken - seg->base < seg->nrooms)
+                seg->rooms[j->taken - seg->base] = e->room;
+            if ((j->taken - seg->base) % JR_INDEX_EVERY == 0) {
+                ie.id = j->taken;
+                ie.off = off;
+                ie.ts = e->ts;
+                jr_mark(j, seg, &ie);
+            }
+            off += e->mb->len;
+            n++;
+        }
+        
+        mb_unref(e->mb);
+        free(e);
+        done++;
+    }
+    
+    if (seg != NULL && n > 0)
+        jr_publish(j, seg, from, off, n);
+    
+    pthread_mutex_lock(&j->lock);
+    j->settled = j->taken;
+    pthread_mutex_unlock(&j->lock);
+    __atomic_add_fetch(&j->written, done, __ATOMIC_SEQ_CST);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_publish
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void jr_publish(struct journal* j,
+--                                     struct jr_segment* seg, size_t from,
+--                                     size_t to, uint64_t n)
+--              struct journal* j: the journal
+--              struct jr_segment* seg: the segment written
+--              size_t from: first byte of the batch
+--              size_t to: end of the batch
+--              uint64_t n: # of messages in the batch
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Called on the writer thread only. One msync() covers the whole batch,
+-- another its room keys, then the messages become visible to readers.
+------------------------------------------------------------------------------*/
+static void jr_publish(struct journal* j, struct jr_segment* seg, size_t from,
+                       size_t to, uint64_t n)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = from & ~(page - 1);
+    size_t kfrom = seg->count * sizeof(uint64_t);
+    size_t kto = ((seg->count + n < seg->nrooms) ? seg->count + n : seg->nrooms)
+                 * sizeof(uint64_t);
+    
+    if (to > from && msync(seg->map + start, to - start, MS_SYNC) < 0)
+        perror(" - journal: msync error.\n");
+    
+    start = kfrom & ~(page - 1);
+    if (kto > kfrom && msync((char*) seg->rooms + start, kto - start, MS_SYNC) < 0)
+        perror(" - journal: msync error.\n");
+    
+    pthread_mutex_lock(&j->lock);
+    seg->len = to;
+    seg->count += n;
+    j->committed = seg->base + seg->count - 1;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_load
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int jr_load(struct journal* j, uint64_t base)
+--              struct journal* j: the journal
+--              uint64_t base: id of the segment's first message
+-- 
+-- RETURNS:     0 on success, -1 on error
+-- 
+-- NOTES:
+-- Called at start-up to add an existing segment. Its end is found by
+-- walking the frames from the last index entry that lies within the file.
+-- The file is truncated to its end and mapped read-only, and so are the
+-- room keys; a segment left empty is removed.
+------------------------------------------------------------------------------*/
+static int jr_load(struct journal* j, uint64_t base)
+{
+    struct  jr_segment* seg;
+    struct  jr_index ie;
+    struct  stat st;
+    char    path[JR_PATH_MAX + 32];
+    uint64_t id, off;
+    uint32_t len;
+    ssize_t n;
+    int     fd, idxfd;
+    void*   map;
+    
+    // ids only go up, a gap is left by dropped messages
+    if (j->nsegs > 0 && base <= j->committed) {
+        fprintf(stderr, " - journal: segment %llu overlaps message %llu.\n",
+                (unsigned long long) base, (unsigned long long) j->committed);
+        return -1;
+    }
+    
+    snprintf(path, sizeof(path), "%s/%020llu.jrn", j->dir, (unsigned long long) base);
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0)
+        return -1;
+    
+    if ((seg = (struct jr_segment*) calloc(1, sizeof(*seg))) == NULL) {
+        close(fd);
+        return -1;
+    }
+    seg->base = base;
+    seg->fd = fd;
+    seg->idxfd = -1;
+    seg->rmsfd = -1;
+    seg->size = st.st_size;
+    
+    if (seg->size > 0) {
+        seg->map = (char*) mmap(NULL, seg->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (seg->map == MAP_FAILED) {
+            close(fd);
+            free(seg);
+            return -1;
+        }
+    }
+    
+    // the index, as far as it points into the data
+    snprintf(path, sizeof(path), "%s/%020llu.idx", j->dir, (unsigned long long) base);
+    if ((idxfd = open(path, O_RDONLY | O_CLOEXEC)) >= 0) {
+        while ((n = read(idxfd, &ie, sizeof(ie))) == (ssize_t) sizeof(ie)) {
+            if (ie.off + FRAME_HDR_SIZE > seg->size || ie.id < base)
+                break;
+            jr_mark(j, seg, &ie);
+        }
+        close(idxfd);
+    }
+    
+    // the room keys, without them the messages are in no room
+    snprintf(path, sizeof(path), "%s/%020llu.rms", j->dir, (unsigned long long) base);
+    if ((seg->rmsfd = open(path, O_RDWR | O_CLOEXEC)) >= 0
+        && fstat(seg->rmsfd, &st) == 0 && st.st_size >= (off_t) sizeof(uint64_t)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, seg->rmsfd, 0);
+        if (map != MAP_FAILED) {
+            seg->rooms = (uint64_t*) map;
+            seg->nrooms = st.st_size / sizeof(uint64_t);
+        }
+    }
+    
+    id = (seg->nindex > 0) ? seg->index[seg->nindex - 1].id : base;
+    off = (seg->nindex > 0) ? seg->index[seg->nindex - 1].off : 0;
+    
+    while (off + FRAME_HDR_SIZE <= seg->size
+           && (unsigned char) seg->map[off] == FRAME_MAGIC
+           && seg->map[off + 1] == FRAME_VERSION) {
+        len = jr_frame_len(seg->map + off);
+        if (off + FRAME_HDR_SIZE + len > seg->size)
+            break;
+        off += FRAME_HDR_SIZE + len;
+        id++;
+    }
+    
+    // the entry of the first message, which may not have reached the disk
+    if (seg->nindex == 0 && id > base) {
+        ie.id = base;
+        ie.off = 0;
+        ie.ts = 0;
+        jr_mark(j, seg, &ie);
+    }
+    
+    seg->count = id - base;
+    seg->len = off;
+    
+    if (seg->count == 0) {
+        if (seg->map != NULL)
+            munmap(seg->map, seg->size);
+        if (seg->rooms != NULL)
+            munmap(seg->rooms, seg->nrooms * sizeof(uint64_t));
+        if (seg->rmsfd >= 0)
+            close(seg->rmsfd);
+        close(fd);
+        free(seg->index);
+        free(seg);
+        snprintf(path, sizeof(path), "%s/%020llu.jrn", j->dir, (unsigned long long) base);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%020llu.idx", j->dir, (unsigned long long) base);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%020llu.rms", j->dir, (unsigned long long) base);
+        unlink(path);
+        return 0;
+    }
+    
+    if (seg->len < seg->size && ftruncate(fd, seg->len) < 0)
+        perror(" - journal: ftruncate error.\n");
+    if (seg->rmsfd >= 0) {
+        if (seg->nrooms > seg->count
+            && ftruncate(seg->rmsfd, seg->count * sizeof(uint64_t)) < 0)
+            perror(" - journal: ftruncate error.\n");
+        close(seg->rmsfd);
+        seg->rmsfd = -1;
+    }
+    
+    j->committed = base + seg->count - 1;
+    return jr_add(j, seg);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_roll
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static struct jr_segment* jr_roll(struct journal* j,
+--                                                uint64_t base)
+--              struct journal* j: the journal
+--              uint64_t base: id of the segment's first message
+-- 
+-- RETURNS:     the new segment, NULL on error
+-- 
+-- NOTES:
+-- This function is called to start a segment. The file is sized up front
+-- so the writer never extends it, and mapped writable. So is the file of
+-- room keys; without it the segment's messages are in no room.
+------------------------------------------------------------------------------*/
+static struct jr_segment* jr_roll(struct journal* j, uint64_t base)
+{
+    struct  jr_segment* seg;
+    char    path[JR_PATH_MAX + 32];
+    size_t  keys;
+    void*   map;
+    
+    if ((seg = (struct jr_segment*) calloc(1, sizeof(*seg))) == NULL)
+        return NULL;
+    seg->base = base;
+    seg->size = j->seg_size;
+    
+    snprintf(path, sizeof(path), "%s/%020llu.jrn", j->dir, (unsigned long long) base);
+    if ((seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        perror(" - journal: can't create segment.\n");
+        free(seg);
+        return NULL;
+    }
+    
+    if (ftruncate(seg->fd, seg->size) < 0
+        || (seg->map = (char*) mmap(NULL, seg->size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, seg->fd, 0)) == MAP_FAILED) {
+        perror(" - journal: can't map segment.\n");
+        close(seg->fd);
+        unlink(path);
+        free(seg);
+        return NULL;
+    }
+    
+    snprintf(path, sizeof(path), "%s/%020llu.idx", j->dir, (unsigned long long) base);
+    seg->idxfd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    
+    keys = seg->size / FRAME_HDR_SIZE;
+    snprintf(path, sizeof(path), "%s/%020llu.rms", j->dir, (unsigned long long) base);
+    if ((seg->rmsfd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+        || ftruncate(seg->rmsfd, keys * sizeof(uint64_t)) < 0
+        || (map = mmap(NULL, keys * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, seg->rmsfd, 0)) == MAP_FAILED) {
+        perror(" - journal: can't map room keys.\n");
+    } else {
+        seg->rooms = (uint64_t*) map;
+        seg->nrooms = keys;
+    }
+    
+    pthread_mutex_lock(&j->lock);
+    if (jr_add(j, seg) < 0) {
+        pthread_mutex_unlock(&j->lock);
+        munmap(seg->map, seg->size);
+        if (seg->rooms != NULL) munmap(seg->rooms, seg->nrooms * sizeof(uint64_t));
+        close(seg->fd);
+        if (seg->idxfd >= 0) close(seg->idxfd);
+        if (seg->rmsfd >= 0) close(seg->rmsfd);
+        free(seg);
+        return NULL;
+    }
+    pthread_mutex_unlock(&j->lock);
+    return seg;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_seal
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void jr_seal(struct jr_segment* seg)
+--              struct jr_segment* seg: the full segment
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Called on the writer thread once a segment is full. The file shrinks to
+-- the committed bytes and the room keys to the committed messages; the
+-- mappings stay, readers send from them.
+------------------------------------------------------------------------------*/
+static void jr_seal(struct jr_segment* seg)
+{
+    if (ftruncate(seg->fd, seg->len) < 0)
+        perror(" - journal: ftruncate error.\n");
+    
+    if (seg->rmsfd >= 0) {
+        if (ftruncate(seg->rmsfd, seg->count * sizeof(uint64_t)) < 0)
+            perror(" - journal: ftruncate error.\n");
+        close(seg->rmsfd);
+        seg->rmsfd = -1;
+    }
+    
+    if (seg->idxfd >= 0) {
+        close(seg->idxfd);
+        seg->idxfd = -1;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_add
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int jr_add(struct journal* j, struct jr_segment* seg)
+--              struct journal* j: the journal
+--              struct jr_segment* seg: the segment to append
+-- 
+-- RETURNS:     0 on success, -1 if memory runs out
+-- 
+-- NOTES:
+-- This function is called with the lock held once readers can see the
+-- journal.
+------------------------------------------------------------------------------*/
+static int jr_add(struct journal* j, struct jr_segment* seg)
+{
+    struct jr_segment** segs;
+    
+    if (j->nsegs == j->capsegs) {
+        segs = (struct jr_segment**) realloc(j->segs,
+                (j->capsegs ? j->capsegs * 2 : 16) * sizeof(*segs));
+        if (segs == NULL)
+            return -1;
+        j->segs = segs;
+        j->capsegs = j->capsegs ? j->capsegs * 2 : 16;
+    }
+    
+    j->segs[j->nsegs++] = seg;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_mark
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void jr_mark(struct journal* j,
+--                                  struct jr_segment* seg,
+--                                  const struct jr_index* e)
+--              struct journal* j: the journal
+--              struct jr_segment* seg: the segment
+--              const struct jr_index* e: the entry
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to add an index entry, in memory and to the
+-- segment's index file while it is being written. The array only grows
+-- under the lock since readers search it.
+------------------------------------------------------------------------------*/
+static void jr_mark(struct journal* j, struct jr_segment* seg, const struct jr_index* e)
+{
+    struct jr_index* index;
+    
+    if (seg->idxfd >= 0 && write(seg->idxfd, e, sizeof(*e)) < 0)
+        perror(" - journal: index write error.\n");
+    
+    pthread_mutex_lock(&j->lock);
+    if (seg->nindex == seg->capindex) {
+        index = (struct jr_index*) realloc(seg->index,
+                (seg->capindex ? seg->capindex * 2 : 64) * sizeof(*index));
+        if (index != NULL) {
+            seg->index = index;
+            seg->capindex = seg->capindex ? seg->capindex * 2 : 64;
+        }
+    }
+    // a missing entry only makes seeks step over more frames
+    if (seg->nindex < seg->capindex)
+        seg->index[seg->nindex++] = *e;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_frame_len
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static uint32_t jr_frame_len(const char* p)
+--              const char* p: a frame header
+-- 
+-- RETURNS:     the payload length in the header
+-- 
+-- NOTES:
+-- The length is stored big-endian at offset 4 (see frame.h).
+------------------------------------------------------------------------------*/
+static uint32_t jr_frame_len(const char* p)
+{
+    const unsigned char* u = (const unsigned char*) p + 4;
+    
+    return ((uint32_t) u[0] << 24) | ((uint32_t) u[1] << 16)
+           | ((uint32_t) u[2] << 8) | u[3];
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_cmp
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int jr_cmp(const void* a, const void* b)
+--              const void* a: a segment id
+--              const void* b: another segment id
+-- 
+-- RETURNS:     <0, 0 or >0 as for qsort()
+-- 
+-- NOTES:
+-- Orders the segments found in the directory by their first id.
+------------------------------------------------------------------------------*/
+static int jr_cmp(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    
+    return (x > y) - (x < y);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_find
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int jr_find(struct journal* j, uint64_t base)
+--              struct journal* j: the journal, lock held
+--              uint64_t base: the first id of a segment
+-- 
+-- RETURNS:     the index of the segment in segs, -1 if there is none
+-- 
+-- NOTES:
+-- Binary search, the segments are kept in base order.
+------------------------------------------------------------------------------*/
+static int jr_find(struct journal* j, uint64_t base)
+{
+    int lo = 0, hi = j->nsegs - 1, mid;
+    
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (j->segs[mid]->base == base) return mid;
+        if (j->segs[mid]->base < base) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    jr_room
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static uint64_t jr_room(const struct jr_segment* seg,
+--                                      uint64_t id)
+--              const struct jr_segment* seg: the segment holding the message
+--              uint64_t id: a committed message id
+-- 
+-- RETURNS:     the key of the message's room, 0 if it has none
+-- 
+-- NOTES:
+-- A segment without a room keys file has no keys at all.
+------------------------------------------------------------------------------*/
+static uint64_t jr_room(const struct jr_segment* seg, uint64_t id)
+{
+    return (id - seg->base < seg->nrooms) ? seg->rooms[id - seg->base] : 0;
+}
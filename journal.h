@@ -0,0 +1,131 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: journal.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares the server's message journal. Every broadcast
+-- gets a message id and its frame is appended, exactly as it went out on the
+-- wire, to a fixed-size segment file mapped into memory. A sparse index
+-- records the offset and time of every JR_INDEX_EVERY-th message, so a
+-- reader can find message id X and send the segments from there to a socket
+-- as they are.
+-- The event loops only push a reference to the framed message onto a
+-- lock-free queue; a writer thread copies the frames into the segments and
+-- syncs them once per batch (group commit). Readers only see committed
+-- messages.
+-- A message gets its id when it is queued and a frame encoded with
+-- FRAME_F_ID carries it, so clients learn the id of what they received.
+-- Each message is journaled with the key of its room, and a reader's
+-- cursor can be given a filter so that it only streams the rooms it is
+-- allowed to read.
+-------------------------------------------------------------------------------*/
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "msgbuf.h"
+#include "mpsc.h"
+
+#define JR_PATH_MAX     256     // maximum length of the journal directory
+#define JR_SEG_SIZE     67108864 // size of a segment file
+#define JR_INDEX_EVERY  64      // messages between two index entries
+#define JR_CHUNK        262144  // most bytes handed to one write of a stream
+
+// sparse index entry, also the record format of the .idx files
+struct jr_index {
+    uint64_t    id;             // message id
+    uint64_t    off;            // offset of its frame in the segment
+    uint64_t    ts;             // when it was journaled, ns since the epoch
+};
+
+// one segment, named after the id of its first message
+struct jr_segment {
+    uint64_t    base;           // id of the first message
+    uint64_t    count;          // # of committed messages
+    size_t      len;            // # of committed bytes
+    int         fd;             // segment file, kept open for sendfile()
+    int         idxfd;          // index file
+    char*       map;            // the whole segment, mapped shared
+    size_t      size;           // size of the mapping
+    struct jr_index* index;     // sparse index
+    size_t      nindex;         // # of index entries
+    size_t      capindex;       // size of index
+    int         rmsfd;          // room keys file
+    uint64_t*   rooms;          // room key of every message, mapped
+    size_t      nrooms;         // # of keys the mapping can hold
+};
+
+// message queued for the writer
+struct jr_entry {
+    struct mpsc_node node;      // queue link, must come first
+    struct msgbuf* mb;          // the framed message
+    uint64_t    ts;             // when it was broadcast, ns since the epoch
+    uint64_t    room;           // key of the message's room
+    uint64_t    id;             // message id given by jr_append()
+};
+
+// journal state, segs and the committed counts are guarded by lock
+struct journal {
+    char        dir[JR_PATH_MAX]; // directory of the segment files
+    size_t      seg_size;       // size of a new segment
+    struct jr_segment** segs;   // segments, oldest first
+    int         nsegs;          // # of segments
+    int         capsegs;        // size of segs
+    uint64_t    committed;      // id of the last committed message
+    uint64_t    settled;        // id of the last message committed or dropped
+    struct jr_segment* active;  // segment being written, writer thread only
+    struct mpsc_queue queue;    // messages waiting for the writer
+    int         efd;            // eventfd waking the writer
+    int         signaled;       // set while a wakeup is pending
+    uint64_t    next;           // id of the last message handed out, atomic
+    uint64_t    taken;          // id of the last message dequeued, writer thread only
+    struct jr_entry* held;      // popped before their turn, in id order,
+                                // writer thread only
+    uint64_t    queued;         // # of messages ever queued, updated atomically
+    uint64_t    written;        // # of them the writer is done with
+    pthread_t   tid;            // writer thread
+    pthread_mutex_t lock;       // protects segs, nsegs and the counts
+};
+
+// position of a reader, streams messages up to a fixed id as they commit
+struct jr_cursor {
+    int         active;         // set while there is something to send
+    int         seg;            // current segment
+    uint64_t    off;            // next byte of the current segment
+    uint64_t    first;          // id of the first message sent
+    uint64_t    upto;           // id of the last message sent
+    uint64_t    id;             // id of the message starting at run
+    uint64_t    run;            // end of the run being sent
+    int       (*keep)(void* arg, uint64_t room); // filter, NULL sends all
+    void*       arg;            // passed to keep
+};
+
+// a cursor with its segments named by base, valid in another process
+struct jr_spot {
+    uint64_t    seg;            // base of the current segment
+    uint64_t    off;            // next byte of the current segment
+    uint64_t    first;          // id of the first message sent
+    uint64_t    upto;           // id of the last message sent
+    uint64_t    id;             // id of the message starting at run
+    uint64_t    run;            // end of the run being sent
+};
+
+// function prototypes
+int jr_open(struct journal* j, const char* dir, size_t seg_size);
+void jr_append(struct journal* j, struct msgbuf* mb, uint64_t room);
+void jr_range(struct journal* j, uint64_t* first, uint64_t* last);
+int jr_seek(struct journal* j, uint64_t after, struct jr_cursor* c);
+int jr_next(struct journal* j, struct jr_cursor* c, int* fd, char** data,
+            size_t* len);
+void jr_sync(struct journal* j);
+void jr_export(struct journal* j, const struct jr_cursor* c, struct jr_spot* p);
+int jr_import(struct journal* j, const struct jr_spot* p, struct jr_cursor* c);
+
+#endif
@@ -0,0 +1,364 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: logger.c - Buffered background writer for the chat session
+--              dump file.
+-- 
+-- PROGRAM:     chatclnt
+-- 
+-- FUNCTIONS:   int log_open(struct logger* lg, const char* path, int flush_ms,
+--                           size_t rotate_size, int rotate_secs, int keep);
+--              void log_write(struct logger* lg, const char* text,
+--                             size_t len);
+--              void log_close(struct logger* lg);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- log_write() only copies the record into the current buffer under a mutex.
+-- The writer thread wakes up every flush interval, or earlier once a batch
+-- has built up, swaps the buffers and writes the full one with a single
+-- write() outside the lock. If the disk stalls long enough for the buffer
+-- to fill, new records are dropped and counted instead of blocking the
+-- terminal; the count is logged once the writer catches up.
+-- Every line is stored as a CR-LF terminated record.
+------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "logger.h"
+
+static void* log_writer(void* arg);
+static void log_flush(struct logger* lg, const char* data, size_t len);
+static void log_rotate(struct logger* lg);
+static void log_append(struct logger* lg, const char* text, size_t len);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_open
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int log_open(struct logger* lg, const char* path,
+--                           int flush_ms, size_t rotate_size,
+--                           int rotate_secs, int keep)
+--              struct logger* lg: the logger to start
+--              const char* path: the log file, appended to
+--              int flush_ms: longest time a record stays in memory
+--              size_t rotate_size: rotate once the file reaches this size,
+--                                  0 to never rotate by size
+--              int rotate_secs: rotate once the file is this old, 0 to
+--                               never rotate by age
+--              int keep: # of rotated files kept (path.1 is the newest)
+-- 
+-- RETURNS:     0 on success, -1 if the file or the writer cannot be started
+-- 
+-- NOTES:
+-- This function is called once to open the log file and start the writer.
+------------------------------------------------------------------------------*/
+int log_open(struct logger* lg, const char* path, int flush_ms,
+             size_t rotate_size, int rotate_secs, int keep)
+{
+    struct stat st;
+    
+    memset(lg, 0, sizeof(*lg));
+    snprintf(lg->path, sizeof(lg->path), "%s", path);
+    lg->flush_ms = (flush_ms > 0) ? flush_ms : LOG_FLUSH_MS;
+    lg->rotate_size = rotate_size;
+    lg->rotate_secs = rotate_secs;
+    lg->keep = (keep > 0) ? keep : 1;
+    
+    if ((lg->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+        return -1;
+    
+    lg->size = (fstat(lg->fd, &st) == 0) ? st.st_size : 0;
+    lg->opened = time(NULL);
+    
+    lg->buf = (char*) malloc(LOG_BUF_SIZE);
+    lg->spare = (char*) malloc(LOG_BUF_SIZE);
+    if (lg->buf == NULL || lg->spare == NULL)
+        return -1;
+    
+    pthread_mutex_init(&lg->lock, NULL);
+    pthread_cond_init(&lg->cond, NULL);
+    
+    return (pthread_create(&lg->tid, NULL, log_writer, lg) == 0) ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_write
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void log_write(struct logger* lg, const char* text,
+--                             size_t len)
+--              struct logger* lg: the logger
+--              const char* text: one or more lines, the final newline is
+--                                optional
+--              size_t len: the length of the text
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to log text. It never blocks on the disk.
+------------------------------------------------------------------------------*/
+void log_write(struct logger* lg, const char* text, size_t len)
+{
+    int wake;
+    
+    if (lg->buf == NULL)
+        return;
+    
+    pthread_mutex_lock(&lg->lock);
+    
+    log_append(lg, text, len);
+    wake = (lg->len >= LOG_BATCH_SIZE);
+    
+    pthread_mutex_unlock(&lg->lock);
+    
+    if (wake)
+        pthread_cond_signal(&lg->cond);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_close
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void log_close(struct logger* lg)
+--              struct logger* lg: the logger
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called before the client exits. It waits for the
+-- writer to write out every buffered record.
+------------------------------------------------------------------------------*/
+void log_close(struct logger* lg)
+{
+    if (lg->buf == NULL)
+        return;
+    
+    pthread_mutex_lock(&lg->lock);
+    lg->stop = 1;
+    pthread_cond_signal(&lg->cond);
+    pthread_mutex_unlock(&lg->lock);
+    
+    pthread_join(lg->tid, NULL);
+    close(lg->fd);
+    free(lg->buf);
+    free(lg->spare);
+    lg->buf = lg->spare = NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_writer
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void* log_writer(void* arg)
+--              void* arg: the logger
+-- 
+-- RETURNS:     NULL once the logger is closed
+-- 
+-- NOTES:
+-- Writer thread. It takes the whole buffer at once and hands the client
+-- the empty spare, so the lock is only held for a pointer swap.
+------------------------------------------------------------------------------*/
+static void* log_writer(void* arg)
+{
+    struct  logger* lg = (struct logger*) arg;
+    struct  timespec ts;
+    char    note[64];
+    char*   data;
+    size_t  len;
+    int     n, stop;
+    
+    do {
+        pthread_mutex_lock(&lg->lock);
+        
+        if (!lg->stop && lg->len < LOG_BATCH_SIZE) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += lg->flush_ms / 1000;
+            ts.tv_nsec += (long)(lg->flush_ms % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&lg->cond, &lg->lock, &ts);
+        }
+        
+        // room is free again, note what the stall cost
+        if (lg->dropped > 0 && lg->len + sizeof(note) <= LOG_BUF_SIZE) {
+            n = snprintf(note, sizeof(note), "[%llu records dropped]",
+                         (unsigned long long) lg->dropped);
+            log_append(lg, note, n);
+            lg->dropped = 0;
+        }
+        
+        data = lg->buf;
+        len = lg->len;
+        lg->buf = lg->spare;
+        lg->len = 0;
+        lg->spare = data;
+        stop = lg->stop;
+        
+        pthread_mutex_unlock(&lg->lock);
+        
+        log_flush(lg, data, len);
+    } while (!stop);
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void log_flush(struct logger* lg, const char* data,
+--                                    size_t len)
+--              struct logger* lg: the logger
+--              const char* data: whole records
+--              size_t len: the number of bytes
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Called on the writer thread only. The file is rotated before a batch, so
+-- a batch never spans two files.
+------------------------------------------------------------------------------*/
+static void log_flush(struct logger* lg, const char* data, size_t len)
+{
+    ssize_t n;
+    
+    if ((lg->rotate_size > 0 && lg->size > 0 && lg->size + len > lg->rotate_size)
+        || (lg->rotate_secs > 0 && time(NULL) - lg->opened >= lg->rotate_secs))
+        log_rotate(lg);
+    
+    while (len > 0 && lg->fd >= 0) {
+        if ((n = write(lg->fd, data, len)) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        len -= n;
+        lg->size += n;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_rotate
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void log_rotate(struct logger* lg)
+--              struct logger* lg: the logger
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Renames path.N-1 to path.N down to path to path.1, dropping the oldest
+-- file, and starts a new empty file.
+------------------------------------------------------------------------------*/
+static void log_rotate(struct logger* lg)
+{
+    char    from[LOG_PATH_MAX + 16];
+    char    to[LOG_PATH_MAX + 16];
+    int     i;
+    
+    for (i = lg->keep; i > 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", lg->path, i - 1);
+        snprintf(to, sizeof(to), "%s.%d", lg->path, i);
+        rename(from, to);
+    }
+    
+    snprintf(to, sizeof(to), "%s.1", lg->path);
+    rename(lg->path, to);
+    
+    if (lg->fd >= 0)
+        close(lg->fd);
+    lg->fd = open(lg->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    lg->size = 0;
+    lg->opened = time(NULL);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    log_append
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void log_append(struct logger* lg, const char* text,
+--                                     size_t len)
+--              struct logger* lg: the logger, locked
+--              const char* text: one or more lines
+--              size_t len: the length of the text
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Stores every line of text as a CR-LF terminated record. Line endings in
+-- the text, LF or CR-LF, are replaced. Text that does not fit is dropped
+-- as a whole.
+------------------------------------------------------------------------------*/
+static void log_append(struct logger* lg, const char* text, size_t len)
+{
+    char*   out;
+    size_t  i;
+    
+    // drop the final line ending, one is added below
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r'))
+        len--;
+    
+    // worst case every byte is a LF that becomes CR-LF
+    if (lg->len + 2 * len + 2 > LOG_BUF_SIZE) {
+        lg->dropped++;
+        return;
+    }
+    
+    out = lg->buf + lg->len;
+    for (i = 0; i < len; i++) {
+        if (text[i] == '\r')
+            continue;
+        if (text[i] == '\n')
+            *out++ = '\r';
+        *out++ = text[i];
+    }
+    *out++ = '\r';
+    *out++ = '\n';
+    lg->len = out - lg->buf;
+}
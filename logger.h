@@ -0,0 +1,56 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: logger.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares the chat session logger. Records are appended
+-- to an in-memory buffer and a background thread writes them out in large
+-- batches, so the client never waits on the disk. The log file can be
+-- rotated by size, by age, or both.
+-------------------------------------------------------------------------------*/
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LOG_PATH_MAX    256     // maximum length of the log file name
+#define LOG_BUF_SIZE    1048576 // records held in memory before dropping
+#define LOG_BATCH_SIZE  65536   // buffered bytes that wake the writer early
+#define LOG_FLUSH_MS    1000    // default flush interval
+#define LOG_KEEP        5       // default # of rotated files kept
+
+// logger state, the buffers are swapped between client and writer
+struct logger {
+    char        path[LOG_PATH_MAX]; // log file name
+    int         fd;             // log file, -1 if it could not be opened
+    char*       buf;            // records waiting to be written
+    size_t      len;            // # of bytes in buf
+    char*       spare;          // buffer being written by the writer
+    uint64_t    dropped;        // records dropped while the disk stalled
+    int         flush_ms;       // longest time a record stays in memory
+    size_t      rotate_size;    // rotate at this file size, 0 = never
+    int         rotate_secs;    // rotate at this file age, 0 = never
+    int         keep;           // # of rotated files kept
+    size_t      size;           // current file size
+    time_t      opened;         // when the current file was started
+    int         stop;           // set by log_close()
+    pthread_t   tid;            // writer thread
+    pthread_mutex_t lock;       // protects buf, len, dropped and stop
+    pthread_cond_t cond;        // wakes the writer
+};
+
+// function prototypes
+int log_open(struct logger* lg, const char* path, int flush_ms,
+             size_t rotate_size, int rotate_secs, int keep);
+void log_write(struct logger* lg, const char* text, size_t len);
+void log_close(struct logger* lg);
+
+#endif
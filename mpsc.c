@@ -0,0 +1,127 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: mpsc.c - Lock-free multi-producer single-consumer queue.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   void mpsc_init(struct mpsc_queue* q);
+--              void mpsc_push(struct mpsc_queue* q, struct mpsc_node* n);
+--              struct mpsc_node* mpsc_pop(struct mpsc_queue* q);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- Intrusive queue after Dmitry Vyukov's design. A push is one atomic
+-- exchange and one store, so producers never wait for each other or for
+-- the consumer. A pop may briefly report the queue empty while a producer
+-- is between its exchange and its store; the producer then wakes the
+-- consumer again, so nothing is lost.
+------------------------------------------------------------------------------*/
+
+#include <stddef.h>
+#include "mpsc.h"
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mpsc_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void mpsc_init(struct mpsc_queue* q)
+--              struct mpsc_queue* q: the queue to initialize
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- An empty queue holds only the stub node.
+------------------------------------------------------------------------------*/
+void mpsc_init(struct mpsc_queue* q)
+{
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mpsc_push
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void mpsc_push(struct mpsc_queue* q, struct mpsc_node* n)
+--              struct mpsc_queue* q: the queue
+--              struct mpsc_node* n: the node to append
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- May be called from any thread.
+------------------------------------------------------------------------------*/
+void mpsc_push(struct mpsc_queue* q, struct mpsc_node* n)
+{
+    struct mpsc_node* prev;
+    
+    __atomic_store_n(&n->next, (struct mpsc_node*) NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&q->head, n, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mpsc_pop
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct mpsc_node* mpsc_pop(struct mpsc_queue* q)
+--              struct mpsc_queue* q: the queue
+-- 
+-- RETURNS:     the oldest node, or NULL if none is ready
+-- 
+-- NOTES:
+-- Must only be called by the consumer thread.
+------------------------------------------------------------------------------*/
+struct mpsc_node* mpsc_pop(struct mpsc_queue* q)
+{
+    struct mpsc_node* tail = q->tail;
+    struct mpsc_node* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    struct mpsc_node* head;
+    
+    // step over the stub
+    if (tail == &q->stub) {
+        if (next == NULL) return NULL;
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    
+    // tail is the last node unless a producer is half way through a push
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (tail != head) return NULL;
+    
+    // put the stub back behind the last node so it can be handed out
+    mpsc_push(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    
+    return NULL;
+}
@@ -0,0 +1,35 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: mpsc.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares a lock-free multi-producer single-consumer
+-- queue. Any thread may push; only the owning thread pops. Nodes are
+-- intrusive: embed a struct mpsc_node as the first member of the item.
+-------------------------------------------------------------------------------*/
+#ifndef __MPSC_H__
+#define __MPSC_H__
+
+// link embedded in every queued item
+struct mpsc_node {
+    struct mpsc_node* next;
+};
+
+// queue state, the consumer owns tail
+struct mpsc_queue {
+    struct mpsc_node* head;     // last pushed node, swapped by producers
+    struct mpsc_node* tail;     // next node to pop
+    struct mpsc_node stub;      // keeps the list non-empty
+};
+
+// function prototypes
+void mpsc_init(struct mpsc_queue* q);
+void mpsc_push(struct mpsc_queue* q, struct mpsc_node* n);
+struct mpsc_node* mpsc_pop(struct mpsc_queue* q);
+
+#endif
@@ -0,0 +1,138 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: msgbuf.c - Reference counted message buffers for broadcast
+--              fan-out.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   struct msgbuf* mb_alloc(size_t len);
+--              struct msgbuf* mb_frame(int type, int flags,
+--                                      const void* payload, uint32_t len);
+--              void mb_ref(struct msgbuf* mb);
+--              void mb_unref(struct msgbuf* mb);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- Header and bytes are one allocation. The reference count is updated with
+-- atomic builtins so a buffer may be shared by queues owned by different
+-- threads.
+------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+#include "msgbuf.h"
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mb_alloc
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct msgbuf* mb_alloc(size_t len)
+--              size_t len: the number of bytes to hold
+-- 
+-- RETURNS:     a buffer holding one reference, or NULL if memory runs out
+-- 
+-- NOTES:
+-- The caller fills MB_DATA(mb) before sharing the buffer.
+------------------------------------------------------------------------------*/
+struct msgbuf* mb_alloc(size_t len)
+{
+    struct msgbuf* mb = (struct msgbuf*) malloc(sizeof(struct msgbuf) + len);
+    
+    if (mb == NULL) return NULL;
+    
+    mb->refs = 1;
+    mb->len = len;
+    return mb;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mb_frame
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct msgbuf* mb_frame(int type, int flags,
+--                                      const void* payload, uint32_t len)
+--              int type: the frame type
+--              int flags: the frame flags
+--              const void* payload: the payload bytes
+--              uint32_t len: the payload length
+-- 
+-- RETURNS:     a buffer holding one reference to the encoded frame, or NULL
+-- 
+-- NOTES:
+-- This function is called to encode a frame once for all its recipients.
+-- With FRAME_F_ID, room is left for the message id, see frame_stamp().
+------------------------------------------------------------------------------*/
+struct msgbuf* mb_frame(int type, int flags, const void* payload, uint32_t len)
+{
+    struct msgbuf* mb;
+    uint32_t idlen = (flags & FRAME_F_ID) ? FRAME_ID_SIZE : 0;
+    
+    if (len > FRAME_MAX - idlen || (mb = mb_alloc(FRAME_HDR_SIZE + idlen + len)) == NULL)
+        return NULL;
+    
+    frame_header(MB_DATA(mb), type, flags, idlen + len);
+    memset(MB_DATA(mb) + FRAME_HDR_SIZE, 0, idlen);
+    memcpy(MB_DATA(mb) + FRAME_HDR_SIZE + idlen, payload, len);
+    return mb;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mb_ref
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void mb_ref(struct msgbuf* mb)
+--              struct msgbuf* mb: the buffer
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to take another reference to a buffer.
+------------------------------------------------------------------------------*/
+void mb_ref(struct msgbuf* mb)
+{
+    __atomic_fetch_add(&mb->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    mb_unref
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void mb_unref(struct msgbuf* mb)
+--              struct msgbuf* mb: the buffer
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to drop a reference. The last one frees the
+-- buffer.
+------------------------------------------------------------------------------*/
+void mb_unref(struct msgbuf* mb)
+{
+    if (__atomic_sub_fetch(&mb->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(mb);
+}
@@ -0,0 +1,37 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: msgbuf.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the shared message buffer. A broadcast is
+-- framed once into an immutable msgbuf and every recipient's output queue
+-- holds a reference to the same bytes. The buffer is freed when the last
+-- reference is dropped, i.e. when the slowest recipient has sent it.
+-------------------------------------------------------------------------------*/
+#ifndef __MSGBUF_H__
+#define __MSGBUF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// reference counted, immutable once shared
+struct msgbuf {
+    int         refs;           // # of references, updated atomically
+    uint32_t    len;            // # of bytes in the buffer
+};
+
+// the bytes follow the header
+#define MB_DATA(mb)     ((char*)((struct msgbuf*)(mb) + 1))
+
+// function prototypes
+struct msgbuf* mb_alloc(size_t len);
+struct msgbuf* mb_frame(int type, int flags, const void* payload, uint32_t len);
+void mb_ref(struct msgbuf* mb);
+void mb_unref(struct msgbuf* mb);
+
+#endif
@@ -0,0 +1,389 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: outq.c - Bounded per-client outbound message queue.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   void oq_init(struct outq* q);
+--              void oq_free(struct outq* q);
+--              int oq_push(struct outq* q, struct msgbuf* mb, size_t off);
+--              int oq_flush(struct outq* q, int fd);
+--              int oq_iov(struct outq* q, struct iovec* iov, int max);
+--              void oq_consume(struct outq* q, size_t n);
+--              int oq_drop_oldest(struct outq* q, size_t limit);
+--              void oq_mark(struct outq* q);
+--              void oq_unmark(struct outq* q);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- The queue only tracks bytes; what happens when a queue grows too large is
+-- decided by the server's congestion policy. Entries reference shared
+-- message buffers, so queueing a broadcast for N clients costs N pointers
+-- rather than N copies. Messages are only ever dropped
+-- whole, and never the first one once part of it has reached the socket, so
+-- the byte stream seen by the client always stays frame aligned.
+-- The io_uring backend writes the queue asynchronously: it pins the
+-- messages it handed to the kernel so they are not dropped under it.
+-- A mark holds back whatever is queued after it, so output from elsewhere
+-- (a history stream) can go out between the two parts of the queue.
+------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "outq.h"
+
+static void oq_pop(struct outq* q);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void oq_init(struct outq* q)
+--              struct outq* q: the queue to initialize
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- The ring is allocated on the first push, most clients keep up with the
+-- server and never need it.
+------------------------------------------------------------------------------*/
+void oq_init(struct outq* q)
+{
+    memset(q, 0, sizeof(*q));
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_free
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void oq_free(struct outq* q)
+--              struct outq* q: the queue to release
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to discard every queued message and the ring.
+------------------------------------------------------------------------------*/
+void oq_free(struct outq* q)
+{
+    while (q->count > 0)
+        oq_pop(q);
+    
+    free(q->ring);
+    oq_init(q);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_push
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int oq_push(struct outq* q, struct msgbuf* mb, size_t off)
+--              struct outq* q: the queue
+--              struct msgbuf* mb: the message
+--              size_t off: bytes of the message already sent, only allowed
+--                          when the queue is empty
+-- 
+-- RETURNS:     0 on success, -1 if memory runs out
+-- 
+-- NOTES:
+-- This function is called to append a message to the queue. The queue takes
+-- its own reference to the buffer. The ring doubles when it is full.
+------------------------------------------------------------------------------*/
+int oq_push(struct outq* q, struct msgbuf* mb, size_t off)
+{
+    struct  outq_entry* ring;
+    uint32_t cap, i;
+    
+    if (q->count == q->cap) {
+        cap = q->cap ? q->cap * 2 : 8;
+        ring = (struct outq_entry*) malloc(cap * sizeof(*ring));
+        if (ring == NULL) return -1;
+        for (i = 0; i < q->count; i++)
+            ring[i] = q->ring[(q->head + i) & (q->cap - 1)];
+        free(q->ring);
+        q->ring = ring;
+        q->cap = cap;
+        q->head = 0;
+    }
+    
+    if (q->count == 0)
+        q->off = off;
+    
+    mb_ref(mb);
+    i = (q->head + q->count) & (q->cap - 1);
+    q->ring[i].mb = mb;
+    q->count++;
+    q->bytes += mb->len - ((q->count == 1) ? q->off : 0);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int oq_flush(struct outq* q, int fd)
+--              struct outq* q: the queue
+--              int fd: the non-blocking socket to write to
+-- 
+-- RETURNS:     0 when the queue is empty or the socket is full, -1 on a
+--              socket error
+-- 
+-- NOTES:
+-- This function is called to write as much of the queue as the socket
+-- accepts, up to OQ_IOV_MAX messages per writev(). It stops at the mark.
+------------------------------------------------------------------------------*/
+int oq_flush(struct outq* q, int fd)
+{
+    struct  iovec iov[OQ_IOV_MAX];
+    ssize_t n;
+    int     cnt;
+    
+    while (q->count > 0) {
+        if ((cnt = oq_iov(q, iov, OQ_IOV_MAX)) == 0)
+            break;
+        
+        n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        
+        oq_consume(q, n);
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_iov
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int oq_iov(struct outq* q, struct iovec* iov, int max)
+--              struct outq* q: the queue
+--              struct iovec* iov: receives the unsent bytes
+--              int max: the size of iov
+-- 
+-- RETURNS:     the number of iovecs filled
+-- 
+-- NOTES:
+-- This function is called to describe the head of the queue for writev(),
+-- one iovec per message, the first one starting after the bytes already
+-- sent, and none past the mark. The queue is left unchanged.
+------------------------------------------------------------------------------*/
+int oq_iov(struct outq* q, struct iovec* iov, int max)
+{
+    struct  outq_entry* e;
+    int     i, cnt;
+    
+    cnt = (q->count < (uint32_t) max) ? (int) q->count : max;
+    if (q->marked && (uint32_t) cnt > q->mark)
+        cnt = (int) q->mark;
+    for (i = 0; i < cnt; i++) {
+        e = &q->ring[(q->head + i) & (q->cap - 1)];
+        iov[i].iov_base = MB_DATA(e->mb);
+        iov[i].iov_len = e->mb->len;
+    }
+    
+    if (cnt > 0) {
+        iov[0].iov_base = (char*) iov[0].iov_base + q->off;
+        iov[0].iov_len -= q->off;
+    }
+    
+    return cnt;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_consume
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void oq_consume(struct outq* q, size_t n)
+--              struct outq* q: the queue
+--              size_t n: the number of bytes written
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called after a write to retire the messages that went
+-- out completely and advance into the one that went out in part.
+------------------------------------------------------------------------------*/
+void oq_consume(struct outq* q, size_t n)
+{
+    struct outq_entry* e;
+    
+    while (n > 0 && q->count > 0) {
+        e = &q->ring[q->head];
+        if (n < e->mb->len - q->off) {
+            q->off += n;
+            q->bytes -= n;
+            break;
+        }
+        n -= e->mb->len - q->off;
+        oq_pop(q);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_drop_oldest
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int oq_drop_oldest(struct outq* q, size_t limit)
+--              struct outq* q: the queue
+--              size_t limit: the queue size to shrink to
+-- 
+-- RETURNS:     the number of messages dropped
+-- 
+-- NOTES:
+-- This function is called to drop the oldest unsent messages until the
+-- queue holds at most limit bytes. A partially sent first message is kept,
+-- and so are pinned messages and the newest message.
+------------------------------------------------------------------------------*/
+int oq_drop_oldest(struct outq* q, size_t limit)
+{
+    struct  outq_entry* e;
+    uint32_t keep, i, at;
+    int     dropped = 0;
+    
+    keep = (q->off > 0) ? 1 : 0;   // # of leading messages to keep
+    if (q->pinned > keep)
+        keep = q->pinned;
+    
+    while (q->bytes > limit && q->count > keep + 1) {
+        at = (q->head + keep) & (q->cap - 1);
+        e = &q->ring[at];
+        q->bytes -= e->mb->len;
+        mb_unref(e->mb);
+        if (keep < q->mark)
+            q->mark--;
+        
+        // close the gap, keep is only above 1 while a write is in flight
+        for (i = keep; i > 0; i--)
+            q->ring[(q->head + i) & (q->cap - 1)] = q->ring[(q->head + i - 1) & (q->cap - 1)];
+        q->head = (q->head + 1) & (q->cap - 1);
+        q->count--;
+        dropped++;
+    }
+    
+    return dropped;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_mark
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void oq_mark(struct outq* q)
+--              struct outq* q: the queue
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to put a mark after the last queued message.
+-- The messages ahead of it are written as usual; the ones queued later
+-- wait until oq_unmark(). mark counts down as the messages ahead go.
+------------------------------------------------------------------------------*/
+void oq_mark(struct outq* q)
+{
+    q->marked = 1;
+    q->mark = q->count;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_unmark
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void oq_unmark(struct outq* q)
+--              struct outq* q: the queue
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to remove the mark and let the rest of the
+-- queue go.
+------------------------------------------------------------------------------*/
+void oq_unmark(struct outq* q)
+{
+    q->marked = 0;
+    q->mark = 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    oq_pop
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void oq_pop(struct outq* q)
+--              struct outq* q: the queue
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to remove the first message and drop the queue's
+-- reference to it.
+------------------------------------------------------------------------------*/
+static void oq_pop(struct outq* q)
+{
+    struct outq_entry* e = &q->ring[q->head];
+    
+    q->bytes -= e->mb->len - q->off;
+    mb_unref(e->mb);
+    q->head = (q->head + 1) & (q->cap - 1);
+    q->count--;
+    q->off = 0;
+    if (q->mark > 0)
+        q->mark--;
+}
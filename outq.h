@@ -0,0 +1,55 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: outq.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the outbound queue kept for every client. Bytes
+-- that a non-blocking socket does not accept right away are queued as whole
+-- messages and written out with writev() when the socket becomes writable.
+-- The queue holds references to shared message buffers, never copies.
+-------------------------------------------------------------------------------*/
+#ifndef __OUTQ_H__
+#define __OUTQ_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "msgbuf.h"
+
+#define OQ_IOV_MAX      1024    // maximum # of messages per writev()
+
+// one queued message
+struct outq_entry {
+    struct msgbuf* mb;          // shared message buffer
+};
+
+// ring of queued messages, the first one may be partially sent
+struct outq {
+    struct outq_entry* ring;    // message ring
+    uint32_t    head;           // index of the first message
+    uint32_t    count;          // # of queued messages
+    uint32_t    cap;            // size of the ring, a power of 2
+    size_t      off;            // bytes of the first message already sent
+    size_t      bytes;          // # of bytes waiting to be sent
+    uint32_t    pinned;         // leading messages an asynchronous write uses
+    uint32_t    mark;           // messages ahead of the mark, see oq_mark()
+    int         marked;         // set while output is held at the mark
+};
+
+// function prototypes
+void oq_init(struct outq* q);
+void oq_free(struct outq* q);
+int oq_push(struct outq* q, struct msgbuf* mb, size_t off);
+int oq_flush(struct outq* q, int fd);
+int oq_iov(struct outq* q, struct iovec* iov, int max);
+void oq_consume(struct outq* q, size_t n);
+int oq_drop_oldest(struct outq* q, size_t limit);
+void oq_mark(struct outq* q);
+void oq_unmark(struct outq* q);
+
+#endif
@@ -0,0 +1,1301 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: peer.c - Federation, relays the broadcasts between servers.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int peer_add(const char* hostport);
+--              int peer_start(int lfd);
+--              int peer_enabled(void);
+--              void peer_relay(int kind, const char* room, const char* nick,
+--                              const char* text, size_t len);
+--              void peer_presence(const char* room, const char* nick,
+--                                 int join);
+--              void peer_stats(int* links, uint64_t* in, uint64_t* out,
+--                              uint64_t* dups);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- The links are served by a peer thread with its own epoll instance, so a
+-- slow or distant server never holds up a shard. A shard hands a record
+-- over with peer_relay(), which frames it once and pushes it on a
+-- lock-free queue; the thread numbers it, queues it on every link and,
+-- once the queue is empty, writes each link's backlog with one writev(). A link
+-- whose backlog goes past PEER_HWM is dropped rather than let it grow.
+-- A record received from a link is forwarded to the other links and
+-- delivered to this server's members of the room with broadcast_peer(),
+-- which also puts it in the scrollback and the journal, so /history and
+-- the replay on joining show the whole conversation.
+-- Both ends of a new link start with PEER_HELLO, the link carries records
+-- once the other end's has come. A server dialling itself finds its own
+-- node id in the answer and gives that --peer up. An outgoing link that
+-- fails or drops is dialled again after PEER_RETRY_MS, doubled per try
+-- up to PEER_RETRY_MAX. Links are not handed over by a hot upgrade, the
+-- new server dials its peers again; records relayed while a link is down
+-- are not sent again.
+-- The joins and leaves of this server's users are queued even with no link
+-- up, the thread counts them per room and nickname as it numbers them. A
+-- link that comes up is sent that count as PEER_ROSTER records, carrying
+-- the last sequence # given out; the other end takes them in place of
+-- what it had from us, and ignores the joins and leaves up to that # that
+-- reach it later by another path. The users of every origin are counted
+-- the same way and entered in the room rosters, and taken off them all
+-- once the last link to the origin drops. A leave is only applied to a
+-- join counted for its origin, so it never takes a local user off. The
+-- rosters are not forwarded: the users of a server not linked to this one
+-- are listed from the joins relayed while it could be reached.
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+
+// a --peer to dial
+struct peer_conf {
+    char    host[RES_HOST_MAX]; // as given
+    struct  sockaddr_in addr;   // where to connect
+    struct  peer_link* link;    // the link while there is one
+    uint64_t retry_at;          // when to dial again, stats_now() ns
+    int     delay;              // current reconnect delay, ms
+    int     self;               // set once it turned out to be this server
+};
+
+// records seen from one origin
+struct peer_window {
+    uint64_t top;               // highest sequence # taken
+    uint64_t floor;             // joins and leaves up to it are in its roster
+    uint64_t bits[PEER_WINDOW / 64]; // seq % PEER_WINDOW set once taken
+};
+
+// link to another server
+struct peer_link {
+    int     fd;                 // socket
+    int     conf;               // index of the --peer dialled, -1 if accepted
+    int     connecting;         // non-blocking connect in progress
+    int     up;                 // the other end's hello came
+    int     dead;               // closed at the end of the iteration
+    int     pollout;            // EPOLLOUT is watched
+    int     rostered;           // the other end's roster came
+    uint64_t node;              // node id of the other end
+    struct  frame_decoder dec;  // incoming records
+    struct  outq oq;            // outgoing records
+};
+
+static struct peer_conf peer_confs[PEER_MAX];
+static int peer_nconfs;
+static struct peer_link* peer_links[PEER_LINKS];
+static int peer_nlinks;
+static int peer_lfd = -1;           // --federate socket, or -1
+static int peer_efd = -1;           // eventfd kicked by peer_relay()
+static int peer_epfd = -1;          // the thread's epoll instance
+static int peer_on;                 // set once the thread runs
+static int peer_signaled;           // set while a wakeup is pending
+static uint64_t peer_node;          // this server's node id
+static uint64_t peer_seq;           // last sequence # given out
+static struct mpsc_queue peer_queue; // records from the shards
+static std::unordered_map<uint64_t, struct peer_window> peer_seen; // by origin
+static std::unordered_map<uint64_t, std::map<std::string, int> > peer_names; // by origin
+static char peer_rbuf[READ_SIZE];   // socket read buffer
+static int peer_up;                 // # of links up
+static uint64_t peer_in;            // records delivered here
+static uint64_t peer_out;           // records written to links
+static uint64_t peer_dups;          // records dropped as already seen
+
+static void* peer_main(void* arg);
+static void peer_dial(void);
+static void peer_connected(struct peer_link* l);
+static void peer_accept(void);
+static struct peer_link* peer_link_new(int fd, int conf);
+static void peer_drain(void);
+static void peer_read(struct peer_link* l);
+static int peer_frame(void* arg, const struct frame* f);
+static void peer_take(struct peer_link* from, const struct peer_rec* r);
+static int peer_fresh(struct peer_window* w, uint64_t seq);
+static void peer_count(uint64_t origin, const struct peer_rec* r);
+static void peer_roster(struct peer_link* l);
+static void peer_forget(uint64_t origin);
+static void peer_push(struct peer_link* l, struct msgbuf* mb);
+static void peer_flush(struct peer_link* l);
+static void peer_kill(struct peer_link* l, const char* why);
+static void peer_reap(void);
+static struct msgbuf* peer_encode(const struct peer_rec* r);
+static int peer_parse(const struct frame* f, struct peer_rec* r);
+static void put64(unsigned char* p, uint64_t v);
+static uint64_t get64(const unsigned char* p);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_add
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int peer_add(const char* hostport)
+--              const char* hostport: "host:port" of the server to dial
+-- 
+-- RETURNS:     0 on success, -1 if the address is bad or there are
+--              PEER_MAX already
+-- 
+-- NOTES:
+-- This function is called for every --peer option, before peer_start().
+-- The host name is resolved once, here.
+------------------------------------------------------------------------------*/
+int peer_add(const char* hostport)
+{
+    struct  peer_conf* c;
+    struct  addrinfo hints, *res;
+    const   char* colon = strrchr(hostport, ':');
+    int     port;
+    
+    if (peer_nconfs == PEER_MAX || colon == NULL || colon == hostport
+        || (size_t) (colon - hostport) >= sizeof(c->host)
+        || (port = atoi(colon + 1)) <= 0 || port > 65535)
+        return -1;
+    
+    c = &peer_confs[peer_nconfs];
+    memset(c, 0, sizeof(*c));
+    memcpy(c->host, hostport, colon - hostport);
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(c->host, NULL, &hints, &res) != 0)
+        return -1;
+    
+    memcpy(&c->addr, res->ai_addr, sizeof(c->addr));
+    c->addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    
+    c->delay = PEER_RETRY_MS;
+    peer_nconfs++;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_start
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int peer_start(int lfd)
+--              int lfd: bound --federate socket, -1 to only dial out
+-- 
+-- RETURNS:     0 on success, -1 on failure
+-- 
+-- NOTES:
+-- This function is called once at start-up to pick the node id and start
+-- the peer thread; without --federate or --peer it does nothing. The node id is random, a
+-- restarted server is a new origin and its sequence #s start over.
+------------------------------------------------------------------------------*/
+int peer_start(int lfd)
+{
+    struct  epoll_event ev;
+    pthread_t tid;
+    int     fd;
+    
+    if (lfd < 0 && peer_nconfs == 0)
+        return 0;
+    
+    if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0
+        || read(fd, &peer_node, sizeof(peer_node)) != sizeof(peer_node))
+        peer_node = ((uint64_t) getpid() << 32) ^ stats_now();
+    if (fd >= 0)
+        close(fd);
+    
+    mpsc_init(&peer_queue);
+    if ((peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+        || (peer_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &peer_efd;
+    if (epoll_ctl(peer_epfd, EPOLL_CTL_ADD, peer_efd, &ev) < 0)
+        return -1;
+    
+    if (lfd >= 0) {
+        if (listen(lfd, SOMAXCONN) < 0 || set_nonblock(lfd) < 0)
+            return -1;
+        ev.data.ptr = &peer_lfd;
+        if (epoll_ctl(peer_epfd, EPOLL_CTL_ADD, lfd, &ev) < 0)
+            return -1;
+        peer_lfd = lfd;
+    }
+    
+    if (pthread_create(&tid, NULL, peer_main, NULL) != 0)
+        return -1;
+    
+    pthread_detach(tid);
+    peer_on = 1;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_enabled
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int peer_enabled(void)
+-- 
+-- RETURNS:     1 if a link to another server is up, 0 otherwise
+-- 
+-- NOTES:
+-- This function is called on the broadcast path to skip peer_relay() when
+-- there is nobody to relay to; a record queued then would be dropped by
+-- the peer thread anyway.
+------------------------------------------------------------------------------*/
+int peer_enabled(void)
+{
+    return peer_on && __atomic_load_n(&peer_up, __ATOMIC_RELAXED) > 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_relay
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void peer_relay(int kind, const char* room, const char* nick,
+--                              const char* text, size_t len)
+--              int kind: PEER_MSG, PEER_JOIN or PEER_PART
+--              const char* room: the room name
+--              const char* nick: the sender's nickname
+--              const char* text: what the clients are sent, not NUL
+--                                terminated
+--              size_t len: the length of the text
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function may be called from any thread. The record is framed once
+-- and queued for the peer thread; the eventfd is only written when no
+-- wakeup is pending, as with the shard inboxes. The sequence # is left
+-- for the peer thread, shards racing to the queue would push them out of
+-- order.
+------------------------------------------------------------------------------*/
+void peer_relay(int kind, const char* room, const char* nick, const char* text,
+                size_t len)
+{
+    struct  peer_out* o;
+    struct  peer_rec r;
+    uint64_t one = 1;
+    
+    r.origin = peer_node;
+    r.seq = 0;
+    r.kind = kind;
+    r.hops = 0;
+    r.room = room;
+    r.roomlen = strlen(room);
+    r.nick = nick;
+    r.nicklen = strlen(nick);
+    r.text = text;
+    r.textlen = len;
+    
+    if ((o = (struct peer_out*) malloc(sizeof(*o))) == NULL)
+        return;
+    if ((o->mb = peer_encode(&r)) == NULL) {
+        free(o);
+        return;
+    }
+    
+    mpsc_push(&peer_queue, &o->node);
+    
+    if (__atomic_exchange_n(&peer_signaled, 1, __ATOMIC_SEQ_CST) == 0) {
+        if (write(peer_efd, &one, sizeof(one)) < 0)
+            perror(" - peer: eventfd write error.\n");
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_presence
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void peer_presence(const char* room, const char* nick,
+--                                 int join)
+--              const char* room: the room name
+--              const char* nick: the nickname of a local member
+--              int join: 1 when it enters the room's roster, 0 when it
+--                        leaves it
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by a shard next to every room_enter() and
+-- room_leave(). Unlike a message the record is queued with no link up,
+-- the peer thread counts it for the roster sent to the links to come.
+------------------------------------------------------------------------------*/
+void peer_presence(const char* room, const char* nick, int join)
+{
+    if (peer_on)
+        peer_relay(join ? PEER_JOIN : PEER_PART, room, nick, "", 0);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_stats
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void peer_stats(int* links, uint64_t* in, uint64_t* out,
+--                              uint64_t* dups)
+--              int* links: receives the # of links up
+--              uint64_t* in: receives the # of records delivered here
+--              uint64_t* out: receives the # of records written to links
+--              uint64_t* dups: receives the # of duplicates dropped
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by the stats thread. Only the peer thread writes
+-- the counters.
+------------------------------------------------------------------------------*/
+void peer_stats(int* links, uint64_t* in, uint64_t* out, uint64_t* dups)
+{
+    *links = __atomic_load_n(&peer_up, __ATOMIC_RELAXED);
+    *in = __atomic_load_n(&peer_in, __ATOMIC_RELAXED);
+    *out = __atomic_load_n(&peer_out, __ATOMIC_RELAXED);
+    *dups = __atomic_load_n(&peer_dups, __ATOMIC_RELAXED);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_main
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void* peer_main(void* arg)
+--              void* arg: unused
+-- 
+-- RETURNS:     NULL when epoll fails
+-- 
+-- NOTES:
+-- Event loop of the peer thread. The links are level-triggered, there are
+-- few of them. Records are queued on the links while the events are
+-- handled and written at the end of the iteration, one writev() per link.
+------------------------------------------------------------------------------*/
+static void* peer_main(void* arg)
+{
+    struct  epoll_event events[MAX_EVENTS];
+    struct  peer_link* l;
+    int64_t timeout, wait;
+    uint64_t now;
+    int     n, i;
+    
+    for (;;) {
+        peer_dial();
+        
+        // sleep until the next --peer is due to be dialled
+        timeout = -1;
+        now = stats_now();
+        for (i = 0; i < peer_nconfs; i++) {
+            if (peer_confs[i].link != NULL || peer_confs[i].self)
+                continue;
+            wait = (peer_confs[i].retry_at > now)
+                   ? (int64_t) ((peer_confs[i].retry_at - now) / 1000000) + 1 : 0;
+            if (timeout < 0 || wait < timeout)
+                timeout = wait;
+        }
+        
+        if ((n = epoll_wait(peer_epfd, events, MAX_EVENTS, (int) timeout)) < 0) {
+            if (errno == EINTR) continue;
+            perror(" - peer: epoll_wait error.\n");
+            return NULL;
+        }
+        
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == &peer_lfd) {
+                peer_accept();
+                continue;
+            }
+            if (events[i].data.ptr == &peer_efd) {
+                peer_drain();
+                continue;
+            }
+            
+            l = (struct peer_link*) events[i].data.ptr;
+            if (l->dead)
+                continue;
+            if (l->connecting) {
+                peer_connected(l);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                peer_read(l);
+        }
+        
+        for (i = 0; i < peer_nlinks; i++) {
+            if (!peer_links[i]->dead && !peer_links[i]->connecting)
+                peer_flush(peer_links[i]);
+        }
+        peer_reap();
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_dial
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_dial(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called every iteration to start a non-blocking connect
+-- to every --peer without a link whose reconnect delay is over.
+------------------------------------------------------------------------------*/
+static void peer_dial(void)
+{
+    struct  peer_conf* c;
+    struct  peer_link* l;
+    struct  epoll_event ev;
+    uint64_t now = stats_now();
+    int     i, fd;
+    
+    for (i = 0; i < peer_nconfs; i++) {
+        c = &peer_confs[i];
+        if (c->link != NULL || c->self || c->retry_at > now || peer_nlinks == PEER_LINKS)
+            continue;
+        
+        c->retry_at = now + (uint64_t) c->delay * 1000000;
+        c->delay = (c->delay * 2 < PEER_RETRY_MAX) ? c->delay * 2 : PEER_RETRY_MAX;
+        
+        if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+            continue;
+        if (connect(fd, (struct sockaddr*) &c->addr, sizeof(c->addr)) < 0
+            && errno != EINPROGRESS) {
+            close(fd);
+            continue;
+        }
+        
+        if ((l = peer_link_new(fd, i)) == NULL)
+            continue;
+        l->connecting = 1;
+        ev.events = EPOLLOUT;
+        ev.data.ptr = l;
+        epoll_ctl(peer_epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_connected
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_connected(struct peer_link* l)
+--              struct peer_link* l: the link being dialled
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a non-blocking connect completes. The
+-- link is watched for input from now on and says hello.
+------------------------------------------------------------------------------*/
+static void peer_connected(struct peer_link* l)
+{
+    struct  epoll_event ev;
+    socklen_t len = sizeof(int);
+    int     err = 0;
+    
+    if (getsockopt(l->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        peer_kill(l, NULL);
+        return;
+    }
+    
+    l->connecting = 0;
+    ev.events = EPOLLIN;
+    ev.data.ptr = l;
+    epoll_ctl(peer_epfd, EPOLL_CTL_MOD, l->fd, &ev);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_accept
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_accept(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the --federate socket is readable to take
+-- the links other servers opened.
+------------------------------------------------------------------------------*/
+static void peer_accept(void)
+{
+    int fd;
+    
+    while ((fd = accept4(peer_lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (peer_nlinks == PEER_LINKS || peer_link_new(fd, -1) == NULL)
+            close(fd);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_link_new
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static struct peer_link* peer_link_new(int fd, int conf)
+--              int fd: the link's socket
+--              int conf: the --peer dialled, -1 for a link accepted
+-- 
+-- RETURNS:     the link, NULL on failure (fd is closed)
+-- 
+-- NOTES:
+-- This function is called to add a link. The hello is queued right away,
+-- it goes out with the first flush. Nagle is turned off, the records are
+-- batched per iteration already.
+------------------------------------------------------------------------------*/
+static struct peer_link* peer_link_new(int fd, int conf)
+{
+    struct  peer_link* l;
+    struct  epoll_event ev;
+    struct  peer_rec r;
+    struct  msgbuf* mb;
+    int     on = 1;
+    
+    if ((l = new (std::nothrow) peer_link()) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    
+    l->fd = fd;
+    l->conf = conf;
+    dec_init(&l->dec);
+    oq_init(&l->oq);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    
+    ev.events = EPOLLIN;
+    ev.data.ptr = l;
+    if (epoll_ctl(peer_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        delete l;
+        return NULL;
+    }
+    
+    memset(&r, 0, sizeof(r));
+    r.origin = peer_node;
+    r.kind = PEER_HELLO;
+    r.room = r.nick = r.text = "";
+    if ((mb = peer_encode(&r)) != NULL) {
+        oq_push(&l->oq, mb, 0);
+        mb_unref(mb);
+    }
+    
+    if (conf >= 0)
+        peer_confs[conf].link = l;
+    peer_links[peer_nlinks++] = l;
+    return l;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_drain
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_drain(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the eventfd is readable to queue the
+-- records of the shards on every link that is up. The flag is cleared
+-- before the queue is drained, as in srv_inbox(). Each record gets its
+-- sequence # here, so the #s go out on every link in order, and the joins
+-- and leaves are counted in the same order for the roster.
+------------------------------------------------------------------------------*/
+static void peer_drain(void)
+{
+    struct  mpsc_node* n;
+    struct  peer_out* o;
+    struct  frame f;
+    struct  peer_rec r;
+    uint64_t cnt;
+    int     i;
+    
+    while (read(peer_efd, &cnt, sizeof(cnt)) > 0)
+        ;
+    
+    __atomic_store_n(&peer_signaled, 0, __ATOMIC_SEQ_CST);
+    
+    while ((n = mpsc_pop(&peer_queue)) != NULL) {
+        o = (struct peer_out*) n;
+        put64((unsigned char*) MB_DATA(o->mb) + FRAME_HDR_SIZE + 8, ++peer_seq);
+        
+        f.type = FRAME_RELAY;
+        f.length = o->mb->len - FRAME_HDR_SIZE;
+        f.payload = MB_DATA(o->mb) + FRAME_HDR_SIZE;
+        if (peer_parse(&f, &r) == 0 && (r.kind == PEER_JOIN || r.kind == PEER_PART))
+            peer_count(peer_node, &r);
+        
+        for (i = 0; i < peer_nlinks; i++) {
+            if (peer_links[i]->up && !peer_links[i]->dead)
+                peer_push(peer_links[i], o->mb);
+        }
+        mb_unref(o->mb);
+        free(o);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_read
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_read(struct peer_link* l)
+--              struct peer_link* l: the readable link
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a link is readable. One read per event, the
+-- link is level-triggered and comes back if there is more.
+------------------------------------------------------------------------------*/
+static void peer_read(struct peer_link* l)
+{
+    ssize_t n;
+    
+    if ((n = read(l->fd, peer_rbuf, sizeof(peer_rbuf))) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return;
+        peer_kill(l, "read error");
+        return;
+    }
+    if (n == 0) {
+        peer_kill(l, "closed");
+        return;
+    }
+    
+    if (dec_feed(&l->dec, peer_rbuf, n, peer_frame, l) != 0 && !l->dead)
+        peer_kill(l, "protocol error");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_frame
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int peer_frame(void* arg, const struct frame* f)
+--              void* arg: the link
+--              const struct frame* f: the frame received
+-- 
+-- RETURNS:     0 to continue decoding, 1 if the link was dropped
+-- 
+-- NOTES:
+-- This function is called for each frame received on a link. The first
+-- record must be the hello; one carrying our own node id means we dialled
+-- ourselves, any other brings the link up and gets it our roster. Other
+-- frame types are ignored.
+------------------------------------------------------------------------------*/
+static int peer_frame(void* arg, const struct frame* f)
+{
+    struct  peer_link* l = (struct peer_link*) arg;
+    struct  peer_rec r;
+    
+    if (f->type != FRAME_RELAY)
+        return 0;
+    if (peer_parse(f, &r) < 0) {
+        peer_kill(l, "bad record");
+        return 1;
+    }
+    
+    if (!l->up) {
+        if (r.kind != PEER_HELLO) {
+            peer_kill(l, "no hello");
+            return 1;
+        }
+        if (r.origin == peer_node) {
+            if (l->conf >= 0)
+                peer_confs[l->conf].self = 1;
+            peer_kill(l, "this server");
+            return 1;
+        }
+        
+        l->up = 1;
+        l->node = r.origin;
+        if (l->conf >= 0)
+            peer_confs[l->conf].delay = PEER_RETRY_MS;
+        __atomic_store_n(&peer_up, peer_up + 1, __ATOMIC_RELAXED);
+        printf(" - Peer linked: node %016llx\n", (unsigned long long) l->node);
+        peer_roster(l);
+        return l->dead ? 1 : 0;
+    }
+    
+    if (r.kind != PEER_HELLO)
+        peer_take(l, &r);
+    return l->dead ? 1 : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_take
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_take(struct peer_link* from,
+--                                    const struct peer_rec* r)
+--              struct peer_link* from: the link the record came on
+--              const struct peer_rec* r: the record
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every record relayed to us. One we sent or
+-- have taken already is dropped; this is what keeps records from going
+-- round a loop of links. The others are forwarded to every other link,
+-- one hop further, and delivered here, the joins and leaves to the room
+-- rosters. A roster only comes from the other end of the link; its first
+-- record drops what was counted for that server before.
+------------------------------------------------------------------------------*/
+static void peer_take(struct peer_link* from, const struct peer_rec* r)
+{
+    struct  peer_window* w;
+    struct  peer_rec fwd;
+    struct  msgbuf* mb;
+    char    room[ROOM_NAME_MAX];
+    int     i;
+    
+    if (r->kind == PEER_ROSTER) {
+        if (r->origin != from->node)
+            return;
+        if (!from->rostered) {
+            peer_forget(r->origin);
+            peer_seen[r->origin].floor = r->seq;
+            from->rostered = 1;
+        }
+        if (r->nicklen > 0)
+            peer_count(r->origin, r);
+        return;
+    }
+    
+    w = &peer_seen[r->origin];
+    if (r->origin == peer_node || !peer_fresh(w, r->seq)) {
+        __atomic_store_n(&peer_dups, peer_dups + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    if (r->hops + 1 < PEER_HOPS) {
+        fwd = *r;
+        fwd.hops++;
+        if ((mb = peer_encode(&fwd)) != NULL) {
+            for (i = 0; i < peer_nlinks; i++) {
+                if (peer_links[i] != from && peer_links[i]->up && !peer_links[i]->dead)
+                    peer_push(peer_links[i], mb);
+            }
+            mb_unref(mb);
+        }
+    }
+    
+    if (r->kind == PEER_JOIN || r->kind == PEER_PART) {
+        if (r->seq > w->floor)
+            peer_count(r->origin, r);
+        return;
+    }
+    
+    if (r->roomlen >= sizeof(room))
+        return;
+    memcpy(room, r->room, r->roomlen);
+    room[r->roomlen] = '\0';
+    
+    __atomic_store_n(&peer_in, peer_in + 1, __ATOMIC_RELAXED);
+    broadcast_peer(room, r->text, r->textlen);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_fresh
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int peer_fresh(struct peer_window* w, uint64_t seq)
+--              struct peer_window* w: what was taken from the origin
+--              uint64_t seq: sequence # of a record from it
+-- 
+-- RETURNS:     1 the first time seq is seen, 0 for a duplicate or a record
+--              older than the window
+-- 
+-- NOTES:
+-- A higher sequence # slides the window up, clearing the bits of the #s
+-- it skips, which may still come by another path.
+------------------------------------------------------------------------------*/
+static int peer_fresh(struct peer_window* w, uint64_t seq)
+{
+    uint64_t s;
+    
+    if (seq > w->top) {
+        if (seq - w->top >= PEER_WINDOW)
+            memset(w->bits, 0, sizeof(w->bits));
+        else
+            for (s = w->top + 1; s < seq; s++)
+                w->bits[(s % PEER_WINDOW) / 64] &= ~(1ULL << (s % 64));
+        w->top = seq;
+    } else if (w->top - seq >= PEER_WINDOW
+               || (w->bits[(seq % PEER_WINDOW) / 64] & (1ULL << (seq % 64)))) {
+        return 0;
+    }
+    
+    w->bits[(seq % PEER_WINDOW) / 64] |= 1ULL << (seq % 64);
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_count
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_count(uint64_t origin,
+--                                     const struct peer_rec* r)
+--              uint64_t origin: the server the user is on
+--              const struct peer_rec* r: a join, leave or roster record
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every join and leave taken, ours included.
+-- The sessions of an origin are counted by room name and nickname, joined
+-- by a NUL; a leave nothing was counted for is dropped. Those of another
+-- server also enter or leave the room's roster, as a local session does.
+------------------------------------------------------------------------------*/
+static void peer_count(uint64_t origin, const struct peer_rec* r)
+{
+    std::map<std::string, int>& names = peer_names[origin];
+    std::map<std::string, int>::iterator it;
+    struct  room_info* ri;
+    std::string key(r->room, r->roomlen);
+    
+    if (r->roomlen >= ROOM_NAME_MAX || r->nicklen == 0 || !room_valid(key.c_str()))
+        return;
+    key += '\0';
+    key.append(r->nick, r->nicklen);
+    
+    if (r->kind == PEER_PART) {
+        if ((it = names.find(key)) == names.end())
+            return;
+        if (--it->second == 0)
+            names.erase(it);
+    } else {
+        names[key]++;
+    }
+    
+    if (origin == peer_node || (ri = room_intern(key.c_str())) == NULL)
+        return;
+    if (r->kind == PEER_PART)
+        room_leave(ri, key.c_str() + r->roomlen + 1);
+    else
+        room_enter(ri, key.c_str() + r->roomlen + 1);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_roster
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_roster(struct peer_link* l)
+--              struct peer_link* l: a link that just came up
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to send the other end the users of this server,
+-- one PEER_ROSTER record per session, and one with no nickname to end it
+-- so an empty roster comes too. They all carry the last sequence # given
+-- out: every join and leave after it is sent on the link as well.
+------------------------------------------------------------------------------*/
+static void peer_roster(struct peer_link* l)
+{
+    std::map<std::string, int>& names = peer_names[peer_node];
+    std::map<std::string, int>::iterator it;
+    struct  peer_rec r;
+    struct  msgbuf* mb;
+    int     i;
+    
+    memset(&r, 0, sizeof(r));
+    r.origin = peer_node;
+    r.seq = peer_seq;
+    r.kind = PEER_ROSTER;
+    r.text = "";
+    
+    for (it = names.begin(); it != names.end() && !l->dead; ++it) {
+        r.room = it->first.c_str();
+        r.roomlen = strlen(r.room);
+        r.nick = r.room + r.roomlen + 1;
+        r.nicklen = it->first.size() - r.roomlen - 1;
+        if ((mb = peer_encode(&r)) == NULL)
+            continue;
+        for (i = 0; i < it->second && !l->dead; i++)
+            peer_push(l, mb);
+        mb_unref(mb);
+    }
+    
+    r.room = r.nick = "";
+    r.roomlen = r.nicklen = 0;
+    if (!l->dead && (mb = peer_encode(&r)) != NULL) {
+        peer_push(l, mb);
+        mb_unref(mb);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_forget
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_forget(uint64_t origin)
+--              uint64_t origin: another server
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the last link to a server drops, or it
+-- sends a new roster, to take its users off the room rosters.
+------------------------------------------------------------------------------*/
+static void peer_forget(uint64_t origin)
+{
+    std::unordered_map<uint64_t, std::map<std::string, int> >::iterator o;
+    std::map<std::string, int>::iterator it;
+    struct  room_info* ri;
+    int     i;
+    
+    if ((o = peer_names.find(origin)) == peer_names.end())
+        return;
+    
+    for (it = o->second.begin(); it != o->second.end(); ++it) {
+        if ((ri = room_intern(it->first.c_str())) == NULL)
+            continue;
+        for (i = 0; i < it->second; i++)
+            room_leave(ri, it->first.c_str() + strlen(it->first.c_str()) + 1);
+    }
+    peer_names.erase(o);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_push
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_push(struct peer_link* l, struct msgbuf* mb)
+--              struct peer_link* l: the link
+--              struct msgbuf* mb: the framed record
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to queue a record on a link; the queue takes a
+-- reference. A link more than PEER_HWM behind is dropped.
+------------------------------------------------------------------------------*/
+static void peer_push(struct peer_link* l, struct msgbuf* mb)
+{
+    if (oq_push(&l->oq, mb, 0) < 0) {
+        peer_kill(l, "out of memory");
+        return;
+    }
+    if (l->oq.bytes > PEER_HWM)
+        peer_kill(l, "too slow");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_flush(struct peer_link* l)
+--              struct peer_link* l: the link
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called at the end of every iteration to write what is
+-- queued on a link. EPOLLOUT is only watched while the socket is full.
+------------------------------------------------------------------------------*/
+static void peer_flush(struct peer_link* l)
+{
+    struct  epoll_event ev;
+    uint32_t count = l->oq.count;
+    
+    if (count == 0 && !l->pollout)
+        return;
+    
+    if (oq_flush(&l->oq, l->fd) < 0) {
+        peer_kill(l, "write error");
+        return;
+    }
+    if (l->up)
+        __atomic_store_n(&peer_out, peer_out + count - l->oq.count, __ATOMIC_RELAXED);
+    
+    if ((l->oq.count > 0) != l->pollout) {
+        l->pollout = (l->oq.count > 0);
+        ev.events = EPOLLIN | (l->pollout ? EPOLLOUT : 0);
+        ev.data.ptr = l;
+        epoll_ctl(peer_epfd, EPOLL_CTL_MOD, l->fd, &ev);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_kill
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_kill(struct peer_link* l, const char* why)
+--              struct peer_link* l: the link
+--              const char* why: logged if the link was up, or NULL
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to drop a link. The socket is closed right away
+-- so no more events come for it, the link itself is freed by peer_reap()
+-- once the events of the iteration are handled. A --peer is dialled again
+-- after its reconnect delay.
+------------------------------------------------------------------------------*/
+static void peer_kill(struct peer_link* l, const char* why)
+{
+    if (l->dead)
+        return;
+    
+    if (l->up) {
+        printf(" - Peer lost: node %016llx (%s)\n", (unsigned long long) l->node,
+               why ? why : "error");
+        __atomic_store_n(&peer_up, peer_up - 1, __ATOMIC_RELAXED);
+    }
+    
+    if (l->conf >= 0)
+        peer_confs[l->conf].link = NULL;
+    
+    close(l->fd);
+    l->dead = 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_reap
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void peer_reap(void)
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called at the end of every iteration to free the links
+-- dropped during it. The last link takes the freed place. The users of
+-- the other end are listed no longer once no link to it is up.
+------------------------------------------------------------------------------*/
+static void peer_reap(void)
+{
+    struct  peer_link* l;
+    int     i, j;
+    
+    for (i = 0; i < peer_nlinks; ) {
+        if (!(l = peer_links[i])->dead) {
+            i++;
+            continue;
+        }
+        
+        if (l->up) {
+            for (j = 0; j < peer_nlinks; j++) {
+                if (!peer_links[j]->dead && peer_links[j]->up
+                    && peer_links[j]->node == l->node)
+                    break;
+            }
+            if (j == peer_nlinks)
+                peer_forget(l->node);
+        }
+        
+        dec_free(&l->dec);
+        oq_free(&l->oq);
+        delete l;
+        peer_links[i] = peer_links[--peer_nlinks];
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_encode
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static struct msgbuf* peer_encode(const struct peer_rec* r)
+--              const struct peer_rec* r: the record
+-- 
+-- RETURNS:     the FRAME_RELAY frame, NULL if the record is too long or
+--              memory runs out
+-- 
+-- NOTES:
+-- This function is called to frame a record, see struct peer_rec for the
+-- layout.
+------------------------------------------------------------------------------*/
+static struct msgbuf* peer_encode(const struct peer_rec* r)
+{
+    struct  msgbuf* mb;
+    unsigned char* p;
+    size_t  total = PEER_HDR_SIZE + r->roomlen + r->nicklen + r->textlen;
+    
+    if (r->roomlen > 255 || r->nicklen > 255 || total > FRAME_MAX)
+        return NULL;
+    if ((mb = mb_alloc(FRAME_HDR_SIZE + total)) == NULL)
+        return NULL;
+    
+    frame_header(MB_DATA(mb), FRAME_RELAY, 0, total);
+    p = (unsigned char*) MB_DATA(mb) + FRAME_HDR_SIZE;
+    put64(p, r->origin);
+    put64(p + 8, r->seq);
+    p[16] = (unsigned char) r->kind;
+    p[17] = (unsigned char) r->hops;
+    p[18] = (unsigned char) r->roomlen;
+    p[19] = (unsigned char) r->nicklen;
+    p += PEER_HDR_SIZE;
+    
+    memcpy(p, r->room, r->roomlen);
+    p += r->roomlen;
+    memcpy(p, r->nick, r->nicklen);
+    p += r->nicklen;
+    memcpy(p, r->text, r->textlen);
+    return mb;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    peer_parse
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int peer_parse(const struct frame* f,
+--                                    struct peer_rec* r)
+--              const struct frame* f: a FRAME_RELAY frame
+--              struct peer_rec* r: receives the record, pointing into f
+-- 
+-- RETURNS:     0 on success, -1 if the record is cut short
+------------------------------------------------------------------------------*/
+static int peer_parse(const struct frame* f, struct peer_rec* r)
+{
+    const unsigned char* p = (const unsigned char*) f->payload;
+    
+    if (f->length < PEER_HDR_SIZE || f->length < PEER_HDR_SIZE + (size_t) p[18] + p[19])
+        return -1;
+    
+    r->origin = get64(p);
+    r->seq = get64(p + 8);
+    r->kind = p[16];
+    r->hops = p[17];
+    r->roomlen = p[18];
+    r->nicklen = p[19];
+    r->room = f->payload + PEER_HDR_SIZE;
+    r->nick = r->room + r->roomlen;
+    r->text = r->nick + r->nicklen;
+    r->textlen = f->length - PEER_HDR_SIZE - r->roomlen - r->nicklen;
+    return 0;
+}
+
+// big-endian 64-bit fields of the record header
+static void put64(unsigned char* p, uint64_t v)
+{
+    int i;
+    
+    for (i = 7; i >= 0; i--, v >>= 8)
+        p[i] = (unsigned char) v;
+}
+
+static uint64_t get64(const unsigned char* p)
+{
+    uint64_t v = 0;
+    int     i;
+    
+    for (i = 0; i < 8; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
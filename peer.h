@@ -0,0 +1,90 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: peer.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares federation. Servers started with --federate
+-- port accept links from other servers on that port, and --peer host:port
+-- opens one to another server. Every broadcast, join and leave is relayed
+-- over the links as a FRAME_RELAY record and delivered by each server to
+-- its own members of the room, so the clients of all the servers share
+-- one conversation. The joins and leaves also keep the room rosters, so
+-- /who lists the users of the other servers too.
+-- A record carries the id of the server it started on (its origin) and a
+-- sequence # the origin gives it. A server forwards what it receives to
+-- its other links, and drops a record it has already seen from that
+-- origin, so the servers may be linked in a chain, a star or a full mesh,
+-- loops included. The origin numbers its records in the order they go out
+-- on its links. Copies taking different paths may still arrive out of
+-- order, so a server keeps a window of the last PEER_WINDOW sequence #s of
+-- each origin: a record is a duplicate if its bit is set, and is taken if
+-- not, however late it comes. Only a record older than the whole window is
+-- dropped, as if it was a duplicate.
+-- The records a server queues meanwhile are written to each link with one
+-- writev() per wakeup of the peer thread.
+-------------------------------------------------------------------------------*/
+#ifndef __PEER_H__
+#define __PEER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mpsc.h"
+#include "msgbuf.h"
+
+#define PEER_MAX        32      // most --peer options
+#define PEER_LINKS      256     // most links of a server, either way
+#define PEER_HOPS       16      // links a record crosses at most
+#define PEER_RETRY_MS   250     // first reconnect delay, doubled per try
+#define PEER_RETRY_MAX  30000   // ceiling of the reconnect delay
+#define PEER_HWM        67108864 // queued bytes that drop a slow link
+#define PEER_HDR_SIZE   20      // size of the record header
+#define PEER_WINDOW     4096    // sequence #s of an origin remembered, multiple of 64
+
+// record kinds
+#define PEER_HELLO      1       // first record on a link, tells the node id
+#define PEER_MSG        2       // chat message
+#define PEER_JOIN       3       // a user joined the room
+#define PEER_PART       4       // a user left the room
+#define PEER_ROSTER     5       // a user in the room when the link came up
+
+// record header at the start of a FRAME_RELAY payload, the room name, the
+// nickname and the text follow; the numbers are big-endian on the wire
+//
+//      0        8     16     17     18        19        20
+//      +--------+-----+------+------+---------+---------+------+------+------
+//      | origin | seq | kind | hops | roomlen | nicklen | room | nick | text
+//      +--------+-----+------+------+---------+---------+------+------+------
+struct peer_rec {
+    uint64_t    origin;         // node the record started on
+    uint64_t    seq;            // origin's sequence #
+    int         kind;           // PEER_*
+    int         hops;           // links crossed so far
+    const char* room;           // room name, not NUL terminated
+    size_t      roomlen;
+    const char* nick;           // sender's nickname, not NUL terminated
+    size_t      nicklen;
+    const char* text;           // what the clients are sent
+    size_t      textlen;
+};
+
+// record queued for the peer thread
+struct peer_out {
+    struct mpsc_node node;      // queue link, must come first
+    struct msgbuf* mb;          // the framed record
+};
+
+// function prototypes
+int peer_add(const char* hostport);
+int peer_start(int lfd);
+int peer_enabled(void);
+void peer_relay(int kind, const char* room, const char* nick, const char* text,
+                size_t len);
+void peer_presence(const char* room, const char* nick, int join);
+void peer_stats(int* links, uint64_t* in, uint64_t* out, uint64_t* dups);
+
+#endif
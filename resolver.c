@@ -0,0 +1,389 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: resolver.c - Asynchronous reverse DNS resolution with a
+--              bounded TTL cache.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int res_init(int nthreads, int capacity, int ttl, int negttl);
+--              int res_queue_init(struct res_queue* q);
+--              int res_lookup(uint32_t ip, char* host, size_t size,
+--                             struct res_queue* q, int id, uint64_t tag);
+--              void res_drain(struct res_queue* q,
+--                             std::vector<struct res_done>* out);
+--              void res_stats(struct hist* lookup_ns, uint64_t* hits,
+--                             uint64_t* misses);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- The event loop never waits for DNS. res_lookup() either answers from the
+-- cache or queues the address for the workers and returns at once. An
+-- address that is already being resolved is not queued again, its caller is
+-- only added to the waiters, so a reconnect storm from one NAT address costs
+-- a single query. Cache, pending queue and waiters are protected by one
+-- mutex; completion queues have their own.
+------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include "resolver.h"
+
+// cached answer
+struct res_entry {
+    uint32_t    ip;             // address, network byte order
+    int         ok;             // 1 if host holds a name
+    time_t      expires;        // monotonic time the entry goes stale
+    char        host[RES_HOST_MAX];
+};
+
+// caller waiting for an address being resolved
+struct res_waiter {
+    struct res_queue* q;        // where to post the answer
+    int         id;             // caller tags
+    uint64_t    tag;
+};
+
+typedef std::list<struct res_entry> res_lru;
+
+static pthread_mutex_t res_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t res_cond = PTHREAD_COND_INITIALIZER;
+static res_lru lru;                                         // most recent first
+static std::unordered_map<uint32_t, res_lru::iterator> cache;
+static std::unordered_map<uint32_t, std::vector<struct res_waiter> > inflight;
+static std::deque<uint32_t> pending;                        // addresses to resolve
+static size_t res_capacity = RES_CACHE_SIZE;
+static int res_ttl = RES_TTL;
+static int res_negttl = RES_NEG_TTL;
+static struct hist res_hist;                                // lookup times
+static uint64_t res_hits, res_misses;                       // cache lookups
+
+static void* res_worker(void* arg);
+static int res_resolve(uint32_t ip, char* host, size_t size);
+static time_t res_now(void);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int res_init(int nthreads, int capacity, int ttl, int negttl)
+--              int nthreads: # of worker threads
+--              int capacity: maximum # of cached addresses
+--              int ttl: seconds a resolved name stays cached
+--              int negttl: seconds a failed lookup stays cached
+-- 
+-- RETURNS:     0 on success, -1 if a worker cannot be started
+-- 
+-- NOTES:
+-- This function is called once at start-up to start the worker pool.
+------------------------------------------------------------------------------*/
+int res_init(int nthreads, int capacity, int ttl, int negttl)
+{
+    pthread_t tid;
+    int i;
+    
+    res_capacity = (capacity > 0) ? capacity : 1;
+    res_ttl = ttl;
+    res_negttl = negttl;
+    
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&tid, NULL, res_worker, NULL) != 0)
+            return -1;
+        pthread_detach(tid);
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_queue_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int res_queue_init(struct res_queue* q)
+--              struct res_queue* q: the completion queue to initialize
+-- 
+-- RETURNS:     0 on success, -1 if the eventfd cannot be created
+-- 
+-- NOTES:
+-- The caller adds q->efd to its epoll set and calls res_drain() when it
+-- becomes readable.
+------------------------------------------------------------------------------*/
+int res_queue_init(struct res_queue* q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return (q->efd < 0) ? -1 : 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_lookup
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int res_lookup(uint32_t ip, char* host, size_t size,
+--                             struct res_queue* q, int id, uint64_t tag)
+--              uint32_t ip: the address to resolve, network byte order
+--              char* host: receives the cached name
+--              size_t size: the size of host
+--              struct res_queue* q: where to post the answer on a miss
+--              int id, uint64_t tag: returned with the answer
+-- 
+-- RETURNS:     1 for a cached name, 0 for a cached failure (host is left
+--              untouched), -1 on a miss, the answer follows through q
+-- 
+-- NOTES:
+-- This function never blocks on DNS, it only takes the resolver mutex.
+------------------------------------------------------------------------------*/
+int res_lookup(uint32_t ip, char* host, size_t size, struct res_queue* q,
+               int id, uint64_t tag)
+{
+    std::unordered_map<uint32_t, res_lru::iterator>::iterator it;
+    struct  res_waiter w;
+    int     rc = -1;
+    
+    pthread_mutex_lock(&res_lock);
+    
+    it = cache.find(ip);
+    if (it != cache.end() && it->second->expires > res_now()) {
+        // fresh entry, move it to the front of the LRU list
+        lru.splice(lru.begin(), lru, it->second);
+        rc = it->second->ok;
+        if (rc) snprintf(host, size, "%s", it->second->host);
+        res_hits++;
+    } else {
+        res_misses++;
+        w.q = q;
+        w.id = id;
+        w.tag = tag;
+        std::vector<struct res_waiter>& waiters = inflight[ip];
+        waiters.push_back(w);
+        if (waiters.size() == 1) {
+            pending.push_back(ip);
+            pthread_cond_signal(&res_cond);
+        }
+    }
+    
+    pthread_mutex_unlock(&res_lock);
+    return rc;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_drain
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void res_drain(struct res_queue* q,
+--                             std::vector<struct res_done>* out)
+--              struct res_queue* q: the completion queue
+--              std::vector<struct res_done>* out: receives the answers
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when q->efd is readable. It resets the eventfd and
+-- takes every queued answer in one swap.
+------------------------------------------------------------------------------*/
+void res_drain(struct res_queue* q, std::vector<struct res_done>* out)
+{
+    uint64_t n;
+    
+    while (read(q->efd, &n, sizeof(n)) > 0)
+        ;
+    
+    out->clear();
+    pthread_mutex_lock(&q->lock);
+    out->swap(q->done);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_stats
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void res_stats(struct hist* lookup_ns, uint64_t* hits,
+--                             uint64_t* misses)
+--              struct hist* lookup_ns: the DNS query times are added to it
+--              uint64_t* hits: receives the # of cache hits
+--              uint64_t* misses: receives the # of cache misses
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by the stats thread.
+------------------------------------------------------------------------------*/
+void res_stats(struct hist* lookup_ns, uint64_t* hits, uint64_t* misses)
+{
+    pthread_mutex_lock(&res_lock);
+    hist_add(lookup_ns, &res_hist);
+    *hits = res_hits;
+    *misses = res_misses;
+    pthread_mutex_unlock(&res_lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_worker
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static void* res_worker(void* arg)
+--              void* arg: unused
+-- 
+-- RETURNS:     never returns
+-- 
+-- NOTES:
+-- Worker thread body. It takes a queued address, resolves it without
+-- holding any lock, caches the answer, evicts the least recently used
+-- entries beyond the capacity and posts the answer to every waiter.
+------------------------------------------------------------------------------*/
+static void* res_worker(void* arg)
+{
+    std::vector<struct res_waiter> waiters;
+    std::unordered_map<uint32_t, res_lru::iterator>::iterator it;
+    struct  res_entry e;
+    struct  res_done d;
+    uint64_t one = 1, start;
+    size_t  i;
+    
+    (void) arg;
+    
+    while (1) {
+        pthread_mutex_lock(&res_lock);
+        while (pending.empty())
+            pthread_cond_wait(&res_cond, &res_lock);
+        e.ip = pending.front();
+        pending.pop_front();
+        pthread_mutex_unlock(&res_lock);
+        
+        start = stats_now();
+        e.ok = res_resolve(e.ip, e.host, sizeof(e.host));
+        
+        pthread_mutex_lock(&res_lock);
+        hist_record(&res_hist, stats_now() - start);
+        e.expires = res_now() + (e.ok ? res_ttl : res_negttl);
+        if ((it = cache.find(e.ip)) != cache.end()) {
+            lru.erase(it->second);
+            cache.erase(it);
+        }
+        lru.push_front(e);
+        cache[e.ip] = lru.begin();
+        while (cache.size() > res_capacity) {
+            cache.erase(lru.back().ip);
+            lru.pop_back();
+        }
+        waiters.swap(inflight[e.ip]);
+        inflight.erase(e.ip);
+        pthread_mutex_unlock(&res_lock);
+        
+        d.ip = e.ip;
+        d.ok = e.ok;
+        memcpy(d.host, e.host, sizeof(d.host));
+        for (i = 0; i < waiters.size(); i++) {
+            d.id = waiters[i].id;
+            d.tag = waiters[i].tag;
+            pthread_mutex_lock(&waiters[i].q->lock);
+            waiters[i].q->done.push_back(d);
+            pthread_mutex_unlock(&waiters[i].q->lock);
+            if (write(waiters[i].q->efd, &one, sizeof(one)) < 0)
+                perror(" - resolver: eventfd write error.\n");
+        }
+        waiters.clear();
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_resolve
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static int res_resolve(uint32_t ip, char* host, size_t size)
+--              uint32_t ip: the address to resolve, network byte order
+--              char* host: receives the host name
+--              size_t size: the size of host
+-- 
+-- RETURNS:     1 if a name was found, 0 otherwise
+-- 
+-- NOTES:
+-- Resolve host name given an ip address. Replaces gethostbyaddr(), which is
+-- not safe to call from several threads.
+------------------------------------------------------------------------------*/
+static int res_resolve(uint32_t ip, char* host, size_t size)
+{
+    struct sockaddr_in addr;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ip;
+    
+    host[0] = '\0';
+    return getnameinfo((struct sockaddr*)&addr, sizeof(addr), host, size,
+                       NULL, 0, NI_NAMEREQD) == 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    res_now
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   static time_t res_now(void)
+-- 
+-- RETURNS:     seconds on the monotonic clock
+-- 
+-- NOTES:
+-- Expiry uses the monotonic clock so wall clock changes do not matter.
+------------------------------------------------------------------------------*/
+static time_t res_now(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
@@ -0,0 +1,55 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: resolver.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares the asynchronous reverse DNS resolver. Lookups
+-- run on a small pool of worker threads and their results are kept in an
+-- LRU cache keyed by IPv4 address, failures included, until their TTL runs
+-- out. Concurrent lookups of the same address share one query. Answers are
+-- posted to a completion queue whose eventfd the event loop watches.
+-------------------------------------------------------------------------------*/
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include "stats.h"
+
+#define RES_HOST_MAX    256     // maximum length of a host name
+#define RES_THREADS     2       // default # of resolver threads
+#define RES_CACHE_SIZE  4096    // default # of cached addresses
+#define RES_TTL         300     // seconds a resolved name is cached
+#define RES_NEG_TTL     60      // seconds a failed lookup is cached
+
+// answer to a queued lookup
+struct res_done {
+    uint32_t    ip;             // address looked up, network byte order
+    int         ok;             // 1 if host holds a name, 0 on failure
+    int         id;             // caller tags given to res_lookup()
+    uint64_t    tag;
+    char        host[RES_HOST_MAX];
+};
+
+// completion queue owned by one event loop
+struct res_queue {
+    int         efd;            // eventfd, readable when answers are queued
+    pthread_mutex_t lock;       // protects done
+    std::vector<struct res_done> done;
+};
+
+// function prototypes
+int res_init(int nthreads, int capacity, int ttl, int negttl);
+int res_queue_init(struct res_queue* q);
+int res_lookup(uint32_t ip, char* host, size_t size, struct res_queue* q,
+               int id, uint64_t tag);
+void res_drain(struct res_queue* q, std::vector<struct res_done>* out);
+void res_stats(struct hist* lookup_ns, uint64_t* hits, uint64_t* misses);
+
+#endif
@@ -0,0 +1,430 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: room.c - Server wide directory of chat rooms.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int room_init(int nshards, uint32_t hist_msgs,
+--                            uint32_t hist_slot);
+--              int room_valid(const char* name);
+--              struct room_info* room_intern(const char* name);
+--              void room_count(struct room_info* ri, int shard, int delta);
+--              int room_active(const struct room_info* ri, int shard);
+--              int room_list(char* out, size_t size);
+--              void room_all(std::vector<struct room_info*>* out);
+--              void room_enter(struct room_info* ri, const char* nick);
+--              void room_leave(struct room_info* ri, const char* nick);
+--              struct msgbuf* room_who(struct room_info* ri);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- The directory is only locked by /join, /part and /rooms. Message fan-out
+-- holds a pointer to the entry and reads the per-shard member counts with
+-- atomic loads, so the message path never touches the lock.
+-- Each room's roster has a lock of its own, taken by the nickname changes
+-- of the room and by /who. A change costs a map update and drops the
+-- framed /who reply; the first /who after it frames a new one and every
+-- /who until the next change shares it. A join storm thus costs one
+-- update per join, not one list per join.
+------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <new>
+#include "room.h"
+#include "frame.h"
+
+static pthread_mutex_t room_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, struct room_info*> rooms;     // by name, sorted
+static uint32_t room_next = 1;                              // next room id
+static int room_shards = 1;
+static uint32_t room_hist_msgs = 0;                         // scrollback size
+static uint32_t room_hist_slot = 0;                         // largest message kept
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int room_init(int nshards, uint32_t hist_msgs,
+--                            uint32_t hist_slot)
+--              int nshards: the number of shards counting members
+--              uint32_t hist_msgs: # of messages each room keeps, 0 for none
+--              uint32_t hist_slot: the largest framed message kept
+-- 
+-- RETURNS:     0 on success, -1 if the default room cannot be created
+-- 
+-- NOTES:
+-- This function is called once before the shards start.
+------------------------------------------------------------------------------*/
+int room_init(int nshards, uint32_t hist_msgs, uint32_t hist_slot)
+{
+    room_shards = nshards;
+    room_hist_msgs = hist_msgs;
+    room_hist_slot = hist_slot;
+    return (room_intern(ROOM_DEFAULT) != NULL) ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_valid
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int room_valid(const char* name)
+--              const char* name: the room name, without the leading '#'
+-- 
+-- RETURNS:     1 if the name can be used, 0 otherwise
+-- 
+-- NOTES:
+-- Room names are 1 to ROOM_NAME_MAX-1 letters, digits, '-' or '_'.
+------------------------------------------------------------------------------*/
+int room_valid(const char* name)
+{
+    size_t i;
+    
+    for (i = 0; name[i] != '\0'; i++) {
+        if (i == ROOM_NAME_MAX - 1)
+            return 0;
+        if (!isalnum((unsigned char) name[i]) && name[i] != '-' && name[i] != '_')
+            return 0;
+    }
+    
+    return i > 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_intern
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct room_info* room_intern(const char* name)
+--              const char* name: a valid room name
+-- 
+-- RETURNS:     the directory entry of the room, NULL if memory runs out
+-- 
+-- NOTES:
+-- This function is called to look a room up by name, creating it the first
+-- time the name is seen. The id only lasts as long as the process, the
+-- journal keeps the key, a 64-bit FNV-1a hash of the name that is never 0.
+------------------------------------------------------------------------------*/
+struct room_info* room_intern(const char* name)
+{
+    std::map<std::string, struct room_info*>::iterator it;
+    struct room_info* ri = NULL;
+    const char* p;
+    
+    pthread_mutex_lock(&room_lock);
+    
+    if ((it = rooms.find(name)) != rooms.end()) {
+        ri = it->second;
+    } else if ((ri = (struct room_info*) calloc(1, sizeof(*ri))) != NULL) {
+        if ((ri->members = (int*) calloc(room_shards, sizeof(int))) == NULL
+            || (ri->roster.names = new (std::nothrow) std::map<std::string, int>) == NULL) {
+            free(ri->members);
+            free(ri);
+            ri = NULL;
+        } else {
+            ri->id = room_next++;
+            ri->key = 14695981039346656037ULL;
+            for (p = name; *p != '\0'; p++)
+                ri->key = (ri->key ^ (unsigned char) *p) * 1099511628211ULL;
+            if (ri->key == 0)
+                ri->key = 1;
+            snprintf(ri->name, sizeof(ri->name), "%s", name);
+            sb_init(&ri->hist, room_hist_msgs, room_hist_slot);
+            pthread_mutex_init(&ri->roster.lock, NULL);
+            rooms[name] = ri;
+        }
+    }
+    
+    pthread_mutex_unlock(&room_lock);
+    return ri;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_count
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void room_count(struct room_info* ri, int shard, int delta)
+--              struct room_info* ri: the room
+--              int shard: the shard whose members changed
+--              int delta: +1 on join, -1 on part
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Only the shard itself changes its count, other shards just read it.
+------------------------------------------------------------------------------*/
+void room_count(struct room_info* ri, int shard, int delta)
+{
+    __atomic_add_fetch(&ri->members[shard], delta, __ATOMIC_RELEASE);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_active
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int room_active(const struct room_info* ri, int shard)
+--              const struct room_info* ri: the room
+--              int shard: the shard to check
+-- 
+-- RETURNS:     non-zero if the shard has members in the room
+-- 
+-- NOTES:
+-- This function is called on the message path to skip shards that have no
+-- one to deliver to.
+------------------------------------------------------------------------------*/
+int room_active(const struct room_info* ri, int shard)
+{
+    return __atomic_load_n(&ri->members[shard], __ATOMIC_ACQUIRE) > 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_list
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int room_list(char* out, size_t size)
+--              char* out: receives the list, NUL terminated
+--              size_t size: the size of out
+-- 
+-- RETURNS:     the number of rooms listed
+-- 
+-- NOTES:
+-- This function is called to describe the rooms that have members, as
+-- "#name (members)" separated by blanks in name order. A list that does
+-- not fit ends with "...".
+------------------------------------------------------------------------------*/
+int room_list(char* out, size_t size)
+{
+    std::map<std::string, struct room_info*>::iterator it;
+    char    item[ROOM_NAME_MAX + 16];
+    size_t  len = 0, n;
+    int     i, total, count = 0;
+    
+    out[0] = '\0';
+    pthread_mutex_lock(&room_lock);
+    
+    for (it = rooms.begin(); it != rooms.end(); ++it) {
+        for (total = 0, i = 0; i < room_shards; i++)
+            total += __atomic_load_n(&it->second->members[i], __ATOMIC_RELAXED);
+        if (total <= 0)
+            continue;
+        
+        n = snprintf(item, sizeof(item), "%s#%s (%d)", count ? " " : "",
+                     it->second->name, total);
+        if (len + n + 4 > size) {
+            snprintf(out + len, size - len, " ...");
+            break;
+        }
+        memcpy(out + len, item, n + 1);
+        len += n;
+        count++;
+    }
+    
+    pthread_mutex_unlock(&room_lock);
+    return count;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_all
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void room_all(std::vector<struct room_info*>* out)
+--              std::vector<struct room_info*>* out: receives every room
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to walk the whole directory, empty rooms
+-- included, in name order.
+------------------------------------------------------------------------------*/
+void room_all(std::vector<struct room_info*>* out)
+{
+    std::map<std::string, struct room_info*>::iterator it;
+    
+    pthread_mutex_lock(&room_lock);
+    for (it = rooms.begin(); it != rooms.end(); ++it)
+        out->push_back(it->second);
+    pthread_mutex_unlock(&room_lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_enter
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void room_enter(struct room_info* ri, const char* nick)
+--              struct room_info* ri: the room
+--              const char* nick: the nickname of a member
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by a shard when a named session joins the room,
+-- or a member gets its name, and by the peer thread for a user of another
+-- server. A second session of the same nickname does not change the list,
+-- the /who reply stays.
+------------------------------------------------------------------------------*/
+void room_enter(struct room_info* ri, const char* nick)
+{
+    pthread_mutex_lock(&ri->roster.lock);
+    
+    if (++(*ri->roster.names)[nick] == 1 && ri->roster.who != NULL) {
+        mb_unref(ri->roster.who);
+        ri->roster.who = NULL;
+    }
+    
+    pthread_mutex_unlock(&ri->roster.lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_leave
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void room_leave(struct room_info* ri, const char* nick)
+--              struct room_info* ri: the room
+--              const char* nick: the nickname of a member leaving
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by a shard when a named session leaves the
+-- room, and by the peer thread. The nickname goes with its last session.
+------------------------------------------------------------------------------*/
+void room_leave(struct room_info* ri, const char* nick)
+{
+    std::map<std::string, int>::iterator it;
+    
+    pthread_mutex_lock(&ri->roster.lock);
+    
+    if ((it = ri->roster.names->find(nick)) != ri->roster.names->end() && --it->second <= 0) {
+        ri->roster.names->erase(it);
+        if (ri->roster.who != NULL) {
+            mb_unref(ri->roster.who);
+            ri->roster.who = NULL;
+        }
+    }
+    
+    pthread_mutex_unlock(&ri->roster.lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    room_who
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct msgbuf* room_who(struct room_info* ri)
+--              struct room_info* ri: the room
+-- 
+-- RETURNS:     a reference to the framed /who reply, NULL if memory runs
+--              out
+-- 
+-- NOTES:
+-- This function is called for /who. The reply is "In #name (count): "
+-- and the nicknames in order, cut into text frames of at most
+-- WHO_FRAME_MAX so a large room does not make one huge frame. It is only
+-- framed when the roster changed since the last /who; the caller queues
+-- the shared buffer like a broadcast and drops its reference.
+------------------------------------------------------------------------------*/
+struct msgbuf* room_who(struct room_info* ri)
+{
+    std::map<std::string, int>::iterator it;
+    std::vector<std::string> parts;
+    std::string text;
+    struct  msgbuf* mb;
+    char    head[ROOM_NAME_MAX + 32];
+    const   char* sep = " ";
+    size_t  i, len = 0;
+    char*   p;
+    
+    pthread_mutex_lock(&ri->roster.lock);
+    
+    if (ri->roster.who == NULL) {
+        snprintf(head, sizeof(head), "In #%s (%d):", ri->name, (int) ri->roster.names->size());
+        text = head;
+        for (it = ri->roster.names->begin(); it != ri->roster.names->end(); ++it) {
+            // room for ", ", the name and the ",\n" that may end the frame
+            if (text.size() + it->first.size() + 4 > WHO_FRAME_MAX) {
+                parts.push_back(text + ",\n");
+                text.clear();
+                sep = "";
+            }
+            text += sep;
+            text += it->first;
+            sep = ", ";
+        }
+        parts.push_back(text + "\n");
+        
+        for (i = 0; i < parts.size(); i++)
+            len += FRAME_HDR_SIZE + parts[i].size();
+        
+        if ((ri->roster.who = mb_alloc(len)) != NULL) {
+            p = MB_DATA(ri->roster.who);
+            for (i = 0; i < parts.size(); i++) {
+                frame_header(p, FRAME_TEXT, 0, parts[i].size());
+                memcpy(p + FRAME_HDR_SIZE, parts[i].data(), parts[i].size());
+                p += FRAME_HDR_SIZE + parts[i].size();
+            }
+        }
+    }
+    
+    if ((mb = ri->roster.who) != NULL)
+        mb_ref(mb);
+    
+    pthread_mutex_unlock(&ri->roster.lock);
+    return mb;
+}
@@ -0,0 +1,65 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: room.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the room directory. Every room name is interned
+-- once into an entry shared by all shards, which gives the room a stable id
+-- and keeps a member count per shard. A shard only forwards a room message
+-- to the shards that have members in the room. The members themselves are
+-- indexed by each shard (see struct room in common.h). The entry also holds
+-- the room's scrollback, replayed to clients joining it, and its roster:
+-- the nicknames present on any shard or federated server, with the /who
+-- reply framed once and kept until the next join or leave.
+-------------------------------------------------------------------------------*/
+#ifndef __ROOM_H__
+#define __ROOM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "scrollback.h"
+#include "msgbuf.h"
+
+#define ROOM_NAME_MAX   32      // maximum length of a room name
+#define ROOM_DEFAULT    "lobby" // room every client starts in
+#define WHO_FRAME_MAX   4096    // payload of one frame of a /who reply
+
+// who is in a room, whichever shard they are on
+struct roster {
+    pthread_mutex_t lock;       // held by joins, leaves and /who
+    std::map<std::string, int>* names; // nickname -> # of sessions using it
+    struct msgbuf* who;         // framed /who reply, NULL once out of date
+};
+
+// directory entry of a room, never freed once interned
+struct room_info {
+    uint32_t    id;             // room id, unique for the server's lifetime
+    uint64_t    key;            // hash of the name, the same in every process
+    char        name[ROOM_NAME_MAX];
+    int*        members;        // # of members per shard, updated atomically
+    struct scrollback hist;     // recent messages
+    struct roster roster;       // nicknames present
+};
+
+// function prototypes
+int room_init(int nshards, uint32_t hist_msgs, uint32_t hist_slot);
+int room_valid(const char* name);
+struct room_info* room_intern(const char* name);
+void room_count(struct room_info* ri, int shard, int delta);
+int room_active(const struct room_info* ri, int shard);
+int room_list(char* out, size_t size);
+void room_all(std::vector<struct room_info*>* out);
+void room_enter(struct room_info* ri, const char* nick);
+void room_leave(struct room_info* ri, const char* nick);
+struct msgbuf* room_who(struct room_info* ri);
+
+#endif
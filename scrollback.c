@@ -0,0 +1,178 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: scrollback.c - Bounded ring of recent room messages.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   void sb_init(struct scrollback* sb, uint32_t cap,
+--                           uint32_t slot);
+--              void sb_append(struct scrollback* sb, const char* data,
+--                             uint32_t len, uint64_t ts);
+--              struct msgbuf* sb_replay(struct scrollback* sb, uint32_t max,
+--                                       uint64_t since);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- Messages are stored framed, exactly as they were broadcast, so a replay
+-- is a plain concatenation of slots into one message buffer that goes out
+-- with a single write. Slot i always holds message i modulo the capacity;
+-- the newest message simply overwrites the oldest. A room uses
+-- cap * (slot + sizeof(struct sb_entry)) bytes once it has spoken, and
+-- nothing before.
+------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "scrollback.h"
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sb_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void sb_init(struct scrollback* sb, uint32_t cap,
+--                           uint32_t slot)
+--              struct scrollback* sb: the ring to initialize
+--              uint32_t cap: # of messages kept, 0 keeps none
+--              uint32_t slot: the largest framed message stored
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- The arena is only allocated by the first sb_append().
+------------------------------------------------------------------------------*/
+void sb_init(struct scrollback* sb, uint32_t cap, uint32_t slot)
+{
+    pthread_mutex_init(&sb->lock, NULL);
+    sb->arena = NULL;
+    sb->ents = NULL;
+    sb->cap = cap;
+    sb->slot = slot;
+    sb->next = 0;
+    sb->skipped = 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sb_append
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void sb_append(struct scrollback* sb, const char* data,
+--                             uint32_t len, uint64_t ts)
+--              struct scrollback* sb: the ring
+--              const char* data: the framed message
+--              uint32_t len: its length
+--              uint64_t ts: the time it was sent
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every broadcast. It copies the message into
+-- the next slot; messages longer than a slot are not kept, only counted.
+-- If the arena cannot be allocated the room simply has no history.
+------------------------------------------------------------------------------*/
+void sb_append(struct scrollback* sb, const char* data, uint32_t len, uint64_t ts)
+{
+    uint32_t i;
+    
+    if (sb->cap == 0)
+        return;
+    if (len > sb->slot) {
+        __atomic_add_fetch(&sb->skipped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    pthread_mutex_lock(&sb->lock);
+    
+    if (sb->arena == NULL) {
+        sb->arena = (char*) malloc((size_t) sb->cap * (sizeof(struct sb_entry) + sb->slot));
+        sb->ents = (struct sb_entry*) sb->arena;
+    }
+    
+    if (sb->arena != NULL) {
+        i = (uint32_t) (sb->next % sb->cap);
+        memcpy(sb->arena + (size_t) sb->cap * sizeof(struct sb_entry)
+               + (size_t) i * sb->slot, data, len);
+        sb->ents[i].ts = ts;
+        sb->ents[i].len = len;
+        sb->next++;
+    }
+    
+    pthread_mutex_unlock(&sb->lock);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    sb_replay
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   struct msgbuf* sb_replay(struct scrollback* sb, uint32_t max,
+--                                       uint64_t since)
+--              struct scrollback* sb: the ring
+--              uint32_t max: the most messages to replay
+--              uint64_t since: skip messages stored before this time, 0 to
+--                              replay whatever is kept
+-- 
+-- RETURNS:     the messages oldest first in one buffer holding a reference
+--              for the caller, or NULL if there is nothing to replay
+-- 
+-- NOTES:
+-- This function is called when a client joins a room. The copy is made
+-- under the lock, which is held for a bounded time since the ring is
+-- bounded.
+------------------------------------------------------------------------------*/
+struct msgbuf* sb_replay(struct scrollback* sb, uint32_t max, uint64_t since)
+{
+    struct  msgbuf* mb = NULL;
+    const char* slots;
+    uint64_t first, k;
+    size_t  total = 0;
+    char*   p;
+    uint32_t i;
+    
+    if (sb->cap == 0)
+        return NULL;
+    
+    pthread_mutex_lock(&sb->lock);
+    
+    // the oldest message still kept, within the count limit
+    first = (sb->next > sb->cap) ? sb->next - sb->cap : 0;
+    if (max < sb->next - first)
+        first = sb->next - max;
+    
+    // and within the age limit, stamps only grow
+    while (first < sb->next && sb->ents[first % sb->cap].ts < since)
+        first++;
+    
+    for (k = first; k < sb->next; k++)
+        total += sb->ents[k % sb->cap].len;
+    
+    if (total > 0 && (mb = mb_alloc(total)) != NULL) {
+        slots = sb->arena + (size_t) sb->cap * sizeof(struct sb_entry);
+        p = MB_DATA(mb);
+        for (k = first; k < sb->next; k++) {
+            i = (uint32_t) (k % sb->cap);
+            memcpy(p, slots + (size_t) i * sb->slot, sb->ents[i].len);
+            p += sb->ents[i].len;
+        }
+    }
+    
+    pthread_mutex_unlock(&sb->lock);
+    return mb;
+}
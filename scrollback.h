@@ -0,0 +1,49 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: scrollback.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares the room scrollback, a ring of the most recent
+-- framed messages of a room. The ring lives in one arena of fixed-size
+-- slots allocated with the first message, so storing a message never
+-- allocates and a room's history never takes more than its arena, however
+-- busy the room is.
+-------------------------------------------------------------------------------*/
+#ifndef __SCROLLBACK_H__
+#define __SCROLLBACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "msgbuf.h"
+
+#define SB_DEFAULT_MSGS 50      // default # of messages kept per room
+
+// one stored message
+struct sb_entry {
+    uint64_t    ts;             // when it was stored, stats_now() ns
+    uint32_t    len;            // framed length, at most the slot size
+};
+
+// ring of recent messages, shared by the shards
+struct scrollback {
+    pthread_mutex_t lock;       // appends come from any shard
+    char*       arena;          // entries, then cap slots; NULL until used
+    struct sb_entry* ents;      // one entry per slot, in the arena
+    uint32_t    cap;            // # of slots, 0 disables the ring
+    uint32_t    slot;           // size of a slot
+    uint64_t    next;           // # of messages ever stored
+    uint64_t    skipped;        // # of messages too long for a slot, atomic
+};
+
+// function prototypes
+void sb_init(struct scrollback* sb, uint32_t cap, uint32_t slot);
+void sb_append(struct scrollback* sb, const char* data, uint32_t len, uint64_t ts);
+struct msgbuf* sb_replay(struct scrollback* sb, uint32_t max, uint64_t since);
+
+#endif
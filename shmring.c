@@ -0,0 +1,616 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: shmring.c - Shared-memory ring pair between two processes.
+-- 
+-- PROGRAM:     chatsrv, chatbench
+-- 
+-- FUNCTIONS:   int shm_create(struct shm_link* l, size_t size);
+--              int shm_offer(int sock, struct shm_link* l, int memfd);
+--              int shm_attach(const char* path, struct shm_link* l);
+--              void shm_unmap(struct shm_link* l);
+--              ssize_t shm_put(struct shm_link* l, const void* data,
+--                              size_t len);
+--              void shm_post(struct shm_link* l);
+--              ssize_t shm_write(struct shm_link* l, const void* data,
+--                                size_t len);
+--              ssize_t shm_peek(struct shm_link* l, const char** data);
+--              void shm_consume(struct shm_link* l, size_t n);
+--              int shm_data_wait(struct shm_link* l);
+--              int shm_room_wait(struct shm_link* l);
+--              void shm_clear(struct shm_link* l);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- The server makes a link with shm_create() and sends it down the client's
+-- socket with shm_offer(); the client gets it with shm_attach(). From then
+-- on both ends use the same calls, each writing its tx ring and reading
+-- its rx ring.
+-- Each end keeps its own copy of the counters it owns and only reads the
+-- other end's from the shared header, checking them before use: a ring
+-- never holds more than its size, so a counter that says otherwise is
+-- reported as EPROTO instead of being trusted.
+-- Wakeups follow the pattern of shard_post(): the waiting end raises its
+-- flag, then looks at the ring again; the other end moves its counter,
+-- then takes the flag down, and writes the eventfd only if it was up. The
+-- fences between the two steps on either side make sure that at least one
+-- of them sees the other's.
+------------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include "shmring.h"
+
+static int shm_map(struct shm_link* l, int memfd, size_t size, int server);
+static void shm_kick(struct shm_link* l);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_create
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_create(struct shm_link* l, size_t size)
+--              struct shm_link* l: the server's end, filled in
+--              size_t size: bytes per ring, a power of 2 and of the page
+--                           size
+-- 
+-- RETURNS:     the memfd to pass to shm_offer(), -1 on failure
+-- 
+-- NOTES:
+-- This function is called by the server for every client that attaches.
+-- The memory is allocated as the rings are used, so an idle client costs
+-- little more than its mappings.
+------------------------------------------------------------------------------*/
+int shm_create(struct shm_link* l, size_t size)
+{
+    int     memfd;
+    
+    memset(l, 0, sizeof(*l));
+    l->wait_fd = l->kick_fd = -1;
+    
+    if ((memfd = memfd_create("chatsrv-shm", MFD_CLOEXEC)) < 0)
+        return -1;
+    if (ftruncate(memfd, SHM_HDR_SIZE + 2 * size) < 0
+        || (l->wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+        || (l->kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+        || shm_map(l, memfd, size, 1) < 0) {
+        shm_unmap(l);
+        close(memfd);
+        return -1;
+    }
+    
+    l->hdr->version = SHM_VERSION;
+    l->hdr->size = (uint32_t) size;
+    l->hdr->magic = SHM_MAGIC;
+    return memfd;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_offer
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_offer(int sock, struct shm_link* l, int memfd)
+--              int sock: the client's socket
+--              struct shm_link* l: the server's end
+--              int memfd: as returned by shm_create()
+-- 
+-- RETURNS:     0 on success, -1 if the socket cannot take the message
+-- 
+-- NOTES:
+-- This function is called once the session is set up. The eventfds go
+-- across crossed: the one the server waits on is the one the client
+-- kicks. The caller closes memfd afterwards.
+------------------------------------------------------------------------------*/
+int shm_offer(int sock, struct shm_link* l, int memfd)
+{
+    struct  shm_hello h;
+    struct  msghdr msg;
+    struct  iovec iov;
+    struct  cmsghdr* cm;
+    char    cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int     fds[3] = { memfd, l->wait_fd, l->kick_fd };
+    
+    h.magic = SHM_MAGIC;
+    h.version = SHM_VERSION;
+    h.size = (uint32_t) l->size;
+    
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &h;
+    iov.iov_len = sizeof(h);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    
+    return (sendmsg(sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t) sizeof(h))
+           ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_attach
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_attach(const char* path, struct shm_link* l)
+--              const char* path: the server's --shm socket
+--              struct shm_link* l: the client's end, filled in
+-- 
+-- RETURNS:     the socket to the server, -1 on failure
+-- 
+-- NOTES:
+-- This function is called by a client to attach to the server. It waits
+-- for the server's answer. The socket is left blocking; it carries nothing
+-- more, but reads as closed once the server has dropped the client.
+------------------------------------------------------------------------------*/
+int shm_attach(const char* path, struct shm_link* l)
+{
+    struct  sockaddr_un addr;
+    struct  shm_hello h;
+    struct  msghdr msg;
+    struct  iovec iov;
+    struct  cmsghdr* cm;
+    struct  stat st;
+    char    cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int     fds[3] = { -1, -1, -1 };
+    int     sock, i;
+    ssize_t n;
+    
+    memset(l, 0, sizeof(*l));
+    l->wait_fd = l->kick_fd = -1;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    if ((sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &h;
+    iov.iov_len = sizeof(h);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    
+    for (cm = CMSG_FIRSTHDR(&msg); n > 0 && cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS
+            && cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+            memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    }
+    
+    // the server answers with nothing if it is full
+    if (n != (ssize_t) sizeof(h) || fds[0] < 0 || h.magic != SHM_MAGIC
+        || h.version != SHM_VERSION || h.size == 0 || (h.size & (h.size - 1))
+        || fstat(fds[0], &st) < 0 || st.st_size < (off_t) (SHM_HDR_SIZE + 2 * (size_t) h.size)) {
+        errno = ECONNREFUSED;
+        goto fail;
+    }
+    
+    // the server's wait_fd is our kick_fd and the other way round
+    l->kick_fd = fds[1];
+    l->wait_fd = fds[2];
+    fds[1] = fds[2] = -1;
+    if (shm_map(l, fds[0], h.size, 0) < 0)
+        goto fail;
+    if (l->hdr->magic != SHM_MAGIC || l->hdr->size != h.size) {
+        errno = EPROTO;
+        goto fail;
+    }
+    
+    close(fds[0]);
+    return sock;
+
+fail:
+    shm_unmap(l);
+    for (i = 0; i < 3; i++)
+        if (fds[i] >= 0) close(fds[i]);
+    close(sock);
+    return -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_unmap
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_unmap(struct shm_link* l)
+--              struct shm_link* l: the end to release
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when either end is done with a link; the
+-- memory goes once both have unmapped it.
+------------------------------------------------------------------------------*/
+void shm_unmap(struct shm_link* l)
+{
+    if (l->hdr != NULL)
+        munmap(l->hdr, SHM_HDR_SIZE);
+    if (l->area != NULL)
+        munmap(l->area, 4 * l->size);
+    if (l->wait_fd >= 0)
+        close(l->wait_fd);
+    if (l->kick_fd >= 0)
+        close(l->kick_fd);
+    
+    memset(l, 0, sizeof(*l));
+    l->wait_fd = l->kick_fd = -1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_put
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   ssize_t shm_put(struct shm_link* l, const void* data,
+--                              size_t len)
+--              struct shm_link* l: the writing end
+--              const void* data: bytes to write
+--              size_t len: # of bytes
+-- 
+-- RETURNS:     # of bytes written, as many as there is room for; -1 with
+--              errno EPROTO if the other end broke the ring
+-- 
+-- NOTES:
+-- This function is called to write without waking the other end, so that
+-- several writes cost one wakeup; shm_post() follows them.
+------------------------------------------------------------------------------*/
+ssize_t shm_put(struct shm_link* l, const void* data, size_t len)
+{
+    uint64_t tail = __atomic_load_n(&l->tx->tail, __ATOMIC_ACQUIRE);
+    uint64_t used = l->head - tail;
+    
+    if (used > l->size) {
+        errno = EPROTO;
+        return -1;
+    }
+    
+    if (len > l->size - used)
+        len = l->size - used;
+    if (len == 0)
+        return 0;
+    
+    memcpy(l->txdata + (l->head & (l->size - 1)), data, len);
+    l->head += len;
+    __atomic_store_n(&l->tx->head, l->head, __ATOMIC_RELEASE);
+    return (ssize_t) len;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_post
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_post(struct shm_link* l)
+--              struct shm_link* l: the writing end
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called after shm_put() to wake the other end if it is
+-- waiting for data. A reader that is busy costs a load, no system call.
+------------------------------------------------------------------------------*/
+void shm_post(struct shm_link* l)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&l->tx->rd_wait, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&l->tx->rd_wait, 0, __ATOMIC_SEQ_CST))
+        shm_kick(l);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_write
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   ssize_t shm_write(struct shm_link* l, const void* data,
+--                                size_t len)
+--              struct shm_link* l: the writing end
+--              const void* data: bytes to write
+--              size_t len: # of bytes
+-- 
+-- RETURNS:     as shm_put()
+-- 
+-- NOTES:
+-- This function is called to write and wake the other end at once.
+------------------------------------------------------------------------------*/
+ssize_t shm_write(struct shm_link* l, const void* data, size_t len)
+{
+    ssize_t n = shm_put(l, data, len);
+    
+    if (n > 0)
+        shm_post(l);
+    return n;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_peek
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   ssize_t shm_peek(struct shm_link* l, const char** data)
+--              struct shm_link* l: the reading end
+--              const char** data: receives where the bytes start
+-- 
+-- RETURNS:     # of bytes waiting, all of them contiguous at *data; -1
+--              with errno EPROTO if the other end broke the ring
+-- 
+-- NOTES:
+-- This function is called to read in place; the bytes stay where they are
+-- until shm_consume() gives them back to the writer.
+------------------------------------------------------------------------------*/
+ssize_t shm_peek(struct shm_link* l, const char** data)
+{
+    uint64_t head = __atomic_load_n(&l->rx->head, __ATOMIC_ACQUIRE);
+    uint64_t avail = head - l->tail;
+    
+    if (avail > l->size) {
+        errno = EPROTO;
+        return -1;
+    }
+    
+    *data = l->rxdata + (l->tail & (l->size - 1));
+    return (ssize_t) avail;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_consume
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_consume(struct shm_link* l, size_t n)
+--              struct shm_link* l: the reading end
+--              size_t n: # of bytes done with, at most what shm_peek()
+--                        reported
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once the bytes are used. It wakes the other end
+-- if it is waiting for room.
+------------------------------------------------------------------------------*/
+void shm_consume(struct shm_link* l, size_t n)
+{
+    l->tail += n;
+    __atomic_store_n(&l->rx->tail, l->tail, __ATOMIC_RELEASE);
+    
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&l->rx->wr_wait, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&l->rx->wr_wait, 0, __ATOMIC_SEQ_CST))
+        shm_kick(l);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_data_wait
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_data_wait(struct shm_link* l)
+--              struct shm_link* l: the reading end
+-- 
+-- RETURNS:     1 if the caller may wait on wait_fd, 0 if data came in
+--              meanwhile and it should read again
+-- 
+-- NOTES:
+-- This function is called once the rx ring is empty, before waiting.
+------------------------------------------------------------------------------*/
+int shm_data_wait(struct shm_link* l)
+{
+    __atomic_store_n(&l->rx->rd_wait, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    if (__atomic_load_n(&l->rx->head, __ATOMIC_ACQUIRE) != l->tail) {
+        __atomic_store_n(&l->rx->rd_wait, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_room_wait
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_room_wait(struct shm_link* l)
+--              struct shm_link* l: the writing end
+-- 
+-- RETURNS:     1 if the caller may wait on wait_fd, 0 if room was made
+--              meanwhile and it should write again
+-- 
+-- NOTES:
+-- This function is called when the tx ring is full with more to write,
+-- before waiting.
+------------------------------------------------------------------------------*/
+int shm_room_wait(struct shm_link* l)
+{
+    __atomic_store_n(&l->tx->wr_wait, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    if (l->head - __atomic_load_n(&l->tx->tail, __ATOMIC_ACQUIRE) < l->size) {
+        __atomic_store_n(&l->tx->wr_wait, 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_clear
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_clear(struct shm_link* l)
+--              struct shm_link* l: the end woken up
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when wait_fd is readable, to reset it before
+-- looking at the rings.
+------------------------------------------------------------------------------*/
+void shm_clear(struct shm_link* l)
+{
+    uint64_t v;
+    
+    if (read(l->wait_fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+        perror(" - shm: eventfd read error.\n");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_map
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int shm_map(struct shm_link* l, int memfd, size_t size,
+--                                 int server)
+--              struct shm_link* l: the end to set up
+--              int memfd: the shared memory
+--              size_t size: bytes per ring
+--              int server: 1 for the server's end, 0 for the client's
+-- 
+-- RETURNS:     0 on success, -1 if a mapping fails
+-- 
+-- NOTES:
+-- This function is called by both ends. The address space for the four
+-- data mappings is reserved first, then each ring's data is mapped into
+-- two neighbouring quarters of it.
+------------------------------------------------------------------------------*/
+static int shm_map(struct shm_link* l, int memfd, size_t size, int server)
+{
+    void*   p;
+    char*   up;
+    char*   down;
+    int     i;
+    
+    l->size = size;
+    
+    p = mmap(NULL, SHM_HDR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    l->hdr = (struct shm_hdr*) p;
+    
+    p = mmap(NULL, 4 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    l->area = (char*) p;
+    
+    for (i = 0; i < 4; i++) {
+        p = mmap(l->area + i * size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, memfd, SHM_HDR_SIZE + (i / 2) * size);
+        if (p == MAP_FAILED)
+            return -1;
+    }
+    
+    up = l->area;
+    down = l->area + 2 * size;
+    l->tx = server ? &l->hdr->down : &l->hdr->up;
+    l->rx = server ? &l->hdr->up : &l->hdr->down;
+    l->txdata = server ? down : up;
+    l->rxdata = server ? up : down;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_kick
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void shm_kick(struct shm_link* l)
+--              struct shm_link* l: this end
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to wake the other end.
+------------------------------------------------------------------------------*/
+static void shm_kick(struct shm_link* l)
+{
+    uint64_t one = 1;
+    
+    if (write(l->kick_fd, &one, sizeof(one)) < 0)
+        perror(" - shm: eventfd write error.\n");
+}
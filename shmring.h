@@ -0,0 +1,94 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: shmring.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the shared-memory transport for clients on the
+-- server's host. A local client connects to the server's --shm Unix domain
+-- socket and gets back a memfd holding a pair of byte rings, one each way,
+-- and two eventfds. The rings carry the same frames as a TCP connection;
+-- the socket stays open only to tell either side when the other is gone.
+-- Each ring has a single producer and a single consumer, so it needs no
+-- lock: the producer owns head, the consumer owns tail, both only grow.
+-- The data area of a ring is mapped twice in a row, so any run of bytes,
+-- even one that wraps around, is contiguous in memory and a frame can be
+-- written or decoded in place.
+-- A side only waits on its eventfd after raising a flag in the ring it
+-- waits for and finding it still empty (or full); the other side writes
+-- the eventfd only when it finds that flag up. While both sides are busy
+-- a message costs two memcpy()s and no system call.
+-------------------------------------------------------------------------------*/
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_MAGIC       0x43485352  // first word of the shared header
+#define SHM_VERSION     1           // bumped when the layout changes
+#define SHM_RING_SIZE   65536       // bytes per ring, a power of 2 and of the page size
+#define SHM_HDR_SIZE    4096        // bytes before the first ring in the memfd
+
+// one direction, the counters are byte counts since the link was made
+struct shm_ring {
+    uint64_t    head;           // bytes written, producer only
+    uint32_t    wr_wait;        // producer waits for room, see shm_room_wait()
+    char        pad1[52];
+    uint64_t    tail;           // bytes read, consumer only
+    uint32_t    rd_wait;        // consumer waits for data, see shm_data_wait()
+    char        pad2[52];
+};
+
+// start of the memfd, the rings' data follows at SHM_HDR_SIZE
+struct shm_hdr {
+    uint32_t    magic;          // SHM_MAGIC
+    uint32_t    version;        // SHM_VERSION
+    uint32_t    size;           // bytes per ring
+    uint32_t    pad[13];
+    struct shm_ring up;         // client to server
+    struct shm_ring down;       // server to client
+};
+
+// one end of a link
+struct shm_link {
+    struct shm_hdr* hdr;        // the shared header
+    struct shm_ring* tx;        // ring this end writes
+    struct shm_ring* rx;        // ring this end reads
+    char*       txdata;         // data of tx, mapped twice in a row
+    char*       rxdata;         // data of rx, mapped twice in a row
+    size_t      size;           // bytes per ring
+    char*       area;           // the four data mappings
+    uint64_t    head;           // bytes written to tx, this end's copy
+    uint64_t    tail;           // bytes read from rx, this end's copy
+    int         wait_fd;        // eventfd this end waits on
+    int         kick_fd;        // eventfd that wakes the other end
+};
+
+// first message on the socket, the memfd and the eventfds come with it
+struct shm_hello {
+    uint32_t    magic;          // SHM_MAGIC
+    uint32_t    version;        // SHM_VERSION
+    uint32_t    size;           // bytes per ring
+};
+
+// function prototypes
+int shm_create(struct shm_link* l, size_t size);
+int shm_offer(int sock, struct shm_link* l, int memfd);
+int shm_attach(const char* path, struct shm_link* l);
+void shm_unmap(struct shm_link* l);
+ssize_t shm_put(struct shm_link* l, const void* data, size_t len);
+void shm_post(struct shm_link* l);
+ssize_t shm_write(struct shm_link* l, const void* data, size_t len);
+ssize_t shm_peek(struct shm_link* l, const char** data);
+void shm_consume(struct shm_link* l, size_t n);
+int shm_data_wait(struct shm_link* l);
+int shm_room_wait(struct shm_link* l);
+void shm_clear(struct shm_link* l);
+
+#endif
@@ -0,0 +1,448 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: srv_shm.c - Local clients attached through shared memory.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int shm_listen(const char* path);
+--              void shm_register(struct server* srv);
+--              void shm_accept(struct server* srv);
+--              void shm_event(struct server* srv, struct session* s, int fd);
+--              void shm_read(struct server* srv, struct session* s);
+--              int shm_flush(struct server* srv, struct session* s);
+--              void shm_idle(struct server* srv, struct session* s);
+--              void shm_close(struct server* srv, struct session* s);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- Selected with --shm path. A bot or a bridge running on the server's host
+-- connects to the Unix domain socket at path and gets a pair of rings in
+-- shared memory instead of a TCP connection (see shmring.h). It is a
+-- session like any other, in the same rooms and the same broadcasts; only
+-- its bytes move differently:
+--      - what it sends is decoded straight out of its ring, no read();
+--      - a message to it is copied into its ring by sess_send(), no
+--        send(), and what does not fit waits in its output queue as usual;
+--      - a /history stream is copied from the journal's mapping.
+-- The session's fd is the socket, which only reports the client gone; the
+-- eventfd the client kicks is in the shard's epoll set and the fd table
+-- too, so shm_event() gets both. The client only kicks it when the shard
+-- said it was waiting, for data or for room, so a busy client and a busy
+-- shard trade messages without a system call.
+-- All the epoll shards watch the socket with EPOLLEXCLUSIVE and one of
+-- them takes each client. The io_uring backend does not serve local
+-- clients. They are not handed over by a hot upgrade either: they attach
+-- to the new server again once the old one has exited.
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+#include <sys/un.h>
+
+int shm_lfd = -1;                   // --shm socket, or -1
+
+static void shm_admit(struct server* srv, int fd);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_listen
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_listen(const char* path)
+--              const char* path: where to put the socket
+-- 
+-- RETURNS:     0 on success, -1 if the socket cannot be created
+-- 
+-- NOTES:
+-- This function is called at start-up, before the shards run. A socket
+-- left at path by an earlier run, or by the server taken over, is removed
+-- first.
+------------------------------------------------------------------------------*/
+int shm_listen(const char* path)
+{
+    struct  sockaddr_un addr;
+    int     fd;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(fd, cfg.backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    
+    shm_lfd = fd;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_register
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_register(struct server* srv)
+--              struct server* srv: an epoll shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by every epoll shard before its loop starts.
+-- EPOLLEXCLUSIVE wakes one of the shards for a new client, not all.
+------------------------------------------------------------------------------*/
+void shm_register(struct server* srv)
+{
+    struct epoll_event ev;
+    
+    if (shm_lfd < 0)
+        return;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = shm_lfd;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, shm_lfd, &ev) < 0)
+        perror(" - server: epoll_ctl error.\n");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_accept
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_accept(struct server* srv)
+--              struct server* srv: the shard woken up
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the --shm socket is readable. Another
+-- shard may have taken the client already.
+------------------------------------------------------------------------------*/
+void shm_accept(struct server* srv)
+{
+    int fd;
+    
+    while (1) {
+        fd = accept4(shm_lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror(" - server: local accept error.\n");
+            return;
+        }
+        shm_admit(srv, fd);
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_event
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_event(struct server* srv, struct session* s, int fd)
+--              struct server* srv: the shard
+--              struct session* s: a local client
+--              int fd: the descriptor reported, its socket or its eventfd
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by the loop for every event of a local client.
+-- The client sends nothing on the socket, so any event there means it is
+-- gone. A kick may mean new data or room made, both are looked at.
+------------------------------------------------------------------------------*/
+void shm_event(struct server* srv, struct session* s, int fd)
+{
+    if (fd == s->fd) {
+        sess_kill(srv, s);
+        return;
+    }
+    
+    shm_clear(s->shm);
+    sess_flush(srv, s);
+    srv_read(srv, s);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_read
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_read(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a local client, not paused
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by srv_read() instead of reading a socket. The
+-- frames are decoded where they lie in the ring; the decoder only copies
+-- a frame cut short, and what is left when the session gets paused. The
+-- client is asked to kick the eventfd once the ring is empty.
+------------------------------------------------------------------------------*/
+void shm_read(struct server* srv, struct session* s)
+{
+    const   char* data;
+    ssize_t n;
+    int     rc;
+    
+    while (1) {
+        if ((n = shm_peek(s->shm, &data)) < 0) {
+            sess_kill(srv, s);
+            return;
+        }
+        
+        if (n == 0) {
+            if (shm_data_wait(s->shm))
+                return;
+            continue;
+        }
+        
+        STAT_ADD(srv->stats.bytes_in, n);
+        
+        // protocol error, "/q" or paused by a congested recipient
+        rc = srv_input(srv, s, data, n);
+        shm_consume(s->shm, n);
+        if (rc != 0)
+            return;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int shm_flush(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a local client
+-- 
+-- RETURNS:     0 when the queue is empty or the ring is full, -1 if the
+--              client broke the ring
+-- 
+-- NOTES:
+-- This function is called by sess_flush() instead of oq_flush(), and like
+-- it stops at the mark. The client is not woken here, see shm_idle().
+------------------------------------------------------------------------------*/
+int shm_flush(struct server* srv, struct session* s)
+{
+    struct  iovec iov[OQ_IOV_MAX];
+    size_t  done;
+    ssize_t n;
+    int     cnt, i;
+    
+    while ((cnt = oq_iov(&s->oq, iov, OQ_IOV_MAX)) > 0) {
+        for (done = 0, i = 0; i < cnt; i++) {
+            if ((n = shm_put(s->shm, iov[i].iov_base, iov[i].iov_len)) < 0)
+                return -1;
+            done += n;
+            if ((size_t) n < iov[i].iov_len)
+                break;
+        }
+        
+        oq_consume(&s->oq, done);
+        if (i < cnt)
+            break;
+    }
+    
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_idle
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_idle(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a local client
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once a local client's output is written as far
+-- as it goes. The client is woken if it waits for data. If output is left
+-- over, the client is asked to kick the eventfd once it has made room,
+-- which plays the part of EPOLLOUT; room made meanwhile kicks it here.
+------------------------------------------------------------------------------*/
+void shm_idle(struct server* srv, struct session* s)
+{
+    uint64_t one = 1;
+    
+    shm_post(s->shm);
+    
+    if ((s->oq.count > 0 || s->oq.marked) && !shm_room_wait(s->shm)
+        && write(s->shm->wait_fd, &one, sizeof(one)) < 0)
+        perror(" - server: eventfd write error.\n");
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_close
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void shm_close(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a local client being closed
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by srv_close() before the socket is closed. The
+-- client holds the eventfd too, so closing it would not take it out of
+-- the epoll set; it is removed first.
+------------------------------------------------------------------------------*/
+void shm_close(struct server* srv, struct session* s)
+{
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, s->shm->wait_fd, NULL);
+    srv->fdtab[s->shm->wait_fd] = NULL;
+    shm_unmap(s->shm);
+    delete s->shm;
+    s->shm = NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    shm_admit
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void shm_admit(struct server* srv, int fd)
+--              struct server* srv: the shard
+--              int fd: the client's socket
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every local client accepted, to set up its
+-- rings and its session like srv_admit() does for a TCP connection. A
+-- client that cannot be taken is closed without an answer, which it reads
+-- as a refusal. The connection rate limits do not apply.
+------------------------------------------------------------------------------*/
+static void shm_admit(struct server* srv, int fd)
+{
+    struct  epoll_event ev;
+    struct  shm_link* l;
+    struct  session* s = NULL;
+    int     memfd;
+    
+    if (srv->nclients >= srv->maxclients || fd >= srv->tabsize) {
+        STAT_ADD(srv->stats.rejects, 1);
+        close(fd);
+        return;
+    }
+    
+    if ((l = new (std::nothrow) shm_link) == NULL) {
+        STAT_ADD(srv->stats.rejects, 1);
+        close(fd);
+        return;
+    }
+    
+    if ((memfd = shm_create(l, SHM_RING_SIZE)) < 0) {
+        perror(" - server: shared memory error.\n");
+        delete l;
+        STAT_ADD(srv->stats.rejects, 1);
+        close(fd);
+        return;
+    }
+    
+    if (l->wait_fd >= srv->tabsize || (s = sess_new(srv)) == NULL)
+        goto fail;
+    
+    s->fd = fd;
+    s->shm = l;
+    s->paused = srv->handoff;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        goto fail;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = l->wait_fd;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, l->wait_fd, &ev) < 0)
+        goto fail;
+    
+    if (shm_offer(fd, l, memfd) < 0) {
+        epoll_ctl(srv->epfd, EPOLL_CTL_DEL, l->wait_fd, NULL);
+        goto fail;
+    }
+    close(memfd);
+    
+    s->slot = srv->nclients;
+    srv->clients[srv->nclients++] = s;
+    srv->fdtab[fd] = s;
+    srv->fdtab[l->wait_fd] = s;
+    s->room = sess_join(srv, s, default_room);
+    STAT_ADD(srv->stats.accepts, 1);
+    if (cfg.capture_path != NULL)
+        cap_record(&srv->cap, CAP_OPEN, srv->id, s->serial, NULL, 0);
+    
+    s->born = s->rx_at = s->talk_at = srv->wheel.now;
+    sess_timeout(srv, s);
+    
+    snprintf(s->info, sizeof(s->info), "local:shm:%d", fd);
+    sess_decorate(s);
+    
+    printf(" - Local client attached: [%s]\n", s->info);
+    
+    // raises rd_wait, so the client kicks the eventfd for its first frame
+    srv_read(srv, s);
+    return;
+
+fail:
+    perror(" - server: local client setup error.\n");
+    if (s != NULL) {
+        s->shm = NULL;
+        sess_free(srv, s);
+    }
+    shm_unmap(l);
+    delete l;
+    close(memfd);
+    STAT_ADD(srv->stats.rejects, 1);
+    close(fd);
+}
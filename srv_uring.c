@@ -0,0 +1,826 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: srv_uring.c - io_uring backend of the chat server's event
+--              loop.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int uring_start(struct server* srv);
+--              void* srv_loop_uring(struct server* srv);
+--              void uring_recv(struct server* srv, struct session* s);
+--              void uring_resume(struct server* srv, struct session* s);
+--              void uring_flush(struct server* srv);
+--              void uring_quiesce(struct server* srv);
+--              int uring_quiet(struct server* srv);
+--              void uring_drain(struct server* srv);
+--              void uring_reopen(struct server* srv);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- Selected with --io uring. Instead of waiting for readiness and then
+-- calling accept(), read() and writev() per socket, a shard keeps
+-- long-lived requests in its ring and only reaps completions:
+--      - one multishot accept on the listening socket posts every new
+--        connection;
+--      - one multishot receive per session, the kernel picks a buffer from
+--        the shard's provided buffer ring for every completion, so idle
+--        sessions hold no receive buffer;
+--      - multishot polls on the resolver and inbox eventfds.
+-- Output is queued by sess_send() as with epoll but never written there.
+-- The sessions that got output during a loop iteration, or during the
+-- --coalesce window, are written with one writev request each, and all of
+-- them go to the kernel together with the wait for the next completions in
+-- a single io_uring_enter(). Since a
+-- queue now also holds what the kernel was not offered yet, a client only
+-- counts as congested when a write completes short and leaves more than
+-- the high-water mark queued; a paused sender is the one of the last
+-- message queued.
+-- A paused session cannot stop the kernel from receiving, so its receive
+-- is cancelled and whatever arrives meanwhile is held in the decoder
+-- undecoded.
+-- Sessions out of read budget or over their rate (see sess_yield() and
+-- sess_throttle()) are paused the same way.
+-- A /history stream is written from the journal's mapping of the segment
+-- files, a run of at most JR_CHUNK bytes per request, since the ring has no
+-- sendfile(); the bytes still go from the page cache to the socket without
+-- a copy in between.
+-- Before a hot upgrade hands the sockets over (see handoff.h), the accept
+-- and every receive are cancelled and the writes in flight are waited
+-- for, so the kernel holds nothing of the shard's when they go. Needs Linux 6.0 for multishot receive; the shard falls back
+-- to epoll when the ring or the buffer ring cannot be set up.
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+
+// request types, in the upper half of the completion's user_data
+#define UR_ACCEPT       1       // multishot accept on the listening socket
+#define UR_RECV         2       // multishot receive on a session
+#define UR_WRITE        3       // writev of a session's queue
+#define UR_RESOLVED     4       // multishot poll on the resolver eventfd
+#define UR_INBOX        5       // multishot poll on the inbox eventfd
+#define UR_CANCEL       6       // cancellation of a receive or the accept
+#define UR_LISTEN       7       // poll on the listening socket, out of descriptors
+
+#define UR_DATA(op, fd) (((uint64_t)(op) << 32) | (uint32_t)(fd))
+#define URING_BGID      0       // buffer group of the receive buffers
+#define URING_WRITE_IOV 1024    // maximum # of messages per writev
+#define URING_IOV_MAX   (URING_WRITE_IOV * 8) // iovecs per batch of writes
+
+static void uring_accept(struct server* srv);
+static void uring_listen(struct server* srv);
+static void uring_poll(struct server* srv, int fd, int op);
+static void uring_done(struct server* srv, struct session* s);
+static void uring_complete(struct server* srv, struct io_uring_cqe* cqe);
+static void uring_received(struct server* srv, struct session* s,
+                           struct io_uring_cqe* cqe);
+static void uring_written(struct server* srv, struct session* s, int res);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_start
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int uring_start(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     0 on success, -1 if the shard has to stay on epoll
+-- 
+-- NOTES:
+-- This function is called on the shard's thread to create its ring and
+-- receive buffers and to post the long-lived requests. The epoll instance
+-- is left as it is, it is simply never waited on.
+------------------------------------------------------------------------------*/
+int uring_start(struct server* srv)
+{
+    struct uring* u = new uring();
+    struct uring_bufs* b = new uring_bufs();
+    struct iovec* iov = (struct iovec*) malloc(URING_IOV_MAX * sizeof(struct iovec));
+    
+    // writev() vectors must only live until submission
+    if (iov == NULL || uring_init(u, URING_ENTRIES) < 0
+        || !(u->features & IORING_FEAT_SUBMIT_STABLE)
+        || !(u->features & IORING_FEAT_EXT_ARG)
+        || uring_bufs_init(u, b, URING_BGID, URING_BUF_COUNT, URING_BUF_SIZE) < 0) {
+        if (u->fd > 0) close(u->fd);
+        free(iov);
+        delete u;
+        delete b;
+        return -1;
+    }
+    
+    srv->ring = u;
+    srv->bufs = b;
+    srv->iov = iov;
+    
+    uring_accept(srv);
+    uring_poll(srv, srv->resq.efd, UR_RESOLVED);
+    uring_poll(srv, srv->inbox_efd, UR_INBOX);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    srv_loop_uring
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void* srv_loop_uring(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     NULL when io_uring_enter() fails
+-- 
+-- NOTES:
+-- Event loop of a shard on io_uring. Each iteration submits the writes
+-- gathered by the previous one and waits in the same system call, then
+-- handles every completion, and reaps like the epoll loop does.
+------------------------------------------------------------------------------*/
+void* srv_loop_uring(struct server* srv)
+{
+    struct  io_uring_cqe* cqe;          // completion
+    uint64_t start;                     // when the batch of completions came in
+    
+    // sessions handed over by the server we took over from
+    srv_adopt(srv);
+    
+    while (1) {
+        if (srv_flush_due(srv))
+            uring_flush(srv);
+        
+        // wake up in time for the next throttled session
+        if (uring_wait(srv->ring, srv_timeout(srv)) < 0) {
+            if (errno == EINTR) continue;
+            perror(" - server: io_uring_enter error.\n");
+            break;
+        }
+        
+        start = stats_now();
+        srv_wake(srv);
+        
+        while ((cqe = uring_peek(srv->ring)) != NULL) {
+            uring_complete(srv, cqe);
+            uring_seen(srv->ring);
+        }
+        
+        // resume unblocked senders and close dead sessions
+        srv_reap(srv);
+        
+        // the iteration's joins and leaves, one notice per room
+        while (!srv->presence.empty()) {
+            srv_presence(srv);
+            srv_reap(srv);
+        }
+        
+        // the traffic captured during the iteration, in one write
+        if (!srv->cap.empty())
+            cap_flush(&srv->cap);
+        
+        // hot upgrade, once the kernel gave everything back
+        if (srv->handoff)
+            srv_handoff(srv);
+        
+        STAT_ADD(srv->stats.loops, 1);
+        hist_record(&srv->stats.loop_ns, stats_now() - start);
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_recv
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_recv(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: the session to receive from
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to post a multishot receive for a session unless
+-- one is already posted or the session is paused or closing.
+------------------------------------------------------------------------------*/
+void uring_recv(struct server* srv, struct session* s)
+{
+    struct io_uring_sqe* sqe;
+    
+    if (s->recv_armed || s->paused || s->closing)
+        return;
+    
+    sqe = uring_sqe(srv->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = s->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = UR_DATA(UR_RECV, s->fd);
+    
+    s->recv_armed = 1;
+    s->inflight++;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_resume
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_resume(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: a sender whose last pause was lifted
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- The io_uring counterpart of srv_read() for resumed senders: the frames
+-- held during the pause are handled first, then receiving starts again.
+------------------------------------------------------------------------------*/
+void uring_resume(struct server* srv, struct session* s)
+{
+    if (s->paused || s->closing)
+        return;
+    
+    if (dec_pending(&s->dec) && srv_input(srv, s, NULL, 0) != 0)
+        return;
+    
+    uring_recv(srv, s);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_flush
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_flush(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called before the loop waits to post one writev per
+-- session listed by sess_dirty() that has no write in flight. The vectors come from the
+-- shard's scratch array; it is handed to the kernel before being reused,
+-- and the kernel copies vectors at submission. The messages written are
+-- pinned in the queue until the write completes. Once the queue reaches its
+-- mark, the next run of the session's history stream is written instead.
+------------------------------------------------------------------------------*/
+void uring_flush(struct server* srv)
+{
+    struct  io_uring_sqe* sqe;
+    struct  session* s;
+    int     niov = 0, cnt, j, fd, rc;
+    size_t  i, len;
+    char*   data;
+    
+    for (i = 0; i < srv->dirty.size(); i++) {
+        if ((s = sess_lookup(srv, srv->dirty[i])) == NULL)
+            continue;
+        
+        s->dirty = 0;
+        if (s->writing || (s->oq.count == 0 && !s->oq.marked))
+            continue;
+        
+        if (niov + URING_WRITE_IOV > URING_IOV_MAX) {
+            uring_enter(srv->ring, 0);
+            niov = 0;
+        }
+        
+        s->writing = 1;
+        if ((cnt = oq_iov(&s->oq, srv->iov + niov, URING_WRITE_IOV)) == 0) {
+            if ((rc = jr_next(journal, &s->stream, &fd, &data, &len)) > 0) {
+                srv->iov[niov].iov_base = data;
+                srv->iov[niov].iov_len = len;
+                s->writing = 2;
+                cnt = 1;
+            } else if (rc < 0) {
+                // not committed yet, the session's timer comes back
+                tw_add(&srv->wheel, &s->timer, srv->wheel.now + 1);
+            } else {
+                oq_unmark(&s->oq);
+                cnt = oq_iov(&s->oq, srv->iov + niov, URING_WRITE_IOV);
+            }
+        }
+        if (cnt == 0) {
+            s->writing = 0;
+            continue;
+        }
+        
+        for (s->wbytes = 0, j = 0; j < cnt; j++)
+            s->wbytes += srv->iov[niov + j].iov_len;
+        
+        sqe = uring_sqe(srv->ring);
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = s->fd;
+        sqe->addr = (uint64_t) (uintptr_t) (srv->iov + niov);
+        sqe->len = cnt;
+        sqe->user_data = UR_DATA(UR_WRITE, s->fd);
+        
+        niov += cnt;
+        s->oq.pinned = (s->writing == 1) ? cnt : 0;
+        s->inflight++;
+    }
+    
+    srv->dirty.clear();
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_quiesce
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_quiesce(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by srv_quiesce() once every session is paused.
+-- The accept is cancelled, and so is the receive of every session; what
+-- arrives before a cancellation takes effect is held in the decoder as
+-- for any paused session.
+------------------------------------------------------------------------------*/
+void uring_quiesce(struct server* srv)
+{
+    struct  io_uring_sqe* sqe;
+    struct  session* s;
+    int     i;
+    
+    if (srv->accepting) {
+        sqe = uring_sqe(srv->ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UR_DATA(UR_ACCEPT, srv->listenfd);
+        sqe->user_data = UR_DATA(UR_CANCEL, srv->listenfd);
+        sqe = uring_sqe(srv->ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UR_DATA(UR_LISTEN, srv->listenfd);
+        sqe->user_data = UR_DATA(UR_CANCEL, srv->listenfd);
+    }
+    
+    for (i = 0; i < srv->nclients; i++) {
+        if ((s = srv->clients[i])->recv_armed != 1)
+            continue;
+        sqe = uring_sqe(srv->ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UR_DATA(UR_RECV, s->fd);
+        sqe->user_data = UR_DATA(UR_CANCEL, s->fd);
+        s->recv_armed = 2;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_quiet
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int uring_quiet(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     1 once neither the accept nor a receive is posted, 0 otherwise
+-- 
+-- NOTES:
+-- This function is called every loop iteration while the shard waits for
+-- the cancellations of uring_quiesce() to complete.
+------------------------------------------------------------------------------*/
+int uring_quiet(struct server* srv)
+{
+    int i;
+    
+    if (srv->accepting)
+        return 0;
+    for (i = 0; i < srv->nclients; i++) {
+        if (srv->clients[i]->recv_armed)
+            return 0;
+    }
+    return 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_drain
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_drain(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called by srv_handoff() to wait for the writes in
+-- flight. Their completions are handled as usual, nothing new is written:
+-- what is still queued goes to the new server.
+------------------------------------------------------------------------------*/
+void uring_drain(struct server* srv)
+{
+    struct  io_uring_cqe* cqe;
+    int     i, busy = 1;
+    
+    while (busy) {
+        for (busy = 0, i = 0; i < srv->nclients && !busy; i++)
+            busy = srv->clients[i]->writing;
+        if (!busy)
+            break;
+        
+        if (uring_wait(srv->ring, -1) < 0 && errno != EINTR) {
+            perror(" - server: io_uring_enter error.\n");
+            return;
+        }
+        while ((cqe = uring_peek(srv->ring)) != NULL) {
+            uring_complete(srv, cqe);
+            uring_seen(srv->ring);
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_reopen
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_reopen(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a hot upgrade failed to post the accept
+-- again. The sessions receive again as they are resumed, the output held
+-- during the attempt is still listed to be written.
+------------------------------------------------------------------------------*/
+void uring_reopen(struct server* srv)
+{
+    if (!srv->accepting)
+        uring_accept(srv);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_accept
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_accept(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to post the multishot accept, and again if the
+-- kernel ends it, unless a hot upgrade cancelled it. Sessions stay
+-- blocking: on a non-blocking socket the kernel fails a write to a full
+-- socket with EAGAIN instead of waiting for room itself.
+------------------------------------------------------------------------------*/
+static void uring_accept(struct server* srv)
+{
+    struct io_uring_sqe* sqe = uring_sqe(srv->ring);
+    
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = srv->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UR_DATA(UR_ACCEPT, srv->listenfd);
+    srv->accepting = 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_listen
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_listen(struct server* srv)
+--              struct server* srv: the shard
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the accept failed for want of a descriptor
+-- and no connection was waiting to be shed. The kernel fails an accept
+-- that way before it looks at the queue, so instead of the accept a
+-- one-shot poll waits for the next connection; the accept is posted again
+-- when it completes. accepting stays set, a hot upgrade cancels the poll.
+------------------------------------------------------------------------------*/
+static void uring_listen(struct server* srv)
+{
+    struct io_uring_sqe* sqe = uring_sqe(srv->ring);
+    
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = srv->listenfd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = UR_DATA(UR_LISTEN, srv->listenfd);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_poll
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_poll(struct server* srv, int fd, int op)
+--              struct server* srv: the shard
+--              int fd: the eventfd to watch
+--              int op: UR_RESOLVED or UR_INBOX
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to post a multishot poll, and again if the
+-- kernel ends it.
+------------------------------------------------------------------------------*/
+static void uring_poll(struct server* srv, int fd, int op)
+{
+    struct io_uring_sqe* sqe = uring_sqe(srv->ring);
+    
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = UR_DATA(op, fd);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_done
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_done(struct server* srv, struct session* s)
+--              struct server* srv: the shard
+--              struct session* s: the session a request ended for
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when the kernel is done with a request. A
+-- session srv_reap() could not close yet is handed back to it with the
+-- last one.
+------------------------------------------------------------------------------*/
+static void uring_done(struct server* srv, struct session* s)
+{
+    if (--s->inflight == 0 && s->closing == 2)
+        srv->closing.push_back(s);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_complete
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_complete(struct server* srv,
+--                                         struct io_uring_cqe* cqe)
+--              struct server* srv: the shard
+--              struct io_uring_cqe* cqe: the completion
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every completion. A session is never closed
+-- while it has requests in flight, so the fd of a receive or write
+-- completion always maps to the session it was posted for.
+------------------------------------------------------------------------------*/
+static void uring_complete(struct server* srv, struct io_uring_cqe* cqe)
+{
+    struct  sockaddr_in addr;
+    struct  session* s;
+    socklen_t len;
+    int     op = (int) (cqe->user_data >> 32);
+    int     fd = (int) (uint32_t) cqe->user_data;
+    int     more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    
+    switch (op) {
+    case UR_ACCEPT:
+        if (cqe->res >= 0) {
+            len = sizeof(addr);
+            if (getpeername(cqe->res, (struct sockaddr*) &addr, &len) == 0)
+                srv_admit(srv, cqe->res, &addr);
+            else
+                close(cqe->res);
+        } else if ((cqe->res == -EMFILE || cqe->res == -ENFILE) && !srv_shed(srv)
+                   && !more && !srv->handoff) {
+            // posting the accept again would fail again at once
+            uring_listen(srv);
+            break;
+        }
+        if (more)
+            break;
+    // fall through
+    case UR_LISTEN:
+        if (srv->handoff)
+            srv->accepting = 0;
+        else
+            uring_accept(srv);
+        break;
+    
+    case UR_RESOLVED:
+        srv_resolved(srv);
+        if (!more) uring_poll(srv, fd, op);
+        break;
+    
+    case UR_INBOX:
+        srv_inbox(srv);
+        if (!more) uring_poll(srv, fd, op);
+        break;
+    
+    case UR_RECV:
+        if ((s = srv->fdtab[fd]) != NULL)
+            uring_received(srv, s, cqe);
+        break;
+    
+    case UR_WRITE:
+        if ((s = srv->fdtab[fd]) != NULL)
+            uring_written(srv, s, cqe->res);
+        break;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_received
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_received(struct server* srv,
+--                                         struct session* s,
+--                                         struct io_uring_cqe* cqe)
+--              struct server* srv: the shard
+--              struct session* s: the session
+--              struct io_uring_cqe* cqe: the receive completion
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called for every receive completion. The bytes are
+-- decoded in place in the provided buffer, which goes back to the kernel
+-- right after. A paused session keeps the bytes in its decoder and its
+-- receive is cancelled. Running out of buffers ends a multishot receive,
+-- it is posted again unless the session is paused or closing.
+------------------------------------------------------------------------------*/
+static void uring_received(struct server* srv, struct session* s,
+                           struct io_uring_cqe* cqe)
+{
+    struct  io_uring_sqe* sqe;
+    unsigned bid;
+    
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        s->recv_armed = 0;
+        uring_done(srv, s);
+    }
+    
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        STAT_ADD(srv->stats.bytes_in, cqe->res);
+        
+        if (s->closing) {
+            // the rest of the input is discarded
+        } else if (s->paused) {
+            if (dec_hold(&s->dec, uring_buf(srv->bufs, bid), cqe->res) < 0)
+                sess_kill(srv, s);
+        } else {
+            srv_input(srv, s, uring_buf(srv->bufs, bid), cqe->res);
+        }
+        uring_buf_put(srv->bufs, bid);
+        
+        if (s->paused && s->recv_armed == 1) {
+            sqe = uring_sqe(srv->ring);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = UR_DATA(UR_RECV, s->fd);
+            sqe->user_data = UR_DATA(UR_CANCEL, s->fd);
+            s->recv_armed = 2;
+        }
+    } else if (cqe->res == 0 || (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+        // end of stream or a socket error
+        sess_kill(srv, s);
+    }
+    
+    if (!s->recv_armed)
+        uring_recv(srv, s);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_written
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void uring_written(struct server* srv,
+--                                        struct session* s, int res)
+--              struct server* srv: the shard
+--              struct session* s: the session
+--              int res: bytes written, or a negated errno
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called when a write completes. The bytes written are
+-- retired from the queue as sess_flush() does, a short write over the
+-- high-water mark invokes the congestion policy, and a queue that still
+-- holds messages or a mark is listed for the next batch. A history write advances
+-- the stream instead; nothing is written from the queue meanwhile, so it
+-- is held to the high-water mark as well.
+------------------------------------------------------------------------------*/
+static void uring_written(struct server* srv, struct session* s, int res)
+{
+    int stream = (s->writing == 2);
+    
+    s->writing = 0;
+    s->oq.pinned = 0;
+    uring_done(srv, s);
+    
+    if (s->closing)
+        return;
+    
+    if (res < 0) {
+        if (res != -EAGAIN && res != -EINTR)
+            sess_kill(srv, s);
+        else
+            sess_dirty(srv, s);
+        return;
+    }
+    
+    STAT_ADD(srv->stats.bytes_out, res);
+    
+    if (stream) {
+        s->stream.off += res;
+        if (s->oq.bytes > cfg.hwm) {
+            sess_congested(srv, s, (s->from.shard >= 0) ? &s->from : NULL);
+            if (s->closing)
+                return;
+        }
+        sess_dirty(srv, s);
+        return;
+    }
+    
+    oq_consume(&s->oq, res);
+    
+    // the socket is full
+    if ((size_t) res < s->wbytes && s->oq.bytes > cfg.hwm) {
+        sess_congested(srv, s, (s->from.shard >= 0) ? &s->from : NULL);
+        if (s->closing)
+            return;
+    }
+    
+    if (s->oq.bytes <= cfg.lwm)
+        sess_release(srv, s);
+    
+    if (s->oq.count > 0 || s->oq.marked)
+        sess_dirty(srv, s);
+}
@@ -0,0 +1,483 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: stats.c - Server metrics and the stats socket.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   uint64_t stats_now();
+--              void hist_record(struct hist* h, uint64_t v);
+--              void hist_add(struct hist* dst, const struct hist* src);
+--              uint64_t hist_value(const struct hist* h, double q);
+--              int stats_start(const char* path);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- The stats socket answers one request per connection. A client writes
+-- "json" for a JSON object, or "text" (or nothing) for one metric per line,
+-- and reads the answer until the server closes the connection:
+--      echo json | socat - UNIX-CONNECT:/tmp/chatsrv.stats
+-- Snapshots are taken on the stats thread, the event loops never wait for
+-- a reader. A snapshot may mix values from slightly different moments,
+-- which is fine for monitoring.
+------------------------------------------------------------------------------*/
+
+#include "common.h"
+#include <stddef.h>
+#include <sys/un.h>
+#include <string>
+
+// an exported counter of struct srv_stats
+struct stats_field {
+    const char* name;
+    size_t      off;
+};
+
+static const struct stats_field counters[] = {
+    { "loops",      offsetof(struct srv_stats, loops) },
+    { "accepts",    offsetof(struct srv_stats, accepts) },
+    { "rejects",    offsetof(struct srv_stats, rejects) },
+    { "refused",    offsetof(struct srv_stats, refused) },
+    { "closes",     offsetof(struct srv_stats, closes) },
+    { "bytes_in",   offsetof(struct srv_stats, bytes_in) },
+    { "bytes_out",  offsetof(struct srv_stats, bytes_out) },
+    { "frames_in",  offsetof(struct srv_stats, frames_in) },
+    { "broadcasts", offsetof(struct srv_stats, broadcasts) },
+    { "deliveries", offsetof(struct srv_stats, deliveries) },
+    { "dropped",    offsetof(struct srv_stats, dropped) },
+    { "slow_kills", offsetof(struct srv_stats, slow_kills) },
+    { "throttles",  offsetof(struct srv_stats, throttles) },
+    { "yields",     offsetof(struct srv_stats, yields) },
+    { "pings",      offsetof(struct srv_stats, pings) },
+    { "timeouts",   offsetof(struct srv_stats, timeouts) },
+};
+
+#define NCOUNTERS   (sizeof(counters) / sizeof(counters[0]))
+
+static int stats_fd = -1;               // listening stats socket
+static uint64_t stats_started;          // stats_now() at start-up
+
+static void* stats_main(void* arg);
+static void stats_report(std::string* out, int json);
+static void stats_hist(std::string* out, const char* name,
+                       const struct hist* h, int json, int first);
+static int hist_index(uint64_t v);
+static uint64_t hist_floor(int idx);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    stats_now
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   uint64_t stats_now()
+-- 
+-- RETURNS:     the monotonic time in nanoseconds
+-- 
+-- NOTES:
+-- clock_gettime() is served by the vDSO, cheap enough for every loop
+-- iteration.
+------------------------------------------------------------------------------*/
+uint64_t stats_now()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    hist_record
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void hist_record(struct hist* h, uint64_t v)
+--              struct hist* h: the histogram
+--              uint64_t v: the value to record
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Only one thread may record into a histogram at a time.
+------------------------------------------------------------------------------*/
+void hist_record(struct hist* h, uint64_t v)
+{
+    int idx = hist_index(v);
+    
+    STAT_ADD(h->buckets[idx], 1);
+    STAT_ADD(h->count, 1);
+    STAT_ADD(h->sum, v);
+    if (v > h->max)
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    hist_add
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void hist_add(struct hist* dst, const struct hist* src)
+--              struct hist* dst: the sum, owned by the caller
+--              const struct hist* src: a histogram another thread updates
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to merge a live histogram into a snapshot.
+------------------------------------------------------------------------------*/
+void hist_add(struct hist* dst, const struct hist* src)
+{
+    uint64_t max;
+    int i;
+    
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max)
+        dst->max = max;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    hist_value
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   uint64_t hist_value(const struct hist* h, double q)
+--              const struct hist* h: a snapshot
+--              double q: the quantile, 0.5 for the median
+-- 
+-- RETURNS:     the lower bound of the bucket holding the quantile, capped
+--              by the maximum
+-- 
+-- NOTES:
+-- The bucket counts are summed rather than h->count used, so a snapshot
+-- taken while values were recorded still finds a bucket.
+------------------------------------------------------------------------------*/
+uint64_t hist_value(const struct hist* h, double q)
+{
+    uint64_t total = 0, rank, seen = 0, v;
+    int i;
+    
+    for (i = 0; i < HIST_BUCKETS; i++)
+        total += h->buckets[i];
+    if (total == 0)
+        return 0;
+    
+    rank = (uint64_t) (q * (total - 1)) + 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+    
+    v = hist_floor(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+    return (v < h->max) ? v : h->max;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    stats_start
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int stats_start(const char* path)
+--              const char* path: the Unix domain socket to listen on
+-- 
+-- RETURNS:     0 on success, -1 if the socket or thread cannot be created
+-- 
+-- NOTES:
+-- This function is called once the shards are initialized. A stale socket
+-- left by an earlier run is removed.
+------------------------------------------------------------------------------*/
+int stats_start(const char* path)
+{
+    struct  sockaddr_un addr;
+    pthread_t tid;
+    
+    stats_started = stats_now();
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    
+    if ((stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    
+    if (bind(stats_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(stats_fd, 16) < 0
+        || pthread_create(&tid, NULL, stats_main, NULL) != 0) {
+        close(stats_fd);
+        return -1;
+    }
+    
+    pthread_detach(tid);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    stats_main
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void* stats_main(void* arg)
+--              void* arg: unused
+-- 
+-- RETURNS:     never returns
+-- 
+-- NOTES:
+-- Stats thread body. Requests are served one at a time; a client that
+-- sends nothing within a second gets the text report.
+------------------------------------------------------------------------------*/
+static void* stats_main(void* arg)
+{
+    struct  pollfd pfd;
+    std::string out;
+    char    cmd[STATS_CMD_MAX];
+    ssize_t n, off;
+    int     fd;
+    
+    (void) arg;
+    
+    while (1) {
+        if ((fd = accept(stats_fd, NULL, NULL)) < 0)
+            continue;
+        
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        n = 0;
+        if (poll(&pfd, 1, 1000) > 0 && (n = read(fd, cmd, sizeof(cmd) - 1)) < 0)
+            n = 0;
+        cmd[n] = '\0';
+        
+        stats_report(&out, strncmp(cmd, "json", 4) == 0);
+        
+        for (off = 0; off < (ssize_t) out.size(); off += n) {
+            if ((n = send(fd, out.data() + off, out.size() - off, MSG_NOSIGNAL)) <= 0)
+                break;
+        }
+        close(fd);
+    }
+    
+    return NULL;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    stats_report
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void stats_report(std::string* out, int json)
+--              std::string* out: receives the report
+--              int json: 1 for JSON, 0 for text
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Adds up the metrics of every shard, the resolver, the peer links and
+-- the rooms' scrollbacks.
+-- Counters are totals since start-up; rates come from comparing two
+-- reports.
+------------------------------------------------------------------------------*/
+static void stats_report(std::string* out, int json)
+{
+    struct  hist* loop_ns = new hist();
+    struct  hist* queue_bytes = new hist();
+    struct  hist* dns_ns = new hist();
+    uint64_t sum[NCOUNTERS];
+    uint64_t hits, misses;
+    uint64_t relayed_in, relayed_out, relay_dups;
+    uint64_t hist_skipped = 0;
+    std::vector<struct room_info*> rooms;
+    char    line[256];
+    size_t  i;
+    int     s, clients = 0, links;
+    
+    memset(sum, 0, sizeof(sum));
+    for (s = 0; s < nshards; s++) {
+        for (i = 0; i < NCOUNTERS; i++)
+            sum[i] += __atomic_load_n((uint64_t*) ((char*) &shards[s]->stats
+                                      + counters[i].off), __ATOMIC_RELAXED);
+        hist_add(loop_ns, &shards[s]->stats.loop_ns);
+        hist_add(queue_bytes, &shards[s]->stats.queue_bytes);
+        clients += __atomic_load_n(&shards[s]->nclients, __ATOMIC_RELAXED);
+    }
+    res_stats(dns_ns, &hits, &misses);
+    peer_stats(&links, &relayed_in, &relayed_out, &relay_dups);
+    room_all(&rooms);
+    for (i = 0; i < rooms.size(); i++)
+        hist_skipped += __atomic_load_n(&rooms[i]->hist.skipped, __ATOMIC_RELAXED);
+    
+    out->clear();
+    snprintf(line, sizeof(line), json ? "{\"uptime_secs\": %.3f, \"shards\": %d, "
+             "\"clients\": %d, \"dns_hits\": %llu, \"dns_misses\": %llu"
+             : "uptime_secs %.3f\nshards %d\nclients %d\ndns_hits %llu\n"
+             "dns_misses %llu\n", (stats_now() - stats_started) / 1e9, nshards,
+             clients, (unsigned long long) hits, (unsigned long long) misses);
+    out->append(line);
+    
+    snprintf(line, sizeof(line), json ? ", \"peer_links\": %d, \"relayed_in\": %llu, "
+             "\"relayed_out\": %llu, \"relay_dups\": %llu"
+             : "peer_links %d\nrelayed_in %llu\nrelayed_out %llu\nrelay_dups %llu\n",
+             links, (unsigned long long) relayed_in, (unsigned long long) relayed_out,
+             (unsigned long long) relay_dups);
+    out->append(line);
+    
+    snprintf(line, sizeof(line), json ? ", \"history_skipped\": %llu" : "history_skipped %llu\n",
+             (unsigned long long) hist_skipped);
+    out->append(line);
+    
+    for (i = 0; i < NCOUNTERS; i++) {
+        snprintf(line, sizeof(line), json ? ", \"%s\": %llu" : "%s %llu\n",
+                 counters[i].name, (unsigned long long) sum[i]);
+        out->append(line);
+    }
+    
+    if (json) out->append(", \"histograms\": {");
+    stats_hist(out, "loop_ns", loop_ns, json, 1);
+    stats_hist(out, "queue_bytes", queue_bytes, json, 0);
+    stats_hist(out, "dns_ns", dns_ns, json, 0);
+    if (json) out->append("}}\n");
+    
+    delete loop_ns;
+    delete queue_bytes;
+    delete dns_ns;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    stats_hist
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void stats_hist(std::string* out, const char* name,
+--                                     const struct hist* h, int json,
+--                                     int first)
+--              std::string* out: the report
+--              const char* name: the metric name
+--              const struct hist* h: the snapshot
+--              int json: 1 for JSON, 0 for text
+--              int first: 1 for the first histogram of a JSON object
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- Appends count, mean, p50, p90, p99, p999 and max of a histogram.
+------------------------------------------------------------------------------*/
+static void stats_hist(std::string* out, const char* name,
+                       const struct hist* h, int json, int first)
+{
+    char line[512];
+    
+    snprintf(line, sizeof(line), json
+             ? "%s\"%s\": {\"count\": %llu, \"mean\": %llu, \"p50\": %llu, "
+               "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}"
+             : "%s%s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu "
+               "max=%llu\n",
+             (json && !first) ? ", " : "", name,
+             (unsigned long long) h->count,
+             (unsigned long long) (h->count ? h->sum / h->count : 0),
+             (unsigned long long) hist_value(h, 0.5),
+             (unsigned long long) hist_value(h, 0.9),
+             (unsigned long long) hist_value(h, 0.99),
+             (unsigned long long) hist_value(h, 0.999),
+             (unsigned long long) h->max);
+    out->append(line);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    hist_index
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static int hist_index(uint64_t v)
+--              uint64_t v: a value
+-- 
+-- RETURNS:     the bucket of v
+-- 
+-- NOTES:
+-- Values below 2^(HIST_SUB_BITS+1) have a bucket each. Above, the bucket
+-- is given by the position of the top bit and the HIST_SUB_BITS bits
+-- after it.
+------------------------------------------------------------------------------*/
+static int hist_index(uint64_t v)
+{
+    int shift;
+    
+    if (v < (2u << HIST_SUB_BITS))
+        return (int) v;
+    
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (2 << HIST_SUB_BITS) + ((shift - 1) << HIST_SUB_BITS)
+         + (int) ((v >> shift) - (1u << HIST_SUB_BITS));
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    hist_floor
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static uint64_t hist_floor(int idx)
+--              int idx: a bucket
+-- 
+-- RETURNS:     the smallest value in the bucket
+-- 
+-- NOTES:
+-- Inverse of hist_index().
+------------------------------------------------------------------------------*/
+static uint64_t hist_floor(int idx)
+{
+    int shift;
+    
+    if (idx < (2 << HIST_SUB_BITS))
+        return (uint64_t) idx;
+    
+    idx -= 2 << HIST_SUB_BITS;
+    shift = (idx >> HIST_SUB_BITS) + 1;
+    return (uint64_t) ((idx & ((1 << HIST_SUB_BITS) - 1)) + (1 << HIST_SUB_BITS)) << shift;
+}
@@ -0,0 +1,70 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: stats.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the server metrics. Every shard owns its
+-- counters and histograms and is the only thread writing them, so updates
+-- are plain relaxed stores without locked instructions. The stats thread
+-- reads them with relaxed loads, adds the shards up and serves the result
+-- on a Unix domain socket.
+-- Histograms are log-linear in the style of HdrHistogram: values below 32
+-- are exact, larger ones fall in 16 buckets per power of two, so any
+-- percentile is within about 6% of the true value.
+-------------------------------------------------------------------------------*/
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HIST_SUB_BITS   4       // 2^4 buckets per power of two
+#define HIST_BUCKETS    976     // enough for any 64-bit value
+#define STATS_CMD_MAX   64      // longest request on the stats socket
+
+// log-linear histogram
+struct hist {
+    uint64_t    count;          // # of values recorded
+    uint64_t    sum;            // sum of the values
+    uint64_t    max;            // largest value
+    uint64_t    buckets[HIST_BUCKETS];
+};
+
+// metrics of one shard
+struct srv_stats {
+    uint64_t    loops;          // event loop iterations with events
+    uint64_t    accepts;        // connections accepted
+    uint64_t    rejects;        // connections refused, server full
+    uint64_t    refused;        // connections refused by the rate limits
+    uint64_t    closes;         // sessions closed
+    uint64_t    bytes_in;       // bytes read from clients
+    uint64_t    bytes_out;      // bytes written to clients
+    uint64_t    frames_in;      // frames received
+    uint64_t    broadcasts;     // messages sent to a room
+    uint64_t    deliveries;     // messages queued for a recipient
+    uint64_t    dropped;        // messages dropped by POLICY_DROP
+    uint64_t    slow_kills;     // clients disconnected for congestion
+    uint64_t    throttles;      // times a client went over its rate
+    uint64_t    yields;         // times a client ran out of read budget
+    uint64_t    pings;          // heartbeats sent to silent clients
+    uint64_t    timeouts;       // clients dropped by a session timer
+    struct hist loop_ns;        // busy time per event loop iteration
+    struct hist queue_bytes;    // queue size when a message has to wait
+};
+
+// single writer update, other threads may read x at any time
+#define STAT_ADD(x, n)  __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+
+// function prototypes
+uint64_t stats_now();
+void hist_record(struct hist* h, uint64_t v);
+void hist_add(struct hist* dst, const struct hist* src);
+uint64_t hist_value(const struct hist* h, double q);
+int stats_start(const char* path);
+
+#endif
@@ -0,0 +1,128 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: throttle.c - Token buckets for per-client rate limits.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   void tb_init(struct tbucket* b, double burst, uint64_t now);
+--              uint64_t tb_take(struct tbucket* b, double rate, double burst,
+--                               double cost, uint64_t now);
+--              int tb_try(struct tbucket* b, double rate, double burst,
+--                         double cost, uint64_t now);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- A client's bucket is only touched by the shard owning the session, so
+-- there is no locking; the shared ones of admit.c are behind its lock.
+-- Tokens are refilled lazily from the time elapsed since the last take
+-- instead of by a timer.
+------------------------------------------------------------------------------*/
+
+#include "throttle.h"
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tb_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   void tb_init(struct tbucket* b, double burst, uint64_t now)
+--              struct tbucket* b: the bucket
+--              double burst: size of the bucket
+--              uint64_t now: the current time, see stats_now()
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to start a bucket full.
+------------------------------------------------------------------------------*/
+void tb_init(struct tbucket* b, double burst, uint64_t now)
+{
+    b->tokens = burst;
+    b->last = now;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tb_take
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   uint64_t tb_take(struct tbucket* b, double rate, double burst,
+--                               double cost, uint64_t now)
+--              struct tbucket* b: the bucket
+--              double rate: tokens added per second
+--              double burst: size of the bucket
+--              double cost: tokens taken
+--              uint64_t now: the current time, see stats_now()
+-- 
+-- RETURNS:     0 if the bucket still holds tokens, otherwise the # of
+--              nanoseconds until it is out of debt
+-- 
+-- NOTES:
+-- This function is called to charge a message to a bucket.
+------------------------------------------------------------------------------*/
+uint64_t tb_take(struct tbucket* b, double rate, double burst, double cost,
+                 uint64_t now)
+{
+    if (now > b->last) {
+        b->tokens += rate * (double) (now - b->last) / 1e9;
+        if (b->tokens > burst)
+            b->tokens = burst;
+        b->last = now;
+    }
+    
+    b->tokens -= cost;
+    if (b->tokens > 0)
+        return 0;
+    return (uint64_t) (-b->tokens / rate * 1e9) + 1;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tb_try
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- INTERFACE:   int tb_try(struct tbucket* b, double rate, double burst,
+--                         double cost, uint64_t now)
+--              struct tbucket* b: the bucket
+--              double rate: tokens added per second
+--              double burst: size of the bucket
+--              double cost: tokens wanted
+--              uint64_t now: the current time, see stats_now()
+-- 
+-- RETURNS:     1 if the tokens were taken, 0 if the bucket holds too few
+-- 
+-- NOTES:
+-- This function is called to charge something that is refused when the
+-- bucket is short. Nothing is taken then, the bucket never goes into debt.
+------------------------------------------------------------------------------*/
+int tb_try(struct tbucket* b, double rate, double burst, double cost,
+           uint64_t now)
+{
+    if (now > b->last) {
+        b->tokens += rate * (double) (now - b->last) / 1e9;
+        if (b->tokens > burst)
+            b->tokens = burst;
+        b->last = now;
+    }
+    
+    if (b->tokens < cost)
+        return 0;
+    b->tokens -= cost;
+    return 1;
+}
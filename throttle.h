@@ -0,0 +1,36 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: throttle.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Maitiu Morton
+-- 
+-- PROGRAMMER:  Maitiu Morton
+-- 
+-- NOTES:
+-- This header file declares the token buckets that limit how fast a client
+-- may talk. A bucket fills at a steady rate up to its burst size and every
+-- message takes its cost out of it. A message is never refused for lack of
+-- tokens: the bucket goes into debt and tells the caller how long to wait
+-- until it is out of it again, so the cost is known only after the message
+-- has been decoded. tb_try() is the all-or-nothing kind, for connections.
+-------------------------------------------------------------------------------*/
+#ifndef __THROTTLE_H__
+#define __THROTTLE_H__
+
+#include <stdint.h>
+
+// token bucket
+struct tbucket {
+    double      tokens;         // tokens left, negative when in debt
+    uint64_t    last;           // when tokens was last brought up to date
+};
+
+// function prototypes
+void tb_init(struct tbucket* b, double burst, uint64_t now);
+uint64_t tb_take(struct tbucket* b, double rate, double burst, double cost,
+                 uint64_t now);
+int tb_try(struct tbucket* b, double rate, double burst, double cost,
+           uint64_t now);
+
+#endif
@@ -0,0 +1,295 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: twheel.c - Hierarchical timer wheel.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   void tw_init(struct twheel* w, uint64_t now);
+--              void tw_add(struct twheel* w, struct tw_timer* t,
+--                          uint64_t expires);
+--              void tw_del(struct twheel* w, struct tw_timer* t);
+--              void tw_advance(struct twheel* w, uint64_t now, tw_cb cb,
+--                              void* ctx);
+--              uint64_t tw_next(const struct twheel* w);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- A wheel belongs to one shard and is never locked. A timer sits in the
+-- level whose slots are the narrowest that still reach its expiry from the
+-- current tick, so with TW_LEVELS levels of TW_SLOTS slots a timer can be
+-- TW_MAX_DELAY ticks away. Each time level 0 wraps around, the next slot
+-- of level 1 is spread over level 0, and so on up the levels.
+------------------------------------------------------------------------------*/
+
+#include "twheel.h"
+
+static void tw_cascade(struct twheel* w, int level, int idx);
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tw_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void tw_init(struct twheel* w, uint64_t now)
+--              struct twheel* w: the wheel
+--              uint64_t now: the current tick
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to set up an empty wheel.
+------------------------------------------------------------------------------*/
+void tw_init(struct twheel* w, uint64_t now)
+{
+    int l, i;
+    
+    w->now = now;
+    w->count = 0;
+    for (l = 0; l < TW_LEVELS; l++) {
+        for (i = 0; i < TW_SLOTS; i++) {
+            w->slots[l][i].next = &w->slots[l][i];
+            w->slots[l][i].prev = &w->slots[l][i];
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tw_add
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void tw_add(struct twheel* w, struct tw_timer* t,
+--                          uint64_t expires)
+--              struct twheel* w: the wheel
+--              struct tw_timer* t: the timer, armed or not
+--              uint64_t expires: the tick it is to fire at
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to arm a timer, or to move an armed one. A tick
+-- already run fires on the next one; one too far ahead is brought in to
+-- TW_MAX_DELAY ticks.
+------------------------------------------------------------------------------*/
+void tw_add(struct twheel* w, struct tw_timer* t, uint64_t expires)
+{
+    struct  tw_timer* head;
+    uint64_t delta;
+    int     level;
+    
+    if (t->prev != NULL)
+        tw_del(w, t);
+    
+    if (expires < w->now)
+        expires = w->now;
+    if (expires - w->now > TW_MAX_DELAY)
+        expires = w->now + TW_MAX_DELAY;
+    
+    delta = expires - w->now;
+    for (level = 0; level < TW_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TW_BITS * (level + 1))))
+            break;
+    }
+    head = &w->slots[level][(expires >> (TW_BITS * level)) & TW_MASK];
+    
+    t->expires = expires;
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+    w->count++;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tw_del
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void tw_del(struct twheel* w, struct tw_timer* t)
+--              struct twheel* w: the wheel
+--              struct tw_timer* t: the timer, armed or not
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to disarm a timer.
+------------------------------------------------------------------------------*/
+void tw_del(struct twheel* w, struct tw_timer* t)
+{
+    if (t->prev == NULL)
+        return;
+    
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+    w->count--;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tw_advance
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void tw_advance(struct twheel* w, uint64_t now, tw_cb cb,
+--                              void* ctx)
+--              struct twheel* w: the wheel
+--              uint64_t now: the current tick
+--              tw_cb cb: called for every timer that fires
+--              void* ctx: passed to cb
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to run the ticks up to now. The slot of a tick
+-- is taken off the wheel before its timers fire and the wheel has already
+-- moved past it, so a callback may arm any timer again, including the one
+-- firing, and it lands in a later tick.
+------------------------------------------------------------------------------*/
+void tw_advance(struct twheel* w, uint64_t now, tw_cb cb, void* ctx)
+{
+    struct  tw_timer list;
+    struct  tw_timer* head;
+    struct  tw_timer* t;
+    uint64_t tick;
+    int     level;
+    
+    while (w->now <= now) {
+        tick = w->now;
+        
+        // level 0 wrapped, bring the next slots of the levels above down
+        for (level = 1; level < TW_LEVELS; level++) {
+            if ((tick & ((1ULL << (TW_BITS * level)) - 1)) != 0)
+                break;
+            tw_cascade(w, level, (tick >> (TW_BITS * level)) & TW_MASK);
+        }
+        
+        head = &w->slots[0][tick & TW_MASK];
+        w->now = tick + 1;
+        if (head->next == head)
+            continue;
+        
+        list.next = head->next;
+        list.prev = head->prev;
+        list.next->prev = &list;
+        list.prev->next = &list;
+        head->next = head;
+        head->prev = head;
+        
+        while ((t = list.next) != &list) {
+            list.next = t->next;
+            t->next->prev = &list;
+            t->next = NULL;
+            t->prev = NULL;
+            w->count--;
+            cb(ctx, t);
+        }
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tw_next
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   uint64_t tw_next(const struct twheel* w)
+--              const struct twheel* w: the wheel
+-- 
+-- RETURNS:     the next tick tw_advance() has work at, UINT64_MAX if no
+--              timer is armed
+-- 
+-- NOTES:
+-- This function is called to know how long the event loop may sleep. It
+-- looks at most at the rest of level 0; past that the answer is the next
+-- wrap of level 0, where the upper levels are cascaded. Either way no due
+-- timer is missed, and an idle wheel costs one wakeup per TW_SLOTS ticks.
+------------------------------------------------------------------------------*/
+uint64_t tw_next(const struct twheel* w)
+{
+    const struct tw_timer* head;
+    uint64_t tick;
+    
+    if (w->count == 0)
+        return UINT64_MAX;
+    
+    // the upper levels are due to be cascaded
+    if ((w->now & TW_MASK) == 0)
+        return w->now;
+    
+    for (tick = w->now; ; tick++) {
+        head = &w->slots[0][tick & TW_MASK];
+        if (head->next != head)
+            return tick;
+        if (((tick + 1) & TW_MASK) == 0)
+            return tick + 1;
+    }
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    tw_cascade
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   static void tw_cascade(struct twheel* w, int level, int idx)
+--              struct twheel* w: the wheel
+--              int level: the level, 1 or above
+--              int idx: the slot the wheel got to
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to arm the timers of an upper level slot again,
+-- which spreads them over the levels below.
+------------------------------------------------------------------------------*/
+static void tw_cascade(struct twheel* w, int level, int idx)
+{
+    struct  tw_timer list;
+    struct  tw_timer* head = &w->slots[level][idx];
+    struct  tw_timer* t;
+    
+    if (head->next == head)
+        return;
+    
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head->next = head;
+    head->prev = head;
+    
+    while ((t = list.next) != &list) {
+        list.next = t->next;
+        t->next->prev = &list;
+        t->prev = NULL;
+        w->count--;
+        tw_add(w, t, t->expires);
+    }
+}
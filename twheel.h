@@ -0,0 +1,57 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: twheel.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares the hierarchical timer wheel that keeps the
+-- session deadlines of a shard. Time is counted in ticks. Level 0 has one
+-- slot per tick for the next TW_SLOTS ticks, every further level has slots
+-- TW_SLOTS times as wide, and a slot of an upper level is spread over the
+-- level below when the wheel gets to it (cascading). Timers are linked
+-- into their slot in place, so arming, moving and cancelling a timer is
+-- O(1) and a tick only touches the timers that are due, however many are
+-- armed.
+-------------------------------------------------------------------------------*/
+#ifndef __TWHEEL_H__
+#define __TWHEEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_BITS         6                       // log2 of the slots per level
+#define TW_SLOTS        (1 << TW_BITS)          // slots per level
+#define TW_MASK         (TW_SLOTS - 1)
+#define TW_LEVELS       4                       // levels of the wheel
+#define TW_MAX_DELAY    ((1ULL << (TW_BITS * TW_LEVELS)) - 1) // in ticks
+
+// timer, embedded in whatever it times
+struct tw_timer {
+    struct tw_timer* next;      // slot list link
+    struct tw_timer* prev;      // slot list link, NULL while not armed
+    uint64_t    expires;        // tick the timer fires at
+    void*       arg;            // owner, for the callback
+};
+
+// wheel state, the slots are list heads
+struct twheel {
+    uint64_t    now;            // next tick to run, earlier ones have fired
+    size_t      count;          // # of armed timers
+    struct tw_timer slots[TW_LEVELS][TW_SLOTS];
+};
+
+// called for each timer that fires, the timer is disarmed first
+typedef void (*tw_cb)(void* ctx, struct tw_timer* t);
+
+// function prototypes
+void tw_init(struct twheel* w, uint64_t now);
+void tw_add(struct twheel* w, struct tw_timer* t, uint64_t expires);
+void tw_del(struct twheel* w, struct tw_timer* t);
+void tw_advance(struct twheel* w, uint64_t now, tw_cb cb, void* ctx);
+uint64_t tw_next(const struct twheel* w);
+
+#endif
@@ -0,0 +1,391 @@
+/*------------------------------------------------------------------------------
+-- SOURCE FILE: uring.c - Minimal io_uring wrapper on raw system calls.
+-- 
+-- PROGRAM:     chatsrv
+-- 
+-- FUNCTIONS:   int uring_init(struct uring* u, unsigned entries);
+--              struct io_uring_sqe* uring_sqe(struct uring* u);
+--              int uring_enter(struct uring* u, unsigned wait);
+--              int uring_wait(struct uring* u, int64_t timeout);
+--              struct io_uring_cqe* uring_peek(struct uring* u);
+--              void uring_seen(struct uring* u);
+--              int uring_bufs_init(struct uring* u, struct uring_bufs* b,
+--                                  int bgid, unsigned count, unsigned size);
+--              char* uring_buf(struct uring_bufs* b, unsigned bid);
+--              void uring_buf_put(struct uring_bufs* b, unsigned bid);
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- A ring is used by one thread only. The orderings follow the io_uring
+-- documentation: the sq tail is published with a release store after the
+-- sqe is written, the cq tail is read with an acquire load before the cqe,
+-- and the cq head is released once the cqe has been used.
+------------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int uring_init(struct uring* u, unsigned entries)
+--              struct uring* u: the ring to create
+--              unsigned entries: the submission queue size
+-- 
+-- RETURNS:     0 on success, -1 if io_uring is not available
+-- 
+-- NOTES:
+-- Must be called on the thread that will use the ring: it is created
+-- single issuer with deferred task running where the kernel allows, so
+-- completions are only processed when the thread waits for them. The
+-- completion queue is four times the submission queue, multishot requests
+-- post many completions per submission.
+------------------------------------------------------------------------------*/
+int uring_init(struct uring* u, unsigned entries)
+{
+    struct  io_uring_params p;
+    char*   sq;
+    char*   cq;
+    size_t  sqlen, cqlen;
+    
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER
+            | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = entries * 4;
+    
+    if ((u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        // older kernels lack the task running flags
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;
+        if ((u->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+            return -1;
+    }
+    
+    // one mmap for both rings, the layout of every kernel since 5.4
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+        return -1;
+    
+    sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cqlen > sqlen)
+        sqlen = cqlen;
+    
+    sq = (char*) mmap(NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        return -1;
+    cq = sq;
+    
+    u->sqes = (struct io_uring_sqe*) mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                                          PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                          u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        return -1;
+    
+    u->features = p.features;
+    u->sq_head = (unsigned*) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    u->sq_array = (unsigned*) (sq + p.sq_off.array);
+    u->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned*) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_sqe
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct io_uring_sqe* uring_sqe(struct uring* u)
+--              struct uring* u: the ring
+-- 
+-- RETURNS:     a zeroed submission queue entry, queued for the next
+--              uring_enter()
+-- 
+-- NOTES:
+-- The entry is published right away; the kernel only looks at it once we
+-- enter. When the submission queue is full the queued entries are
+-- submitted first.
+------------------------------------------------------------------------------*/
+struct io_uring_sqe* uring_sqe(struct uring* u)
+{
+    struct  io_uring_sqe* sqe;
+    unsigned tail = *u->sq_tail;
+    
+    while (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+        uring_enter(u, 0);
+    
+    sqe = &u->sqes[tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->tosubmit++;
+    return sqe;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_enter
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int uring_enter(struct uring* u, unsigned wait)
+--              struct uring* u: the ring
+--              unsigned wait: # of completions to wait for, 0 to only
+--                             submit
+-- 
+-- RETURNS:     0 on success, -1 on error (errno is set)
+-- 
+-- NOTES:
+-- Every queued entry goes to the kernel in this one system call, however
+-- many sockets they are for.
+------------------------------------------------------------------------------*/
+int uring_enter(struct uring* u, unsigned wait)
+{
+    int n;
+    
+    // with deferred task running completions are only posted on GETEVENTS
+    n = syscall(__NR_io_uring_enter, u->fd, u->tosubmit, wait,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    if (n < 0)
+        return -1;
+    
+    u->tosubmit -= ((unsigned) n < u->tosubmit) ? (unsigned) n : u->tosubmit;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_wait
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int uring_wait(struct uring* u, int64_t timeout)
+--              struct uring* u: the ring
+--              int64_t timeout: longest wait in nanoseconds, -1 for none
+-- 
+-- RETURNS:     0 on success or timeout, -1 on error (errno is set)
+-- 
+-- NOTES:
+-- This function is called like uring_enter() to submit and wait for one
+-- completion, but gives up after timeout. The timeout is passed with
+-- IORING_ENTER_EXT_ARG, so it costs no submission entry.
+------------------------------------------------------------------------------*/
+int uring_wait(struct uring* u, int64_t timeout)
+{
+    struct  io_uring_getevents_arg arg;
+    struct  __kernel_timespec ts;
+    int     n;
+    
+    if (timeout < 0)
+        return uring_enter(u, 1);
+    if (timeout == 0)
+        return uring_enter(u, 0);
+    
+    ts.tv_sec = timeout / 1000000000;
+    ts.tv_nsec = timeout % 1000000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+    
+    n = syscall(__NR_io_uring_enter, u->fd, u->tosubmit, 1,
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (n < 0)
+        return (errno == ETIME) ? 0 : -1;
+    
+    u->tosubmit -= ((unsigned) n < u->tosubmit) ? (unsigned) n : u->tosubmit;
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_peek
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   struct io_uring_cqe* uring_peek(struct uring* u)
+--              struct uring* u: the ring
+-- 
+-- RETURNS:     the oldest unseen completion, NULL if there is none
+-- 
+-- NOTES:
+-- The entry stays valid until uring_seen() is called.
+------------------------------------------------------------------------------*/
+struct io_uring_cqe* uring_peek(struct uring* u)
+{
+    unsigned head = *u->cq_head;
+    
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    
+    return &u->cqes[head & u->cq_mask];
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_seen
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_seen(struct uring* u)
+--              struct uring* u: the ring
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called to hand the slot of the oldest completion back
+-- to the kernel.
+------------------------------------------------------------------------------*/
+void uring_seen(struct uring* u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_bufs_init
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   int uring_bufs_init(struct uring* u, struct uring_bufs* b,
+--                                  int bgid, unsigned count, unsigned size)
+--              struct uring* u: the ring
+--              struct uring_bufs* b: the buffer ring to create
+--              int bgid: the buffer group id receives refer to
+--              unsigned count: # of buffers, a power of 2
+--              unsigned size: size of a buffer
+-- 
+-- RETURNS:     0 on success, -1 if the kernel lacks provided buffer rings
+-- 
+-- NOTES:
+-- The buffers are registered with IORING_REGISTER_PBUF_RING, the kernel
+-- takes one for every receive that completes, so idle connections hold no
+-- receive buffer at all.
+------------------------------------------------------------------------------*/
+int uring_bufs_init(struct uring* u, struct uring_bufs* b, int bgid,
+                    unsigned count, unsigned size)
+{
+    struct  io_uring_buf_reg reg;
+    size_t  len = count * sizeof(struct io_uring_buf);
+    unsigned i;
+    
+    memset(b, 0, sizeof(*b));
+    b->count = count;
+    b->size = size;
+    b->bgid = bgid;
+    
+    b->ring = (struct io_uring_buf_ring*) mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                               MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (b->ring == MAP_FAILED)
+        return -1;
+    
+    if ((b->base = (char*) malloc((size_t) count * size)) == NULL)
+        return -1;
+    
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) b->ring;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+    
+    for (i = 0; i < count; i++)
+        uring_buf_put(b, i);
+    return 0;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_buf
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   char* uring_buf(struct uring_bufs* b, unsigned bid)
+--              struct uring_bufs* b: the buffer ring
+--              unsigned bid: the buffer id of a completion
+-- 
+-- RETURNS:     the buffer
+-- 
+-- NOTES:
+-- The buffer id is in the upper 16 bits of the completion flags.
+------------------------------------------------------------------------------*/
+char* uring_buf(struct uring_bufs* b, unsigned bid)
+{
+    return b->base + (size_t) bid * b->size;
+}
+
+/*------------------------------------------------------------------------------
+-- FUNCTION:    uring_buf_put
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- INTERFACE:   void uring_buf_put(struct uring_bufs* b, unsigned bid)
+--              struct uring_bufs* b: the buffer ring
+--              unsigned bid: the buffer to give back
+-- 
+-- RETURNS:     void
+-- 
+-- NOTES:
+-- This function is called once the data of a receive has been used, the
+-- kernel may fill the buffer again right away.
+------------------------------------------------------------------------------*/
+void uring_buf_put(struct uring_bufs* b, unsigned bid)
+{
+    struct io_uring_buf* buf;
+    
+    // not b->ring->bufs, C++ pads the kernel header's flexible array
+    buf = (struct io_uring_buf*) b->ring + (b->tail & (b->count - 1));
+    
+    buf->addr = (uint64_t) (uintptr_t) uring_buf(b, bid);
+    buf->len = b->size;
+    buf->bid = (uint16_t) bid;
+    b->tail++;
+    __atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+}
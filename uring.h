@@ -0,0 +1,67 @@
+/*------------------------------------------------------------------------------
+-- HEADER FILE: uring.h
+-- 
+-- DATE:        October 16, 2026
+-- 
+-- DESIGNER:    Fred Yang
+-- 
+-- PROGRAMMER:  Fred Yang
+-- 
+-- NOTES:
+-- This header file declares a minimal io_uring wrapper built directly on
+-- the io_uring_setup(2), io_uring_enter(2) and io_uring_register(2) system
+-- calls, so the server needs nothing beyond the kernel headers. It covers
+-- what the server's io_uring backend uses: submission and completion
+-- rings, and a provided buffer ring the kernel picks receive buffers from.
+-------------------------------------------------------------------------------*/
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES   1024    // submission queue size
+#define URING_BUF_COUNT 512     // receive buffers per ring, a power of 2
+#define URING_BUF_SIZE  16384   // size of a receive buffer
+
+// submission and completion rings shared with the kernel
+struct uring {
+    int         fd;             // io_uring instance
+    unsigned    features;       // IORING_FEAT_* of the kernel
+    unsigned*   sq_head;        // consumed by the kernel
+    unsigned*   sq_tail;        // produced by us
+    unsigned*   sq_array;       // sqe indexes
+    unsigned    sq_mask;
+    unsigned    sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned*   cq_head;        // consumed by us
+    unsigned*   cq_tail;        // produced by the kernel
+    unsigned    cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned    tosubmit;       // sqes queued since the last enter
+};
+
+// provided buffer ring, the kernel selects a buffer for every receive
+struct uring_bufs {
+    struct io_uring_buf_ring* ring; // shared with the kernel
+    char*       base;           // the buffers, URING_BUF_SIZE each
+    unsigned    count;          // # of buffers, a power of 2
+    unsigned    size;           // size of a buffer
+    uint16_t    tail;           // next free slot in the ring
+    int         bgid;           // buffer group id
+};
+
+// function prototypes
+int uring_init(struct uring* u, unsigned entries);
+struct io_uring_sqe* uring_sqe(struct uring* u);
+int uring_enter(struct uring* u, unsigned wait);
+int uring_wait(struct uring* u, int64_t timeout);
+struct io_uring_cqe* uring_peek(struct uring* u);
+void uring_seen(struct uring* u);
+int uring_bufs_init(struct uring* u, struct uring_bufs* b, int bgid,
+                    unsigned count, unsigned size);
+char* uring_buf(struct uring_bufs* b, unsigned bid);
+void uring_buf_put(struct uring_bufs* b, unsigned bid);
+
+#endif